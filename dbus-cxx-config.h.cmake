@@ -28,6 +28,10 @@
 
 #cmakedefine01 DBUS_CXX_HAS_PROP_CONST
 
+#cmakedefine01 DBUS_CXX_HAS_IO_URING
+
+#cmakedefine01 DBUS_CXX_HAS_MEMFD
+
 #if DBUS_CXX_HAS_PROP_CONST
 #include <experimental/propagate_const>
 #define DBUS_CXX_PROPAGATE_CONST(T) std::experimental::propagate_const<T>
@@ -33,6 +33,10 @@ using DBus::GLib::GLibDispatcher;
 class GLibDispatcher::priv_data {
 public:
     std::map<GIOChannel*, std::shared_ptr<Connection>> m_channelToConnection;
+    /* Channels that we are waiting on to become writable */
+    std::map<GIOChannel*, guint> m_writeWatches;
+    /* Timer for writing out messages held back by the flush latency budget */
+    guint m_flushTimer = 0;
 };
 
 GLibDispatcher::GLibDispatcher() :
@@ -41,6 +45,10 @@ GLibDispatcher::GLibDispatcher() :
 }
 
 GLibDispatcher::~GLibDispatcher(){
+    if( m_priv->m_flushTimer != 0 ){
+        g_source_remove( m_priv->m_flushTimer );
+    }
+
     for( auto const& [key,val] : m_priv->m_channelToConnection ){
         g_io_channel_unref( key );
     }
@@ -71,7 +79,7 @@ bool GLibDispatcher::add_connection( std::shared_ptr<Connection> connection ){
         return false;
     }
 
-    GIOChannel* newChannel = g_io_channel_unix_new( connection->unix_fd() );
+    GIOChannel* newChannel = g_io_channel_unix_new( connection->dispatch_fd() );
     m_priv->m_channelToConnection[ newChannel ] = connection;
     guint sourceId = g_io_add_watch( newChannel, G_IO_IN, &GLibDispatcher::channel_data_cb, this );
 
@@ -93,9 +101,83 @@ gboolean GLibDispatcher::channel_has_data(GIOChannel* channel, GIOCondition cond
         status = conn->dispatch();
     }while( status != DBus::DispatchStatus::COMPLETE );
 
+    update_write_watch( channel );
+
     return TRUE;
 }
 
+void GLibDispatcher::update_write_watch( GIOChannel* channel ){
+    std::shared_ptr<Connection> conn = m_priv->m_channelToConnection[ channel ];
+    bool watching = m_priv->m_writeWatches.find( channel ) != m_priv->m_writeWatches.end();
+
+    if( !conn ){
+        return;
+    }
+
+    if( conn->has_messages_to_send() && !watching ){
+        SIMPLELOGGER_TRACE( LOGGER_NAME, "Waiting for channel to become writable" );
+        m_priv->m_writeWatches[ channel ] =
+            g_io_add_watch( channel, G_IO_OUT, &GLibDispatcher::channel_writable_cb, this );
+    }
+
+    // Come back in time to write out any corked messages
+    int flush_timeout = conn->flush_timeout_milliseconds();
+
+    if( flush_timeout >= 0 && m_priv->m_flushTimer == 0 ){
+        m_priv->m_flushTimer = g_timeout_add( flush_timeout, &GLibDispatcher::flush_timer_cb, this );
+    }
+}
+
+gboolean GLibDispatcher::flush_timer(){
+    m_priv->m_flushTimer = 0;
+
+    for( auto const& [channel,conn] : m_priv->m_channelToConnection ){
+        conn->flush();
+        update_write_watch( channel );
+    }
+
+    // Returning FALSE removes this timer, update_write_watch() started a new one if needed
+    return FALSE;
+}
+
+gboolean GLibDispatcher::flush_timer_cb( gpointer data ){
+    GLibDispatcher* disp = static_cast<GLibDispatcher*>( data );
+
+    if( !disp ){
+        return FALSE;
+    }
+
+    return disp->flush_timer();
+}
+
+gboolean GLibDispatcher::channel_writable(GIOChannel* channel, GIOCondition condition ){
+    std::shared_ptr<Connection> conn = m_priv->m_channelToConnection[ channel ];
+
+    SIMPLELOGGER_TRACE( LOGGER_NAME, "channel is writable" );
+
+    if( conn ){
+        conn->flush();
+    }
+
+    if( conn && conn->has_messages_to_send() ){
+        return TRUE;
+    }
+
+    // Returning FALSE removes this watch
+    m_priv->m_writeWatches.erase( channel );
+    return FALSE;
+}
+
+gboolean GLibDispatcher::channel_writable_cb(GIOChannel* channel, GIOCondition condition, gpointer data ){
+    GLibDispatcher* disp = static_cast<GLibDispatcher*>( data );
+
+    if( !disp ){
+        return FALSE;
+    }
+
+    return disp->channel_writable( channel, condition );
+}
+
 gboolean GLibDispatcher::channel_data_cb(GIOChannel* channel, GIOCondition condition, gpointer data ){
     GLibDispatcher* disp = static_cast<GLibDispatcher*>( data );
 
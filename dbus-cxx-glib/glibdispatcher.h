@@ -51,6 +51,17 @@ private:
     gboolean channel_has_data(GIOChannel* channel, GIOCondition condition );
     static gboolean channel_data_cb(GIOChannel* channel, GIOCondition condition, gpointer data );
 
+    /**
+     * Start waiting for the channel to become writable if the connection
+     * has data that the bus has not taken yet, and for any messages that
+     * are being held back by the flush latency budget to become due.
+     */
+    void update_write_watch( GIOChannel* channel );
+    gboolean channel_writable(GIOChannel* channel, GIOCondition condition );
+    static gboolean channel_writable_cb(GIOChannel* channel, GIOCondition condition, gpointer data );
+    gboolean flush_timer();
+    static gboolean flush_timer_cb( gpointer data );
+
 private:
     class priv_data;
 
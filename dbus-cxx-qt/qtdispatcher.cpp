@@ -19,6 +19,7 @@
 #include <QMap>
 #include <QVector>
 #include <QSocketNotifier>
+#include <QTimer>
 #include <dbus-cxx/connection.h>
 
 #include "qtdispatcher.h"
@@ -29,6 +30,10 @@ class QtDispatcher::priv_data {
 public:
     QMap<int,std::shared_ptr<DBus::Connection>> m_fdToConnection;
     QVector<std::shared_ptr<QSocketNotifier>> m_socketNotifiers;
+    /* Notifiers for when the bus can take more data, only enabled while we have data to write */
+    QMap<int,std::shared_ptr<QSocketNotifier>> m_writeNotifiers;
+    /* Timers for writing out messages held back by the flush latency budget */
+    QMap<int,std::shared_ptr<QTimer>> m_flushTimers;
 };
 
 QtDispatcher::QtDispatcher() :
@@ -67,7 +72,7 @@ bool QtDispatcher::add_connection( std::shared_ptr<DBus::Connection> connection
         return false;
     }
 
-    int fd = connection->unix_fd();
+    int fd = connection->dispatch_fd();
     m_priv->m_fdToConnection[ fd ] = connection;
 
     // Now add in the socket notifier so that when data comes in we will dispatch the connection
@@ -77,6 +82,20 @@ bool QtDispatcher::add_connection( std::shared_ptr<DBus::Connection> connection
     connect( socketNotify.get(), &QSocketNotifier::activated,
              this, &QtDispatcher::activated );
 
+    std::shared_ptr<QSocketNotifier> writeNotify = std::make_shared<QSocketNotifier>( fd, QSocketNotifier::Write );
+    writeNotify->setEnabled( false );
+    m_priv->m_writeNotifiers[ fd ] = writeNotify;
+
+    connect( writeNotify.get(), &QSocketNotifier::activated,
+             this, &QtDispatcher::writable );
+
+    std::shared_ptr<QTimer> flushTimer = std::make_shared<QTimer>();
+    flushTimer->setSingleShot( true );
+    m_priv->m_flushTimers[ fd ] = flushTimer;
+
+    connect( flushTimer.get(), &QTimer::timeout,
+             this, [this, fd](){ writable( fd ); } );
+
     return true;
 }
 
@@ -91,4 +110,40 @@ void QtDispatcher::activated( int fd ){
     do{
         status = conn->dispatch();
     }while( status != DBus::DispatchStatus::COMPLETE );
+
+    update_write_watch( fd );
+}
+
+void QtDispatcher::writable( int fd ){
+    std::shared_ptr<DBus::Connection> conn = m_priv->m_fdToConnection[ fd ];
+    std::shared_ptr<QSocketNotifier> writeNotify = m_priv->m_writeNotifiers[ fd ];
+
+    if( !conn || !writeNotify ){
+        return;
+    }
+
+    conn->flush();
+
+    update_write_watch( fd );
+}
+
+void QtDispatcher::update_write_watch( int fd ){
+    std::shared_ptr<DBus::Connection> conn = m_priv->m_fdToConnection[ fd ];
+
+    if( !conn ){
+        return;
+    }
+
+    // Wait for the bus to take the rest of our data
+    std::shared_ptr<QSocketNotifier> writeNotify = m_priv->m_writeNotifiers[ fd ];
+    if( writeNotify ){
+        writeNotify->setEnabled( conn->has_messages_to_send() );
+    }
+
+    // Come back in time to write out any corked messages
+    std::shared_ptr<QTimer> flushTimer = m_priv->m_flushTimers[ fd ];
+    int flush_timeout = conn->flush_timeout_milliseconds();
+    if( flushTimer && flush_timeout >= 0 && !flushTimer->isActive() ){
+        flushTimer->start( flush_timeout );
+    }
 }
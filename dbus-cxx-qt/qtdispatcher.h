@@ -45,6 +45,15 @@ public:
 
 private Q_SLOTS:
     void activated( int socket );
+    void writable( int socket );
+
+private:
+    /**
+     * Wait for the socket to become writable if the bus has not taken all
+     * of our data yet, and for any messages that are being held back by the
+     * flush latency budget to become due.
+     */
+    void update_write_watch( int socket );
 
 private:
     class priv_data;
@@ -52,6 +52,8 @@
 #include <dbus-cxx/filedescriptor.h>
 #include <dbus-cxx/simplelogger_defs.h>
 #include <dbus-cxx/standalonedispatcher.h>
+#include <dbus-cxx/server.h>
+#include <dbus-cxx/sharedmemorychannel.h>
 #include <dbus-cxx/propertyproxy.h>
 #include <dbus-cxx/property.h>
 
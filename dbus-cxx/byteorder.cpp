@@ -0,0 +1,379 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "byteorder.h"
+
+#include "dbus-cxx-private.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+static const char* LOGGER_NAME = "DBus.priv.ByteOrder";
+
+/* Arrays, structs and variants may only be nested this deep */
+#define MAX_NESTING_DEPTH 64
+
+namespace {
+
+/**
+ * Walks marshaled data according to its signature, swapping each value
+ * as it goes.
+ */
+class ByteSwapper {
+public:
+    ByteSwapper( uint8_t* data, uint32_t dataLen, DBus::Endianess from ) :
+        m_data( data ),
+        m_dataLen( dataLen ),
+        m_pos( 0 ),
+        m_from( from ) {}
+
+    /**
+     * Swap all of the complete types in the signature, one after the other.
+     */
+    bool swap_all( const char* sig, const char* sigEnd, int depth ) {
+        while( sig < sigEnd ) {
+            if( !swap_single( &sig, sigEnd, depth ) ) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint32_t position() const {
+        return m_pos;
+    }
+
+private:
+    /**
+     * Swap a single complete type.  sig is advanced past the type.
+     */
+    bool swap_single( const char** sig, const char* sigEnd, int depth ) {
+        char type = **sig;
+
+        if( depth > MAX_NESTING_DEPTH ) {
+            return false;
+        }
+
+        ( *sig )++;
+
+        switch( type ) {
+        case 'y':
+            return skip( 1 );
+
+        case 'n':
+        case 'q':
+            return swap_value( 2 );
+
+        case 'b':
+        case 'i':
+        case 'u':
+        case 'h':
+            return swap_value( 4 );
+
+        case 'x':
+        case 't':
+        case 'd':
+            return swap_value( 8 );
+
+        case 's':
+        case 'o': {
+            uint32_t len;
+
+            if( !read_uint32( &len ) || !swap_value( 4 ) ) {
+                return false;
+            }
+
+            // The string and its nul terminator
+            return skip( static_cast<uint64_t>( len ) + 1 );
+        }
+
+        case 'g':
+            if( m_pos >= m_dataLen ) {
+                return false;
+            }
+
+            return skip( static_cast<uint64_t>( m_data[ m_pos ] ) + 2 );
+
+        case 'v': {
+            if( m_pos >= m_dataLen ) {
+                return false;
+            }
+
+            uint8_t sigLen = m_data[ m_pos ];
+            const char* variantSig = reinterpret_cast<const char*>( m_data + m_pos + 1 );
+
+            if( !skip( static_cast<uint64_t>( sigLen ) + 2 ) ) {
+                return false;
+            }
+
+            const char* variantSigEnd = variantSig + sigLen;
+
+            // A variant holds exactly one complete type
+            if( sigLen == 0 || !swap_single( &variantSig, variantSigEnd, depth + 1 ) ) {
+                return false;
+            }
+
+            return variantSig == variantSigEnd;
+        }
+
+        case 'a': {
+            uint32_t len;
+            const char* elementSig = *sig;
+
+            if( !read_uint32( &len ) || !swap_value( 4 ) ) {
+                return false;
+            }
+
+            *sig = skip_signature( elementSig, sigEnd );
+
+            if( *sig == nullptr ) {
+                return false;
+            }
+
+            // The padding to the first element is there even if the array is empty
+            if( !align( alignment_of( *elementSig ) ) ) {
+                return false;
+            }
+
+            if( static_cast<uint64_t>( m_pos ) + len > m_dataLen ) {
+                return false;
+            }
+
+            uint32_t arrayEnd = m_pos + len;
+
+            while( m_pos < arrayEnd ) {
+                const char* element = elementSig;
+                uint32_t elementStart = m_pos;
+
+                if( !swap_single( &element, *sig, depth + 1 ) ) {
+                    return false;
+                }
+
+                // Every element takes up at least one byte, or we would never finish
+                if( m_pos == elementStart ) {
+                    return false;
+                }
+            }
+
+            return m_pos == arrayEnd;
+        }
+
+        case '(':
+        case '{': {
+            char closing = type == '(' ? ')' : '}';
+
+            if( !align( 8 ) ) {
+                return false;
+            }
+
+            while( *sig < sigEnd && **sig != closing ) {
+                if( !swap_single( sig, sigEnd, depth + 1 ) ) {
+                    return false;
+                }
+            }
+
+            if( *sig >= sigEnd ) {
+                return false;
+            }
+
+            ( *sig )++;
+            return true;
+        }
+        }
+
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unknown type in signature: " << type );
+        return false;
+    }
+
+    /**
+     * Returns the end of the complete type starting at sig, or nullptr if the
+     * signature is not valid.
+     */
+    static const char* skip_signature( const char* sig, const char* sigEnd ) {
+        int depth = 0;
+
+        while( sig < sigEnd ) {
+            char type = *sig++;
+
+            if( type == 'a' ) {
+                continue;
+            }
+
+            if( type == '(' || type == '{' ) {
+                depth++;
+            } else if( type == ')' || type == '}' ) {
+                depth--;
+            }
+
+            if( depth < 0 ) {
+                return nullptr;
+            }
+
+            if( depth == 0 ) {
+                return sig;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static int alignment_of( char type ) {
+        switch( type ) {
+        case 'n':
+        case 'q':
+            return 2;
+
+        case 'b':
+        case 'i':
+        case 'u':
+        case 'h':
+        case 's':
+        case 'o':
+        case 'a':
+            return 4;
+
+        case 'x':
+        case 't':
+        case 'd':
+        case '(':
+        case '{':
+            return 8;
+        }
+
+        return 1;
+    }
+
+    bool align( int alignment ) {
+        uint32_t padding = ( alignment - ( m_pos % alignment ) ) % alignment;
+
+        return skip( padding );
+    }
+
+    bool skip( uint64_t bytes ) {
+        if( m_pos + bytes > m_dataLen ) {
+            return false;
+        }
+
+        m_pos += bytes;
+        return true;
+    }
+
+    /* Read a uint32 at the next 4-byte boundary, in the original byte order */
+    bool read_uint32( uint32_t* value ) {
+        if( !align( 4 ) || m_pos + 4 > m_dataLen ) {
+            return false;
+        }
+
+        const uint8_t* bytes = m_data + m_pos;
+
+        if( m_from == DBus::Endianess::Little ) {
+            *value = static_cast<uint32_t>( bytes[ 0 ] ) |
+                static_cast<uint32_t>( bytes[ 1 ] ) << 8 |
+                static_cast<uint32_t>( bytes[ 2 ] ) << 16 |
+                static_cast<uint32_t>( bytes[ 3 ] ) << 24;
+        } else {
+            *value = static_cast<uint32_t>( bytes[ 0 ] ) << 24 |
+                static_cast<uint32_t>( bytes[ 1 ] ) << 16 |
+                static_cast<uint32_t>( bytes[ 2 ] ) << 8 |
+                static_cast<uint32_t>( bytes[ 3 ] );
+        }
+
+        return true;
+    }
+
+    bool swap_value( int size ) {
+        if( !align( size ) || m_pos + size > m_dataLen ) {
+            return false;
+        }
+
+        std::reverse( m_data + m_pos, m_data + m_pos + size );
+        m_pos += size;
+
+        return true;
+    }
+
+private:
+    uint8_t* m_data;
+    uint32_t m_dataLen;
+    uint32_t m_pos;
+    DBus::Endianess m_from;
+};
+
+template <typename T, T( *swap )( T )>
+void swap_elements( uint8_t* data, uint32_t count ) {
+    for( uint32_t x = 0; x < count; x++ ) {
+        T value;
+        memcpy( &value, data + x * sizeof( T ), sizeof( T ) );
+        value = swap( value );
+        memcpy( data + x * sizeof( T ), &value, sizeof( T ) );
+    }
+}
+
+uint16_t swap16( uint16_t value ) {
+    return __builtin_bswap16( value );
+}
+
+uint32_t swap32( uint32_t value ) {
+    return __builtin_bswap32( value );
+}
+
+uint64_t swap64( uint64_t value ) {
+    return __builtin_bswap64( value );
+}
+
+} /* anonymous namespace */
+
+bool DBus::priv::swap_byte_order( uint8_t* data, uint32_t dataLen, const Signature& signature, Endianess from ) {
+    if( !signature.is_valid() ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Not swapping data with invalid signature " << signature.str() );
+        return false;
+    }
+
+    ByteSwapper swapper( data, dataLen, from );
+    const char* sig = signature.str().c_str();
+
+    if( !swapper.swap_all( sig, sig + signature.str().size(), 0 ) ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Data does not match signature " << signature.str() );
+        return false;
+    }
+
+    if( swapper.position() != dataLen ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Data is longer than signature " << signature.str() );
+        return false;
+    }
+
+    return true;
+}
+
+void DBus::priv::swap_array( uint8_t* data, uint32_t count, int elementSize ) {
+    switch( elementSize ) {
+    case 2:
+        swap_elements<uint16_t, swap16>( data, count );
+        break;
+
+    case 4:
+        swap_elements<uint32_t, swap32>( data, count );
+        break;
+
+    case 8:
+        swap_elements<uint64_t, swap64>( data, count );
+        break;
+    }
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUSCXX_BYTEORDER_H
+#define DBUSCXX_BYTEORDER_H
+
+#include <dbus-cxx/enums.h>
+#include <dbus-cxx/signature.h>
+#include <stdint.h>
+
+namespace DBus {
+
+namespace priv {
+
+/**
+ * Convert marshaled data from one byte order to the other, in place.  The
+ * signature is walked once, and every value that is wider than a byte is
+ * swapped where it is; lengths are read in the original byte order before
+ * they are swapped.
+ *
+ * The data must start on an 8-byte boundary as far as the marshaling is
+ * concerned, which is true of a message body and of the data of a Variant.
+ *
+ * If the data does not match the signature, it is left partially converted.
+ * Nothing is converted if the signature is not valid.
+ *
+ * @param data The data to convert
+ * @param dataLen The length of the data
+ * @param signature The signature of the data; all of the complete types in
+ * the data, in order
+ * @param from The byte order that the data is in now
+ * @return True if all of the data was converted, false if the data does not
+ * match the signature.
+ */
+bool swap_byte_order( uint8_t* data, uint32_t dataLen, const Signature& signature, Endianess from );
+
+/**
+ * Swap the byte order of an array of fixed-size values, in place.  This is
+ * a tight loop over the elements that the compiler can vectorize.
+ *
+ * @param data The first element
+ * @param count The number of elements
+ * @param elementSize The size of each element: 1, 2, 4 or 8
+ */
+void swap_array( uint8_t* data, uint32_t count, int elementSize );
+
+} /* namespace priv */
+
+} /* namespace DBus */
+
+#endif /* DBUSCXX_BYTEORDER_H */
@@ -56,19 +56,44 @@ CallMessage::CallMessage( const std::string& path, const std::string& method ) {
 }
 
 std::shared_ptr<CallMessage> CallMessage::create() {
-    return std::shared_ptr<CallMessage>( new CallMessage() );
+    Message* msg = take_from_pool( MessageType::CALL );
+
+    if( !msg ) {
+        msg = new CallMessage();
+    }
+
+    return std::static_pointer_cast<CallMessage>( manage_pooled( msg ) );
 }
 
 std::shared_ptr<CallMessage> CallMessage::create( const std::string& dest, const std::string& path, const std::string& iface, const std::string& method ) {
-    return std::shared_ptr<CallMessage>( new CallMessage( dest, path, iface, method ) );
+    std::shared_ptr<CallMessage> msg = create();
+
+    SIMPLELOGGER_DEBUG( "DBus.CallMessage", "Creating call message to " << dest << " path: " << path << " " << iface << "." << method );
+    msg->set_path( path );
+    msg->set_interface( iface );
+    msg->set_member( method );
+    msg->set_destination( dest );
+
+    return msg;
 }
 
 std::shared_ptr<CallMessage> CallMessage::create( const std::string& path, const std::string& iface, const std::string& method ) {
-    return std::shared_ptr<CallMessage>( new CallMessage( path, iface, method ) );
+    std::shared_ptr<CallMessage> msg = create();
+
+    msg->set_path( path );
+    msg->set_interface( iface );
+    msg->set_member( method );
+
+    return msg;
 }
 
 std::shared_ptr<CallMessage> CallMessage::create( const std::string& path, const std::string& method ) {
-    return std::shared_ptr<CallMessage>( new CallMessage( path, method ) );
+    std::shared_ptr<CallMessage> msg = create();
+
+    msg->set_path( path );
+    msg->set_member( method );
+
+    return msg;
 }
 
 std::shared_ptr<ReturnMessage> CallMessage::create_reply() const {
@@ -100,45 +125,27 @@ std::shared_ptr<ErrorMessage> CallMessage::create_error_reply() const {
 }
 
 void CallMessage::set_path( const std::string& p ) {
-    set_header_field( MessageHeaderFields::Path, Variant( Path( p ) ) );
+    set_header_string( MessageHeaderFields::Path, p );
 }
 
-Path CallMessage::path() const {
-    Variant field = header_field( MessageHeaderFields::Path );
-
-    if( field.type() == DataType::OBJECT_PATH ) {
-        return field.to_path();
-    }
-
-    return Path();
+const Path& CallMessage::path() const {
+    return header_path();
 }
 
 void CallMessage::set_interface( const std::string& i ) {
-    set_header_field( MessageHeaderFields::Interface, Variant( i ) );
+    set_header_string( MessageHeaderFields::Interface, i );
 }
 
-std::string CallMessage::interface_name() const {
-    Variant iface = header_field( MessageHeaderFields::Interface );
-
-    if( iface.type() == DataType::STRING ) {
-        return iface.to_string();
-    }
-
-    return "";
+const std::string& CallMessage::interface_name() const {
+    return header_string( MessageHeaderFields::Interface );
 }
 
 void CallMessage::set_member( const std::string& m ) {
-    set_header_field( MessageHeaderFields::Member, Variant( m ) );
+    set_header_string( MessageHeaderFields::Member, m );
 }
 
-std::string CallMessage::member() const {
-    Variant member = header_field( MessageHeaderFields::Member );
-
-    if( member.type() == DataType::STRING ) {
-        return member.to_string();
-    }
-
-    return "";
+const std::string& CallMessage::member() const {
+    return header_string( MessageHeaderFields::Member );
 }
 
 void CallMessage::set_no_reply( bool no_reply ) {
@@ -87,15 +87,15 @@ public:
 
     void set_path( const std::string& p );
 
-    Path path() const;
+    const Path& path() const;
 
     void set_interface( const std::string& i );
 
-    std::string interface_name() const;
+    const std::string& interface_name() const;
 
     void set_member( const std::string& m );
 
-    std::string member() const;
+    const std::string& member() const;
 
     void set_no_reply( bool no_reply = true );
 
@@ -21,6 +21,7 @@
 #include <dbus-cxx/signalmessage.h>
 #include <dbus-cxx/errormessage.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <utility>
@@ -37,6 +38,7 @@
 #include "signalproxy.h"
 #include "transport.h"
 #include "simpletransport.h"
+#include "loopbacktransport.h"
 #include <poll.h>
 #include "utility.h"
 #include "daemon-proxy/DBusDaemonProxy.h"
@@ -63,6 +65,10 @@
 #define DBUSCXX_START_REPLY_SUCCESS 0x01
 #define DBUSCXX_START_REPLY_ALREADY_RUNNING 0x02
 
+#define DBUSCXX_BUS_NAME "org.freedesktop.DBus"
+#define DBUSCXX_BUS_PATH "/org/freedesktop/DBus"
+#define DBUSCXX_BUS_INTERFACE "org.freedesktop.DBus"
+
 #if defined( _WIN32 ) && defined( ERROR )
     #undef ERROR
 #endif
@@ -72,6 +78,12 @@ namespace sigc { template <typename T_return, typename ...T_arg> class slot; }
 
 static const char* LOGGER_NAME = "DBus.Connection";
 
+/* Once this many messages are queued, a corked flush no longer holds them back */
+#define MAX_CORKED_MESSAGES 64
+
+/* How long the dispatching thread waits for the bus to take data above the high-water mark */
+#define WRITE_SPACE_TIMEOUT_MS 1000
+
 namespace DBus {
 
 struct ExpectingResponse {
@@ -80,11 +92,6 @@ struct ExpectingResponse {
     std::shared_ptr<Message> reply;
 };
 
-struct OutgoingMessage {
-    std::shared_ptr<const Message> msg;
-    uint32_t serial;
-};
-
 struct PathHandlingEntry {
     std::shared_ptr<Object> handler;
     std::thread::id handlingThread;
@@ -105,17 +112,45 @@ public:
     priv_data() :
         m_currentSerial( 1 ),
         m_dispatchingThread( std::this_thread::get_id() ),
-        m_dispatchStatus( DispatchStatus::COMPLETE )
+        m_flushLatencyBudget( 0 ),
+        m_writeHighWaterMark( 0 ),
+        m_blockOnWriteHighWaterMark( false ),
+        m_aboveWriteHighWaterMark( false ),
+        m_dispatchStatus( DispatchStatus::COMPLETE ),
+        m_creatingDaemonProxy( false ),
+        m_normalizeByteOrder( false ),
+        m_isPeer( false ),
+        m_helloSerial( 0 )
     {}
 
+    /**
+     * True if the queued messages are being held back until the latency
+     * budget of the oldest one runs out.  m_outgoingLock must be held.
+     */
+    bool is_corked() const {
+        return m_flushLatencyBudget.count() > 0 &&
+            !m_outgoingMessages.empty() &&
+            m_outgoingMessages.size() < MAX_CORKED_MESSAGES &&
+            std::chrono::steady_clock::now() < m_firstQueuedTime + m_flushLatencyBudget;
+    }
+
     std::vector<uint8_t> m_sendBuffer;
     uint32_t m_currentSerial;
     std::shared_ptr<priv::Transport> m_transport;
     std::string m_uniqueName;
     std::thread::id m_dispatchingThread;
     std::queue<std::shared_ptr<Message>> m_incomingMessages;
-    std::mutex m_outgoingLock;
-    std::queue<OutgoingMessage> m_outgoingMessages;
+    mutable std::mutex m_outgoingLock;
+    std::vector<priv::OutgoingMessage> m_outgoingMessages;
+    /* The messages currently being written out by flush() */
+    std::vector<priv::OutgoingMessage> m_flushingMessages;
+    std::chrono::steady_clock::time_point m_firstQueuedTime;
+    std::chrono::microseconds m_flushLatencyBudget;
+    size_t m_writeHighWaterMark;
+    bool m_blockOnWriteHighWaterMark;
+    bool m_aboveWriteHighWaterMark;
+    std::condition_variable m_writeSpaceAvailable;
+    sigc::signal<void(size_t)> m_writeHighWaterMarkSignal;
     std::mutex m_expectingResponsesLock;
     std::map<uint32_t, std::shared_ptr<ExpectingResponse>> m_expectingResponses;
     DispatchStatus m_dispatchStatus;
@@ -123,12 +158,20 @@ public:
     std::map<std::string, PathHandlingEntry> m_path_handler;
     std::mutex m_threadDispatcherLock;
     std::map<std::thread::id, std::weak_ptr<ThreadDispatcher>> m_threadDispatchers;
-    std::shared_ptr<DBusDaemonProxy> m_daemonProxy;
+    /* Created the first time that we need to talk to the bus daemon */
+    mutable std::recursive_mutex m_daemonProxyLock;
+    mutable std::shared_ptr<DBusDaemonProxy> m_daemonProxy;
+    mutable bool m_creatingDaemonProxy;
+    std::atomic<bool> m_normalizeByteOrder;
     sigc::signal<void()> m_needsDispatching;
     std::mutex m_freeProxySignalsLock;
     std::vector<FreeSignalThreadInfo> m_freeProxySignals;
     std::mutex m_objectProxiesLock;
     std::vector<ObjectProxyThreadInfo> m_objectProxies;
+    /* True if there is no bus daemon on the other end of this connection */
+    bool m_isPeer;
+    /* The serial of the Hello that we sent while authenticating, if any */
+    uint32_t m_helloSerial;
 };
 
 Connection::Connection( BusType type ) {
@@ -143,7 +186,7 @@ Connection::Connection( BusType type ) {
 
         std::string sessionBusAddr = std::string( env_address );
         SIMPLELOGGER_DEBUG( LOGGER_NAME, "Going to open session bus: " + sessionBusAddr );
-        m_priv->m_transport = priv::Transport::open_transport( sessionBusAddr );
+        open_bus_transport( sessionBusAddr );
     } else if( type == BusType::SYSTEM ) {
         char* env_address = getenv( "DBUS_SYSTEM_BUS_ADDRESS" );
         std::string systemBusAddr;
@@ -156,7 +199,7 @@ Connection::Connection( BusType type ) {
             systemBusAddr = "unix:path=/var/run/dbus/system_bus_socket";
         }
 
-        m_priv->m_transport = priv::Transport::open_transport( systemBusAddr );
+        open_bus_transport( systemBusAddr );
     } else if( type == BusType::STARTER ) {
         char* env_address = getenv( "DBUS_STARTER_ADDRESS" );
         std::string starterBusAddr;
@@ -170,7 +213,7 @@ Connection::Connection( BusType type ) {
                 "to DBUS_STARTER_ADDRESS, but environment variable not defined or empty" );
         }
 
-        m_priv->m_transport = priv::Transport::open_transport( starterBusAddr );
+        open_bus_transport( starterBusAddr );
     }
 
     if( !m_priv->m_transport || !m_priv->m_transport->is_valid() ) {
@@ -179,9 +222,15 @@ Connection::Connection( BusType type ) {
     }
 }
 
-Connection::Connection( std::string address ) {
+Connection::Connection( std::string address, bool isPeer ) {
     m_priv = std::make_unique<priv_data>();
-    m_priv->m_transport = priv::Transport::open_transport( address );
+    m_priv->m_isPeer = isPeer;
+
+    if( isPeer ) {
+        m_priv->m_transport = priv::Transport::open_transport( address );
+    } else {
+        open_bus_transport( address );
+    }
 
     if( !m_priv->m_transport || !m_priv->m_transport->is_valid() ) {
         SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to open transport" );
@@ -189,6 +238,16 @@ Connection::Connection( std::string address ) {
     }
 }
 
+Connection::Connection( std::shared_ptr<priv::Transport> transport ) {
+    m_priv = std::make_unique<priv_data>();
+    m_priv->m_transport = transport;
+    m_priv->m_isPeer = true;
+
+    // Nobody dispatches us until we are added to a dispatcher; anything registered
+    // for the dispatcher thread before then is moved to it by set_dispatching_thread()
+    m_priv->m_dispatchingThread = std::thread::id();
+}
+
 std::shared_ptr<Connection> Connection::create( BusType type ) {
     std::shared_ptr<Connection> p( new Connection( type ) );
 
@@ -196,10 +255,31 @@ std::shared_ptr<Connection> Connection::create( BusType type ) {
 }
 
 std::shared_ptr<Connection> Connection::create( std::string address ) {
-    std::shared_ptr<Connection> p( new Connection( address ) );
+    std::shared_ptr<Connection> p( new Connection( address, false ) );
+
+    return p;
+
+}
+
+std::shared_ptr<Connection> Connection::create_peer( std::string address ) {
+    std::shared_ptr<Connection> p( new Connection( address, true ) );
 
     return p;
+}
+
+std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>> Connection::create_loopback_pair() {
+    std::pair<std::shared_ptr<priv::LoopbackTransport>, std::shared_ptr<priv::LoopbackTransport>> transports =
+        priv::LoopbackTransport::create_pair();
+
+    if( !transports.first || !transports.second ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to create loopback transports" );
+        return std::make_pair( std::shared_ptr<Connection>(), std::shared_ptr<Connection>() );
+    }
 
+    std::shared_ptr<Connection> first( new Connection( transports.first ) );
+    std::shared_ptr<Connection> second( new Connection( transports.second ) );
+
+    return std::make_pair( first, second );
 }
 
 Connection::~Connection() {
@@ -222,15 +302,86 @@ bool Connection::bus_register() {
         return true;
     }
 
-    m_priv->m_daemonProxy = DBus::DBusDaemonProxy::create( shared_from_this() );
+    if( m_priv->m_isPeer ) {
+        // Nobody to register with; our peer talks to us directly
+        return true;
+    }
+
+    std::shared_ptr<ReturnMessage> reply;
 
-    m_priv->m_uniqueName = m_priv->m_daemonProxy->Hello();
+    if( m_priv->m_helloSerial != 0 ) {
+        // We already said Hello while authenticating
+        uint32_t serial = m_priv->m_helloSerial;
+        m_priv->m_helloSerial = 0;
+        reply = wait_for_reply( serial, -1 );
+    } else {
+        reply = send_with_reply_blocking( CallMessage::create( DBUSCXX_BUS_NAME,
+                    DBUSCXX_BUS_PATH, DBUSCXX_BUS_INTERFACE, "Hello" ) );
+    }
+
+    if( !reply ) {
+        return false;
+    }
+
+    reply >> m_priv->m_uniqueName;
 
     return true;
 }
 
+void Connection::open_bus_transport( std::string address ) {
+    std::shared_ptr<CallMessage> hello = CallMessage::create( DBUSCXX_BUS_NAME,
+            DBUSCXX_BUS_PATH, DBUSCXX_BUS_INTERFACE, "Hello" );
+    std::vector<uint8_t> helloData;
+    uint32_t helloSerial = m_priv->m_currentSerial;
+
+    if( !hello->serialize_to_vector( &helloData, helloSerial ) ) {
+        // bus_register() will have to send it normally
+        helloData.clear();
+    }
+
+    m_priv->m_transport = priv::Transport::open_transport( address, helloData );
+
+    if( helloData.empty() || !m_priv->m_transport || !m_priv->m_transport->is_valid() ) {
+        return;
+    }
+
+    /*
+     * The reply may be read by whoever dispatches us before bus_register()
+     * is called, so make sure that it is kept for us.
+     */
+    m_priv->m_currentSerial++;
+    m_priv->m_helloSerial = helloSerial;
+    m_priv->m_expectingResponses[ helloSerial ] = std::make_shared<ExpectingResponse>();
+}
+
+std::shared_ptr<DBusDaemonProxy> Connection::daemon_proxy() const {
+    if( m_priv->m_isPeer || !is_registered() ) {
+        return std::shared_ptr<DBusDaemonProxy>();
+    }
+
+    std::unique_lock<std::recursive_mutex> lock( m_priv->m_daemonProxyLock );
+
+    /*
+     * The proxy adds its signals to us as it is created, which comes back
+     * here to add their matches.  There is no proxy to add them with yet.
+     */
+    if( !m_priv->m_daemonProxy && !m_priv->m_creatingDaemonProxy ) {
+        std::shared_ptr<Connection> self =
+            std::const_pointer_cast<Connection>( shared_from_this() );
+        m_priv->m_creatingDaemonProxy = true;
+        m_priv->m_daemonProxy = DBus::DBusDaemonProxy::create( self );
+        m_priv->m_creatingDaemonProxy = false;
+    }
+
+    return m_priv->m_daemonProxy;
+}
+
 bool Connection::is_registered() const {
-    return !m_priv->m_uniqueName.empty();
+    return m_priv->m_isPeer || !m_priv->m_uniqueName.empty();
+}
+
+bool Connection::is_peer() const {
+    return m_priv->m_isPeer;
 }
 
 std::string Connection::unique_name() const {
@@ -244,7 +395,13 @@ RequestNameResponse Connection::request_name( const std::string& name, unsigned
         throw ErrorDisconnected();
     }
 
-    uint32_t retval = m_priv->m_daemonProxy->RequestName( name, flags );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( !daemonProxy ) {
+        throw ErrorNotSupported( "Not connected to a bus" );
+    }
+
+    uint32_t retval = daemonProxy->RequestName( name, flags );
 
     switch( retval ) {
     case DBUSCXX_REQUEST_NAME_REPLY_PRIMARY_OWNER:
@@ -268,7 +425,13 @@ RequestNameResponse Connection::request_name( const std::string& name, unsigned
 }
 
 ReleaseNameResponse Connection::release_name( const std::string& name ) {
-    uint32_t retval = m_priv->m_daemonProxy->ReleaseName( name );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( !daemonProxy ) {
+        throw ErrorNotSupported( "Not connected to a bus" );
+    }
+
+    uint32_t retval = daemonProxy->ReleaseName( name );
 
     switch( retval ) {
     case DBUSCXX_RELEASE_NAME_REPLY_RELEASED:
@@ -288,11 +451,23 @@ ReleaseNameResponse Connection::release_name( const std::string& name ) {
 }
 
 bool Connection::name_has_owner( const std::string& name ) const {
-    return m_priv->m_daemonProxy->NameHasOwner( name );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( !daemonProxy ) {
+        throw ErrorNotSupported( "Not connected to a bus" );
+    }
+
+    return daemonProxy->NameHasOwner( name );
 }
 
 StartReply Connection::start_service( const std::string& name, uint32_t flags ) const {
-    uint32_t retval = m_priv->m_daemonProxy->StartServiceByName( name, flags );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( !daemonProxy ) {
+        throw ErrorNotSupported( "Not connected to a bus" );
+    }
+
+    uint32_t retval = daemonProxy->StartServiceByName( name, flags );
 
     switch( retval ) {
     case DBUSCXX_START_REPLY_SUCCESS:
@@ -315,8 +490,10 @@ bool Connection::add_match( const std::string& rule ) {
 
     SIMPLELOGGER_DEBUG( LOGGER_NAME, "Adding the following match: " << rule );
 
-    if( m_priv->m_daemonProxy ) {
-        m_priv->m_daemonProxy->AddMatch( rule );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( daemonProxy ) {
+        daemonProxy->AddMatch( rule );
     }
 
     return true;
@@ -328,7 +505,12 @@ void Connection::add_match_nonblocking( const std::string& rule ) {
 }
 
 bool Connection::remove_match( const std::string& rule ) {
-    m_priv->m_daemonProxy->RemoveMatch( rule );
+    std::shared_ptr<DBusDaemonProxy> daemonProxy = daemon_proxy();
+
+    if( daemonProxy ) {
+        daemonProxy->RemoveMatch( rule );
+    }
+
     return true;
 }
 
@@ -361,17 +543,56 @@ uint32_t Connection::send( std::shared_ptr<const Message> msg ) {
 
     if( !msg ) { return 0; }
 
-    if( m_priv->m_currentSerial == 0 ) { m_priv->m_currentSerial = 1; }
+    uint32_t serial;
+    {
+        std::unique_lock<std::mutex> lock( m_priv->m_outgoingLock );
+        serial = queue_outgoing_message( msg );
+    }
+
+    notify_dispatcher_or_dispatch();
+    wait_for_write_space();
+
+    return serial;
+}
+
+std::vector<uint32_t> Connection::send_batch( const std::vector<std::shared_ptr<const Message>>& messages ) {
+    if( !this->is_valid() ) { throw ErrorDisconnected(); }
+
+    std::vector<uint32_t> serials;
+    serials.reserve( messages.size() );
 
-    OutgoingMessage outgoing;
     {
         std::unique_lock<std::mutex> lock( m_priv->m_outgoingLock );
-        outgoing.msg = msg;
-        outgoing.serial = m_priv->m_currentSerial++;
-        m_priv->m_outgoingMessages.push( outgoing );
+
+        for( const std::shared_ptr<const Message>& msg : messages ) {
+            if( !msg ) {
+                serials.push_back( 0 );
+                continue;
+            }
+
+            serials.push_back( queue_outgoing_message( msg ) );
+        }
     }
 
     notify_dispatcher_or_dispatch();
+    wait_for_write_space();
+
+    return serials;
+}
+
+uint32_t Connection::queue_outgoing_message( std::shared_ptr<const Message> msg ) {
+    priv::OutgoingMessage outgoing;
+
+    if( m_priv->m_currentSerial == 0 ) { m_priv->m_currentSerial = 1; }
+
+    outgoing.msg = msg;
+    outgoing.serial = m_priv->m_currentSerial++;
+
+    if( m_priv->m_outgoingMessages.empty() ) {
+        m_priv->m_firstQueuedTime = std::chrono::steady_clock::now();
+    }
+
+    m_priv->m_outgoingMessages.push_back( outgoing );
 
     return outgoing.serial;
 }
@@ -388,6 +609,35 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
 
     if( !message ) { return std::shared_ptr<ReturnMessage>(); }
 
+    uint32_t serial;
+
+    if( m_priv->m_dispatchingThread == std::this_thread::get_id() ) {
+        /*
+         * We are trying to do a blocking method call in the dispatching thread.
+         * Don't queue up this message, just send it.
+         */
+        std::unique_lock<std::mutex> lock( m_priv->m_outgoingLock );
+        serial = write_single_message( message );
+    } else {
+        /*
+         * We are trying to do a blocking method call in a thread that is not the dispatcher thread.
+         * Queue up the message and notify the dispatcher thread.
+         */
+        {
+            std::scoped_lock<std::mutex, std::mutex> lock( m_priv->m_outgoingLock, m_priv->m_expectingResponsesLock );
+            serial = queue_outgoing_message( message );
+
+            // Add this to our expecting responses
+            m_priv->m_expectingResponses[ serial ] = std::make_shared<ExpectingResponse>();
+        }
+
+        notify_dispatcher_or_dispatch();
+    }
+
+    return wait_for_reply( serial, timeout_milliseconds );
+}
+
+std::shared_ptr<ReturnMessage> Connection::wait_for_reply( uint32_t serial, int timeout_milliseconds ) {
     std::shared_ptr<ReturnMessage> retmsg;
     int msToWait = timeout_milliseconds;
 
@@ -397,16 +647,27 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
     }
 
     if( m_priv->m_dispatchingThread == std::this_thread::get_id() ) {
-        uint32_t replySerialExpceted;
         bool gotReply = false;
 
-        /*
-         * We are trying to do a blocking method call in the dispatching thread.
-         * Don't queue up this message, just send it.
-         */
         {
-            std::unique_lock<std::mutex> lock( m_priv->m_outgoingLock );
-            replySerialExpceted = write_single_message( message );
+            /*
+             * We are going to read the reply ourselves.  If somebody was expecting
+             * it for us, it may have already been dispatched to them.
+             */
+            std::unique_lock<std::mutex> lock( m_priv->m_expectingResponsesLock );
+            std::map<uint32_t, std::shared_ptr<ExpectingResponse>>::iterator it =
+                m_priv->m_expectingResponses.find( serial );
+
+            if( it != m_priv->m_expectingResponses.end() ) {
+                std::shared_ptr<Message> reply = it->second->reply;
+                m_priv->m_expectingResponses.erase( it );
+
+                if( reply && reply->type() == MessageType::ERROR ) {
+                    std::static_pointer_cast<ErrorMessage>( reply )->throw_error();
+                } else if( reply && reply->type() == MessageType::RETURN ) {
+                    return std::static_pointer_cast<ReturnMessage>( reply );
+                }
+            }
         }
 
         /*
@@ -416,20 +677,38 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
         fds.push_back( m_priv->m_transport->fd() );
 
         do {
-            std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> fdResponse =
-                DBus::priv::wait_for_fd_activity( fds, msToWait );
+            // Only wait if we have not already read the next message from the socket
+            if( !m_priv->m_transport->has_buffered_message() ) {
+                std::vector<int> write_fds;
 
-            msToWait -= std::get<3>( fdResponse ).count();
+                // Our message may not have been fully written out yet
+                if( m_priv->m_transport->needs_writable() ) {
+                    write_fds = fds;
+                }
 
-            if( msToWait <= 0 ) {
-                throw ErrorNoReply( "Did not receive a response in the alotted time" );
+                std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> fdResponse =
+                    DBus::priv::wait_for_fd_activity( fds, write_fds, msToWait );
+
+                msToWait -= std::get<3>( fdResponse ).count();
+
+                if( msToWait <= 0 ) {
+                    throw ErrorNoReply( "Did not receive a response in the alotted time" );
+                }
+            }
+
+            {
+                std::unique_lock<std::mutex> lock( m_priv->m_outgoingLock );
+
+                if( m_priv->m_transport->pending_write_size() > 0 ) {
+                    m_priv->m_transport->write_pending();
+                }
             }
 
             if( !m_priv->m_transport->is_valid() ) {
                 throw ErrorDisconnected();
             }
 
-            std::shared_ptr<Message> incoming = m_priv->m_transport->readMessage();
+            std::shared_ptr<Message> incoming = read_message();
             {
                 std::ostringstream str;
                 str << incoming.get();
@@ -442,13 +721,13 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
                 if( incoming->type() == MessageType::ERROR ) {
                     std::shared_ptr<ErrorMessage> errmsg = std::static_pointer_cast<ErrorMessage>( incoming );
 
-                    if( errmsg->reply_serial() == replySerialExpceted ) {
+                    if( errmsg->reply_serial() == serial ) {
                         errmsg->throw_error();
                     }
                 } else if( incoming->type() == MessageType::RETURN ) {
                     retmsg = std::static_pointer_cast<ReturnMessage>( incoming );
 
-                    if( retmsg->reply_serial() == replySerialExpceted ) {
+                    if( retmsg->reply_serial() == serial ) {
                         gotReply = true;
                     }
                 }
@@ -461,27 +740,19 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
         } while( !gotReply );
 
     } else {
-        /*
-         * We are trying to do a blocking method call in a thread that is not the dispatcher thread.
-         * Queue up the message and notify the dispatcher thread.
-         */
-        uint32_t serial;
         std::shared_ptr<ExpectingResponse> ex;
 
         {
-            OutgoingMessage outgoing;
-            std::scoped_lock<std::mutex, std::mutex> lock( m_priv->m_outgoingLock, m_priv->m_expectingResponsesLock );
-            outgoing.msg = message;
-            outgoing.serial = m_priv->m_currentSerial++;
-            m_priv->m_outgoingMessages.push( outgoing );
-            serial = outgoing.serial;
+            std::unique_lock<std::mutex> lock( m_priv->m_expectingResponsesLock );
+            std::map<uint32_t, std::shared_ptr<ExpectingResponse>>::iterator it =
+                m_priv->m_expectingResponses.find( serial );
 
-            // Add this to our expecting responses
-            ex = std::make_shared<ExpectingResponse>();
-            m_priv->m_expectingResponses[ serial ] = ex;
-        }
+            if( it == m_priv->m_expectingResponses.end() ) {
+                throw ErrorUnexpectedResponse();
+            }
 
-        notify_dispatcher_or_dispatch();
+            ex = it->second;
+        }
 
         {
             /*
@@ -539,15 +810,190 @@ std::shared_ptr<ReturnMessage> Connection::send_with_reply_blocking( std::shared
 void Connection::flush() {
     if( !this->is_valid() ) { return; }
 
+    bool high_water_reached = false;
+    size_t pending_size;
+
     {
         std::unique_lock lock( m_priv->m_outgoingLock );
 
-        while( !m_priv->m_outgoingMessages.empty() ) {
-            OutgoingMessage outgoing = m_priv->m_outgoingMessages.front();
-            m_priv->m_outgoingMessages.pop();
+        if( m_priv->m_outgoingMessages.empty() || m_priv->is_corked() ) {
+            /*
+             * Corked messages stay queued until the oldest one has waited for
+             * our latency budget, so that any messages that are queued in the
+             * meantime are written out together with them.  The dispatcher
+             * comes back once flush_timeout_milliseconds() has passed.
+             */
+            m_priv->m_transport->write_pending();
+        } else {
+            m_priv->m_flushingMessages.swap( m_priv->m_outgoingMessages );
+            m_priv->m_transport->writeMessages( m_priv->m_flushingMessages );
+            m_priv->m_flushingMessages.clear();
+        }
+
+        pending_size = m_priv->m_transport->pending_write_size();
+
+        if( m_priv->m_writeHighWaterMark > 0 &&
+            pending_size > m_priv->m_writeHighWaterMark ) {
+            high_water_reached = !m_priv->m_aboveWriteHighWaterMark;
+            m_priv->m_aboveWriteHighWaterMark = true;
+        } else {
+            m_priv->m_aboveWriteHighWaterMark = false;
+        }
+
+        if( !m_priv->m_aboveWriteHighWaterMark || !m_priv->m_transport->is_valid() ) {
+            m_priv->m_writeSpaceAvailable.notify_all();
+        }
+    }
+
+    if( high_water_reached ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Write high-water mark reached, " << pending_size << " bytes pending" );
+        m_priv->m_writeHighWaterMarkSignal.emit( pending_size );
+    }
+}
+
+void Connection::set_flush_latency_budget( std::chrono::microseconds budget ) {
+    bool has_queued;
+
+    if( budget.count() < 0 ) {
+        budget = std::chrono::microseconds( 0 );
+    }
+
+    {
+        std::unique_lock lock( m_priv->m_outgoingLock );
+
+        m_priv->m_flushLatencyBudget = budget;
+        has_queued = !m_priv->m_outgoingMessages.empty();
+    }
+
+    // Messages that were held under the old budget may be due now
+    if( has_queued ) {
+        notify_dispatcher_or_dispatch();
+    }
+}
+
+std::chrono::microseconds Connection::flush_latency_budget() const {
+    return m_priv->m_flushLatencyBudget;
+}
+
+int Connection::flush_timeout_milliseconds() const {
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    if( !m_priv->is_corked() ) {
+        return -1;
+    }
+
+    std::chrono::steady_clock::duration remaining =
+        m_priv->m_firstQueuedTime + m_priv->m_flushLatencyBudget - std::chrono::steady_clock::now();
+
+    // Round up so that the dispatcher does not wake up before the budget runs out
+    return std::chrono::ceil<std::chrono::milliseconds>( remaining ).count();
+}
+
+void Connection::set_normalize_byte_order( bool normalize ) {
+    m_priv->m_normalizeByteOrder = normalize;
+}
+
+bool Connection::normalize_byte_order() const {
+    return m_priv->m_normalizeByteOrder;
+}
+
+std::shared_ptr<Message> Connection::read_message() {
+    std::shared_ptr<Message> incoming = m_priv->m_transport->readMessage();
 
-            m_priv->m_transport->writeMessage( outgoing.msg, outgoing.serial );
+    if( !incoming ||
+        !m_priv->m_normalizeByteOrder ||
+        incoming->endianess() == HOST_ENDIANESS ) {
+        return incoming;
+    }
+
+    if( !incoming->set_endianess( HOST_ENDIANESS ) ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Dropping message " << incoming->serial()
+            << ": unable to convert it to our byte order" );
+        return std::shared_ptr<Message>();
+    }
+
+    return incoming;
+}
+
+void Connection::set_write_high_water_mark( size_t bytes ) {
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    m_priv->m_writeHighWaterMark = bytes;
+    m_priv->m_aboveWriteHighWaterMark = false;
+    m_priv->m_writeSpaceAvailable.notify_all();
+}
+
+size_t Connection::write_high_water_mark() const {
+    return m_priv->m_writeHighWaterMark;
+}
+
+void Connection::set_block_on_write_high_water_mark( bool block ) {
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    m_priv->m_blockOnWriteHighWaterMark = block;
+    m_priv->m_writeSpaceAvailable.notify_all();
+}
+
+bool Connection::block_on_write_high_water_mark() const {
+    return m_priv->m_blockOnWriteHighWaterMark;
+}
+
+size_t Connection::pending_write_size() const {
+    if( !this->is_valid() ) { return 0; }
+
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    return m_priv->m_transport->pending_write_size();
+}
+
+void Connection::wait_for_write_space() {
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    auto has_space = [this] {
+        return !m_priv->m_blockOnWriteHighWaterMark ||
+            m_priv->m_writeHighWaterMark == 0 ||
+            !m_priv->m_transport->is_valid() ||
+            m_priv->m_transport->pending_write_size() <= m_priv->m_writeHighWaterMark;
+    };
+
+    if( has_space() ) { return; }
+
+    if( m_priv->m_dispatchingThread != std::this_thread::get_id() ) {
+        // The dispatching thread will tell us when the data has drained
+        m_priv->m_writeSpaceAvailable.wait( lock, has_space );
+        return;
+    }
+
+    /*
+     * We are the dispatching thread, so nobody else is going to write out
+     * the data for us.  Wait for the bus to be writable and write it ourselves,
+     * but not forever: nothing is read while we are in here, so a peer that
+     * is waiting for us to read before it reads would never take the data.
+     * Whatever is left is written out when we are next dispatched.
+     */
+    std::vector<int> fds;
+    fds.push_back( m_priv->m_transport->fd() );
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( WRITE_SPACE_TIMEOUT_MS );
+
+    while( !has_space() ) {
+        bool needs_writable = m_priv->m_transport->needs_writable();
+        int64_t ms_left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now() ).count();
+
+        if( ms_left <= 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Gave up waiting for the bus to take "
+                << m_priv->m_transport->pending_write_size() << " pending bytes" );
+            return;
         }
+
+        lock.unlock();
+        DBus::priv::wait_for_fd_activity( needs_writable ? std::vector<int>() : fds,
+            needs_writable ? fds : std::vector<int>(),
+            static_cast<int>( ms_left ) );
+        lock.lock();
+
+        m_priv->m_transport->write_pending();
     }
 }
 
@@ -579,7 +1025,7 @@ DispatchStatus Connection::dispatch( ) {
     // Try to read a message
     {
         SIMPLELOGGER_DEBUG( LOGGER_NAME, "Try to read a message" );
-        std::shared_ptr<Message> incoming = m_priv->m_transport->readMessage();
+        std::shared_ptr<Message> incoming = read_message();
 
         if( incoming ) {
             m_priv->m_incomingMessages.push( incoming );
@@ -589,8 +1035,18 @@ DispatchStatus Connection::dispatch( ) {
     // Process any messages that we need to
     process_single_message();
 
-    if( m_priv->m_outgoingMessages.empty() &&
-        m_priv->m_incomingMessages.empty() ) {
+    bool outgoing_done;
+
+    {
+        std::unique_lock lock( m_priv->m_outgoingLock );
+
+        // Corked messages are written out once flush_timeout_milliseconds() has passed
+        outgoing_done = m_priv->m_outgoingMessages.empty() || m_priv->is_corked();
+    }
+
+    if( outgoing_done &&
+        m_priv->m_incomingMessages.empty() &&
+        !m_priv->m_transport->has_buffered_message() ) {
         m_priv->m_dispatchStatus = DispatchStatus::COMPLETE;
     } else {
         m_priv->m_dispatchStatus = DispatchStatus::DATA_REMAINS;
@@ -781,25 +1237,38 @@ void Connection::send_error_on_handler_result( std::shared_ptr<const CallMessage
 int Connection::unix_fd() const {
     if( !this->is_valid() ) { return -1; }
 
-    return m_priv->m_transport->fd();
+    return m_priv->m_transport->socket_fd();
 }
 
 int Connection::socket() const {
     if( !this->is_valid() ) { return -1; }
 
+    return m_priv->m_transport->socket_fd();
+}
+
+int Connection::dispatch_fd() const {
+    if( !this->is_valid() ) { return -1; }
+
     return m_priv->m_transport->fd();
 }
 
 bool Connection::has_messages_to_send() {
     if( !this->is_valid() ) { return false; }
 
-    return !m_priv->m_outgoingMessages.empty();
+    std::unique_lock lock( m_priv->m_outgoingLock );
+
+    return ( !m_priv->m_outgoingMessages.empty() && !m_priv->is_corked() ) ||
+        m_priv->m_transport->needs_writable();
 }
 
 sigc::signal< void() >& Connection::signal_needs_dispatch() {
     return m_priv->m_needsDispatching;
 }
 
+sigc::signal<void(size_t)>& Connection::signal_write_high_water_mark() {
+    return m_priv->m_writeHighWaterMarkSignal;
+}
+
 std::shared_ptr<Object> Connection::create_object( const std::string& path, ThreadForCalling calling ) {
     std::shared_ptr<Object> object = Object::create( path );
 
@@ -1029,6 +1498,40 @@ std::string Connection::introspect( const std::string& destination, const std::s
 }
 
 void Connection::set_dispatching_thread( std::thread::id tid ) {
+    std::thread::id noThread;
+
+    if( m_priv->m_dispatchingThread == noThread && tid != noThread ) {
+        {
+            std::unique_lock<std::mutex> lock( m_priv->m_pathHandlerLock );
+
+            for( std::pair<const std::string, PathHandlingEntry>& entry : m_priv->m_path_handler ) {
+                if( entry.second.handlingThread == noThread ) {
+                    entry.second.handlingThread = tid;
+                }
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock( m_priv->m_objectProxiesLock );
+
+            for( ObjectProxyThreadInfo& thrInfo : m_priv->m_objectProxies ) {
+                if( thrInfo.handlingThread == noThread ) {
+                    thrInfo.handlingThread = tid;
+                }
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock( m_priv->m_freeProxySignalsLock );
+
+            for( FreeSignalThreadInfo& sigInfo : m_priv->m_freeProxySignals ) {
+                if( sigInfo.handlingThread == noThread ) {
+                    sigInfo.handlingThread = tid;
+                }
+            }
+        }
+    }
+
     m_priv->m_dispatchingThread = tid;
 }
 
@@ -31,8 +31,10 @@
 #include <vector>
 #include "enums.h"
 #include <sigc++/sigc++.h>
+#include <chrono>
 #include <future>
 #include <queue>
+#include <utility>
 
 #ifndef DBUSCXX_CONNECTION_H
 #define DBUSCXX_CONNECTION_H
@@ -69,6 +71,7 @@ class Watch;
 class ThreadDispatcher;
 class ErrorMessage;
 class DBusDaemonProxy;
+class Server;
 
 namespace priv {
 class Transport;
@@ -86,7 +89,9 @@ class Connection : public std::enable_shared_from_this<Connection> {
 private:
     Connection( BusType type );
 
-    Connection( std::string address );
+    Connection( std::string address, bool isPeer );
+
+    Connection( std::shared_ptr<priv::Transport> transport );
 
 public:
     /**
@@ -110,6 +115,35 @@ public:
      */
     static std::shared_ptr<Connection> create( std::string address );
 
+    /**
+     * Create a new peer-to-peer connection, connecting to the specified address.
+     * This is for talking directly to another application, such as one that
+     * has created a DBus::Server, without going through a bus daemon.
+     *
+     * A peer-to-peer connection does not need to be registered, and has no
+     * unique name.  Methods that talk to the bus daemon, such as request_name(),
+     * will throw ErrorNotSupported.
+     *
+     * @param address The address to connect to, in DBus transport format
+     * @return
+     */
+    static std::shared_ptr<Connection> create_peer( std::string address );
+
+    /**
+     * Create two connections that are connected directly to each other within
+     * this process.  Messages sent on one connection are handed to the other
+     * connection as objects; they are never serialized and no socket is
+     * involved.  Objects and object proxies work on these connections
+     * exactly like on a peer-to-peer connection, so this is useful when
+     * components in the same process talk to each other, and for testing.
+     *
+     * Both connections must be added to a Dispatcher.  If one of them goes
+     * away, the other one becomes invalid.
+     *
+     * @return The two ends of the loopback
+     */
+    static std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>> create_loopback_pair();
+
     ~Connection();
 
     /** True if this is a valid connection; false otherwise */
@@ -121,6 +155,9 @@ public:
     /** True if this connection is already registered */
     bool is_registered() const;
 
+    /** True if this is a peer-to-peer connection that has no bus daemon */
+    bool is_peer() const;
+
     /**
      * Registers this connection with the bus.  It is safe to call this
      * method multiple times.
@@ -194,6 +231,17 @@ public:
      */
     uint32_t send( const std::shared_ptr<const Message> message );
 
+    /**
+     * Queues up several messages to be sent on the bus.  The messages are
+     * sent in order, and are written out together with as few writes to
+     * the bus as possible.
+     *
+     * @param messages The messages to send
+     * @return The serials of the messages, in the same order as the messages.
+     * The serial for a null message is 0.
+     */
+    std::vector<uint32_t> send_batch( const std::vector<std::shared_ptr<const Message>>& messages );
+
     /**
      * Blindly sends the message on the connection.  Since you don't get any kind of handle
      * back from this, you should really only use it for sending method returns and signals.
@@ -218,6 +266,78 @@ public:
      */
     void flush();
 
+    /**
+     * Set how long a queued message may wait before it is flushed out to
+     * the bus.  While this time has not yet passed, flush() leaves the
+     * messages queued so that messages queued from other threads in the
+     * meantime may all be written out together.  This is useful for sending
+     * bursts of small signals from other threads, at the cost of some latency.
+     * Dispatchers use flush_timeout_milliseconds() to know when to come back.
+     *
+     * The default is 0, meaning that messages are written out as soon as
+     * the connection is dispatched.
+     *
+     * @param budget The maximum amount of time to hold a message for.
+     */
+    void set_flush_latency_budget( std::chrono::microseconds budget );
+
+    std::chrono::microseconds flush_latency_budget() const;
+
+    /**
+     * Returns how many milliseconds may pass before flush() has to be called
+     * again to write out messages that are being held back by the flush
+     * latency budget, or -1 if no messages are being held back.
+     */
+    int flush_timeout_milliseconds() const;
+
+    /**
+     * Set if messages that we receive in the other byte order should be
+     * converted to our byte order as soon as they are read.  The body of
+     * the message is swapped once, in place, so that reading the arguments
+     * afterwards does not have to swap every value.  Messages that can't be
+     * converted are dropped.
+     *
+     * The default is false, meaning that messages are left in the byte
+     * order that they were sent in.
+     *
+     * @param normalize True to convert incoming messages to our byte order
+     */
+    void set_normalize_byte_order( bool normalize );
+
+    bool normalize_byte_order() const;
+
+    /**
+     * Set the high-water mark for data that has been queued up to be written
+     * to the bus, but that the bus has not taken yet.  When more than this
+     * many bytes are waiting to be written, signal_write_high_water_mark() is
+     * emitted, and if set_block_on_write_high_water_mark() has been enabled,
+     * sending more messages will block until the data drains below this mark.
+     *
+     * The default is 0, meaning that there is no limit.
+     *
+     * @param bytes The high-water mark, in bytes
+     */
+    void set_write_high_water_mark( size_t bytes );
+
+    size_t write_high_water_mark() const;
+
+    /**
+     * Set if sending a message should block while more data than the
+     * write high-water mark is waiting to be written to the bus.
+     *
+     * @param block True to block the sending thread, false to only emit
+     * signal_write_high_water_mark()
+     */
+    void set_block_on_write_high_water_mark( bool block );
+
+    bool block_on_write_high_water_mark() const;
+
+    /**
+     * Returns the number of bytes that are waiting to be written to the bus
+     * because the bus has not been able to take them yet.
+     */
+    size_t pending_write_size() const;
+
     DispatchStatus dispatch_status( ) const;
 
     /**
@@ -236,10 +356,20 @@ public:
      */
     DispatchStatus dispatch( );
 
+    /**
+     * Returns the socket that this connection talks over.
+     */
     int unix_fd() const;
 
     int socket() const;
 
+    /**
+     * Returns the FD that a dispatcher waits on: when it becomes readable,
+     * the connection needs to be dispatched.  This is the socket, unless the
+     * transport completes its reads and writes asynchronously.
+     */
+    int dispatch_fd() const;
+
     bool has_messages_to_send();
 
     /**
@@ -252,6 +382,16 @@ public:
      */
     sigc::signal<void()>& signal_needs_dispatch();
 
+    /**
+     * This signal is emitted from the dispatching thread when the amount of
+     * data waiting to be written to the bus goes over the write high-water
+     * mark.  The parameter is the number of bytes waiting to be written.
+     *
+     * It will not be emitted again until the data has drained below the
+     * high-water mark.
+     */
+    sigc::signal<void(size_t)>& signal_write_high_water_mark();
+
     /**
      * Create and return a new object, registering the object automatically.  If the registering
      * fails, an invalid pointer will be returned.
@@ -379,6 +519,9 @@ public:
      *
      * By default, the dispatching thread is the thread that this Connection
      * was created in.  If using the default Dispatcher, this will be set automatically.
+     * Connections accepted by a Server have no dispatching thread until they are
+     * added to a Dispatcher; anything registered on them for the dispatcher thread
+     * before then will be handled by the new dispatching thread.
      *
      * @param tid
      */
@@ -416,6 +559,50 @@ private:
      */
     uint32_t write_single_message( std::shared_ptr<const Message> msg );
 
+    /**
+     * Add a message to the outgoing queue, return the serial of this message.
+     * This should be called with a lock on m_outgoingLock
+     *
+     * @param msg
+     * @return
+     */
+    uint32_t queue_outgoing_message( std::shared_ptr<const Message> msg );
+
+    /**
+     * If we block on the write high-water mark, wait until the data that is
+     * waiting to be written to the bus drains below the high-water mark.
+     */
+    void wait_for_write_space();
+
+    /**
+     * Wait for the reply to the method call with the given serial.  If this is
+     * not the dispatching thread, an ExpectingResponse for the serial must
+     * already have been added.
+     *
+     * @param serial The serial of the method call
+     * @param timeout_milliseconds How long to wait for, or -1 for the default
+     * @return The reply; if the reply is an error, it is thrown instead
+     */
+    std::shared_ptr<ReturnMessage> wait_for_reply( uint32_t serial, int timeout_milliseconds );
+
+    /**
+     * Connect to a bus daemon.  The Hello message is sent along with our
+     * authentication, so that registering doesn't cost another round trip.
+     */
+    void open_bus_transport( std::string address );
+
+    /**
+     * Read the next message from the transport, converting it to our byte
+     * order if set_normalize_byte_order() is enabled.
+     */
+    std::shared_ptr<Message> read_message();
+
+    /**
+     * Get the proxy to the bus daemon, creating it if needed.  Returns an
+     * invalid pointer if there is no bus daemon or we are not registered yet.
+     */
+    std::shared_ptr<DBusDaemonProxy> daemon_proxy() const;
+
     void process_single_message();
 
     void remove_invalid_threaddispatchers_and_associated_objects();
@@ -436,6 +623,8 @@ private:
     class priv_data;
 
     DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+
+    friend class Server;
 };
 
 inline
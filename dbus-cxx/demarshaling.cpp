@@ -17,43 +17,33 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include "demarshaling.h"
+#include "byteorder.h"
 #include <cstring>
 #include <stdint.h>
 #include <cassert>
 
 using DBus::Demarshaling;
 
-class Demarshaling::priv_data {
-public:
-    priv_data() :
-        m_data( nullptr ),
-        m_dataLen( 0 ),
-        m_dataPos( 0 ),
-        m_endian( Endianess::Big ) {}
+/* The limit on how deep containers may be nested in the specification */
+static constexpr int MAXIMUM_NESTING_DEPTH = 64;
 
-    const uint8_t* m_data;
-    uint32_t m_dataLen;
-    uint32_t m_dataPos;
-    Endianess m_endian;
-};
-
-Demarshaling::Demarshaling() {
-    m_priv = std::make_unique<priv_data>();
-}
-
-Demarshaling::Demarshaling( const uint8_t* data, uint32_t dataLen, Endianess endian ) {
-    m_priv = std::make_unique<priv_data>();
-    m_priv->m_data = data;
-    m_priv->m_dataLen = dataLen;
-    m_priv->m_endian = endian;
+Demarshaling::Demarshaling() :
+    m_data( nullptr ),
+    m_dataLen( 0 ),
+    m_dataPos( 0 ),
+    m_endian( HOST_ENDIANESS ) {
 }
 
-Demarshaling::~Demarshaling() {
+Demarshaling::Demarshaling( const uint8_t* data, uint32_t dataLen, Endianess endian ) :
+    m_data( data ),
+    m_dataLen( dataLen ),
+    m_dataPos( 0 ),
+    m_endian( endian ) {
 }
 
 uint8_t Demarshaling::demarshal_uint8_t() {
     is_valid( 1 );
-    return m_priv->m_data[m_priv->m_dataPos++];
+    return m_data[m_dataPos++];
 }
 
 bool Demarshaling::demarshal_boolean() {
@@ -67,62 +57,32 @@ bool Demarshaling::demarshal_boolean() {
 }
 
 int16_t Demarshaling::demarshal_int16_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return demarshalShortLittle();
-    } else {
-        return demarshalShortBig();
-    }
+    return demarshalShort();
 }
 
 uint16_t Demarshaling::demarshal_uint16_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return static_cast<uint16_t>( demarshalShortLittle() );
-    } else {
-        return static_cast<uint16_t>( demarshalShortBig() );
-    }
+    return static_cast<uint16_t>( demarshalShort() );
 }
 
 int32_t Demarshaling::demarshal_int32_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return demarshalIntLittle();
-    } else {
-        return demarshalIntBig();
-    }
+    return demarshalInt();
 }
 
 uint32_t Demarshaling::demarshal_uint32_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return static_cast<uint32_t>( demarshalIntLittle() );
-    } else {
-        return static_cast<uint32_t>( demarshalIntBig() );
-    }
+    return static_cast<uint32_t>( demarshalInt() );
 }
 
 int64_t Demarshaling::demarshal_int64_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return demarshalLongLittle();
-    } else {
-        return demarshalLongBig();
-    }
+    return demarshalLong();
 }
 
 uint64_t Demarshaling::demarshal_uint64_t() {
-    if( m_priv->m_endian == Endianess::Little ) {
-        return static_cast<uint64_t>( demarshalLongLittle() );
-    } else {
-        return static_cast<uint64_t>( demarshalLongBig() );
-    }
+    return static_cast<uint64_t>( demarshalLong() );
 }
 
 double Demarshaling::demarshal_double() {
     double ret;
-    int64_t val;
-
-    if( m_priv->m_endian == Endianess::Little ) {
-        val = demarshalLongLittle();
-    } else {
-        val = demarshalLongBig();
-    }
+    int64_t val = demarshalLong();
 
     memcpy( &ret, &val, sizeof( int64_t ) );
 
@@ -132,10 +92,10 @@ double Demarshaling::demarshal_double() {
 std::string Demarshaling::demarshal_string() {
     uint32_t len = demarshal_uint32_t();
     is_valid( len + 1 );
-    const char* start = reinterpret_cast<const char*>( m_priv->m_data + m_priv->m_dataPos );
+    const char* start = reinterpret_cast<const char*>( m_data + m_dataPos );
     std::string ret = std::string( start, len );
 
-    m_priv->m_dataPos += len + 1;
+    m_dataPos += len + 1;
 
     return ret;
 }
@@ -149,12 +109,12 @@ DBus::Path Demarshaling::demarshal_path() {
 
 DBus::Signature Demarshaling::demarshal_signature() {
     uint8_t len = demarshal_uint8_t();
-    const char* start = reinterpret_cast<const char*>( m_priv->m_data + m_priv->m_dataPos );
-    std::string asStr = std::string( start, len );
+    is_valid( len + 1 );
+    const char* start = reinterpret_cast<const char*>( m_data + m_dataPos );
 
-    m_priv->m_dataPos += len + 1;
+    m_dataPos += len + 1;
 
-    return Signature( asStr );
+    return Signature( start, len );
 }
 
 DBus::Variant Demarshaling::demarshal_variant() {
@@ -220,16 +180,211 @@ DBus::Variant Demarshaling::demarshal_variant() {
     return DBus::Variant();
 }
 
+bool Demarshaling::demarshal_fixed_array( void* data, uint32_t count, int elementSize ) {
+    uint64_t numBytes = static_cast<uint64_t>( count ) * elementSize;
+
+    align( elementSize );
+
+    if( !has_bytes( numBytes ) ) {
+        return false;
+    }
+
+    memcpy( data, m_data + m_dataPos, numBytes );
+
+    if( m_endian != HOST_ENDIANESS ) {
+        DBus::priv::swap_array( static_cast<uint8_t*>( data ), count, elementSize );
+    }
+
+    m_dataPos += numBytes;
+
+    return true;
+}
+
+bool Demarshaling::demarshal_string_view( std::string_view* view ) {
+    align( 4 );
+
+    if( !has_bytes( 4 ) ) {
+        return false;
+    }
+
+    uint32_t len = demarshal_uint32_t();
+
+    if( !has_bytes( static_cast<uint64_t>( len ) + 1 ) ) {
+        return false;
+    }
+
+    *view = std::string_view( reinterpret_cast<const char*>( m_data + m_dataPos ), len );
+    m_dataPos += len + 1;
+
+    return true;
+}
+
+bool Demarshaling::skip( SignatureIterator type ) {
+    return skip_value( type, 0 );
+}
+
+bool Demarshaling::skip_value( SignatureIterator type, int depth ) {
+    // Each variant brings its own signature, so bound how deep they can go
+    if( depth > MAXIMUM_NESTING_DEPTH ) {
+        return false;
+    }
+
+    int fixedSize = type.fixed_size();
+
+    if( fixedSize != 0 ) {
+        align( type.alignment() );
+
+        if( !has_bytes( fixedSize ) ) {
+            return false;
+        }
+
+        m_dataPos += fixedSize;
+        return true;
+    }
+
+    switch( type.type() ) {
+    case DataType::STRING:
+    case DataType::OBJECT_PATH: {
+        std::string_view unused;
+        return demarshal_string_view( &unused );
+    }
+
+    case DataType::SIGNATURE: {
+        if( !has_bytes( 1 ) ) {
+            return false;
+        }
+
+        uint8_t len = demarshal_uint8_t();
+
+        if( !has_bytes( static_cast<uint64_t>( len ) + 1 ) ) {
+            return false;
+        }
+
+        m_dataPos += len + 1;
+        return true;
+    }
+
+    case DataType::ARRAY: {
+        align( 4 );
+
+        if( !has_bytes( 4 ) ) {
+            return false;
+        }
+
+        // The length does not include the padding before the first element
+        uint32_t len = demarshal_uint32_t();
+        align( type.recurse().alignment() );
+
+        if( !has_bytes( len ) ) {
+            return false;
+        }
+
+        m_dataPos += len;
+        return true;
+    }
+
+    case DataType::STRUCT:
+    case DataType::DICT_ENTRY:
+        align( 8 );
+
+        for( SignatureIterator member = type.recurse(); member.is_valid(); member.next() ) {
+            if( !skip_value( member, depth + 1 ) ) {
+                return false;
+            }
+        }
+
+        return true;
+
+    case DataType::VARIANT: {
+        if( !has_bytes( 1 ) ) {
+            return false;
+        }
+
+        uint8_t len = demarshal_uint8_t();
+
+        if( !has_bytes( static_cast<uint64_t>( len ) + 1 ) ) {
+            return false;
+        }
+
+        Signature sig( reinterpret_cast<const char*>( m_data + m_dataPos ), len );
+        m_dataPos += len + 1;
+
+        if( !sig.is_valid() || !sig.is_singleton() ) {
+            return false;
+        }
+
+        return skip_value( sig.begin(), depth + 1 );
+    }
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+int16_t Demarshaling::demarshalShort() {
+    int16_t ret;
+
+    if( m_endian == HOST_ENDIANESS ) {
+        demarshalNative( &ret, sizeof( ret ) );
+    } else if( m_endian == Endianess::Little ) {
+        ret = demarshalShortLittle();
+    } else {
+        ret = demarshalShortBig();
+    }
+
+    return ret;
+}
+
+int32_t Demarshaling::demarshalInt() {
+    int32_t ret;
+
+    if( m_endian == HOST_ENDIANESS ) {
+        demarshalNative( &ret, sizeof( ret ) );
+    } else if( m_endian == Endianess::Little ) {
+        ret = demarshalIntLittle();
+    } else {
+        ret = demarshalIntBig();
+    }
+
+    return ret;
+}
+
+int64_t Demarshaling::demarshalLong() {
+    int64_t ret;
+
+    if( m_endian == HOST_ENDIANESS ) {
+        demarshalNative( &ret, sizeof( ret ) );
+    } else if( m_endian == Endianess::Little ) {
+        ret = demarshalLongLittle();
+    } else {
+        ret = demarshalLongBig();
+    }
+
+    return ret;
+}
+
+void Demarshaling::demarshalNative( void* value, int size ) {
+    align( size );
+    is_valid( size );
+
+    // Already in our byte order, so this is just a load
+    memcpy( value, m_data + m_dataPos, size );
+
+    m_dataPos += size;
+}
+
 int16_t Demarshaling::demarshalShortBig() {
     int16_t ret = 0;
     align( 2 );
     is_valid( 2 );
 
-    ret = ( ( m_priv->m_data[ m_priv->m_dataPos ] & 0xFF ) << 8 ) |
-        ( ( m_priv->m_data[ m_priv->m_dataPos + 1 ] & 0xFF ) << 0 );
+    ret = ( ( m_data[ m_dataPos ] & 0xFF ) << 8 ) |
+        ( ( m_data[ m_dataPos + 1 ] & 0xFF ) << 0 );
 
 
-    m_priv->m_dataPos += 2;
+    m_dataPos += 2;
 
     return ret;
 }
@@ -239,10 +394,10 @@ int16_t Demarshaling::demarshalShortLittle() {
     align( 2 );
     is_valid( 2 );
 
-    ret = ( ( m_priv->m_data[ m_priv->m_dataPos ] & 0xFF ) << 0 ) |
-        ( ( m_priv->m_data[ m_priv->m_dataPos + 1 ] & 0xFF ) << 8 );
+    ret = ( ( m_data[ m_dataPos ] & 0xFF ) << 0 ) |
+        ( ( m_data[ m_dataPos + 1 ] & 0xFF ) << 8 );
 
-    m_priv->m_dataPos += 2;
+    m_dataPos += 2;
 
     return ret;
 }
@@ -252,12 +407,12 @@ int32_t Demarshaling::demarshalIntBig() {
     align( 4 );
     is_valid( 4 );
 
-    ret = static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos ] ) << 24  |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 1 ] ) << 16 |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 2 ] ) << 8 |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 3 ] ) << 0 ;
+    ret = static_cast<int32_t>( m_data[ m_dataPos ] ) << 24  |
+        static_cast<int32_t>( m_data[ m_dataPos + 1 ] ) << 16 |
+        static_cast<int32_t>( m_data[ m_dataPos + 2 ] ) << 8 |
+        static_cast<int32_t>( m_data[ m_dataPos + 3 ] ) << 0 ;
 
-    m_priv->m_dataPos += 4;
+    m_dataPos += 4;
 
     return ret;
 }
@@ -267,12 +422,12 @@ int32_t Demarshaling::demarshalIntLittle() {
     align( 4 );
     is_valid( 4 );
 
-    ret = static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos ] ) << 0  |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 1 ] ) << 8 |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 2 ] ) << 16 |
-        static_cast<int32_t>( m_priv->m_data[ m_priv->m_dataPos + 3 ] ) << 24 ;
+    ret = static_cast<int32_t>( m_data[ m_dataPos ] ) << 0  |
+        static_cast<int32_t>( m_data[ m_dataPos + 1 ] ) << 8 |
+        static_cast<int32_t>( m_data[ m_dataPos + 2 ] ) << 16 |
+        static_cast<int32_t>( m_data[ m_dataPos + 3 ] ) << 24 ;
 
-    m_priv->m_dataPos += 4;
+    m_dataPos += 4;
 
     return ret;
 }
@@ -282,16 +437,16 @@ int64_t Demarshaling::demarshalLongBig() {
     align( 8 );
     is_valid( 8 );
 
-    ret = static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos ] ) << 56 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 1 ] ) << 48 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 2 ] ) << 40 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 3 ] ) << 32 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 4 ] ) << 24 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 5 ] ) << 16 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 6 ] ) << 8 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 7 ] ) << 0 ;
+    ret = static_cast<int64_t>( m_data[ m_dataPos ] ) << 56 |
+        static_cast<int64_t>( m_data[ m_dataPos + 1 ] ) << 48 |
+        static_cast<int64_t>( m_data[ m_dataPos + 2 ] ) << 40 |
+        static_cast<int64_t>( m_data[ m_dataPos + 3 ] ) << 32 |
+        static_cast<int64_t>( m_data[ m_dataPos + 4 ] ) << 24 |
+        static_cast<int64_t>( m_data[ m_dataPos + 5 ] ) << 16 |
+        static_cast<int64_t>( m_data[ m_dataPos + 6 ] ) << 8 |
+        static_cast<int64_t>( m_data[ m_dataPos + 7 ] ) << 0 ;
 
-    m_priv->m_dataPos += 8;
+    m_dataPos += 8;
 
     return ret;
 }
@@ -301,47 +456,60 @@ int64_t Demarshaling::demarshalLongLittle() {
     align( 8 );
     is_valid( 8 );
 
-    ret = static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos ] ) << 0 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 1 ] ) << 8 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 2 ] ) << 16 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 3 ] ) << 24 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 4 ] ) << 32 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 5 ] ) << 40 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 6 ] ) << 48 |
-        static_cast<int64_t>( m_priv->m_data[ m_priv->m_dataPos + 7 ] ) << 56 ;
+    ret = static_cast<int64_t>( m_data[ m_dataPos ] ) << 0 |
+        static_cast<int64_t>( m_data[ m_dataPos + 1 ] ) << 8 |
+        static_cast<int64_t>( m_data[ m_dataPos + 2 ] ) << 16 |
+        static_cast<int64_t>( m_data[ m_dataPos + 3 ] ) << 24 |
+        static_cast<int64_t>( m_data[ m_dataPos + 4 ] ) << 32 |
+        static_cast<int64_t>( m_data[ m_dataPos + 5 ] ) << 40 |
+        static_cast<int64_t>( m_data[ m_dataPos + 6 ] ) << 48 |
+        static_cast<int64_t>( m_data[ m_dataPos + 7 ] ) << 56 ;
 
-    m_priv->m_dataPos += 8;
+    m_dataPos += 8;
 
     return ret;
 }
 
 void Demarshaling::is_valid( uint32_t bytesWanted ) {
-    assert( m_priv->m_data != nullptr );
-    assert( ( m_priv->m_dataPos + bytesWanted ) <= m_priv->m_dataLen );
+    assert( m_data != nullptr );
+    assert( ( m_dataPos + bytesWanted ) <= m_dataLen );
+}
+
+bool Demarshaling::has_bytes( uint64_t bytesWanted ) const {
+    return m_data != nullptr &&
+        static_cast<uint64_t>( m_dataPos ) + bytesWanted <= m_dataLen;
 }
 
 void Demarshaling::align( int alignment ) {
     if( alignment == 0 ){
         return;
     }
-    int bytesToAlign = alignment - ( m_priv->m_dataPos % alignment );
+    int bytesToAlign = alignment - ( m_dataPos % alignment );
 
     if( bytesToAlign == alignment ) {
         // already aligned!
         return;
     }
 
-    m_priv->m_dataPos += bytesToAlign;
+    m_dataPos += bytesToAlign;
 }
 
 uint32_t Demarshaling::current_offset() const {
-    return m_priv->m_dataPos;
+    return m_dataPos;
+}
+
+uint32_t Demarshaling::remaining() const {
+    if( m_dataPos >= m_dataLen ) {
+        return 0;
+    }
+
+    return m_dataLen - m_dataPos;
 }
 
 void Demarshaling::set_endianess( Endianess endian ) {
-    m_priv->m_endian = endian;
+    m_endian = endian;
 }
 
 void Demarshaling::set_data_offset( uint32_t offset ) {
-    m_priv->m_dataPos = offset;
+    m_dataPos = offset;
 }
@@ -26,6 +26,7 @@
 #include <dbus-cxx/enums.h>
 #include <dbus-cxx/dbus-cxx-config.h>
 #include <memory>
+#include <string_view>
 
 namespace DBus {
 
@@ -45,8 +46,6 @@ public:
      */
     Demarshaling( const uint8_t* data, uint32_t dataLen, Endianess endian );
 
-    ~Demarshaling();
-
     /**
      * Set the data C array to marshal/demarshal.  This also has
      * the side effect of resetting the data offset to 0, in
@@ -69,6 +68,11 @@ public:
 
     uint32_t current_offset() const;
 
+    /**
+     * The number of bytes between our position and the end of the data.
+     */
+    uint32_t remaining() const;
+
     uint8_t demarshal_uint8_t();
     bool demarshal_boolean();
     int16_t demarshal_int16_t();
@@ -83,6 +87,40 @@ public:
     Signature demarshal_signature();
     Variant demarshal_variant();
 
+    /**
+     * Demarshal the elements of an array of fixed-size values in one go,
+     * converting them to our byte order.  The length of the array must
+     * already have been demarshaled.
+     *
+     * @param data Where to put the elements
+     * @param count The number of elements
+     * @param elementSize The size of each element: 1, 2, 4 or 8
+     * @return False if the elements run past the end of the data
+     */
+    bool demarshal_fixed_array( void* data, uint32_t count, int elementSize );
+
+    /**
+     * Demarshal a string or object path without copying it.  The view
+     * points into the data that we were given.
+     *
+     * @param view Where to put the string
+     * @return False if the length of the string runs past the end of the data
+     */
+    bool demarshal_string_view( std::string_view* view );
+
+    /**
+     * Move past one value of the type that the given iterator points at,
+     * without decoding it.  Arrays are jumped over using their length, and
+     * values of a fixed size are jumped over in one go.
+     *
+     * The lengths come from the data, so they are checked against the
+     * number of bytes that are left rather than trusted.
+     *
+     * @param type The type of the value to skip
+     * @return False if the value runs past the end of the data
+     */
+    bool skip( SignatureIterator type );
+
 private:
     /**
      * Checks to make sure that we're not overruing any array via an assertion.
@@ -90,6 +128,16 @@ private:
      * @param numBytesWanted The number of bytes that we want to pull out of the array.
      */
     void is_valid( uint32_t numBytesWanted );
+
+    /**
+     * Check, without asserting, that there are at least this many bytes left.
+     */
+    bool has_bytes( uint64_t numBytesWanted ) const;
+    bool skip_value( SignatureIterator type, int depth );
+    int16_t demarshalShort();
+    int32_t demarshalInt();
+    int64_t demarshalLong();
+    void demarshalNative( void* value, int size );
     int16_t demarshalShortBig();
     int16_t demarshalShortLittle();
     int32_t demarshalIntBig();
@@ -98,9 +146,14 @@ private:
     int64_t demarshalLongLittle();
 
 private:
-    class priv_data;
-
-    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+    /*
+     * Only a position in data that belongs to someone else, so that a
+     * Demarshaling can be created and copied without allocating
+     */
+    const uint8_t* m_data;
+    uint32_t m_dataLen;
+    uint32_t m_dataPos;
+    Endianess m_endian;
 };
 
 }
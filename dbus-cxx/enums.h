@@ -126,6 +126,16 @@ enum class Endianess {
     Big,
 };
 
+/**
+ * The byte order of the machine that we are running on.  Data is marshaled
+ * in this order unless something asks for a different one.
+ */
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr Endianess HOST_ENDIANESS = Endianess::Big;
+#else
+constexpr Endianess HOST_ENDIANESS = Endianess::Little;
+#endif
+
 enum class RegistrationStatus {
     Success,
     /** Unable to register object: There is already an object exported on this path */
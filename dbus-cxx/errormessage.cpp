@@ -32,37 +32,46 @@ ErrorMessage::ErrorMessage() {
 
 ErrorMessage::ErrorMessage( std::shared_ptr<const CallMessage> to_reply, const std::string& name, const std::string& message ) {
     if( to_reply ) {
-        set_header_field( MessageHeaderFields::Reply_Serial, Variant( to_reply->serial() ) );
+        set_header_uint32( MessageHeaderFields::Reply_Serial, to_reply->serial() );
     }
 
-    set_header_field( MessageHeaderFields::Error_Name, Variant( name ) );
+    set_header_string( MessageHeaderFields::Error_Name, name );
     append() << message;
 }
 
 std::shared_ptr<ErrorMessage> ErrorMessage::create() {
-    return std::shared_ptr<ErrorMessage>( new ErrorMessage() );
+    Message* msg = take_from_pool( MessageType::ERROR );
+
+    if( !msg ) {
+        msg = new ErrorMessage();
+    }
+
+    return std::static_pointer_cast<ErrorMessage>( manage_pooled( msg ) );
 }
 
 std::shared_ptr<ErrorMessage> ErrorMessage::create( std::shared_ptr<const CallMessage> msg, const std::string& name, const std::string& message ) {
-    return std::shared_ptr<ErrorMessage>( new ErrorMessage( msg, name, message ) );
+    std::shared_ptr<ErrorMessage> error = create();
+
+    if( msg ) {
+        error->set_header_uint32( MessageHeaderFields::Reply_Serial, msg->serial() );
+    }
+
+    error->set_header_string( MessageHeaderFields::Error_Name, name );
+    error->append() << message;
+
+    return error;
 }
 
 bool ErrorMessage::operator == ( const ErrorMessage& m ) const {
     return name() == m.name() && message() == m.message();
 }
 
-std::string ErrorMessage::name() const {
-    Variant msgName = header_field( MessageHeaderFields::Error_Name );
-
-    if( msgName.type() == DataType::STRING ) {
-        return msgName.to_string();
-    }
-
-    return "";
+const std::string& ErrorMessage::name() const {
+    return header_string( MessageHeaderFields::Error_Name );
 }
 
 void ErrorMessage::set_name( const std::string& n ) {
-    set_header_field( MessageHeaderFields::Error_Name, Variant( n ) );
+    set_header_string( MessageHeaderFields::Error_Name, n );
 }
 
 MessageType ErrorMessage::type() const {
@@ -70,15 +79,10 @@ MessageType ErrorMessage::type() const {
 }
 
 std::string ErrorMessage::message() const {
-    Variant signature = header_field( MessageHeaderFields::Signature );
     std::string retval;
 
-    if( signature.type() == DataType::SIGNATURE ) {
-        Signature value = signature.to_signature();
-
-        if( value.begin().type() == DataType::STRING ) {
-            begin() >> retval;
-        }
+    if( signature().begin().type() == DataType::STRING ) {
+        begin() >> retval;
     }
 
     return retval;
@@ -90,19 +94,12 @@ void ErrorMessage::set_message( const std::string& message ) {
 }
 
 bool ErrorMessage::set_reply_serial( uint32_t s ) {
-    Variant serialField = Variant( s );
-    set_header_field( MessageHeaderFields::Reply_Serial, serialField );
+    set_header_uint32( MessageHeaderFields::Reply_Serial, s );
     return false;
 }
 
 uint32_t ErrorMessage::reply_serial() const {
-    Variant field = header_field( MessageHeaderFields::Reply_Serial );
-
-    if( field.type() == DataType::UINT32 ) {
-        return field.to_uint32();
-    }
-
-    return 0;
+    return header_uint32( MessageHeaderFields::Reply_Serial );
 }
 
 void ErrorMessage::throw_error() {
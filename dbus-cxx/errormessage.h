@@ -48,7 +48,7 @@ public:
 
     static std::shared_ptr<ErrorMessage> create( std::shared_ptr<const CallMessage> callMessage, const std::string& name, const std::string& message );
 
-    std::string name() const;
+    const std::string& name() const;
 
     void set_name( const std::string& n );
 
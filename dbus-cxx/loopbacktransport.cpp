@@ -0,0 +1,178 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "loopbacktransport.h"
+
+#include "dbus-cxx-private.h"
+#include "message.h"
+
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+using DBus::priv::LoopbackTransport;
+using DBus::priv::LoopbackQueue;
+
+static const char* LOGGER_NAME = "DBus.priv.LoopbackTransport";
+
+/**
+ * The messages going in one direction.  This is shared between the
+ * transport that writes to it and the transport that reads from it.
+ */
+class DBus::priv::LoopbackQueue {
+public:
+    LoopbackQueue() :
+        m_closed( false ) {
+        m_wakeupFd[ 0 ] = -1;
+        m_wakeupFd[ 1 ] = -1;
+    }
+
+    ~LoopbackQueue() {
+        if( m_wakeupFd[ 0 ] >= 0 ) { close( m_wakeupFd[ 0 ] ); }
+
+        if( m_wakeupFd[ 1 ] >= 0 ) { close( m_wakeupFd[ 1 ] ); }
+    }
+
+    /* Make the reading end readable.  Must hold m_lock. */
+    void wakeup() {
+        char wakeup = '1';
+
+        if( ::write( m_wakeupFd[ 1 ], &wakeup, 1 ) < 0 && errno != EAGAIN ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to wake up loopback: " << strerror( errno ) );
+        }
+    }
+
+    /* Make the reading end not readable anymore.  Must hold m_lock. */
+    void drain() {
+        char buffer[ 64 ];
+
+        while( ::read( m_wakeupFd[ 0 ], buffer, sizeof( buffer ) ) > 0 ) {}
+    }
+
+    std::mutex m_lock;
+    std::queue<std::shared_ptr<DBus::Message>> m_messages;
+    /* [0] is polled by the reader, [1] is written by the writer */
+    int m_wakeupFd[ 2 ];
+    bool m_closed;
+};
+
+class LoopbackTransport::priv_data {
+public:
+    priv_data( std::shared_ptr<LoopbackQueue> incoming, std::shared_ptr<LoopbackQueue> outgoing ) :
+        m_incoming( incoming ),
+        m_outgoing( outgoing ) {}
+
+    std::shared_ptr<LoopbackQueue> m_incoming;
+    std::shared_ptr<LoopbackQueue> m_outgoing;
+};
+
+LoopbackTransport::LoopbackTransport( std::shared_ptr<LoopbackQueue> incoming, std::shared_ptr<LoopbackQueue> outgoing ) :
+    m_priv( std::make_unique<priv_data>( incoming, outgoing ) ) {
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    // Both directions are dead now; make sure that the other end notices
+    {
+        std::unique_lock<std::mutex> lock( m_priv->m_incoming->m_lock );
+        m_priv->m_incoming->m_closed = true;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( m_priv->m_outgoing->m_lock );
+        m_priv->m_outgoing->m_closed = true;
+        m_priv->m_outgoing->wakeup();
+    }
+}
+
+std::pair<std::shared_ptr<LoopbackTransport>, std::shared_ptr<LoopbackTransport>> LoopbackTransport::create_pair() {
+    std::shared_ptr<LoopbackQueue> first_to_second = std::make_shared<LoopbackQueue>();
+    std::shared_ptr<LoopbackQueue> second_to_first = std::make_shared<LoopbackQueue>();
+
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, first_to_second->m_wakeupFd ) < 0 ||
+        socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, second_to_first->m_wakeupFd ) < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to create socket pair: " << strerror( errno ) );
+        return std::make_pair( std::shared_ptr<LoopbackTransport>(), std::shared_ptr<LoopbackTransport>() );
+    }
+
+    std::shared_ptr<LoopbackTransport> first( new LoopbackTransport( second_to_first, first_to_second ) );
+    std::shared_ptr<LoopbackTransport> second( new LoopbackTransport( first_to_second, second_to_first ) );
+
+    return std::make_pair( first, second );
+}
+
+ssize_t LoopbackTransport::writeMessage( std::shared_ptr<const Message> message, uint32_t serial ) {
+    std::shared_ptr<Message> copy = message->copy_with_serial( serial );
+
+    if( !copy ) {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock( m_priv->m_outgoing->m_lock );
+
+    if( m_priv->m_outgoing->m_closed ) {
+        return -1;
+    }
+
+    if( m_priv->m_outgoing->m_messages.empty() ) {
+        m_priv->m_outgoing->wakeup();
+    }
+
+    m_priv->m_outgoing->m_messages.push( copy );
+
+    return copy->body_size();
+}
+
+std::shared_ptr<DBus::Message> LoopbackTransport::readMessage() {
+    std::unique_lock<std::mutex> lock( m_priv->m_incoming->m_lock );
+    std::shared_ptr<Message> message;
+
+    if( m_priv->m_incoming->m_messages.empty() ) {
+        m_priv->m_incoming->drain();
+        return message;
+    }
+
+    message = m_priv->m_incoming->m_messages.front();
+    m_priv->m_incoming->m_messages.pop();
+
+    if( m_priv->m_incoming->m_messages.empty() ) {
+        m_priv->m_incoming->drain();
+    }
+
+    return message;
+}
+
+bool LoopbackTransport::has_buffered_message() const {
+    std::unique_lock<std::mutex> lock( m_priv->m_incoming->m_lock );
+
+    return !m_priv->m_incoming->m_messages.empty();
+}
+
+bool LoopbackTransport::is_valid() const {
+    std::unique_lock<std::mutex> lock( m_priv->m_incoming->m_lock );
+
+    return !m_priv->m_incoming->m_closed;
+}
+
+int LoopbackTransport::fd() const {
+    return m_priv->m_incoming->m_wakeupFd[ 0 ];
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUS_CXX_LOOPBACKTRANSPORT_H
+#define DBUS_CXX_LOOPBACKTRANSPORT_H
+
+#include <dbus-cxx/dbus-cxx-config.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "transport.h"
+
+namespace DBus {
+
+class Message;
+
+namespace priv {
+
+class LoopbackQueue;
+
+/**
+ * One end of an in-process transport.  Messages written to one end are
+ * queued as Message objects for the other end to read; nothing is serialized.
+ * fd() becomes readable whenever there are messages waiting to be read, so
+ * that the connection can be driven by a normal Dispatcher.
+ */
+class LoopbackTransport : public Transport {
+private:
+    LoopbackTransport( std::shared_ptr<LoopbackQueue> incoming, std::shared_ptr<LoopbackQueue> outgoing );
+
+public:
+    ~LoopbackTransport();
+
+    /**
+     * Create both ends of a loopback.  If the transports are unable to be
+     * created, returns invalid shared_ptrs.
+     *
+     * @return
+     */
+    static std::pair<std::shared_ptr<LoopbackTransport>, std::shared_ptr<LoopbackTransport>> create_pair();
+
+    /**
+     * Hand a copy of the message to the other end, with the given serial.
+     * The body is copied as-is and any FDs are duplicated.
+     *
+     * @return The size of the message body, or -1 if the other end has gone away
+     */
+    ssize_t writeMessage( std::shared_ptr<const Message> message, uint32_t serial );
+
+    std::shared_ptr<Message> readMessage();
+
+    bool has_buffered_message() const;
+
+    /**
+     * The transport is valid until either end of it is destroyed.
+     */
+    bool is_valid() const;
+
+    int fd() const;
+
+private:
+    class priv_data;
+
+    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+};
+
+} /* namespace priv */
+
+} /* namespace DBus */
+
+#endif /* DBUS_CXX_LOOPBACKTRANSPORT_H */
@@ -26,233 +26,200 @@
 #include <dbus-cxx/path.h>
 #include <dbus-cxx/signature.h>
 #include <dbus-cxx/signatureiterator.h>
+#include "byteorder.h"
 
 using DBus::Marshaling;
 
-class Marshaling::priv_data {
-public:
-    priv_data() :
-        m_data( nullptr ),
-        m_endian( Endianess::Big ) {}
-
-    std::vector<uint8_t>* m_data;
-    Endianess m_endian;
-};
-
-Marshaling::Marshaling() {
-    m_priv = std::make_shared<priv_data>();
+Marshaling::Marshaling() :
+    m_data( nullptr ),
+    m_endian( HOST_ENDIANESS ) {
 }
 
-Marshaling::Marshaling( std::vector<uint8_t>* data, Endianess endian ) {
-    m_priv = std::make_shared<priv_data>();
-    m_priv->m_data = data;
-    m_priv->m_endian = endian;
+Marshaling::Marshaling( std::vector<uint8_t>* data, Endianess endian ) :
+    m_data( data ),
+    m_endian( endian ) {
 }
 
 Marshaling::~Marshaling() {
 }
 
+void Marshaling::reserve( size_t bytes ) {
+    m_data->reserve( m_data->size() + bytes );
+}
+
 void Marshaling::marshal( bool v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalIntBig( v );
-    } else {
-        marshalIntLittle( v );
-    }
+    marshalInt( v );
 }
 
 void Marshaling::marshal( uint8_t v ) {
-    m_priv->m_data->push_back( v );
+    m_data->push_back( v );
 }
 
 void Marshaling::marshal( int16_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalShortBig( v );
-    } else {
-        marshalShortLittle( v );
-    }
+    marshalShort( v );
 }
 
 void Marshaling::marshal( uint16_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalShortBig( v );
-    } else {
-        marshalShortLittle( v );
-    }
+    marshalShort( v );
 }
 
 void Marshaling::marshal( int32_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalIntBig( v );
-    } else {
-        marshalIntLittle( v );
-    }
+    marshalInt( v );
 }
 
 void Marshaling::marshal( uint32_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalIntBig( v );
-    } else {
-        marshalIntLittle( v );
-    }
+    marshalInt( v );
 }
 
 void Marshaling::marshal( int64_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalLongBig( v );
-    } else {
-        marshalLongLittle( v );
-    }
+    marshalLong( v );
 }
 
 void Marshaling::marshal( uint64_t v ) {
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalLongBig( v );
-    } else {
-        marshalLongLittle( v );
-    }
+    marshalLong( v );
 }
 
 void Marshaling::marshal( double v ) {
     uint64_t data;
     std::memcpy( &data, &v, sizeof( uint64_t ) );
 
-    if( m_priv->m_endian == Endianess::Big ) {
-        marshalLongBig( data );
-    } else {
-        marshalLongLittle( data );
-    }
+    marshalLong( data );
+}
+
+void Marshaling::marshal( const char* v ) {
+    marshal( std::string_view( v ) );
 }
 
-void Marshaling::marshal( std::string v ) {
+void Marshaling::marshal( std::string_view v ) {
     uint32_t len = v.size();
-    marshal( len );
 
-    for( const char& c : v ) {
-        m_priv->m_data->push_back( c );
+    if( m_endian != HOST_ENDIANESS ) {
+        len = __builtin_bswap32( len );
     }
 
-    m_priv->m_data->push_back( 0 );
+    // The length, the string and its nul terminator all go in at once
+    uint8_t* location = grow( 4, sizeof( len ) + v.size() + 1 );
+    std::memcpy( location, &len, sizeof( len ) );
+    std::memcpy( location + sizeof( len ), v.data(), v.size() );
+    location[ sizeof( len ) + v.size() ] = 0;
 }
 
-void Marshaling::marshal( Path v ) {
-    std::string data = std::string( v );
-    marshal( data );
+void Marshaling::marshal( const std::string& v ) {
+    marshal( std::string_view( v ) );
 }
 
-void Marshaling::marshal( Signature v ) {
-    std::string data = v.str();
-    m_priv->m_data->push_back( data.size() & 0xFF );
+void Marshaling::marshal( const Path& v ) {
+    marshal( std::string_view( v ) );
+}
 
-    for( const char& c : data ) {
-        m_priv->m_data->push_back( c );
-    }
+void Marshaling::marshal( const Signature& v ) {
+    const std::string& data = v.str();
+    uint8_t* location = grow( 1, data.size() + 2 );
 
-    m_priv->m_data->push_back( 0 );
+    location[ 0 ] = data.size() & 0xFF;
+    std::memcpy( location + 1, data.data(), data.size() );
+    location[ data.size() + 1 ] = 0;
 }
 
-void Marshaling::align( int alignment ) {
-    int bytesToAlign = alignment - ( m_priv->m_data->size() % alignment );
+void Marshaling::marshal_fixed_array( const void* data, uint32_t count, int elementSize ) {
+    uint8_t* location = grow( elementSize, static_cast<size_t>( count ) * elementSize );
 
-    if( bytesToAlign == alignment ) {
-        // already aligned!
-        return;
-    }
+    std::memcpy( location, data, static_cast<size_t>( count ) * elementSize );
 
-    for( int x = 0; x < bytesToAlign; x++ ) {
-        m_priv->m_data->push_back( 0 );
+    if( m_endian != HOST_ENDIANESS ) {
+        priv::swap_array( location, count, elementSize );
     }
 }
 
-void Marshaling::marshalShortBig( uint16_t toMarshal ) {
-    align( 2 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF00 ) >> 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF ) >> 0 );
+void Marshaling::align( int alignment ) {
+    grow( alignment, 0 );
 }
 
-void Marshaling::marshalIntBig( uint32_t toMarshal ) {
-    align( 4 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF000000 ) >> 24 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF0000 ) >> 16 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000FF00 ) >> 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000FF ) >> 0 );
+uint8_t* Marshaling::grow( int alignment, size_t size ) {
+    size_t start = m_data->size();
+    size_t padding = 0;
+
+    if( alignment > 1 ) {
+        padding = ( alignment - ( start % alignment ) ) % alignment;
+    }
+
+    // New bytes are zeroed, which takes care of the padding
+    m_data->resize( start + padding + size );
+
+    return m_data->data() + start + padding;
 }
 
-void Marshaling::marshalLongBig( uint64_t toMarshal ) {
-    align( 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF00000000000000 ) >> 56 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF000000000000 ) >> 48 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000FF0000000000 ) >> 40 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000FF00000000 ) >> 32 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00000000FF000000 ) >> 24 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000000000FF0000 ) >> 16 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000000000FF00 ) >> 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00000000000000FF ) >> 0 );
+void Marshaling::marshalShort( uint16_t toMarshal ) {
+    if( m_endian != HOST_ENDIANESS ) {
+        toMarshal = __builtin_bswap16( toMarshal );
+    }
+
+    marshalNative( &toMarshal, sizeof( toMarshal ) );
 }
 
-void Marshaling::marshalShortLittle( uint16_t toMarshal ) {
-    align( 2 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF ) >> 0 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF00 ) >> 8 );
+void Marshaling::marshalInt( uint32_t toMarshal ) {
+    if( m_endian != HOST_ENDIANESS ) {
+        toMarshal = __builtin_bswap32( toMarshal );
+    }
+
+    marshalNative( &toMarshal, sizeof( toMarshal ) );
 }
 
-void Marshaling::marshalIntLittle( uint32_t toMarshal ) {
-    align( 4 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000FF ) >> 0 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000FF00 ) >> 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF0000 ) >> 16 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF000000 ) >> 24 );
+void Marshaling::marshalLong( uint64_t toMarshal ) {
+    if( m_endian != HOST_ENDIANESS ) {
+        toMarshal = __builtin_bswap64( toMarshal );
+    }
+
+    marshalNative( &toMarshal, sizeof( toMarshal ) );
 }
 
-void Marshaling::marshalLongLittle( uint64_t toMarshal ) {
-    align( 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00000000000000FF ) >> 0 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000000000FF00 ) >> 8 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000000000FF0000 ) >> 16 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00000000FF000000 ) >> 24 );
-    m_priv->m_data->push_back( ( toMarshal & 0x000000FF00000000 ) >> 32 );
-    m_priv->m_data->push_back( ( toMarshal & 0x0000FF0000000000 ) >> 40 );
-    m_priv->m_data->push_back( ( toMarshal & 0x00FF000000000000 ) >> 48 );
-    m_priv->m_data->push_back( ( toMarshal & 0xFF00000000000000 ) >> 56 );
+void Marshaling::marshalNative( const void* toMarshal, int size ) {
+    std::memcpy( grow( size, size ), toMarshal, size );
 }
 
 void Marshaling::set_data( std::vector<uint8_t>* data ) {
-    m_priv->m_data = data;
+    m_data = data;
 }
 
 void Marshaling::set_endianess( Endianess endian ) {
-    m_priv->m_endian = endian;
+    m_endian = endian;
 }
 
 void Marshaling::marshal( const Variant& v ) {
-    Signature signature = v.signature();
+    const Signature& signature = v.signature();
     const std::vector<uint8_t>* data = v.marshaled();
 
-    m_priv->m_data->reserve( m_priv->m_data->size()
+    m_data->reserve( m_data->size()
         + signature.str().size()
         + data->size()
         + 12 /* Extra alignment bytes, if needed */ );
 
     marshal( signature );
 
-    for( const uint8_t& byte : *data ) {
-        m_priv->m_data->push_back( byte );
+    // Variants always hold their data in our byte order
+    uint8_t* location = grow( v.data_alignment(), data->size() );
+    std::memcpy( location, data->data(), data->size() );
+
+    if( m_endian != HOST_ENDIANESS ) {
+        priv::swap_byte_order( location, data->size(),
+            signature, HOST_ENDIANESS );
     }
 }
 
 void Marshaling::marshal_at_offset( uint32_t offset, uint32_t value ) {
-    if( m_priv->m_endian == Endianess::Little ) {
-        ( *m_priv->m_data )[offset++] = ( value & 0x000000FF ) >> 0;
-        ( *m_priv->m_data )[offset++] = ( value & 0x0000FF00 ) >> 8;
-        ( *m_priv->m_data )[offset++] = ( value & 0x00FF0000 ) >> 16;
-        ( *m_priv->m_data )[offset++] = ( value & 0xFF000000 ) >> 24;
-    } else {
-        ( *m_priv->m_data )[offset++] = ( value & 0xFF000000 ) >> 24;
-        ( *m_priv->m_data )[offset++] = ( value & 0x00FF0000 ) >> 16;
-        ( *m_priv->m_data )[offset++] = ( value & 0x0000FF00 ) >> 8;
-        ( *m_priv->m_data )[offset++] = ( value & 0x000000FF ) >> 0;
+    if( m_endian != HOST_ENDIANESS ) {
+        value = __builtin_bswap32( value );
     }
+
+    std::memcpy( m_data->data() + offset, &value, sizeof( value ) );
 }
 
 uint32_t Marshaling::currentOffset() const {
-    return m_priv->m_data->size();
+    return m_data->size();
+}
+
+size_t DBus::priv::marshaled_size( size_t offset, const Variant& v ) {
+    offset = marshaled_size( offset, v.signature() );
+
+    return marshaled_align( offset, v.data_alignment() ) + v.marshaled()->size();
 }
@@ -19,21 +19,32 @@
 #ifndef DBUSCXX_MARSHALING_H
 #define DBUSCXX_MARSHALING_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <vector>
 #include <dbus-cxx/path.h>
 #include <dbus-cxx/signature.h>
+#include <dbus-cxx/types.h>
 #include <dbus-cxx/enums.h>
 #include <dbus-cxx/dbus-cxx-config.h>
 
 namespace DBus {
 
+class FileDescriptor;
 class Variant;
 
 /**
  * Implements the marshaling algorithms on a given vector of data.
  *
  * Note that all marshal() methods will always append to the given buffer.
+ *
+ * This is a small value type: it only points at the buffer, so it may be
+ * created and copied freely.  Copies append to the same buffer.
  */
 class Marshaling {
 public:
@@ -56,6 +67,14 @@ public:
 
     void set_endianess( Endianess endian );
 
+    /**
+     * Make sure that the given number of bytes can be appended without the
+     * buffer growing again.
+     *
+     * @param bytes The number of bytes that are about to be marshaled
+     */
+    void reserve( size_t bytes );
+
     void marshal( bool v );
     void marshal( uint8_t v );
     void marshal( int16_t v );
@@ -65,11 +84,24 @@ public:
     void marshal( int64_t v );
     void marshal( uint64_t v );
     void marshal( double v );
-    void marshal( std::string v );
-    void marshal( Path v );
-    void marshal( Signature v );
+    void marshal( const char* v );
+    void marshal( std::string_view v );
+    void marshal( const std::string& v );
+    void marshal( const Path& v );
+    void marshal( const Signature& v );
     void marshal( const Variant& v );
 
+    /**
+     * Marshal the elements of an array of fixed-size values in one go.  The
+     * elements are in our byte order, and are swapped if needed.  The length
+     * of the array must already have been marshaled.
+     *
+     * @param data The first element
+     * @param count The number of elements
+     * @param elementSize The size of each element: 1, 2, 4 or 8
+     */
+    void marshal_fixed_array( const void* data, uint32_t count, int elementSize );
+
     void align( int alignment );
 
     /**
@@ -84,19 +116,112 @@ public:
     uint32_t currentOffset() const;
 
 private:
-    void marshalShortBig( uint16_t toMarshal );
-    void marshalIntBig( uint32_t toMarshal );
-    void marshalLongBig( uint64_t toMarshal );
-    void marshalShortLittle( uint16_t toMarshal );
-    void marshalIntLittle( uint32_t toMarshal );
-    void marshalLongLittle( uint64_t toMarshal );
+    /**
+     * Pad to the given alignment, then make room for size more bytes.
+     *
+     * @return Where the bytes go
+     */
+    uint8_t* grow( int alignment, size_t size );
+    void marshalShort( uint16_t toMarshal );
+    void marshalInt( uint32_t toMarshal );
+    void marshalLong( uint64_t toMarshal );
+    void marshalNative( const void* toMarshal, int size );
 
 private:
-    class priv_data;
-
-    std::shared_ptr<priv_data> m_priv;
+    std::vector<uint8_t>* m_data;
+    Endianess m_endian;
 };
 
+namespace priv {
+
+/*
+ * Computes the size of values once they are marshaled, so that a buffer
+ * can be reserved up front.  Each function takes the offset that the value
+ * starts at, since that decides the padding, and returns the offset just
+ * after it.
+ */
+
+inline size_t marshaled_align( size_t offset, size_t alignment ) {
+    return ( offset + alignment - 1 ) & ~( alignment - 1 );
+}
+
+/* Types that are not known here count for nothing; the buffer still grows as needed */
+template <typename T>
+size_t marshaled_size( size_t offset, const T& ) { return offset; }
+
+inline size_t marshaled_size( size_t offset, bool ) { return marshaled_align( offset, 4 ) + 4; }
+inline size_t marshaled_size( size_t offset, uint8_t ) { return offset + 1; }
+inline size_t marshaled_size( size_t offset, int16_t ) { return marshaled_align( offset, 2 ) + 2; }
+inline size_t marshaled_size( size_t offset, uint16_t ) { return marshaled_align( offset, 2 ) + 2; }
+inline size_t marshaled_size( size_t offset, int32_t ) { return marshaled_align( offset, 4 ) + 4; }
+inline size_t marshaled_size( size_t offset, uint32_t ) { return marshaled_align( offset, 4 ) + 4; }
+inline size_t marshaled_size( size_t offset, int64_t ) { return marshaled_align( offset, 8 ) + 8; }
+inline size_t marshaled_size( size_t offset, uint64_t ) { return marshaled_align( offset, 8 ) + 8; }
+inline size_t marshaled_size( size_t offset, double ) { return marshaled_align( offset, 8 ) + 8; }
+inline size_t marshaled_size( size_t offset, std::string_view v ) { return marshaled_align( offset, 4 ) + 4 + v.size() + 1; }
+inline size_t marshaled_size( size_t offset, const std::string& v ) { return marshaled_align( offset, 4 ) + 4 + v.size() + 1; }
+inline size_t marshaled_size( size_t offset, const char* v ) { return marshaled_size( offset, std::string_view( v ) ); }
+inline size_t marshaled_size( size_t offset, const Path& v ) { return marshaled_size( offset, static_cast<const std::string&>( v ) ); }
+inline size_t marshaled_size( size_t offset, const Signature& v ) { return offset + 1 + v.str().size() + 1; }
+inline size_t marshaled_size( size_t offset, const std::shared_ptr<FileDescriptor>& ) { return marshaled_align( offset, 4 ) + 4; }
+size_t marshaled_size( size_t offset, const Variant& v );
+
+template <typename T>
+size_t marshaled_size( size_t offset, const std::vector<T>& v );
+
+template <typename Key, typename Data>
+size_t marshaled_size( size_t offset, const std::map<Key, Data>& v );
+
+template <typename... T>
+size_t marshaled_size( size_t offset, const std::tuple<T...>& v );
+
+template <typename T>
+size_t marshaled_size( size_t offset, const std::vector<T>& v ) {
+    // The padding to the first element is at most 7 bytes, and it is
+    // there even when the array is empty
+    offset = marshaled_align( offset, 4 ) + 4;
+
+    if constexpr( is_fixed_array_type<T>::value ) {
+        return marshaled_align( offset, sizeof( T ) ) + v.size() * sizeof( T );
+    }
+
+    if( v.empty() ) {
+        return offset + 7;
+    }
+
+    for( const T& element : v ) {
+        offset = marshaled_size( offset, element );
+    }
+
+    return offset;
+}
+
+template <typename Key, typename Data>
+size_t marshaled_size( size_t offset, const std::map<Key, Data>& v ) {
+    offset = marshaled_align( marshaled_align( offset, 4 ) + 4, 8 );
+
+    for( const std::pair<const Key, Data>& entry : v ) {
+        offset = marshaled_align( offset, 8 );
+        offset = marshaled_size( offset, entry.first );
+        offset = marshaled_size( offset, entry.second );
+    }
+
+    return offset;
+}
+
+template <typename... T>
+size_t marshaled_size( size_t offset, const std::tuple<T...>& v ) {
+    offset = marshaled_align( offset, 8 );
+    std::apply( [&offset]( const auto& ...element ) {
+        ( ( offset = marshaled_size( offset, element ) ), ... );
+    },
+    v );
+
+    return offset;
+}
+
+} /* namespace priv */
+
 }
 
 #endif
@@ -26,39 +26,632 @@
 #include "variant.h"
 #include "marshaling.h"
 #include "demarshaling.h"
+#include "byteorder.h"
+#include "types.h"
 #include <dbus-cxx/dbus-cxx-private.h>
 #include <dbus-cxx/simplelogger.h>
 #include "validator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <mutex>
 #include <unistd.h>
 
 static const char* LOGGER_NAME = "DBus.Message";
 
 namespace DBus {
 
+/* One past the highest header field code */
+#define HEADER_FIELD_COUNT 10
+
+/* A pooled message gives up its body buffer if it has grown beyond this */
+#define MAX_POOLED_BODY_CAPACITY ( 64 * 1024 )
+
+/* Control blocks of pooled messages are allocated at this size */
+#define POOLED_CONTROL_BLOCK_SIZE 64
+
+/**
+ * The type code of the value of each header field, or 0 for fields that we
+ * do not know about.
+ */
+static char header_field_type( MessageHeaderFields field ) {
+    switch( field ) {
+    case MessageHeaderFields::Path:
+        return 'o';
+
+    case MessageHeaderFields::Interface:
+    case MessageHeaderFields::Member:
+    case MessageHeaderFields::Error_Name:
+    case MessageHeaderFields::Destination:
+    case MessageHeaderFields::Sender:
+        return 's';
+
+    case MessageHeaderFields::Reply_Serial:
+    case MessageHeaderFields::Unix_FDs:
+        return 'u';
+
+    case MessageHeaderFields::Signature:
+        return 'g';
+
+    default:
+        return 0;
+    }
+}
+
+static uint16_t header_field_bit( MessageHeaderFields field ) {
+    return 1 << header_field_to_int( field );
+}
+
+namespace {
+
+/**
+ * Reads the header fields of a received message straight out of the data
+ * that it was received into.  Every read is checked against the end of the
+ * header field array; nothing is decoded into a Variant or a Signature.
+ */
+class HeaderReader {
+public:
+    HeaderReader( const uint8_t* data, uint32_t pos, uint32_t end, Endianess endian ) :
+        m_data( data ),
+        m_pos( pos ),
+        m_end( end ),
+        m_endian( endian ) {}
+
+    bool at_end() const {
+        return m_pos >= m_end;
+    }
+
+    bool align( uint32_t alignment ) {
+        uint32_t padding = ( alignment - ( m_pos % alignment ) ) % alignment;
+
+        return skip( padding );
+    }
+
+    bool read_uint8( uint8_t* value ) {
+        if( m_pos >= m_end ) {
+            return false;
+        }
+
+        *value = m_data[ m_pos++ ];
+        return true;
+    }
+
+    bool read_uint32( uint32_t* value ) {
+        if( !align( 4 ) || m_end - m_pos < 4 ) {
+            return false;
+        }
+
+        const uint8_t* bytes = m_data + m_pos;
+
+        if( m_endian == Endianess::Little ) {
+            *value = static_cast<uint32_t>( bytes[ 0 ] ) |
+                static_cast<uint32_t>( bytes[ 1 ] ) << 8 |
+                static_cast<uint32_t>( bytes[ 2 ] ) << 16 |
+                static_cast<uint32_t>( bytes[ 3 ] ) << 24;
+        } else {
+            *value = static_cast<uint32_t>( bytes[ 0 ] ) << 24 |
+                static_cast<uint32_t>( bytes[ 1 ] ) << 16 |
+                static_cast<uint32_t>( bytes[ 2 ] ) << 8 |
+                static_cast<uint32_t>( bytes[ 3 ] );
+        }
+
+        m_pos += 4;
+        return true;
+    }
+
+    /**
+     * Read a string or an object path.  The text is left where it is; its
+     * offset in the data and its length are returned.
+     */
+    bool read_string( uint32_t* offset, uint32_t* len ) {
+        if( !read_uint32( len ) ) {
+            return false;
+        }
+
+        return read_text( *len, offset );
+    }
+
+    bool read_signature( uint32_t* offset, uint32_t* len ) {
+        uint8_t sigLen;
+
+        if( !read_uint8( &sigLen ) ) {
+            return false;
+        }
+
+        *len = sigLen;
+        return read_text( sigLen, offset );
+    }
+
+    /**
+     * Skip over a value of any type that we are not going to use.
+     */
+    bool skip_value( SignatureIterator type ) {
+        Demarshaling demarshal( m_data, m_end, m_endian );
+        demarshal.set_data_offset( m_pos );
+
+        if( !demarshal.skip( type ) ) {
+            return false;
+        }
+
+        m_pos = demarshal.current_offset();
+        return true;
+    }
+
+private:
+    bool skip( uint64_t bytes ) {
+        if( m_pos + bytes > m_end ) {
+            return false;
+        }
+
+        m_pos += bytes;
+        return true;
+    }
+
+    /* Text of the given length, and its nul terminator */
+    bool read_text( uint32_t len, uint32_t* offset ) {
+        *offset = m_pos;
+
+        if( !skip( static_cast<uint64_t>( len ) + 1 ) ) {
+            return false;
+        }
+
+        return m_data[ m_pos - 1 ] == 0;
+    }
+
+private:
+    const uint8_t* m_data;
+    uint32_t m_pos;
+    uint32_t m_end;
+    Endianess m_endian;
+};
+
+} /* anonymous namespace */
+
 class Message::priv_data {
 public:
     priv_data() :
         m_valid( true ),
-        m_endianess( Endianess::Big ),
+        m_endianess( HOST_ENDIANESS ),
         m_flags( 0 ),
-        m_serial( 0 )
+        m_serial( 0 ),
+        m_fieldsSet( 0 ),
+        m_replySerial( 0 ),
+        m_unixFds( 0 ),
+        m_lazyFields( 0 ),
+        m_signatureDirty( false ),
+        m_bodyStorageSize( 0 ),
+        m_bodyShared( false ),
+        m_bodyCopied( false ),
+        m_argOffsetsValid( false ),
+        m_argOffsetsBodySize( 0 )
     {}
 
+    uint8_t* body_data() const {
+        return m_bodyStorage ? m_bodyStorage.get() : m_body.data();
+    }
+
+    uint32_t body_size() const {
+        return m_bodyStorage ? m_bodyStorageSize : m_body.size();
+    }
+
+    /**
+     * Copy a body that is in shared storage into m_body, so that it can be
+     * changed or handed out as a vector.
+     */
+    void detach_body() const {
+        if( !m_bodyStorage ) {
+            return;
+        }
+
+        m_body.assign( m_bodyStorage.get(), m_bodyStorage.get() + m_bodyStorageSize );
+        m_bodyStorage.reset();
+        m_bodyStorageSize = 0;
+        m_bodyShared = false;
+        m_bodyCopied = false;
+    }
+
+    /**
+     * Put the message back the way that it was constructed, keeping the
+     * memory that its header strings and body have already allocated.
+     */
+    void reset() {
+        for( int fd : m_filedescriptors ) {
+            close( fd );
+        }
+
+        m_valid = true;
+        m_endianess = HOST_ENDIANESS;
+        m_flags = 0;
+        m_filedescriptors.clear();
+        m_serial = 0;
+        m_fieldsSet = 0;
+        m_path.clear();
+
+        for( std::string& str : m_strings ) {
+            str.clear();
+        }
+
+        m_replySerial = 0;
+        m_unixFds = 0;
+        m_signature = Signature();
+        m_lazyFields = 0;
+        m_headerStorage.reset();
+        m_signatureText.clear();
+        m_signatureDirty = false;
+
+        if( m_body.capacity() > MAX_POOLED_BODY_CAPACITY ) {
+            std::vector<uint8_t>().swap( m_body );
+        } else {
+            m_body.clear();
+        }
+
+        m_bodyStorage.reset();
+        m_bodyStorageSize = 0;
+        m_bodyShared = false;
+        m_bodyCopied = false;
+        m_argOffsetsValid = false;
+    }
+
+    bool has_field( MessageHeaderFields field ) const {
+        return m_fieldsSet & header_field_bit( field );
+    }
+
+    /**
+     * Decode a header field that was left in the data that the message was
+     * received into, if it has not been decoded yet.
+     */
+    void load_field( MessageHeaderFields field ) const {
+        if( !( m_lazyFields & header_field_bit( field ) ) ) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock( m_lazyLock );
+
+        // Another thread may have decoded it while we were waiting
+        if( !( m_lazyFields & header_field_bit( field ) ) ) {
+            return;
+        }
+
+        uint8_t code = header_field_to_int( field );
+        const char* text = reinterpret_cast<const char*>( m_headerStorage.get() ) + m_lazyOffset[ code ];
+
+        if( field == MessageHeaderFields::Signature ) {
+            m_signature = Signature( text, m_lazyLength[ code ] );
+        } else {
+            m_strings[ code ].assign( text, m_lazyLength[ code ] );
+        }
+
+        forget_field( field );
+    }
+
+    void load_all_fields() const {
+        for( uint8_t code = 1; code < HEADER_FIELD_COUNT && m_lazyFields; code++ ) {
+            load_field( int_to_header_field( code ) );
+        }
+    }
+
+    /**
+     * Stop tracking a field that has not been decoded, because it has been
+     * decoded or is being replaced.
+     */
+    void forget_field( MessageHeaderFields field ) const {
+        m_lazyFields &= ~header_field_bit( field );
+
+        if( m_lazyFields == 0 ) {
+            m_headerStorage.reset();
+        }
+    }
+
+    /**
+     * Put the body signature that has been appended into its header field,
+     * if it has changed since it was last put there.
+     */
+    void sync_signature() const {
+        if( !m_signatureDirty ) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock( m_lazyLock );
+
+        if( !m_signatureDirty ) {
+            return;
+        }
+
+        m_signature = Signature( m_signatureText );
+        m_fieldsSet |= header_field_bit( MessageHeaderFields::Signature );
+        forget_field( MessageHeaderFields::Signature );
+        m_signatureDirty = false;
+    }
+
+    /**
+     * The offset in the body of each argument, found by jumping over the
+     * values the first time that an argument is looked up by its position.
+     * Appending only ever makes the body bigger, so the offsets are good
+     * until the size of the body changes.
+     */
+    const std::vector<uint32_t>& arg_offsets( const Signature& sig ) const {
+        std::lock_guard<std::mutex> lock( m_lazyLock );
+
+        if( m_argOffsetsValid && m_argOffsetsBodySize == body_size() ) {
+            return m_argOffsets;
+        }
+
+        Demarshaling demarshal( body_data(), body_size(), m_endianess );
+
+        m_argOffsets.clear();
+
+        for( SignatureIterator it = sig.begin(); it.is_valid(); it.next() ) {
+            if( demarshal.current_offset() >= body_size() ) {
+                break;
+            }
+
+            m_argOffsets.push_back( demarshal.current_offset() );
+
+            if( !demarshal.skip( it ) ) {
+                // The body is cut short, so the later arguments are not there
+                break;
+            }
+        }
+
+        m_argOffsetsValid = true;
+        m_argOffsetsBodySize = body_size();
+
+        return m_argOffsets;
+    }
 
     bool m_valid;
-    std::map<MessageHeaderFields, Variant> m_headerMap;
-    std::vector<uint8_t> m_body;
     Endianess m_endianess;
     uint8_t m_flags;
     std::vector<int> m_filedescriptors;
     uint32_t m_serial;
+
+    /*
+     * The header fields, each stored as the type that it is marshaled as.
+     * There is a bit in m_fieldsSet for each field that the message has.
+     * The fields that are strings are in m_strings, by field code.
+     */
+    mutable std::atomic<uint16_t> m_fieldsSet;
+    Path m_path;
+    mutable std::string m_strings[ HEADER_FIELD_COUNT ];
+    uint32_t m_replySerial;
+    uint32_t m_unixFds;
+    mutable Signature m_signature;
+
+    /*
+     * The fields of a received message that are not needed to route it are
+     * only decoded when they are asked for.  Until then, there is a bit in
+     * m_lazyFields for each of them, and the offset and length of its text
+     * in m_headerStorage.
+     *
+     * A message is handed to several threads at once as a const message,
+     * so anything that a const method decodes or caches is done while
+     * holding m_lazyLock.
+     */
+    mutable std::atomic<uint16_t> m_lazyFields;
+    mutable std::mutex m_lazyLock;
+    mutable std::shared_ptr<uint8_t> m_headerStorage;
+    uint32_t m_lazyOffset[ HEADER_FIELD_COUNT ];
+    uint32_t m_lazyLength[ HEADER_FIELD_COUNT ];
+
+    /* The body signature while arguments are appended; see append_signature() */
+    std::string m_signatureText;
+    mutable std::atomic<bool> m_signatureDirty;
+
+    /* The body of a message that was created here, or that had to be copied */
+    mutable std::vector<uint8_t> m_body;
+    /*
+     * The body of a message that was received, in the storage that it was
+     * received into; m_body is not used while this is set.
+     */
+    mutable std::shared_ptr<uint8_t> m_bodyStorage;
+    mutable uint32_t m_bodyStorageSize;
+    /*
+     * Set when another message has been given m_bodyStorage as well, so that
+     * the storage must not be changed in place.
+     */
+    mutable std::atomic<bool> m_bodyShared;
+    /*
+     * Set when serialized_body() has copied m_bodyStorage into m_body.  The
+     * body is still read from m_bodyStorage, so that the const method does
+     * not move it out from under another thread.
+     */
+    mutable bool m_bodyCopied;
+
+    /* See arg_offsets() */
+    mutable std::vector<uint32_t> m_argOffsets;
+    mutable bool m_argOffsetsValid;
+    mutable uint32_t m_argOffsetsBodySize;
+};
+
+/* How many freed messages of each type each thread keeps */
+static std::atomic<uint32_t> pool_size( 0 );
+
+namespace {
+
+/**
+ * The freed messages that a thread keeps to hand out again, and the
+ * control blocks of their shared_ptrs.
+ */
+class MessagePool {
+public:
+    MessagePool() :
+        m_stats{ 0, 0, 0, 0 } {}
+
+    ~MessagePool();
+
+    /* Indexed by message type, less one */
+    std::vector<Message*> m_free[ 4 ];
+    std::vector<void*> m_controlBlocks;
+    MessagePoolStatistics m_stats;
+};
+
+thread_local bool pool_destroyed = false;
+
+/**
+ * The calling thread's pool, or null if the thread is exiting and its pool
+ * has already been destroyed.
+ */
+MessagePool* thread_pool() {
+    if( pool_destroyed ) {
+        return nullptr;
+    }
+
+    static thread_local MessagePool pool;
+
+    return &pool;
+}
+
+MessagePool::~MessagePool() {
+    pool_destroyed = true;
+
+    for( std::vector<Message*>& messages : m_free ) {
+        for( Message* msg : messages ) {
+            delete msg;
+        }
+    }
+
+    for( void* block : m_controlBlocks ) {
+        ::operator delete( block );
+    }
+}
+
+void* allocate_control_block( size_t bytes ) {
+    MessagePool* pool = thread_pool();
+
+    if( bytes > POOLED_CONTROL_BLOCK_SIZE ) {
+        return ::operator new( bytes );
+    }
+
+    if( pool && !pool->m_controlBlocks.empty() ) {
+        void* block = pool->m_controlBlocks.back();
+        pool->m_controlBlocks.pop_back();
+        return block;
+    }
+
+    return ::operator new( POOLED_CONTROL_BLOCK_SIZE );
+}
+
+void free_control_block( void* block, size_t bytes ) {
+    MessagePool* pool = thread_pool();
+
+    if( bytes <= POOLED_CONTROL_BLOCK_SIZE &&
+        pool &&
+        pool->m_controlBlocks.size() < pool_size.load( std::memory_order_relaxed ) * 4 ) {
+        try {
+            pool->m_controlBlocks.push_back( block );
+            return;
+        } catch( std::bad_alloc& ) {
+        }
+    }
+
+    ::operator delete( block );
+}
+
+/**
+ * Allocates the control blocks of pooled messages from the thread's pool.
+ */
+template <typename T>
+class ControlBlockAllocator {
+public:
+    typedef T value_type;
+
+    ControlBlockAllocator() {}
+
+    template <typename U>
+    ControlBlockAllocator( const ControlBlockAllocator<U>& ) {}
+
+    T* allocate( size_t count ) {
+        return static_cast<T*>( allocate_control_block( count * sizeof( T ) ) );
+    }
+
+    void deallocate( T* block, size_t count ) {
+        free_control_block( block, count * sizeof( T ) );
+    }
+
+    template <typename U>
+    bool operator==( const ControlBlockAllocator<U>& ) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=( const ControlBlockAllocator<U>& ) const {
+        return false;
+    }
 };
 
+} /* anonymous namespace */
+
 Message::Message() {
     m_priv = std::make_unique<priv_data>();
 }
 
+void Message::set_pool_size( uint32_t size ) {
+    pool_size.store( size, std::memory_order_relaxed );
+}
+
+MessagePoolStatistics Message::pool_statistics() {
+    MessagePool* pool = thread_pool();
+    MessagePoolStatistics stats = { 0, 0, 0, 0 };
+
+    if( pool ) {
+        stats = pool->m_stats;
+        stats.pooled = 0;
+
+        for( const std::vector<Message*>& messages : pool->m_free ) {
+            stats.pooled += messages.size();
+        }
+    }
+
+    return stats;
+}
+
+Message* Message::take_from_pool( MessageType type ) {
+    MessagePool* pool = thread_pool();
+    int index = static_cast<int>( type ) - 1;
+
+    if( !pool || index < 0 || index >= 4 ) {
+        return nullptr;
+    }
+
+    if( pool->m_free[ index ].empty() ) {
+        pool->m_stats.allocated++;
+        return nullptr;
+    }
+
+    Message* msg = pool->m_free[ index ].back();
+    pool->m_free[ index ].pop_back();
+    pool->m_stats.reused++;
+
+    return msg;
+}
+
+std::shared_ptr<Message> Message::manage_pooled( Message* msg ) {
+    return std::shared_ptr<Message>( msg, &Message::return_to_pool, ControlBlockAllocator<Message>() );
+}
+
+void Message::return_to_pool( Message* msg ) {
+    MessagePool* pool = thread_pool();
+    int index = static_cast<int>( msg->type() ) - 1;
+
+    if( !pool ||
+        index < 0 ||
+        index >= 4 ||
+        pool->m_free[ index ].size() >= pool_size.load( std::memory_order_relaxed ) ) {
+        delete msg;
+        return;
+    }
+
+    msg->m_priv->reset();
+
+    try {
+        pool->m_free[ index ].push_back( msg );
+        pool->m_stats.recycled++;
+    } catch( std::bad_alloc& ) {
+        delete msg;
+    }
+}
+
 Message::~Message() {
     for( int i : m_priv->m_filedescriptors ) {
         close( i );
@@ -73,22 +666,30 @@ bool Message::operator == ( const Message& other ) {
     }
 
     // Next, let's check the headers, since those will likely not be the same if the messages are different
+    m_priv->sync_signature();
+    other.m_priv->sync_signature();
+    m_priv->load_all_fields();
+    other.m_priv->load_all_fields();
+
     bool headersEqual =
-        header_field( MessageHeaderFields::Path ) == other.header_field( MessageHeaderFields::Path ) &&
-        header_field( MessageHeaderFields::Member ) == other.header_field( MessageHeaderFields::Member ) &&
-        header_field( MessageHeaderFields::Sender ) == other.header_field( MessageHeaderFields::Sender ) &&
-        header_field( MessageHeaderFields::Unix_FDs ) == other.header_field( MessageHeaderFields::Unix_FDs ) &&
-        header_field( MessageHeaderFields::Interface ) == other.header_field( MessageHeaderFields::Interface ) &&
-        header_field( MessageHeaderFields::Signature ) == other.header_field( MessageHeaderFields::Signature ) &&
-        header_field( MessageHeaderFields::Error_Name ) == other.header_field( MessageHeaderFields::Error_Name ) &&
-        header_field( MessageHeaderFields::Destination ) == other.header_field( MessageHeaderFields::Destination ) &&
-        header_field( MessageHeaderFields::Reply_Serial ) == other.header_field( MessageHeaderFields::Reply_Serial );
+        m_priv->m_fieldsSet == other.m_priv->m_fieldsSet &&
+        m_priv->m_path == other.m_priv->m_path &&
+        m_priv->m_replySerial == other.m_priv->m_replySerial &&
+        m_priv->m_unixFds == other.m_priv->m_unixFds &&
+        m_priv->m_signature.str() == other.m_priv->m_signature.str();
+
+    for( int x = 0; x < HEADER_FIELD_COUNT && headersEqual; x++ ) {
+        headersEqual = m_priv->m_strings[ x ] == other.m_priv->m_strings[ x ];
+    }
 
     bool dataEqual = false;
 
     if( headersEqual ) {
         // Okay, all of the headers are equal at this point, now we can check the raw data
-        dataEqual = m_priv->m_body == other.m_priv->m_body;
+        dataEqual = m_priv->body_size() == other.m_priv->body_size() &&
+            std::equal( m_priv->body_data(),
+                m_priv->body_data() + m_priv->body_size(),
+                other.m_priv->body_data() );
     }
 
     return  headersEqual && dataEqual;
@@ -112,11 +713,66 @@ uint32_t Message::serial() const {
     return m_priv->m_serial;
 }
 
-//   Message Message::copy()
-//   {
-// TODO fix
-//     return Message( *this, CreateMethod::COPY );
-//   }
+std::shared_ptr<Message> Message::copy() const {
+    std::shared_ptr<Message> retmsg;
+
+    switch( type() ) {
+    case MessageType::CALL:
+        retmsg = CallMessage::create();
+        break;
+
+    case MessageType::RETURN:
+        retmsg = ReturnMessage::create();
+        break;
+
+    case MessageType::ERROR:
+        retmsg = ErrorMessage::create();
+        break;
+
+    case MessageType::SIGNAL:
+        retmsg = SignalMessage::create();
+        break;
+
+    default:
+        return retmsg;
+    }
+
+    for( int fd : m_priv->m_filedescriptors ) {
+        int new_fd = fcntl( fd, F_DUPFD_CLOEXEC, 3 );
+
+        if( new_fd < 0 ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to duplicate fd for message copy" );
+            return std::shared_ptr<Message>();
+        }
+
+        retmsg->m_priv->m_filedescriptors.push_back( new_fd );
+    }
+
+    retmsg->m_priv->m_serial = m_priv->m_serial;
+    retmsg->m_priv->m_flags = m_priv->m_flags;
+    retmsg->m_priv->m_valid = m_priv->m_valid;
+    m_priv->sync_signature();
+    m_priv->load_all_fields();
+    retmsg->m_priv->m_fieldsSet = m_priv->m_fieldsSet.load();
+    retmsg->m_priv->m_path = m_priv->m_path;
+    std::copy( std::begin( m_priv->m_strings ), std::end( m_priv->m_strings ), std::begin( retmsg->m_priv->m_strings ) );
+    retmsg->m_priv->m_replySerial = m_priv->m_replySerial;
+    retmsg->m_priv->m_unixFds = m_priv->m_unixFds;
+    retmsg->m_priv->m_signature = m_priv->m_signature;
+    retmsg->m_priv->m_endianess = m_priv->m_endianess;
+
+    if( m_priv->m_bodyStorage ) {
+        // Both messages read the body from the same storage from now on
+        m_priv->m_bodyShared = true;
+        retmsg->m_priv->m_bodyStorage = m_priv->m_bodyStorage;
+        retmsg->m_priv->m_bodyStorageSize = m_priv->m_bodyStorageSize;
+        retmsg->m_priv->m_bodyShared = true;
+    } else {
+        retmsg->m_priv->m_body = m_priv->m_body;
+    }
+
+    return retmsg;
+}
 
 void Message::set_auto_start( bool auto_start ) {
     if( auto_start ) {
@@ -133,35 +789,98 @@ bool Message::auto_start() {
 bool Message::set_destination( const std::string& s ) {
     if( Validator::validate_bus_name( s ) == false ) { return false; }
 
-    m_priv->m_headerMap[ MessageHeaderFields::Destination ] = DBus::Variant( s );
+    set_header_string( MessageHeaderFields::Destination, s );
     return true;
 }
 
-std::string Message::destination() const {
-    Variant destination = header_field( MessageHeaderFields::Destination );
+const std::string& Message::destination() const {
+    return header_string( MessageHeaderFields::Destination );
+}
 
-    if( destination.type() == DataType::STRING ) {
-        return destination.to_string();
-    }
+const std::string& Message::sender() const {
+    return header_string( MessageHeaderFields::Sender );
+}
 
-    return "";
+MessageIterator Message::begin() const {
+    return MessageIterator( *this );
 }
 
-std::string Message::sender() const {
-    Variant sender = header_field( MessageHeaderFields::Sender );
+MessageIterator Message::end() const {
+    return MessageIterator();
+}
+
+MessageIterator Message::arg( uint32_t index ) const {
+    const std::vector<uint32_t>& offsets = m_priv->arg_offsets( signature() );
 
-    if( sender.type() == DataType::STRING ) {
-        return sender.to_string();
+    if( index >= offsets.size() ) {
+        return MessageIterator();
     }
 
-    return "";
-}
+    SignatureIterator sig = signature().begin();
 
-MessageIterator Message::begin() const {
-    return MessageIterator( *this );
+    for( uint32_t i = 0; i < index; i++ ) {
+        sig.next();
+    }
+
+    return MessageIterator( this, sig, offsets[ index ] );
 }
 
-MessageIterator Message::end() const {
+MessageIterator Message::find( const std::string& signature, const std::string& key ) const {
+    const std::vector<uint32_t>& offsets = m_priv->arg_offsets( this->signature() );
+    SignatureIterator sig = this->signature().begin();
+
+    for( uint32_t i = 0; i < offsets.size(); i++, sig.next() ) {
+        if( !sig.is_dict() || sig.type_signature() != signature ) {
+            continue;
+        }
+
+        SignatureIterator keyType = sig.recurse().recurse();
+        SignatureIterator valueType = keyType;
+        valueType.next();
+
+        if( keyType.type() != DataType::STRING &&
+            keyType.type() != DataType::OBJECT_PATH ) {
+            continue;
+        }
+
+        Demarshaling demarshal( m_priv->body_data(), m_priv->body_size(), m_priv->m_endianess );
+        demarshal.set_data_offset( offsets[ i ] );
+
+        // The length does not include the padding before the first entry
+        demarshal.align( 4 );
+
+        if( demarshal.current_offset() + static_cast<uint64_t>( 4 ) > m_priv->body_size() ) {
+            continue;
+        }
+
+        uint32_t dictLength = demarshal.demarshal_uint32_t();
+        demarshal.align( 8 );
+        uint64_t dictEnd = static_cast<uint64_t>( demarshal.current_offset() ) + dictLength;
+
+        if( dictEnd > m_priv->body_size() ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Dictionary runs past the end of the body" );
+            continue;
+        }
+
+        while( demarshal.current_offset() < dictEnd ) {
+            std::string_view entryKey;
+
+            demarshal.align( 8 );
+
+            if( !demarshal.demarshal_string_view( &entryKey ) ) {
+                break;
+            }
+
+            if( entryKey == key ) {
+                return MessageIterator( this, valueType, demarshal.current_offset() );
+            }
+
+            if( !demarshal.skip( valueType ) ) {
+                break;
+            }
+        }
+    }
+
     return MessageIterator();
 }
 
@@ -169,23 +888,42 @@ MessageAppendIterator Message::append() {
     return MessageAppendIterator( *this );
 }
 
-Signature Message::signature() const {
-    Variant v = header_field( MessageHeaderFields::Signature );
+const Signature& Message::signature() const {
+    m_priv->sync_signature();
+    m_priv->load_field( MessageHeaderFields::Signature );
+
+    return m_priv->m_signature;
+}
+
+bool Message::serialize_to_vector( std::vector<uint8_t>* vec, uint32_t serial ) const {
+    vec->reserve( vec->size() + m_priv->body_size() + 256 );
 
-    if( v.type() == DataType::SIGNATURE ) {
-        return v.to_signature();
+    if( !serialize_header_to_vector( vec, serial ) ) {
+        return false;
     }
 
-    return Signature();
+    vec->insert( vec->end(), m_priv->body_data(), m_priv->body_data() + m_priv->body_size() );
+
+    return true;
 }
 
-bool Message::serialize_to_vector( std::vector<uint8_t>* vec, uint32_t serial ) const {
-    Marshaling marshal( vec, Endianess::Big );
-    Variant serialHeader = header_field( MessageHeaderFields::Reply_Serial );
+bool Message::serialize_header_to_vector( std::vector<uint8_t>* vec, uint32_t serial ) const {
+    Marshaling marshal( vec, m_priv->m_endianess );
     bool mustHaveSerial = false;
 
-    vec->reserve( vec->size() + m_priv->m_body.size() + 256 );
-    marshal.marshal( static_cast<uint8_t>( 'B' ) );
+    // This also puts the appended signature into the header map
+    if( !signature().is_valid() && m_priv->body_size() != 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to serialize message: the body signature is not valid" );
+        return false;
+    }
+
+    m_priv->load_all_fields();
+
+    if( m_priv->m_endianess == Endianess::Little ) {
+        marshal.marshal( static_cast<uint8_t>( 'l' ) );
+    } else {
+        marshal.marshal( static_cast<uint8_t>( 'B' ) );
+    }
 
     switch( type() ) {
     case MessageType::INVALID:
@@ -217,14 +955,12 @@ bool Message::serialize_to_vector( std::vector<uint8_t>* vec, uint32_t serial )
     marshal.marshal( static_cast<uint8_t>( 1 ) );
 
     // Marshal the length
-    marshal.marshal( static_cast<uint32_t>( m_priv->m_body.size() ) );
+    marshal.marshal( m_priv->body_size() );
 
     if( mustHaveSerial ) {
         // Make sure that we have a header for our serial and it is not 0
-        if( serialHeader.type() == DataType::UINT32 ) {
-            uint32_t tmpSerial = serialHeader.to_uint32();
-
-            if( tmpSerial == 0 ) {
+        if( m_priv->has_field( MessageHeaderFields::Reply_Serial ) ) {
+            if( m_priv->m_replySerial == 0 ) {
                 SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to serialize message: invalid return serial provided!" );
                 return false;
             }
@@ -239,89 +975,112 @@ bool Message::serialize_to_vector( std::vector<uint8_t>* vec, uint32_t serial )
     // Marshal our header array
     marshal.marshal( static_cast<uint32_t>( 0 ) ); // The size of the header array; we update this later
 
-    for( const std::pair<const MessageHeaderFields, Variant>& entry : m_priv->m_headerMap ) {
-        if( entry.second.type() == DataType::INVALID ) { continue; }
+    for( uint8_t code = 1; code < HEADER_FIELD_COUNT; code++ ) {
+        MessageHeaderFields field = int_to_header_field( code );
+        char type = header_field_type( field );
+
+        if( !m_priv->has_field( field ) ) { continue; }
 
+        // Each field is a struct of the code and a variant
         marshal.align( 8 );
-        marshal.marshal( header_field_to_int( entry.first ) );
-        marshal.marshal( entry.second );
+        marshal.marshal( code );
+        marshal.marshal( static_cast<uint8_t>( 1 ) );
+        marshal.marshal( static_cast<uint8_t>( type ) );
+        marshal.marshal( static_cast<uint8_t>( 0 ) );
+
+        switch( field ) {
+        case MessageHeaderFields::Path:
+            marshal.marshal( m_priv->m_path );
+            break;
+
+        case MessageHeaderFields::Reply_Serial:
+            marshal.marshal( m_priv->m_replySerial );
+            break;
+
+        case MessageHeaderFields::Unix_FDs:
+            marshal.marshal( m_priv->m_unixFds );
+            break;
+
+        case MessageHeaderFields::Signature:
+            marshal.marshal( m_priv->m_signature );
+            break;
+
+        default:
+            marshal.marshal( m_priv->m_strings[ code ] );
+            break;
+        }
     }
 
     // The size of the header array is always at offset 12
     marshal.marshal_at_offset( 12, static_cast<uint32_t>( vec->size() ) - 16 );
 
-    // Align the message data to an 8-byte boundary and add the data!
+    // Align the message data to an 8-byte boundary; the body goes right after this
     marshal.align( 8 );
 
-    for( const uint8_t& byte : m_priv->m_body ) {
-        vec->push_back( byte );
-    }
-
-    if( !Validator::message_is_small_enough( vec ) ) {
+    if( static_cast<uint64_t>( vec->size() ) + m_priv->body_size() >= Validator::maximum_message_size() ) {
         return false;
     }
 
     return true;
 }
 
+const std::vector<uint8_t>& Message::serialized_body() const {
+    if( !m_priv->m_bodyStorage ) {
+        return m_priv->m_body;
+    }
+
+    std::lock_guard<std::mutex> lock( m_priv->m_lazyLock );
+
+    if( !m_priv->m_bodyCopied ) {
+        m_priv->m_body.assign( m_priv->m_bodyStorage.get(),
+            m_priv->m_bodyStorage.get() + m_priv->m_bodyStorageSize );
+        m_priv->m_bodyCopied = true;
+    }
+
+    return m_priv->m_body;
+}
+
 std::shared_ptr<Message> Message::create_from_data( uint8_t* data, uint32_t data_len, std::vector<int> fds ) {
-    Demarshaling demarshal( data, data_len, Endianess::Big );
+    return create_from_bytes( data, data_len, std::move( fds ), std::shared_ptr<uint8_t>() );
+}
+
+std::shared_ptr<Message> Message::create_from_data( std::shared_ptr<uint8_t> data, uint32_t data_len, std::vector<int> fds ) {
+    uint8_t* bytes = data.get();
+
+    return create_from_bytes( bytes, data_len, std::move( fds ), std::move( data ) );
+}
+
+std::shared_ptr<Message> Message::create_from_bytes( const uint8_t* data, uint32_t data_len, std::vector<int> fds, std::shared_ptr<uint8_t> storage ) {
     uint8_t method_type;
     uint8_t flags;
-    uint8_t protoVersion;
     uint32_t bodyLen;
     uint32_t serial;
     uint32_t arrayLen;
     std::shared_ptr<Message> retmsg;
-    std::map<MessageHeaderFields, Variant> headerMap;
     Endianess msgEndian = Endianess::Big;
-    std::vector<int> real_fds;
 
-    if( demarshal.demarshal_uint8_t() == 'l' ) {
-        demarshal.set_endianess( Endianess::Little );
-        msgEndian = Endianess::Little;
+    if( data_len < 16 ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Message is only " << data_len << " bytes long" );
+        return retmsg;
     }
 
-    method_type = demarshal.demarshal_uint8_t();
-    flags = demarshal.demarshal_uint8_t();
-    protoVersion = demarshal.demarshal_uint8_t();
-    bodyLen = demarshal.demarshal_uint32_t();
-    serial = demarshal.demarshal_uint32_t();
-    arrayLen = demarshal.demarshal_uint32_t();
-
-    while( demarshal.current_offset() < ( 12 + arrayLen ) ) {
-        uint8_t key_demarshal;
-        MessageHeaderFields key;
-        Variant value;
-        demarshal.align( 8 );
-        key_demarshal = demarshal.demarshal_uint8_t();
-        value = demarshal.demarshal_variant();
-
-        key = int_to_header_field( key_demarshal );
-
-        if( key == MessageHeaderFields::Invalid ) {
-            std::ostringstream logmsg;
-            logmsg << "Found invalid header field "
-                << static_cast<int>( key )
-                << " when parsing; ignoring.  Value: "
-                << value;
-            SIMPLELOGGER_WARN( LOGGER_NAME, logmsg.str() );
-            continue;
-        }
-
-        if( key == MessageHeaderFields::Unix_FDs ) {
-            int total_fds = value.to_uint32();
-
-            for( int fd_num = 0; fd_num < total_fds; fd_num++ ) {
-                real_fds.push_back( fds[ fd_num ] );
-            }
-        }
-
-        headerMap[ key ] = value;
+    if( data[ 0 ] == 'l' ) {
+        msgEndian = Endianess::Little;
     }
 
-    // Make sure we're aligned to an 8-byte boundary
-    demarshal.align( 8 );
+    // The fixed part of the header: endianess, type, flags, version, then three uint32s
+    HeaderReader fixedHeader( data, 4, 16, msgEndian );
+    method_type = data[ 1 ];
+    flags = data[ 2 ];
+    fixedHeader.read_uint32( &bodyLen );
+    fixedHeader.read_uint32( &serial );
+    fixedHeader.read_uint32( &arrayLen );
+
+    if( static_cast<uint64_t>( arrayLen ) + 16 > data_len ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Message header fields are " << arrayLen
+            << " bytes, but only " << data_len - 16 << " bytes are left" );
+        return retmsg;
+    }
 
     switch( method_type ) {
     case 1:
@@ -343,23 +1102,156 @@ std::shared_ptr<Message> Message::create_from_data( uint8_t* data, uint32_t data
         SIMPLELOGGER_TRACE( LOGGER_NAME, "Creating SignalMessage from data" );
         retmsg = SignalMessage::create();
         break;
+
+    default:
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Unknown message type " << static_cast<int>( method_type ) );
+        return retmsg;
     }
 
-    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Message has " << real_fds.size() << " fds" );
+    priv_data* msgPriv = retmsg->m_priv.get();
+    HeaderReader reader( data, 16, 16 + arrayLen, msgEndian );
+
+    /*
+     * Only the fields that are needed to route the message are decoded here.
+     * The text of the others is only found, and is decoded when it is asked
+     * for; that needs the data to stay around, so it is only done when the
+     * message is given shared storage.
+     */
+    while( !reader.at_end() ) {
+        uint8_t code;
+        uint32_t sigOffset;
+        uint32_t sigLen;
+        uint32_t offset;
+        uint32_t len;
+
+        // Each field is a struct of the code and a variant
+        if( !reader.align( 8 ) ||
+            !reader.read_uint8( &code ) ||
+            !reader.read_signature( &sigOffset, &sigLen ) ) {
+            SIMPLELOGGER_WARN( LOGGER_NAME, "Unable to parse message header fields" );
+            return std::shared_ptr<Message>();
+        }
+
+        MessageHeaderFields key = int_to_header_field( code );
+        char type = sigLen == 1 ? static_cast<char>( data[ sigOffset ] ) : '\0';
+
+        if( key == MessageHeaderFields::Invalid ||
+            type != header_field_type( key ) ) {
+            // Fields that we do not know about must be accepted and ignored,
+            // whatever type they are
+            Signature fieldSignature( reinterpret_cast<const char*>( data ) + sigOffset, sigLen );
+
+            SIMPLELOGGER_WARN( LOGGER_NAME, "Found invalid header field "
+                << static_cast<int>( code )
+                << " of type " << fieldSignature
+                << " when parsing; ignoring." );
+
+            if( !fieldSignature.is_singleton() ||
+                !reader.skip_value( fieldSignature.begin() ) ) {
+                SIMPLELOGGER_WARN( LOGGER_NAME, "Unable to skip over header field " << static_cast<int>( code ) );
+                return std::shared_ptr<Message>();
+            }
+
+            continue;
+        }
+
+        bool fieldRead = false;
+
+        switch( key ) {
+        case MessageHeaderFields::Reply_Serial:
+            fieldRead = reader.read_uint32( &msgPriv->m_replySerial );
+            break;
+
+        case MessageHeaderFields::Unix_FDs:
+            fieldRead = reader.read_uint32( &msgPriv->m_unixFds );
+            break;
+
+        case MessageHeaderFields::Signature:
+            fieldRead = reader.read_signature( &offset, &len );
+            break;
+
+        default:
+            fieldRead = reader.read_string( &offset, &len );
+            break;
+        }
+
+        if( !fieldRead ) {
+            SIMPLELOGGER_WARN( LOGGER_NAME, "Header field " << static_cast<int>( code ) << " runs past the header" );
+            return std::shared_ptr<Message>();
+        }
+
+        msgPriv->m_fieldsSet |= header_field_bit( key );
+
+        const char* text = reinterpret_cast<const char*>( data ) + offset;
+
+        switch( key ) {
+        case MessageHeaderFields::Reply_Serial:
+        case MessageHeaderFields::Unix_FDs:
+            break;
+
+        case MessageHeaderFields::Path:
+            msgPriv->m_path.assign( text, len );
+            break;
+
+        case MessageHeaderFields::Interface:
+        case MessageHeaderFields::Member:
+        case MessageHeaderFields::Sender:
+            msgPriv->m_strings[ code ].assign( text, len );
+            break;
+
+        default:
+            if( storage ) {
+                msgPriv->m_lazyFields |= header_field_bit( key );
+                msgPriv->m_lazyOffset[ code ] = offset;
+                msgPriv->m_lazyLength[ code ] = len;
+            } else if( key == MessageHeaderFields::Signature ) {
+                msgPriv->m_signature = Signature( text, len );
+            } else {
+                msgPriv->m_strings[ code ].assign( text, len );
+            }
+
+            break;
+        }
+    }
+
+    if( msgPriv->m_lazyFields ) {
+        msgPriv->m_headerStorage = storage;
+    }
+
+    if( msgPriv->m_unixFds > fds.size() ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Message claims to have " << msgPriv->m_unixFds
+            << " fds, but only " << fds.size() << " were received" );
+    } else {
+        fds.resize( msgPriv->m_unixFds );
+    }
+
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Message has " << fds.size() << " fds" );
 
     retmsg->m_priv->m_serial = serial;
     retmsg->m_priv->m_flags = flags;
     retmsg->m_priv->m_valid = true;
-    retmsg->m_priv->m_headerMap = headerMap;
     retmsg->m_priv->m_endianess = msgEndian;
-    retmsg->m_priv->m_body.reserve( bodyLen );
-    retmsg->m_priv->m_filedescriptors = real_fds;
+    retmsg->m_priv->m_filedescriptors = std::move( fds );
+
+    // The body starts at the next 8-byte boundary after the header
+    uint32_t bodyOffset = ( 16 + arrayLen + 7 ) & ~static_cast<uint32_t>( 7 );
 
-    for( uint32_t x = 0; x < bodyLen; x++ ) {
-        retmsg->m_priv->m_body.push_back( demarshal.demarshal_uint8_t() );
+    if( static_cast<uint64_t>( bodyOffset ) + bodyLen > data_len ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Message body is " << bodyLen
+            << " bytes, but only " << data_len - std::min( bodyOffset, data_len ) << " bytes are left" );
+        return std::shared_ptr<Message>();
     }
 
-    {
+    if( storage ) {
+        // Read the body from where it was received into
+        retmsg->m_priv->m_bodyStorage = std::shared_ptr<uint8_t>( storage, storage.get() + bodyOffset );
+        retmsg->m_priv->m_bodyStorageSize = bodyLen;
+    } else {
+        retmsg->m_priv->m_body.assign( data + bodyOffset, data + bodyOffset + bodyLen );
+    }
+
+    if( dbuscxx_log_function ) {
+        // Printing the message decodes all of its header fields, so only do it if it goes somewhere
         std::ostringstream debug_str;
         debug_str << "Following message created from the data: " << retmsg;
         SIMPLELOGGER_TRACE( LOGGER_NAME, debug_str.str() );
@@ -368,39 +1260,57 @@ std::shared_ptr<Message> Message::create_from_data( uint8_t* data, uint32_t data
     return retmsg;
 }
 
-void Message::append_signature( std::string toappend ) {
-    DBus::Variant val = m_priv->m_headerMap[ MessageHeaderFields::Signature ];
-    std::string newval;
-
-    if( val.type() != DataType::INVALID ) {
-        Signature sig = val.to_signature();
-        newval += sig.str();
+void Message::append_signature( std::string_view toappend ) {
+    if( !m_priv->m_signatureDirty ) {
+        // Carry on from whatever is in the header now
+        m_priv->m_signatureText = signature().str();
+        m_priv->m_signatureDirty = true;
     }
 
-    newval += toappend;
-    m_priv->m_headerMap[ MessageHeaderFields::Signature ] = DBus::Variant( Signature( newval ) );
+    m_priv->m_signatureText.append( toappend );
 }
 
 Variant Message::header_field( MessageHeaderFields field ) const {
-    std::map<MessageHeaderFields, Variant>::const_iterator location =
-        m_priv->m_headerMap.find( field );
+    if( field == MessageHeaderFields::Signature ) {
+        m_priv->sync_signature();
+    }
 
-    if( location != m_priv->m_headerMap.end() ) {
-        return location->second;
+    if( !m_priv->has_field( field ) ) {
+        return DBus::Variant();
     }
 
-    return DBus::Variant();
-}
+    m_priv->load_field( field );
 
-void Message::clear_sig_and_data() {
-    std::map<MessageHeaderFields, Variant>::const_iterator location =
-        m_priv->m_headerMap.find( MessageHeaderFields::Signature );
+    switch( field ) {
+    case MessageHeaderFields::Path:
+        return DBus::Variant( m_priv->m_path );
 
-    if( location != m_priv->m_headerMap.end() ) {
-        m_priv->m_headerMap.erase( location );
+    case MessageHeaderFields::Reply_Serial:
+        return DBus::Variant( m_priv->m_replySerial );
+
+    case MessageHeaderFields::Unix_FDs:
+        return DBus::Variant( m_priv->m_unixFds );
+
+    case MessageHeaderFields::Signature:
+        return DBus::Variant( m_priv->m_signature );
+
+    default:
+        return DBus::Variant( m_priv->m_strings[ header_field_to_int( field ) ] );
     }
+}
 
+void Message::clear_sig_and_data() {
+    m_priv->m_fieldsSet &= ~header_field_bit( MessageHeaderFields::Signature );
+    m_priv->forget_field( MessageHeaderFields::Signature );
+    m_priv->m_signature = Signature();
+    m_priv->m_signatureText.clear();
+    m_priv->m_signatureDirty = false;
     m_priv->m_body.clear();
+    m_priv->m_bodyStorage.reset();
+    m_priv->m_bodyShared = false;
+    m_priv->m_bodyStorageSize = 0;
+    m_priv->m_bodyCopied = false;
+    m_priv->m_argOffsetsValid = false;
 }
 
 uint8_t Message::flags() const {
@@ -413,25 +1323,150 @@ void Message::set_flags( uint8_t flags ) {
 
 Variant Message::set_header_field( MessageHeaderFields field, Variant value ) {
     DBus::Variant retval = header_field( field );
+    char type = header_field_type( field );
+
+    if( field == MessageHeaderFields::Signature ) {
+        // This replaces anything that has been appended
+        m_priv->m_signatureDirty = false;
+    }
+
+    if( value.type() == DataType::INVALID ) {
+        m_priv->m_fieldsSet &= ~header_field_bit( field );
+        m_priv->m_strings[ header_field_to_int( field ) ].clear();
+
+        switch( field ) {
+        case MessageHeaderFields::Path:
+            m_priv->m_path.clear();
+            break;
+
+        case MessageHeaderFields::Reply_Serial:
+            m_priv->m_replySerial = 0;
+            break;
+
+        case MessageHeaderFields::Unix_FDs:
+            m_priv->m_unixFds = 0;
+            break;
+
+        case MessageHeaderFields::Signature:
+            m_priv->m_signature = Signature();
+            break;
+
+        default:
+            break;
+        }
 
-    m_priv->m_headerMap[ field ] = value;
+        return retval;
+    }
+
+    if( type == 0 || value.type() != char_to_dbus_type( type ) ) {
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Header field " << static_cast<int>( header_field_to_int( field ) )
+            << " can not hold a value of type " << value.type() );
+        return retval;
+    }
+
+    switch( field ) {
+    case MessageHeaderFields::Path:
+        m_priv->m_path = value.to_path();
+        break;
+
+    case MessageHeaderFields::Reply_Serial:
+        m_priv->m_replySerial = value.to_uint32();
+        break;
+
+    case MessageHeaderFields::Unix_FDs:
+        m_priv->m_unixFds = value.to_uint32();
+        break;
+
+    case MessageHeaderFields::Signature:
+        m_priv->m_signature = value.to_signature();
+        break;
+
+    default:
+        m_priv->m_strings[ header_field_to_int( field ) ] = value.to_string();
+        break;
+    }
+
+    m_priv->m_fieldsSet |= header_field_bit( field );
 
     return retval;
 }
 
+const std::string& Message::header_string( MessageHeaderFields field ) const {
+    if( field == MessageHeaderFields::Path ) {
+        return m_priv->m_path;
+    }
+
+    m_priv->load_field( field );
+
+    return m_priv->m_strings[ header_field_to_int( field ) ];
+}
+
+void Message::set_header_string( MessageHeaderFields field, const std::string& value ) {
+    if( field == MessageHeaderFields::Path ) {
+        m_priv->m_path = value;
+    } else if( header_field_type( field ) == 's' ) {
+        m_priv->forget_field( field );
+        m_priv->m_strings[ header_field_to_int( field ) ] = value;
+    } else {
+        return;
+    }
+
+    m_priv->m_fieldsSet |= header_field_bit( field );
+}
+
+const Path& Message::header_path() const {
+    return m_priv->m_path;
+}
+
+uint32_t Message::header_uint32( MessageHeaderFields field ) const {
+    switch( field ) {
+    case MessageHeaderFields::Reply_Serial:
+        return m_priv->m_replySerial;
+
+    case MessageHeaderFields::Unix_FDs:
+        return m_priv->m_unixFds;
+
+    default:
+        return 0;
+    }
+}
+
+void Message::set_header_uint32( MessageHeaderFields field, uint32_t value ) {
+    switch( field ) {
+    case MessageHeaderFields::Reply_Serial:
+        m_priv->m_replySerial = value;
+        break;
+
+    case MessageHeaderFields::Unix_FDs:
+        m_priv->m_unixFds = value;
+        break;
+
+    default:
+        return;
+    }
+
+    m_priv->m_fieldsSet |= header_field_bit( field );
+}
+
 std::vector<uint8_t>* Message::body() {
+    m_priv->detach_body();
+    m_priv->m_argOffsetsValid = false;
+
     return &m_priv->m_body;
 }
 
-const std::vector<uint8_t>* Message::body() const {
-    return &m_priv->m_body;
+const uint8_t* Message::body_data() const {
+    return m_priv->body_data();
+}
+
+uint32_t Message::body_size() const {
+    return m_priv->body_size();
 }
 
 void Message::add_filedescriptor( int fd ) {
     m_priv->m_filedescriptors.push_back( fd );
 
-    uint32_t fds_size = m_priv->m_filedescriptors.size();
-    set_header_field( MessageHeaderFields::Unix_FDs, Variant( fds_size ) );
+    set_header_uint32( MessageHeaderFields::Unix_FDs, m_priv->m_filedescriptors.size() );
 }
 
 uint32_t Message::filedescriptors_size() const {
@@ -442,6 +1477,33 @@ DBus::Endianess Message::endianess() const {
     return m_priv->m_endianess;
 }
 
+bool Message::set_endianess( Endianess endian ) {
+    if( endian == m_priv->m_endianess ) {
+        return true;
+    }
+
+    if( m_priv->m_bodyShared ) {
+        // Another message reads the same bytes, so convert a copy of them
+        m_priv->detach_body();
+    }
+
+    if( m_priv->body_size() != 0 &&
+        !priv::swap_byte_order( m_priv->body_data(),
+            m_priv->body_size(),
+            signature(),
+            m_priv->m_endianess ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to change byte order: body does not match signature" );
+        m_priv->m_valid = false;
+        return false;
+    }
+
+    // Any copy that serialized_body() made is in the old byte order
+    m_priv->m_bodyCopied = false;
+    m_priv->m_endianess = endian;
+
+    return true;
+}
+
 int Message::filedescriptor_at_location( int location ) const {
     if( location < m_priv->m_filedescriptors.size() &&
         location >= 0 ) {
@@ -451,6 +1513,16 @@ int Message::filedescriptor_at_location( int location ) const {
     return -1;
 }
 
+std::shared_ptr<Message> Message::copy_with_serial( uint32_t serial ) const {
+    std::shared_ptr<Message> retmsg = copy();
+
+    if( retmsg ) {
+        retmsg->m_priv->m_serial = serial;
+    }
+
+    return retmsg;
+}
+
 const std::vector<int>& Message::filedescriptors() const {
     return m_priv->m_filedescriptors;
 }
@@ -458,6 +1530,11 @@ const std::vector<int>& Message::filedescriptors() const {
 std::ostream& operator <<( std::ostream& os, const DBus::Message* msg ) {
     os << "DBus::Message = [";
 
+    if( !msg ) {
+        os << "null]";
+        return os;
+    }
+
     switch( msg->type() ) {
     case DBus::MessageType::INVALID:
         os << "Invalid";
@@ -481,53 +1558,59 @@ std::ostream& operator <<( std::ostream& os, const DBus::Message* msg ) {
     }
 
     os << std::endl;
-    os << "  Message length: " << msg->m_priv->m_body.size() << std::endl;
+    os << "  Message length: " << msg->m_priv->body_size() << std::endl;
     os << "  Endianess: " << msg->m_priv->m_endianess << std::endl;
     os << "  Serial: " << msg->m_priv->m_serial << std::endl;
     os << "  Headers:" << std::endl;
 
-    for( const std::pair<const MessageHeaderFields, DBus::Variant>& set : msg->m_priv->m_headerMap ) {
+    msg->m_priv->sync_signature();
+    msg->m_priv->load_all_fields();
+
+    for( uint8_t code = 1; code < HEADER_FIELD_COUNT; code++ ) {
+        MessageHeaderFields field = int_to_header_field( code );
+
+        if( !msg->m_priv->has_field( field ) ) { continue; }
+
         os << "    ";
 
-        switch( set.first ) {
+        switch( field ) {
         case MessageHeaderFields::Invalid:
-            os << "!! Invalid message header has been stored !!";
             break;
 
         case MessageHeaderFields::Path:
-            os << "Path: " << set.second.to_path();
+            os << "Path: " << msg->m_priv->m_path;
             break;
 
         case MessageHeaderFields::Interface:
-            os << "Interface: " << set.second.to_string();
+            os << "Interface: " << msg->m_priv->m_strings[ code ];
             break;
 
         case MessageHeaderFields::Member:
-            os << "Member: " << set.second.to_string();
+            os << "Member: " << msg->m_priv->m_strings[ code ];
             break;
 
         case MessageHeaderFields::Error_Name:
-            os << "Error Name: " << set.second.to_string();
+            os << "Error Name: " << msg->m_priv->m_strings[ code ];
             break;
 
         case MessageHeaderFields::Reply_Serial:
-            os << "Reply Serial: " << set.second.to_uint32();
+            os << "Reply Serial: " << msg->m_priv->m_replySerial;
             break;
 
         case MessageHeaderFields::Destination:
-            os << "Destination: " << set.second.to_string();
+            os << "Destination: " << msg->m_priv->m_strings[ code ];
             break;
 
         case MessageHeaderFields::Sender:
-            os << "Sender: " << set.second.to_string();
+            os << "Sender: " << msg->m_priv->m_strings[ code ];
             break;
 
         case MessageHeaderFields::Signature:
-            os << "Signature: " << set.second.to_signature();
+            os << "Signature: " << msg->m_priv->m_signature;
             break;
 
         case MessageHeaderFields::Unix_FDs:
-            os << "# Unix FDs: " << set.second.to_uint32();
+            os << "# Unix FDs: " << msg->m_priv->m_unixFds;
             break;
         }
 
@@ -22,6 +22,7 @@
 #include <dbus-cxx/messageiterator.h>
 #include <memory>
 #include <string>
+#include <string_view>
 #include "enums.h"
 
 #include <dbus-cxx/variant.h>
@@ -35,6 +36,25 @@
 namespace DBus {
 class ReturnMessage;
 
+namespace priv {
+class LoopbackTransport;
+}
+
+/**
+ * Counters for the pool of freed messages on the calling thread; see
+ * Message::set_pool_size().
+ */
+struct MessagePoolStatistics {
+    /** Messages that had to be allocated */
+    uint64_t allocated;
+    /** Messages that were taken from the pool */
+    uint64_t reused;
+    /** Messages that were freed into the pool */
+    uint64_t recycled;
+    /** Messages in the pool now */
+    uint32_t pooled;
+};
+
 /**
  * @defgroup message DBus Messages
  * Messages may be either sent across the DBus or received from the DBus
@@ -91,11 +111,11 @@ public:
      */
     bool set_destination( const std::string& s );
 
-    std::string destination() const;
+    const std::string& destination() const;
 
-    std::string sender() const;
+    const std::string& sender() const;
 
-    Signature signature() const;
+    const Signature& signature() const;
 
     template <typename T>
     MessageIterator operator>>( T& value ) const {
@@ -115,6 +135,30 @@ public:
 
     MessageIterator end() const;
 
+    /**
+     * Returns an iterator that points at the argument at the given position,
+     * or an invalid iterator if there is no such argument.  The arguments
+     * before it are not decoded: the first time that this is called, the
+     * offset of every argument is found by jumping over their values.
+     *
+     * @param index The position of the argument, starting from 0
+     */
+    MessageIterator arg( uint32_t index ) const;
+
+    /**
+     * Look up a key in a dictionary argument without decoding the dictionary.
+     * The arguments are searched in order for a dictionary with the given
+     * signature, such as "a{sv}", that contains the key.  Entries with other
+     * keys are jumped over.  Only dictionaries whose keys are strings or
+     * object paths can be searched.
+     *
+     * @param signature The signature of the dictionary
+     * @param key The key to look up
+     * @return An iterator that points at the value of the key, or an invalid
+     *         iterator if it was not found
+     */
+    MessageIterator find( const std::string& signature, const std::string& key ) const;
+
     MessageAppendIterator append();
 
     /**
@@ -129,6 +173,56 @@ public:
      */
     bool serialize_to_vector( std::vector<uint8_t>* vec, uint32_t serial ) const;
 
+    /**
+     * Serialize only the header of this message, including the padding after
+     * the header, to the given vector.  The complete message is this header
+     * followed directly by the body from body_data(), so the body can be sent
+     * from where it already is without being copied.  Fails under the same
+     * circumstances as serialize_to_vector().
+     *
+     * @param vec The location to serialize the header to.
+     * @param serial The serial of the message.
+     * @return True if the message was able to be serialized, false otherwise.
+     */
+    bool serialize_header_to_vector( std::vector<uint8_t>* vec, uint32_t serial ) const;
+
+    /**
+     * The marshaled body of this message, which goes directly after the
+     * header from serialize_header_to_vector().  A body that was received
+     * is copied the first time that this is called; body_data() does not
+     * copy it.
+     */
+    const std::vector<uint8_t>& serialized_body() const;
+
+    /**
+     * The marshaled body of this message, wherever it is stored.  Unlike
+     * serialized_body(), this never copies a body that was received or that
+     * is shared with a copy of this message.  The pointer is valid until the
+     * message is changed.
+     */
+    const uint8_t* body_data() const;
+
+    /**
+     * The size of the marshaled body of this message.
+     */
+    uint32_t body_size() const;
+
+    /**
+     * Create a copy of this message, to send on somewhere else, such as over
+     * another connection.  The routing header fields of the copy can then be
+     * changed with the usual setters before it is sent, and it is given a
+     * new serial when it is sent.
+     *
+     * A body that was received is not copied: the copy reads it from the same
+     * storage, so sending the copy costs the size of its header rather than
+     * the size of its body.  Appending to, or changing the byte order of,
+     * either message gives that message its own copy of the body first.  Any
+     * FDs are duplicated.
+     *
+     * @return The copy, or an invalid shared_ptr if the FDs could not be duplicated
+     */
+    std::shared_ptr<Message> copy() const;
+
     /**
      * Returns the given header field(if it exists), otherwise returns a default
      * constructed variant.
@@ -146,6 +240,8 @@ public:
 
     /**
      * Set the given header field.  Returns the previously set value, if it exists.
+     * Setting a default-constructed variant removes the field.  Every field
+     * has a fixed type, and a value of any other type is ignored.
      *
      * @param field The field to set
      * @param value The value to set the header field to
@@ -155,13 +251,68 @@ public:
 
     Endianess endianess() const;
 
+    /**
+     * Change the byte order of this message.  The body is converted in place
+     * in a single pass over the signature, so that it can be read afterwards
+     * without any byte swapping.  Messages that are created locally are in
+     * the byte order of this machine.
+     *
+     * If the body does not match the signature, the message is invalid
+     * afterwards.
+     *
+     * @param endian The new byte order of the message
+     * @return True if the message is now in the given byte order
+     */
+    bool set_endianess( Endianess endian );
+
     const std::vector<int>& filedescriptors() const;
 
+    /**
+     * Create a message from its marshaled form.  The body is copied, so the
+     * data may be reused as soon as this returns.
+     *
+     * @return The message, or an invalid shared_ptr if the data is not a message
+     */
     static std::shared_ptr<Message> create_from_data( uint8_t* data, uint32_t data_len, std::vector<int> fds = std::vector<int>() );
 
+    /**
+     * Create a message from its marshaled form without copying the body: the
+     * message keeps a reference to the data and reads its body from there.
+     * The data must not be changed while the message exists, though the
+     * message may change the byte order of its own body in place.  The body
+     * is only copied if the message is appended to, or serialized_body() is
+     * used; body_data() reads it where it is.
+     *
+     * @return The message, or an invalid shared_ptr if the data is not a message
+     */
+    static std::shared_ptr<Message> create_from_data( std::shared_ptr<uint8_t> data, uint32_t data_len, std::vector<int> fds = std::vector<int>() );
+
+    /**
+     * Keep up to this many freed messages of each type on each thread, to be
+     * handed out again by the create() methods of the message classes.  A
+     * message that is reused keeps the memory of its header strings and of
+     * its body, and its shared_ptr control block is reused as well.
+     *
+     * The default of 0 turns the pool off.  A message goes back to the pool
+     * of whichever thread frees it.
+     *
+     * @param size The number of messages of each type to keep per thread
+     */
+    static void set_pool_size( uint32_t size );
+
+    /**
+     * The counters of the calling thread's message pool.
+     */
+    static MessagePoolStatistics pool_statistics();
+
 protected:
 
-    void append_signature( std::string toappend );
+    /**
+     * Add to the signature of the body.  The signature is only built up
+     * here; it is parsed and put into the header the first time that
+     * something reads it.
+     */
+    void append_signature( std::string_view toappend );
 
     /**
      * Clears the signature and the data, so you can re-append data
@@ -170,13 +321,66 @@ protected:
 
     void set_flags( uint8_t flags );
 
+    /**
+     * The value of a header field that is a string: Path, Interface, Member,
+     * Error_Name, Destination or Sender.  A field that is not set is empty.
+     */
+    const std::string& header_string( MessageHeaderFields field ) const;
+
+    /**
+     * Set a header field that is a string.  Other fields are not changed.
+     */
+    void set_header_string( MessageHeaderFields field, const std::string& value );
+
+    /**
+     * The Path header field, or an empty Path if it is not set.
+     */
+    const Path& header_path() const;
+
+    /**
+     * The value of the Reply_Serial or Unix_FDs header field, or 0 if it is
+     * not set.
+     */
+    uint32_t header_uint32( MessageHeaderFields field ) const;
+
+    /**
+     * Set the Reply_Serial or Unix_FDs header field.  Other fields are not
+     * changed.
+     */
+    void set_header_uint32( MessageHeaderFields field, uint32_t value );
+
+    /**
+     * Take a freed message of the given type out of the calling thread's
+     * pool.
+     *
+     * @return The message, or nullptr if the pool does not have one
+     */
+    static Message* take_from_pool( MessageType type );
+
+    /**
+     * Wrap a message in a shared_ptr that gives it back to the pool once it
+     * is no longer used.
+     */
+    static std::shared_ptr<Message> manage_pooled( Message* msg );
+
 private:
+    static void return_to_pool( Message* msg );
+
     std::vector<uint8_t>* body();
-    const std::vector<uint8_t>* body() const;
     void add_filedescriptor( int fd );
     uint32_t filedescriptors_size() const;
     int filedescriptor_at_location( int location ) const;
 
+    /**
+     * Create a copy of this message as the receiving end would see it once
+     * it has been sent with the given serial.  Any FDs are duplicated.
+     *
+     * @return The copy, or an invalid shared_ptr if the FDs could not be duplicated
+     */
+    std::shared_ptr<Message> copy_with_serial( uint32_t serial ) const;
+
+    static std::shared_ptr<Message> create_from_bytes( const uint8_t* data, uint32_t data_len, std::vector<int> fds, std::shared_ptr<uint8_t> storage );
+
 private:
     class priv_data;
 
@@ -184,6 +388,7 @@ private:
 
     friend class MessageAppendIterator;
     friend class MessageIterator;
+    friend class priv::LoopbackTransport;
     friend std::ostream& operator<<( std::ostream& os, const DBus::Message* msg );
 
 };
@@ -29,9 +29,15 @@
 #include "signature.h"
 #include "types.h"
 #include "validator.h"
+#include "dbus-cxx-private.h"
+#include <sstream>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+
+static const char* LOGGER_NAME = "DBus.MessageAppendIterator";
 
 namespace DBus {
 
@@ -39,16 +45,24 @@ class MessageAppendIterator::priv_data {
 public:
     priv_data() :
         m_message( nullptr ),
-        m_subiter( nullptr ),
+        m_subiterOpen( false ),
         m_currentContainer( ContainerType::None ),
-        m_arrayAlignment( 0 ) {}
+        m_arrayLengthOffset( 0 ),
+        m_arrayStart( 0 ),
+        m_memfdThreshold( 0 ) {}
 
+    /* Containers share the marshaling of the message body */
     Marshaling m_marshaling;
     Message* m_message;
-    MessageAppendIterator* m_subiter;
-    std::vector<uint8_t> m_workingBuffer;
+    /* Kept around so that it can be reused for the next container */
+    std::unique_ptr<MessageAppendIterator> m_subiter;
+    bool m_subiterOpen;
     ContainerType m_currentContainer;
-    int32_t m_arrayAlignment;
+    /* For arrays: where to write the length when the array is closed */
+    uint32_t m_arrayLengthOffset;
+    /* For arrays: where the first element starts, after any padding */
+    uint32_t m_arrayStart;
+    uint32_t m_memfdThreshold;
 };
 
 MessageAppendIterator::MessageAppendIterator( ContainerType container ) {
@@ -58,13 +72,9 @@ MessageAppendIterator::MessageAppendIterator( ContainerType container ) {
 
 MessageAppendIterator::MessageAppendIterator( Message& message, ContainerType container ) {
     m_priv = std::make_shared<priv_data>();
-    m_priv->m_marshaling = Marshaling( message.body(), Endianess::Big );
+    m_priv->m_marshaling = Marshaling( message.body(), message.endianess() );
     m_priv->m_message = &message;
     m_priv->m_currentContainer = container;
-
-    if( container != ContainerType::None ) {
-        m_priv->m_marshaling = Marshaling( &m_priv->m_workingBuffer, Endianess::Big );
-    }
 }
 
 MessageAppendIterator::MessageAppendIterator( std::shared_ptr<Message> message, ContainerType container ) {
@@ -73,11 +83,7 @@ MessageAppendIterator::MessageAppendIterator( std::shared_ptr<Message> message,
     m_priv->m_currentContainer = container;
 
     if( message ) {
-        m_priv->m_marshaling = Marshaling( message->body(), Endianess::Big );
-    }
-
-    if( container != ContainerType::None ) {
-        m_priv->m_marshaling = Marshaling( &m_priv->m_workingBuffer, Endianess::Big );
+        m_priv->m_marshaling = Marshaling( message->body(), message->endianess() );
     }
 }
 
@@ -87,7 +93,7 @@ MessageAppendIterator::~MessageAppendIterator() {
 
 void MessageAppendIterator::invalidate() {
     m_priv->m_message = nullptr;
-    m_priv->m_subiter = nullptr;
+    m_priv->m_subiterOpen = false;
 }
 
 bool MessageAppendIterator::is_valid() const {
@@ -100,6 +106,31 @@ MessageAppendIterator::operator bool() const {
     return this->is_valid();
 }
 
+void MessageAppendIterator::set_memfd_threshold( uint32_t threshold ) {
+    m_priv->m_memfdThreshold = threshold;
+}
+
+uint32_t MessageAppendIterator::memfd_threshold() const {
+    return m_priv->m_memfdThreshold;
+}
+
+size_t MessageAppendIterator::body_size() const {
+    if( !m_priv->m_message ) {
+        return 0;
+    }
+
+    return m_priv->m_marshaling.currentOffset();
+}
+
+void MessageAppendIterator::reserve( size_t bytes ) {
+    // Large byte arrays may not end up in the body at all
+    if( !this->is_valid() || m_priv->m_memfdThreshold != 0 ) {
+        return;
+    }
+
+    m_priv->m_marshaling.reserve( bytes );
+}
+
 
 MessageAppendIterator& MessageAppendIterator::operator<<( const bool& v ) {
     if( !this->is_valid() ) { return *this; }
@@ -308,110 +339,202 @@ MessageAppendIterator& MessageAppendIterator::operator<<( const Variant& v ) {
         return *this;
     }
 
-    this->open_container( ContainerType::VARIANT, v.signature() );
-    DBus::Signature sig = v.signature();
-    m_priv->m_marshaling.marshal( sig );
-    m_priv->m_marshaling.align( v.data_alignment() );
+    this->open_container( ContainerType::VARIANT, DBUSCXX_TYPE_VARIANT_AS_STRING );
+    m_priv->m_marshaling.marshal( v );
+    this->close_container();
+
+    return *this;
+}
+
+MessageAppendIterator& MessageAppendIterator::operator<<( const std::vector<uint8_t>& v ) {
+    if( !this->is_valid() ) { return *this; }
 
-    for( const uint8_t& data : * ( v.marshaled() ) ) {
-        m_priv->m_marshaling.marshal( data );
+    // Only top-level arguments can be offloaded, the signature of a
+    // container has already been written by the time we get here.
+    if( m_priv->m_currentContainer == ContainerType::None &&
+        m_priv->m_memfdThreshold > 0 &&
+        v.size() >= m_priv->m_memfdThreshold &&
+        append_memfd( v ) ) {
+        return *this;
     }
 
-    this->close_container();
+    return this->operator<< <uint8_t>( v );
+}
 
-    return *this;
+bool MessageAppendIterator::append_memfd( const std::vector<uint8_t>& v ) {
+#if DBUS_CXX_HAS_MEMFD
+    // The receiver would reject it, so leave it to the inline array checks
+    if( v.size() > Validator::maximum_memfd_array_size() ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Array of " << v.size() << " bytes is too large for a memfd" );
+        return false;
+    }
+
+    int fd = memfd_create( "dbus-cxx-array", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+
+    if( fd < 0 ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to create memfd: " << strerror( errno ) );
+        return false;
+    }
+
+    const uint8_t* data = v.data();
+    size_t remaining = v.size();
+
+    while( remaining > 0 ) {
+        ssize_t written = write( fd, data, remaining );
+
+        if( written < 0 && errno == EINTR ) { continue; }
+
+        if( written <= 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to write memfd: " << strerror( errno ) );
+            close( fd );
+            return false;
+        }
+
+        data += written;
+        remaining -= written;
+    }
+
+    // The receiver maps this, so it must not be able to change underneath them
+    if( fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL ) < 0 ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to seal memfd: " << strerror( errno ) );
+        close( fd );
+        return false;
+    }
+
+    SIMPLELOGGER_TRACE( LOGGER_NAME, "Sending " << v.size() << " bytes in memfd " << fd );
+
+    m_priv->m_message->append_signature( DBus::signature( std::shared_ptr<FileDescriptor>() ) );
+    m_priv->m_message->add_filedescriptor( fd );
+    m_priv->m_marshaling.marshal( m_priv->m_message->filedescriptors_size() - 1 );
+
+    return true;
+#else
+    return false;
+#endif
 }
 
+void MessageAppendIterator::append_fixed_array( const void* data, size_t count, int elementSize, std::string_view arraySignature ) {
+    if( !this->is_valid() ) { return; }
 
-bool MessageAppendIterator::open_container( ContainerType t, const std::string& sig ) {
-    std::string signature;
-    int32_t array_align = 0;
+    if( m_priv->m_subiterOpen ) { this->close_container(); }
 
-    switch( t ) {
-    case ContainerType::None:
-        break;
+    if( m_priv->m_currentContainer == ContainerType::None ) {
+        m_priv->m_message->append_signature( arraySignature );
+    }
 
-    case ContainerType::STRUCT:
-        signature.append( "(" );
-        signature.append( sig );
-        signature.append( ")" );
-        break;
+    uint64_t arraySize = static_cast<uint64_t>( count ) * elementSize;
+
+    if( arraySize > Validator::maximum_array_size() ) {
+        m_priv->m_message->invalidate();
+        return;
+    }
 
+    m_priv->m_marshaling.marshal( static_cast<uint32_t>( arraySize ) );
+    m_priv->m_marshaling.marshal_fixed_array( data, count, elementSize );
+}
+
+bool MessageAppendIterator::open_container( ContainerType t, std::string_view signature ) {
+    int32_t array_align = 0;
+
+    switch( t ) {
     case ContainerType::ARRAY:
-        signature.append( "a" );
-        signature.append( sig );
-        // The size will get marshalled once we close the container
-        {
-            Signature tmpSig( sig );
-            SignatureIterator tmpSigIter = tmpSig.begin();
-            TypeInfo ti( tmpSigIter.type() );
-            array_align = ti.alignment();
+        // Only the first type of the element matters for the alignment
+        if( signature.size() > 1 ) {
+            array_align = TypeInfo( char_to_dbus_type( signature[ 1 ] ) ).alignment();
         }
         break;
 
     case ContainerType::VARIANT:
-        signature.append( "v" );
+        signature = DBUSCXX_TYPE_VARIANT_AS_STRING;
         break;
 
     case ContainerType::DICT_ENTRY:
+    case ContainerType::None:
+        signature = std::string_view();
+        break;
+
+    default:
         break;
     }
 
-    if( m_priv->m_subiter ) { this->close_container(); }
+    if( m_priv->m_subiterOpen ) { this->close_container(); }
 
-    if( m_priv->m_message ) {
-        if( m_priv->m_currentContainer == ContainerType::None ) {
-            m_priv->m_message->append_signature( signature );
-        }
+    if( !m_priv->m_subiter ) {
+        m_priv->m_subiter.reset( new MessageAppendIterator( t ) );
+    }
+
+    MessageAppendIterator::priv_data* subiter = m_priv->m_subiter->m_priv.get();
+    subiter->m_message = m_priv->m_message;
+    subiter->m_marshaling = m_priv->m_marshaling;
+    subiter->m_currentContainer = t;
+    m_priv->m_subiterOpen = true;
+
+    if( !m_priv->m_message ) {
+        return true;
+    }
 
-        m_priv->m_subiter = new MessageAppendIterator( *m_priv->m_message, t );
-        m_priv->m_subiter->m_priv->m_arrayAlignment = array_align;
-    } else {
-        m_priv->m_subiter = new MessageAppendIterator( t );
+    if( m_priv->m_currentContainer == ContainerType::None ) {
+        m_priv->m_message->append_signature( signature );
+    }
+
+    // Everything is written straight into the body, so it is aligned
+    // relative to the start of the body
+    switch( t ) {
+    case ContainerType::ARRAY:
+        // The length gets filled in once we close the container.  The padding
+        // to the first element is there even if the array is empty.
+        m_priv->m_marshaling.align( 4 );
+        subiter->m_arrayLengthOffset = m_priv->m_marshaling.currentOffset();
+        m_priv->m_marshaling.marshal( static_cast<uint32_t>( 0 ) );
+        m_priv->m_marshaling.align( array_align );
+        subiter->m_arrayStart = m_priv->m_marshaling.currentOffset();
+        break;
+
+    case ContainerType::DICT_ENTRY:
+    case ContainerType::STRUCT:
+        m_priv->m_marshaling.align( 8 );
+        break;
+
+    default:
+        break;
     }
 
     return true;
 }
 
 bool MessageAppendIterator::close_container( ) {
-    if( ! m_priv->m_subiter ) { return false; }
+    if( !m_priv->m_subiterOpen ) { return false; }
 
-    switch( m_priv->m_subiter->m_priv->m_currentContainer ) {
-    case ContainerType::None: return false;
+    MessageAppendIterator::priv_data* subiter = m_priv->m_subiter->m_priv.get();
 
-    case ContainerType::ARRAY: {
-        uint32_t arraySize = static_cast<uint32_t>( m_priv->m_subiter->m_priv->m_workingBuffer.size() );
+    // Anything that the sub-iterator left open must be finished first
+    if( subiter->m_subiterOpen ) {
+        m_priv->m_subiter->close_container();
+    }
 
-        if( arraySize > Validator::maximum_array_size() ) {
-            m_priv->m_message->invalidate();
-            return true;
-        }
+    m_priv->m_subiterOpen = false;
 
-        m_priv->m_marshaling.marshal( arraySize );
-        m_priv->m_marshaling.align( m_priv->m_subiter->m_priv->m_arrayAlignment );
+    if( subiter->m_currentContainer == ContainerType::None ) {
+        return false;
     }
-    break;
 
-    case ContainerType::DICT_ENTRY:
-    case ContainerType::STRUCT:
-        m_priv->m_marshaling.align( 8 );
-        break;
+    if( subiter->m_currentContainer == ContainerType::ARRAY &&
+        m_priv->m_message ) {
+        uint32_t arraySize = m_priv->m_marshaling.currentOffset() - subiter->m_arrayStart;
 
-    case ContainerType::VARIANT:
-        break;
-    }
+        if( arraySize > Validator::maximum_array_size() ) {
+            m_priv->m_message->invalidate();
+            return true;
+        }
 
-    for( const uint8_t& dataByte : m_priv->m_subiter->m_priv->m_workingBuffer ) {
-        m_priv->m_marshaling.marshal( dataByte );
+        m_priv->m_marshaling.marshal_at_offset( subiter->m_arrayLengthOffset, arraySize );
     }
 
-    delete m_priv->m_subiter;
-    m_priv->m_subiter = nullptr;
     return true;
 }
 
 MessageAppendIterator* MessageAppendIterator::sub_iterator() {
-    return m_priv->m_subiter;
+    return m_priv->m_subiter.get();
 }
 
 }
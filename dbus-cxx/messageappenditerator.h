@@ -25,10 +25,12 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 #include "error.h"
 #include "path.h"
+#include "types.h"
 #include "variant.h"
 
 #ifndef DBUSCXX_MESSAGEAPPENDITERATOR_H
@@ -72,6 +74,38 @@ public:
     /** True if the iterator is valid and initialized, false otherwise */
     operator bool() const;
 
+    /**
+     * Send byte arrays of at least this many bytes out-of-band.
+     *
+     * When a std::vector<uint8_t> of at least this size is appended as a
+     * top-level argument, it is written into a sealed memfd and the
+     * descriptor is appended as a UNIX_FD('h') instead of an 'ay'.  A
+     * MessageIterator on the other side maps it and copies it into a
+     * std::vector<uint8_t>, but the wire signature changes, so only enable
+     * this when both ends use dbus-cxx and the connection can pass file
+     * descriptors.  Arrays larger than
+     * Validator::maximum_memfd_array_size() are always appended inline.
+     *
+     * @param threshold The minimum size to offload, or 0 to never offload(default)
+     */
+    void set_memfd_threshold( uint32_t threshold );
+
+    uint32_t memfd_threshold() const;
+
+    /**
+     * Reserve room in the message body for the given values, so that
+     * appending them afterwards does not have to grow the body again.
+     * Nothing is appended.
+     */
+    template <typename... T>
+    void reserve_for( const T& ...values ) {
+        size_t start = body_size();
+        size_t end = start;
+
+        ( ( end = priv::marshaled_size( end, values ) ), ... );
+        reserve( end - start );
+    }
+
     MessageAppendIterator& operator<<( const bool& v );
     MessageAppendIterator& operator<<( const uint8_t& v );
     MessageAppendIterator& operator<<( const int16_t& v );
@@ -87,13 +121,19 @@ public:
     MessageAppendIterator& operator<<( const Path& v );
     MessageAppendIterator& operator<<( const std::shared_ptr<FileDescriptor> v );
     MessageAppendIterator& operator<<( const Variant& v );
+    MessageAppendIterator& operator<<( const std::vector<uint8_t>& v );
 
     template <typename T>
     MessageAppendIterator& operator<<( const std::vector<T>& v ) {
         bool success;
-        T type;
+        auto sig = priv::signature_of<std::vector<T>>();
+
+        if constexpr( is_fixed_array_type<T>::value ) {
+            append_fixed_array( v.data(), v.size(), sizeof( T ), sig );
+            return *this;
+        }
 
-        success = this->open_container( ContainerType::ARRAY, DBus::signature( type ) );
+        success = this->open_container( ContainerType::ARRAY, sig );
 
         if( !success ) {
             throw ErrorNoMemory();
@@ -114,12 +154,12 @@ public:
 
     template <typename Key, typename Data>
     MessageAppendIterator& operator<<( const std::map<Key, Data>& dictionary ) {
-        std::string sig = signature_dict_data( dictionary );
+        auto sig = priv::signature_of<std::map<Key, Data>>();
         typename std::map<Key, Data>::const_iterator it;
         this->open_container( ContainerType::ARRAY, sig );
 
         for( it = dictionary.begin(); it != dictionary.end(); it++ ) {
-            sub_iterator()->open_container( ContainerType::DICT_ENTRY, std::string() );
+            sub_iterator()->open_container( ContainerType::DICT_ENTRY, std::string_view() );
             *( sub_iterator()->sub_iterator() ) << it->first;
             *( sub_iterator()->sub_iterator() ) << it->second;
             sub_iterator()->close_container();
@@ -133,8 +173,8 @@ public:
     template <typename... T>
     MessageAppendIterator& operator<<( const std::tuple<T...>& tup ) {
         bool success;
-        std::string signature = DBus::priv::dbus_signature<T...>().dbus_sig();
-        success = this->open_container( ContainerType::STRUCT, signature.c_str() );
+        auto signature = priv::signature_of<std::tuple<T...>>();
+        success = this->open_container( ContainerType::STRUCT, signature );
         MessageAppendIterator* subiter = sub_iterator();
         std::apply( [subiter]( auto&& ...arg ) mutable {
             ( *subiter << ... << arg );
@@ -146,12 +186,38 @@ public:
     }
 
 private:
-    bool open_container( ContainerType t, const std::string& contained_signature );
+    /**
+     * Start a container.
+     *
+     * @param t The type of container
+     * @param signature The complete signature of the container, e.g. "ai" or
+     * "a{sv}" for an array and "(ii)" for a struct.  Ignored for dict entries.
+     */
+    bool open_container( ContainerType t, std::string_view signature );
 
     bool close_container( );
 
     MessageAppendIterator* sub_iterator();
 
+    size_t body_size() const;
+
+    void reserve( size_t bytes );
+
+    /**
+     * Write the data into a sealed memfd and append that as a UNIX_FD.
+     *
+     * @return false if the array is larger than
+     * Validator::maximum_memfd_array_size() or the memfd could not be
+     * created; nothing is appended.
+     */
+    bool append_memfd( const std::vector<uint8_t>& v );
+
+    /**
+     * Append an array of fixed-size values, copying all of the elements at
+     * once instead of going through a sub-iterator for each one.
+     */
+    void append_fixed_array( const void* data, size_t count, int elementSize, std::string_view arraySignature );
+
 private:
     class priv_data;
 
@@ -21,101 +21,87 @@
 #include "filedescriptor.h"
 #include "message.h"
 #include "types.h"
+#include "validator.h"
 #include "variant.h"
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace DBus {
 
-class MessageIterator::priv_data {
-public:
-    priv_data() : m_message( nullptr )
-    {}
-
-    struct SubiterInformation {
-        SubiterInformation() :
-            m_subiterDataType( DataType::INVALID ),
-            m_arrayLastPosition( 0 ) {}
-
-        DataType m_subiterDataType;
-        uint32_t m_arrayLastPosition;
-        Signature m_variantSignature;
-    };
-
-    const Message* m_message;
-    std::shared_ptr<Demarshaling> m_demarshal;
-    SignatureIterator m_signatureIterator;
-    SubiterInformation m_subiterInfo;
-};
-
 MessageIterator::MessageIterator( DataType d,
     SignatureIterator sig,
     const Message* message,
-    std::shared_ptr<Demarshaling> demarshal ) {
-    m_priv = std::make_shared<priv_data>();
-    m_priv->m_message = message;
-    m_priv->m_demarshal = demarshal;
-    m_priv->m_signatureIterator = sig;
+    const Demarshaling& demarshal ) :
+    m_message( message ),
+    m_demarshal( demarshal ),
+    m_valueStart( 0 ),
+    m_signatureIterator( sig ),
+    m_subiterDataType( DataType::INVALID ),
+    m_arrayLastPosition( 0 ) {
 
     if( d == DataType::ARRAY ) {
-        m_priv->m_subiterInfo.m_subiterDataType = d;
-        m_priv->m_subiterInfo.m_arrayLastPosition = m_priv->m_demarshal->current_offset() + m_priv->m_demarshal->demarshal_uint32_t();
+        // The length does not include the padding before the first element
+        uint32_t arrayLength = m_demarshal.demarshal_uint32_t();
+        m_demarshal.align( sig.alignment() );
+        m_subiterDataType = d;
+        m_arrayLastPosition = m_demarshal.current_offset() + arrayLength;
     } else if( d == DataType::VARIANT ) {
-        Signature demarshaled_sig = demarshal->demarshal_signature();
-        m_priv->m_subiterInfo.m_variantSignature = demarshaled_sig;
-        m_priv->m_signatureIterator = demarshaled_sig.begin();
+        // Signatures are interned, so the iterator stays good after this goes away
+        Signature demarshaled_sig = m_demarshal.demarshal_signature();
+        m_signatureIterator = demarshaled_sig.begin();
     } else if( d == DataType::DICT_ENTRY || d == DataType::STRUCT ) {
-        m_priv->m_demarshal->align( 8 );
+        m_demarshal.align( 8 );
     }
 
+    m_valueStart = m_demarshal.current_offset();
+}
+
+MessageIterator::MessageIterator( const Message* message,
+    SignatureIterator sig,
+    uint32_t offset ) :
+    m_message( message ),
+    m_demarshal( message->body_data(), message->body_size(), message->endianess() ),
+    m_valueStart( offset ),
+    m_signatureIterator( sig ),
+    m_subiterDataType( DataType::INVALID ),
+    m_arrayLastPosition( 0 ) {
+    m_demarshal.set_data_offset( offset );
 }
 
-MessageIterator::MessageIterator():
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_subiterInfo.m_subiterDataType = DataType::INVALID;
+MessageIterator::MessageIterator() :
+    m_message( nullptr ),
+    m_valueStart( 0 ),
+    m_subiterDataType( DataType::INVALID ),
+    m_arrayLastPosition( 0 ) {
 }
 
-MessageIterator::MessageIterator( const Message& message ):
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_message = &message;
-    m_priv->m_demarshal = std::shared_ptr<Demarshaling>(
-            new Demarshaling( m_priv->m_message->body()->data(),
-                m_priv->m_message->body()->size(),
-                m_priv->m_message->endianess() )
-        );
-    m_priv->m_signatureIterator = m_priv->m_message->signature().begin();
-    m_priv->m_subiterInfo.m_subiterDataType = DataType::INVALID;
+MessageIterator::MessageIterator( const Message& message ) :
+    MessageIterator( &message, message.signature().begin(), 0 ) {
 }
 
-MessageIterator::MessageIterator( std::shared_ptr<Message> message ):
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_message = message.get();
-    m_priv->m_demarshal = std::shared_ptr<Demarshaling>(
-            new Demarshaling( m_priv->m_message->body()->data(),
-                m_priv->m_message->body()->size(),
-                m_priv->m_message->endianess() )
-        );
-    m_priv->m_signatureIterator = m_priv->m_message->signature().begin();
-    m_priv->m_subiterInfo.m_subiterDataType = DataType::INVALID;
+MessageIterator::MessageIterator( std::shared_ptr<Message> message ) :
+    MessageIterator( message.get(), message->signature().begin(), 0 ) {
 }
 
 const Message* MessageIterator::message() const {
-    return m_priv->m_message;
+    return m_message;
 }
 
 void MessageIterator::invalidate() {
-    m_priv->m_message = nullptr;
+    m_message = nullptr;
 }
 
 bool MessageIterator::is_valid() const {
-    if( !( m_priv->m_message && m_priv->m_message->is_valid() ) ) { return false; }
+    if( !( m_message && m_message->is_valid() ) ) { return false; }
 
     if( this->arg_type() == DataType::INVALID ) { return false; }
 
-    if( m_priv->m_subiterInfo.m_subiterDataType == DataType::ARRAY ) {
+    if( m_subiterDataType == DataType::ARRAY ) {
         // We are in a subiter here, figure out if we're at the end of the array yet
-        if( m_priv->m_demarshal->current_offset() > m_priv-> m_subiterInfo.m_arrayLastPosition ) {
+        if( m_demarshal.current_offset() >= m_arrayLastPosition ) {
             return false;
         }
 
@@ -126,7 +112,7 @@ bool MessageIterator::is_valid() const {
 }
 
 bool MessageIterator::has_next() const {
-    if( this->is_valid() ) { return m_priv->m_signatureIterator.has_next(); }
+    if( this->is_valid() ) { return m_signatureIterator.has_next(); }
 
     return false;
 }
@@ -134,17 +120,24 @@ bool MessageIterator::has_next() const {
 bool MessageIterator::next() {
     if( !this->is_valid() ) { return false; }
 
+    if( m_demarshal.current_offset() == m_valueStart &&
+        !m_demarshal.skip( m_signatureIterator ) ) {
+        // The value was not read, and runs past the end of the body
+        this->invalidate();
+        return false;
+    }
+
+    m_valueStart = m_demarshal.current_offset();
+
     // Check to see if we are a subiterator.  If we are, it depends on the type we are.
     // Arrays are valid until they can read no more data,
     // structs iterate over their types like normal,
     // and variants do ..  ?
-    if( m_priv->m_subiterInfo.m_subiterDataType == DataType::ARRAY ) {
-        // Question: should this try to advance the iterator by reading a value
-        // and then just discarding it?
+    if( m_subiterDataType == DataType::ARRAY ) {
         return true;
     }
 
-    bool result = m_priv->m_signatureIterator.next();
+    bool result = m_signatureIterator.next();
 
     if( !result || this->arg_type() == DataType::INVALID ) {
         this->invalidate();
@@ -166,13 +159,24 @@ MessageIterator MessageIterator::operator ++( int ) {
     return temp_copy;
 }
 
+bool MessageIterator::skip() {
+    if( !this->is_valid() ) { return false; }
+
+    if( !m_demarshal.skip( m_signatureIterator ) ) {
+        this->invalidate();
+        return false;
+    }
+
+    return this->next();
+}
+
 bool MessageIterator::operator==( const MessageIterator& other ) {
     //TODO finish this method
-    return ( m_priv->m_message == other.m_priv->m_message );
+    return ( m_message == other.m_message );
 }
 
 DataType MessageIterator::arg_type() const {
-    return m_priv->m_signatureIterator.type();
+    return m_signatureIterator.type();
 }
 
 DataType MessageIterator::element_type() const {
@@ -180,7 +184,7 @@ DataType MessageIterator::element_type() const {
         return DataType::INVALID;
     }
 
-    return m_priv->m_signatureIterator.element_type();
+    return m_signatureIterator.element_type();
 }
 
 bool MessageIterator::is_fixed() const {
@@ -204,16 +208,16 @@ bool MessageIterator::is_dict() const {
 MessageIterator MessageIterator::recurse() {
     if( !this->is_container() ) { return MessageIterator(); }
 
-    MessageIterator iter( m_priv->m_signatureIterator.type(),
-        m_priv->m_signatureIterator.recurse(),
-        m_priv->m_message,
-        m_priv->m_demarshal );
+    MessageIterator iter( m_signatureIterator.type(),
+        m_signatureIterator.recurse(),
+        m_message,
+        m_demarshal );
 
     return iter;
 }
 
 std::string MessageIterator::signature() const {
-    return m_priv->m_signatureIterator.signature();
+    return m_signatureIterator.signature();
 }
 
 MessageIterator::operator bool() {
@@ -496,7 +500,7 @@ bool MessageIterator::get_bool() {
         throw ErrorInvalidTypecast( "MessageIterator: getting bool and type is not DataType::BOOLEAN" );
     }
 
-    return m_priv->m_demarshal->demarshal_boolean();
+    return m_demarshal.demarshal_boolean();
 }
 
 uint8_t MessageIterator::get_uint8() {
@@ -504,7 +508,7 @@ uint8_t MessageIterator::get_uint8() {
         throw ErrorInvalidTypecast( "MessageIterator: getting uint8_t and type is not DataType::BYTE" );
     }
 
-    return m_priv->m_demarshal->demarshal_uint8_t();
+    return m_demarshal.demarshal_uint8_t();
 }
 
 int16_t MessageIterator::get_int16() {
@@ -512,7 +516,7 @@ int16_t MessageIterator::get_int16() {
         throw ErrorInvalidTypecast( "MessageIterator: getting int16_t and type is not DataType::INT16" );
     }
 
-    return m_priv->m_demarshal->demarshal_int16_t();
+    return m_demarshal.demarshal_int16_t();
 }
 
 uint16_t MessageIterator::get_uint16() {
@@ -520,7 +524,7 @@ uint16_t MessageIterator::get_uint16() {
         throw ErrorInvalidTypecast( "MessageIterator: getting uint16_t and type is not DataType::UINT16" );
     }
 
-    return m_priv->m_demarshal->demarshal_uint16_t();
+    return m_demarshal.demarshal_uint16_t();
 }
 
 int32_t MessageIterator::get_int32() {
@@ -528,7 +532,7 @@ int32_t MessageIterator::get_int32() {
         throw ErrorInvalidTypecast( "MessageIterator: getting int32_t and type is not DataType::INT32" );
     }
 
-    return m_priv->m_demarshal->demarshal_int32_t();
+    return m_demarshal.demarshal_int32_t();
 }
 
 uint32_t MessageIterator::get_uint32() {
@@ -536,7 +540,7 @@ uint32_t MessageIterator::get_uint32() {
         throw ErrorInvalidTypecast( "MessageIterator: getting uint32_t and type is not DataType::UINT32" );
     }
 
-    return m_priv->m_demarshal->demarshal_uint32_t();
+    return m_demarshal.demarshal_uint32_t();
 }
 
 int64_t MessageIterator::get_int64() {
@@ -544,7 +548,7 @@ int64_t MessageIterator::get_int64() {
         throw ErrorInvalidTypecast( "MessageIterator: getting int64_t and type is not DataType::INT64" );
     }
 
-    return m_priv->m_demarshal->demarshal_int64_t();
+    return m_demarshal.demarshal_int64_t();
 }
 
 uint64_t MessageIterator::get_uint64() {
@@ -552,7 +556,7 @@ uint64_t MessageIterator::get_uint64() {
         throw ErrorInvalidTypecast( "MessageIterator: getting uint64_t and type is not DataType::UINT64" );
     }
 
-    return m_priv->m_demarshal->demarshal_uint64_t();
+    return m_demarshal.demarshal_uint64_t();
 }
 
 double MessageIterator::get_double() {
@@ -560,7 +564,7 @@ double MessageIterator::get_double() {
         throw ErrorInvalidTypecast( "MessageIterator: getting double and type is not DataType::DOUBLE" );
     }
 
-    return m_priv->m_demarshal->demarshal_double();
+    return m_demarshal.demarshal_double();
 }
 
 std::string MessageIterator::get_string() {
@@ -569,17 +573,17 @@ std::string MessageIterator::get_string() {
     }
 
     if( this->arg_type() == DataType::SIGNATURE ) {
-        return m_priv->m_demarshal->demarshal_signature();
+        return m_demarshal.demarshal_signature();
     }
 
-    return m_priv->m_demarshal->demarshal_string();
+    return m_demarshal.demarshal_string();
 }
 
 std::shared_ptr<FileDescriptor> MessageIterator::get_filedescriptor() {
     std::shared_ptr<FileDescriptor> fd;
-    int32_t fd_location = m_priv->m_demarshal->demarshal_int32_t();
+    int32_t fd_location = m_demarshal.demarshal_int32_t();
 
-    int raw_fd = m_priv->m_message->filedescriptor_at_location( fd_location );
+    int raw_fd = m_message->filedescriptor_at_location( fd_location );
 
     if( raw_fd < 0 ) {
         return FileDescriptor::create( -1 );
@@ -595,6 +599,84 @@ std::shared_ptr<FileDescriptor> MessageIterator::get_filedescriptor() {
     return FileDescriptor::create( new_fd );
 }
 
+void MessageIterator::get_memfd_array( std::vector<uint8_t>& array ) {
+    int32_t fd_location = m_demarshal.demarshal_int32_t();
+    int raw_fd = m_message->filedescriptor_at_location( fd_location );
+
+    if( raw_fd < 0 ) {
+        throw ErrorInvalidTypecast( "MessageIterator: no file descriptor for memfd array" );
+    }
+
+#if DBUS_CXX_HAS_MEMFD
+    // If the sender could still shrink the file, reading the mapping
+    // could fault with SIGBUS, so only accept a sealed memfd.
+    int seals = fcntl( raw_fd, F_GET_SEALS );
+
+    if( seals < 0 || ( seals & ( F_SEAL_SHRINK | F_SEAL_WRITE ) ) != ( F_SEAL_SHRINK | F_SEAL_WRITE ) ) {
+        throw ErrorInvalidTypecast( "MessageIterator: extracting std::vector<uint8_t> from an unsealed file descriptor" );
+    }
+
+    struct stat fd_stat;
+
+    if( fstat( raw_fd, &fd_stat ) < 0 ) {
+        throw ErrorInvalidTypecast( "MessageIterator: unable to stat memfd array" );
+    }
+
+    // The size comes from the peer, so check it before anything is sized by it
+    if( fd_stat.st_size < 0 ||
+        static_cast<uint64_t>( fd_stat.st_size ) > Validator::maximum_memfd_array_size() ) {
+        throw ErrorInvalidTypecast( "MessageIterator: memfd array is too large" );
+    }
+
+    array.clear();
+
+    if( fd_stat.st_size == 0 ) {
+        return;
+    }
+
+    void* mapped = mmap( nullptr, fd_stat.st_size, PROT_READ, MAP_PRIVATE, raw_fd, 0 );
+
+    if( mapped == MAP_FAILED ) {
+        throw ErrorInvalidTypecast( "MessageIterator: unable to map memfd array" );
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>( mapped );
+    array.assign( data, data + fd_stat.st_size );
+    munmap( mapped, fd_stat.st_size );
+#else
+    throw ErrorInvalidTypecast( "MessageIterator: memfd arrays are not supported on this platform" );
+#endif
+}
+
+uint32_t MessageIterator::fixed_array_count( int elementSize ) {
+    m_demarshal.align( 4 );
+
+    if( m_demarshal.remaining() < 4 ) {
+        throw ErrorInvalidTypecast( "MessageIterator: array length runs past the end of the message" );
+    }
+
+    uint32_t arrayLength = m_demarshal.demarshal_uint32_t();
+
+    // The length comes from the peer, so check it before anything is sized by it
+    m_demarshal.align( elementSize );
+
+    if( arrayLength > m_demarshal.remaining() ) {
+        throw ErrorInvalidTypecast( "MessageIterator: array runs past the end of the message" );
+    }
+
+    if( arrayLength % elementSize != 0 ) {
+        throw ErrorInvalidTypecast( "MessageIterator: array length is not a multiple of the element size" );
+    }
+
+    return arrayLength / elementSize;
+}
+
+void MessageIterator::get_fixed_array( void* data, uint32_t count, int elementSize ) {
+    if( !m_demarshal.demarshal_fixed_array( data, count, elementSize ) ) {
+        throw ErrorInvalidTypecast( "MessageIterator: array runs past the end of the message" );
+    }
+}
+
 Variant MessageIterator::get_variant() {
     MessageIterator subiter = this->recurse();
 
@@ -602,15 +684,15 @@ Variant MessageIterator::get_variant() {
 }
 
 Signature MessageIterator::get_signature() {
-    return m_priv->m_demarshal->demarshal_signature();
+    return m_demarshal.demarshal_signature();
 }
 
 void MessageIterator::align( int alignment ) {
-    m_priv->m_demarshal->align( alignment );
+    m_demarshal.align( alignment );
 }
 
 SignatureIterator MessageIterator::signature_iterator() {
-    return m_priv->m_signatureIterator;
+    return m_signatureIterator;
 }
 
 }
@@ -55,6 +55,13 @@ class Message;
 /**
  * Extraction iterator allowing values to be retrieved from a message
  *
+ * The iterator is only a position in the body of the message and in its
+ * signature, so creating, copying and recursing into it does not allocate.
+ * Every iterator reads from its own position, including copies and the
+ * sub-iterators that recurse() returns; moving past a container with
+ * next() jumps over whatever part of it has not been read.  An iterator
+ * must not outlive the message.
+ *
  * @ingroup message
  *
  * @author Rick L Vinyard Jr <rvinyard@cs.nmsu.edu>
@@ -68,12 +75,23 @@ private:
      * @param d The data type we are iterating over
      * @param sig The signature within the data type
      * @param message Our parent message
-     * @param demarshal The demarshaller
+     * @param demarshal Where the container starts
      */
     MessageIterator( DataType d,
         SignatureIterator sig,
         const Message* message,
-        std::shared_ptr<Demarshaling> demarshal );
+        const Demarshaling& demarshal );
+
+    /**
+     * Create an iterator that points at a value in the middle of a message
+     *
+     * @param message Our parent message
+     * @param sig The type of the value
+     * @param offset Where the value starts in the body of the message
+     */
+    MessageIterator( const Message* message,
+        SignatureIterator sig,
+        uint32_t offset );
 
 public:
 
@@ -112,6 +130,17 @@ public:
 
     MessageIterator operator ++( int );
 
+    /**
+     * Moves the iterator past the value that it points to without decoding it,
+     * as if it had been extracted.  Arrays are jumped over using their length,
+     * so this is cheap no matter how large the value is.
+     *
+     * @return true if there is another field to read, false if the iterator
+     *         has been invalidated.  A value that runs past the end of the
+     *         data also invalidates the iterator.
+     */
+    bool skip();
+
     bool operator==( const MessageIterator& other );
 
     /** Returns the argument type that the iterator points to */
@@ -161,7 +190,7 @@ public:
 
     template <typename T>
     operator std::vector<T>() {
-        if( !this->is_array() ) {
+        if( !this->is_array() && !this->is_memfd_array<T>() ) {
             throw ErrorInvalidTypecast( "MessageIterator: Extracting non array into std::vector" );
         }
 
@@ -203,10 +232,25 @@ public:
      */
     template <typename T>
     void get_array( std::vector<T>& array ) {
-        if( !this->is_array() ) { /* Should never happen */
+        if( !this->is_array() && !this->is_memfd_array<T>() ) { /* Should never happen */
             throw ErrorInvalidTypecast( "MessageIterator: Extracting non array into std::vector" );
         }
 
+        if constexpr( std::is_same<T, uint8_t>::value ) {
+            if( this->is_memfd_array<T>() ) {
+                get_memfd_array( array );
+                return;
+            }
+        }
+
+        if constexpr( is_fixed_array_type<T>::value ) {
+            if( this->element_type() == DBus::type( T() ) ) {
+                array.resize( fixed_array_count( sizeof( T ) ) );
+                get_fixed_array( array.data(), array.size(), sizeof( T ) );
+                return;
+            }
+        }
+
         array.clear();
 
         MessageIterator subiter = this->recurse();
@@ -277,7 +321,7 @@ public:
 
     template <typename T>
     MessageIterator& operator>>( std::vector<T>& v ) {
-        if( !this->is_array() ) {
+        if( !this->is_array() && !this->is_memfd_array<T>() ) {
             throw ErrorInvalidTypecast( "MessageIterator: Extracting non array into std::vector" );
         }
 
@@ -302,6 +346,33 @@ public:
 private:
     SignatureIterator signature_iterator();
 
+    /**
+     * True if we are extracting a std::vector<uint8_t> and the sender
+     * offloaded it into a memfd(see MessageAppendIterator::set_memfd_threshold)
+     */
+    template <typename T>
+    bool is_memfd_array() const {
+        return std::is_same<T, uint8_t>::value && this->arg_type() == DataType::UNIX_FD;
+    }
+
+    /**
+     * Map the memfd that the current UNIX_FD points at and copy it out.
+     */
+    void get_memfd_array( std::vector<uint8_t>& array );
+
+    /**
+     * Read the length of the array of fixed-size values that we point at,
+     * returning the number of elements in it.  get_fixed_array() must be
+     * called next.
+     */
+    uint32_t fixed_array_count( int elementSize );
+
+    /**
+     * Copy out all of the elements of the array of fixed-size values that
+     * we point at, after fixed_array_count().
+     */
+    void get_fixed_array( void* data, uint32_t count, int elementSize );
+
     /**
      * Align our memory to the specified location.  This skips bytes.
      * This is for internal use only; don't call it in client code!
@@ -311,11 +382,21 @@ private:
     void align( int alignment );
 
 private:
-    class priv_data;
-
-    std::shared_ptr<priv_data> m_priv;
+    const Message* m_message;
+    /* Where we are in the body */
+    Demarshaling m_demarshal;
+    /*
+     * Where the value that we point at starts.  If we are still there when
+     * next() is called, the value has not been read and is skipped.
+     */
+    uint32_t m_valueStart;
+    SignatureIterator m_signatureIterator;
+    DataType m_subiterDataType;
+    /* Where the array that a sub-iterator is going over ends */
+    uint32_t m_arrayLastPosition;
 
     friend class Variant;
+    friend class Message;
 };
 
 }
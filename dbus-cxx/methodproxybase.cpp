@@ -29,10 +29,12 @@ class MethodProxyBase::priv_data {
 public:
     priv_data( const std::string& name ) :
         m_interface( nullptr ),
-        m_name( name ) {}
+        m_name( name ),
+        m_memfdThreshold( 0 ) {}
 
     InterfaceProxy* m_interface;
     const std::string m_name;
+    uint32_t m_memfdThreshold;
 };
 
 
@@ -43,6 +45,7 @@ MethodProxyBase::MethodProxyBase( const std::string& name ):
 MethodProxyBase::MethodProxyBase( const MethodProxyBase& other ) :
     m_priv( std::make_unique<priv_data>( other.m_priv->m_name ) ) {
     m_priv->m_interface = other.m_priv->m_interface;
+    m_priv->m_memfdThreshold = other.m_priv->m_memfdThreshold;
 }
 
 std::shared_ptr<MethodProxyBase> MethodProxyBase::create( const std::string& name ) {
@@ -74,6 +77,14 @@ std::shared_ptr<const ReturnMessage> DBus::MethodProxyBase::call( std::shared_pt
     return m_priv->m_interface->call( call_message, timeout_milliseconds );
 }
 
+void MethodProxyBase::set_memfd_threshold( uint32_t threshold ) {
+    m_priv->m_memfdThreshold = threshold;
+}
+
+uint32_t MethodProxyBase::memfd_threshold() const {
+    return m_priv->m_memfdThreshold;
+}
+
 //  std::shared_ptr<PendingCall> DBus::MethodProxyBase::call_async(std::shared_ptr<const CallMessage> call_message, int timeout_milliseconds) const
 //  {
 //    if ( not m_priv->m_interface ) return std::shared_ptr<PendingCall>();
@@ -69,6 +69,18 @@ public:
 
     std::shared_ptr<const ReturnMessage> call( std::shared_ptr<const CallMessage>, int timeout_milliseconds = -1 ) const;
 
+    /**
+     * Send std::vector<uint8_t> arguments of at least this many bytes in a
+     * sealed memfd instead of inline.  The remote method must also be
+     * implemented with dbus-cxx.
+     *
+     * @see MessageAppendIterator::set_memfd_threshold
+     * @param threshold The minimum size to offload, or 0 to never offload(default)
+     */
+    void set_memfd_threshold( uint32_t threshold );
+
+    uint32_t memfd_threshold() const;
+
     //      std::shared_ptr<PendingCall> call_async( std::shared_ptr<const CallMessage>, int timeout_milliseconds=-1 ) const;
 
 private:
@@ -107,7 +119,10 @@ public:
         DBUSCXX_DEBUG_STDSTR( "DBus.MethodProxy", debug_str.str() );
 
         std::shared_ptr<CallMessage> _callmsg = this->create_call_message();
-        ( *_callmsg << ... << args );
+        MessageAppendIterator iter = _callmsg->append();
+        iter.set_memfd_threshold( memfd_threshold() );
+        iter.reserve_for( args... );
+        ( void )( iter << ... << args );
         std::shared_ptr<const ReturnMessage> retmsg = this->call( _callmsg, -1 );
     }
 
@@ -154,6 +169,8 @@ public:
 
         std::shared_ptr<CallMessage> _callmsg = this->create_call_message();
         MessageAppendIterator iter = _callmsg->append();
+        iter.set_memfd_threshold( memfd_threshold() );
+        iter.reserve_for( args... );
         ( void )( iter << ... << args );
         std::shared_ptr<const ReturnMessage> retmsg = this->call( _callmsg, -1 );
         T_return _retval;
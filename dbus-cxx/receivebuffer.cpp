@@ -0,0 +1,235 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "receivebuffer.h"
+#include "demarshaling.h"
+
+#include <new>
+#include <string.h>
+
+using DBus::priv::ReceiveBuffer;
+
+ReceiveBuffer::ReceiveBuffer() :
+    m_capacity( 0 ),
+    m_start( 0 ),
+    m_end( 0 ),
+    m_smallReads( 0 )
+{}
+
+ReceiveBuffer::~ReceiveBuffer() {
+}
+
+bool ReceiveBuffer::set_capacity( size_t capacity ) {
+    std::shared_ptr<uint8_t> new_storage;
+
+    if( capacity < size() ) {
+        capacity = size();
+    }
+
+    new_storage.reset( new( std::nothrow ) uint8_t[ capacity ], std::default_delete<uint8_t[]>() );
+
+    if( !new_storage ) {
+        return false;
+    }
+
+    if( size() > 0 ) {
+        ::memcpy( new_storage.get(), data(), size() );
+    }
+
+    m_storage = std::move( new_storage );
+    m_capacity = capacity;
+    m_end = size();
+    m_start = 0;
+
+    return true;
+}
+
+void ReceiveBuffer::clear() {
+    m_start = 0;
+    m_end = 0;
+
+    if( is_shared() && !set_capacity( RECEIVE_BUFFER_SIZE ) ) {
+        // We can not write over what is there, so we have nowhere to read to
+        m_storage.reset();
+        m_capacity = 0;
+    }
+}
+
+std::shared_ptr<uint8_t> ReceiveBuffer::message_data( size_t message_size ) const {
+    std::shared_ptr<uint8_t> copy;
+
+    if( message_size * RECEIVE_BUFFER_SHARE_FRACTION >= m_capacity ) {
+        return shared_data();
+    }
+
+    copy.reset( new( std::nothrow ) uint8_t[ message_size ], std::default_delete<uint8_t[]>() );
+
+    if( !copy ) {
+        return shared_data();
+    }
+
+    ::memcpy( copy.get(), data(), message_size );
+
+    return copy;
+}
+
+bool ReceiveBuffer::prepare_read( size_t message_size ) {
+    size_t wanted = message_size > RECEIVE_BUFFER_SIZE ? message_size : RECEIVE_BUFFER_SIZE;
+
+    compact();
+
+    if( wanted > m_capacity ) {
+        m_smallReads = 0;
+        return set_capacity( wanted );
+    }
+
+    if( m_capacity > RECEIVE_BUFFER_SIZE ) {
+        if( wanted > RECEIVE_BUFFER_SIZE ) {
+            m_smallReads = 0;
+        } else if( ++m_smallReads >= RECEIVE_BUFFER_SHRINK_READS ) {
+            m_smallReads = 0;
+            return set_capacity( RECEIVE_BUFFER_SIZE );
+        }
+    }
+
+    return true;
+}
+
+bool ReceiveBuffer::append( const uint8_t* data, size_t data_size ) {
+    ssize_t message_size = front_message_size();
+
+    if( message_size < 0 ) {
+        message_size = 0;
+    }
+
+    if( !prepare_read( message_size ) ) {
+        return false;
+    }
+
+    if( free_size() < data_size &&
+        !set_capacity( size() + data_size ) ) {
+        return false;
+    }
+
+    ::memcpy( free_space(), data, data_size );
+    produce( data_size );
+
+    return true;
+}
+
+ssize_t ReceiveBuffer::front_message_size() const {
+    const uint8_t* header_raw = data();
+    uint32_t header_array_len;
+    uint32_t body_len;
+
+    if( size() < 16 ) {
+        return 0;
+    }
+
+    if( header_raw[0] == 'l' ) {
+        /* Little-endian */
+        body_len = static_cast<uint32_t>( header_raw[ 7 ] ) << 24 |
+            static_cast<uint32_t>( header_raw[ 6 ] ) << 16 |
+            static_cast<uint32_t>( header_raw[ 5 ] ) << 8 |
+            static_cast<uint32_t>( header_raw[ 4 ] ) << 0;
+
+        header_array_len = static_cast<uint32_t>( header_raw[ 15 ] ) << 24 |
+            static_cast<uint32_t>( header_raw[ 14 ] ) << 16 |
+            static_cast<uint32_t>( header_raw[ 13 ] ) << 8 |
+            static_cast<uint32_t>( header_raw[ 12 ] ) << 0;
+    } else if( header_raw[0] == 'B' ) {
+        /* Big-endian */
+        body_len = static_cast<uint32_t>( header_raw[ 4 ] ) << 24 |
+            static_cast<uint32_t>( header_raw[ 5 ] ) << 16 |
+            static_cast<uint32_t>( header_raw[ 6 ] ) << 8 |
+            static_cast<uint32_t>( header_raw[ 7 ] ) << 0;
+
+        header_array_len = static_cast<uint32_t>( header_raw[ 12 ] ) << 24 |
+            static_cast<uint32_t>( header_raw[ 13 ] ) << 16 |
+            static_cast<uint32_t>( header_raw[ 14 ] ) << 8 |
+            static_cast<uint32_t>( header_raw[ 15 ] ) << 0;
+    } else {
+        return -1;
+    }
+
+    uint64_t padded_array_len = header_array_len;
+
+    if( 0 != padded_array_len % 8 ) {
+        padded_array_len += 8 - ( padded_array_len % 8 );
+    }
+
+    return 12 + ( 4 + padded_array_len ) + body_len;
+}
+
+uint32_t ReceiveBuffer::front_message_unix_fds() const {
+    ssize_t message_size = front_message_size();
+
+    if( message_size <= 0 || static_cast<size_t>( message_size ) > size() ) {
+        return 0;
+    }
+
+    const uint8_t* header_raw = data();
+    Endianess endian = header_raw[ 0 ] == 'l' ? Endianess::Little : Endianess::Big;
+    Demarshaling demarshal( header_raw, message_size, endian );
+    static const Signature field_signature( "(yv)" );
+
+    demarshal.set_data_offset( 12 );
+    uint64_t fields_end = 16 + static_cast<uint64_t>( demarshal.demarshal_uint32_t() );
+
+    // Each field is a struct of the code and a variant
+    while( demarshal.current_offset() < fields_end ) {
+        demarshal.align( 8 );
+        uint32_t field_start = demarshal.current_offset();
+
+        if( demarshal.remaining() >= 8 &&
+            header_raw[ field_start ] == static_cast<uint8_t>( MessageHeaderFields::Unix_FDs ) &&
+            header_raw[ field_start + 1 ] == 1 &&
+            header_raw[ field_start + 2 ] == 'u' ) {
+            demarshal.set_data_offset( field_start + 4 );
+            return demarshal.demarshal_uint32_t();
+        }
+
+        if( !demarshal.skip( field_signature.begin() ) ) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void ReceiveBuffer::compact() {
+    if( m_start == 0 ) {
+        return;
+    }
+
+    if( is_shared() ) {
+        /*
+         * Somebody is still using the start of the buffer.  Move to a buffer
+         * of the default size rather than the current one, so that the messages
+         * that keep the old storage alive are not joined by a copy of it;
+         * prepare_read() grows the new buffer again if a large message needs it.
+         */
+        m_smallReads = 0;
+        set_capacity( RECEIVE_BUFFER_SIZE );
+        return;
+    }
+
+    ::memmove( m_storage.get(), data(), size() );
+    m_end -= m_start;
+    m_start = 0;
+}
@@ -0,0 +1,177 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUSCXX_RECEIVEBUFFER_H
+#define DBUSCXX_RECEIVEBUFFER_H
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The default size of a receive buffer */
+#define RECEIVE_BUFFER_SIZE 8192
+/* Number of reads that fit in the default buffer before an enlarged buffer is shrunk */
+#define RECEIVE_BUFFER_SHRINK_READS 16
+#define RECEIVE_BUFFER_SHARE_FRACTION 4
+
+namespace DBus {
+
+namespace priv {
+
+/**
+ * The buffer that a transport receives data from the socket into.  As much
+ * data as the socket has is read in at once; complete messages are consumed
+ * from the front of the buffer, and any partial message left over is moved
+ * back to the start of the buffer before the next read.
+ *
+ * The storage is reference counted, so that a message can be created on top
+ * of its bytes with shared_data() instead of copying them.  Bytes that have
+ * been consumed are never written to again while anything else holds a
+ * reference to the storage; the buffer moves to new storage of the default
+ * size instead, taking only the partial message that is left over with it.
+ */
+class ReceiveBuffer {
+public:
+    ReceiveBuffer();
+
+    ~ReceiveBuffer();
+
+    ReceiveBuffer( const ReceiveBuffer& ) = delete;
+    ReceiveBuffer& operator=( const ReceiveBuffer& ) = delete;
+
+    /** The start of the data that has not been consumed yet */
+    uint8_t* data() {
+        return m_storage.get() + m_start;
+    }
+
+    const uint8_t* data() const {
+        return m_storage.get() + m_start;
+    }
+
+    /**
+     * The same as data(), but sharing ownership of the storage, so that the
+     * bytes stay valid after they have been consumed.
+     */
+    std::shared_ptr<uint8_t> shared_data() const {
+        return std::shared_ptr<uint8_t>( m_storage, m_storage.get() + m_start );
+    }
+
+    /**
+     * Get the message of the given size at the front of this buffer, for it
+     * to be consumed afterwards.  A message that takes up at least
+     * 1/RECEIVE_BUFFER_SHARE_FRACTION of the buffer shares the storage like
+     * shared_data() does; anything smaller is copied, so that holding on to a
+     * small message does not keep a large buffer alive.
+     */
+    std::shared_ptr<uint8_t> message_data( size_t message_size ) const;
+
+    /** The number of bytes that have been read but not consumed */
+    size_t size() const {
+        return m_end - m_start;
+    }
+
+    uint8_t* free_space() {
+        return m_storage.get() + m_end;
+    }
+
+    size_t free_size() const {
+        return m_capacity - m_end;
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    /** Mark the given number of bytes as having been read into free_space() */
+    void produce( size_t num_bytes ) {
+        m_end += num_bytes;
+    }
+
+    /** Mark the given number of bytes at data() as consumed */
+    void consume( size_t num_bytes ) {
+        m_start += num_bytes;
+
+        // The space can only be used again straight away if it is all ours
+        if( m_start >= m_end && !is_shared() ) {
+            m_start = 0;
+            m_end = 0;
+        }
+    }
+
+    /** Throw away all of the data, so that the whole buffer is free */
+    void clear();
+
+    /**
+     * Set the capacity of this buffer.  The buffer may both grow and shrink,
+     * but never below the amount of unconsumed data that it holds.
+     */
+    bool set_capacity( size_t capacity );
+
+    /**
+     * Get ready to read more data into this buffer.  Any partial data is
+     * moved to the front, and the buffer is resized so that a message of the
+     * given size(0 if not known yet) will fit.  Once we have gone
+     * RECEIVE_BUFFER_SHRINK_READS reads without needing the extra space, an
+     * enlarged buffer is shrunk back down to its default size.
+     */
+    bool prepare_read( size_t message_size );
+
+    /**
+     * Copy the given data to the end of this buffer, growing it if needed.
+     */
+    bool append( const uint8_t* data, size_t size );
+
+    /**
+     * Determine the total size of the message at the front of this buffer.
+     *
+     * @return The size of the message, 0 if we don't have enough data to
+     * determine the size yet, -1 if the data is not a valid message.
+     */
+    ssize_t front_message_size() const;
+
+    /**
+     * Find the number of file descriptors that the header of the complete
+     * message at the front of this buffer says that it has, without parsing
+     * the rest of the message.  This is used to throw away the file
+     * descriptors of a message that could not be parsed.
+     *
+     * @return The value of the Unix_FDs header field, or 0 if there is none
+     */
+    uint32_t front_message_unix_fds() const;
+
+private:
+    bool is_shared() const {
+        return m_storage.use_count() > 1;
+    }
+
+    void compact();
+
+private:
+    std::shared_ptr<uint8_t> m_storage;
+    size_t m_capacity;
+    size_t m_start;
+    size_t m_end;
+    uint32_t m_smallReads;
+};
+
+} /* namespace priv */
+
+} /* namespace DBus */
+
+#endif /* DBUSCXX_RECEIVEBUFFER_H */
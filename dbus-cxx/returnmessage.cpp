@@ -27,29 +27,28 @@ ReturnMessage::ReturnMessage( ) :
 }
 
 std::shared_ptr<ReturnMessage> ReturnMessage::create() {
-    return std::shared_ptr<ReturnMessage>( new ReturnMessage() );
+    Message* msg = take_from_pool( MessageType::RETURN );
+
+    if( !msg ) {
+        msg = new ReturnMessage();
+    }
+
+    return std::static_pointer_cast<ReturnMessage>( manage_pooled( msg ) );
 }
 
 std::shared_ptr<ReturnMessage> ReturnMessage::create( std::shared_ptr<const CallMessage> callee ) {
-    std::shared_ptr<ReturnMessage> ret = std::shared_ptr<ReturnMessage>( new ReturnMessage() );
+    std::shared_ptr<ReturnMessage> ret = create();
     ret->set_reply_serial( callee->serial() );
     return ret;
 }
 
 bool ReturnMessage::set_reply_serial( uint32_t s ) {
-    Variant serialField = Variant( s );
-    set_header_field( MessageHeaderFields::Reply_Serial, serialField );
+    set_header_uint32( MessageHeaderFields::Reply_Serial, s );
     return false;
 }
 
 uint32_t ReturnMessage::reply_serial() const {
-    Variant field = header_field( MessageHeaderFields::Reply_Serial );
-
-    if( field.type() == DataType::UINT32 ) {
-        return field.to_uint32();
-    }
-
-    return 0;
+    return header_uint32( MessageHeaderFields::Reply_Serial );
 }
 
 MessageType ReturnMessage::type() const {
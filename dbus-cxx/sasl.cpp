@@ -20,45 +20,139 @@
 
 #include "dbus-cxx-private.h"
 
+#include <cctype>
 #include <cstring>
+#include <errno.h>
 #include <ostream>
 #include <poll.h>
-#include <regex>
 #include <sstream>
 #include <unistd.h>
 
+#include <sys/socket.h>
+
 using DBus::priv::SASL;
 
 class SASL::priv_data {
 public:
     priv_data( int fd, bool negotiateFDPassing ) :
         m_fd( fd ),
-        m_negotiateFDpassing( negotiateFDPassing )
+        m_negotiateFDpassing( negotiateFDPassing ),
+        m_gotCredentialsByte( false ),
+        m_authenticated( false ),
+        m_negotiatedFD( false ),
+        m_waitingForData( false ),
+        m_clientCommands( 0 )
     {}
 
     int m_fd;
     bool m_negotiateFDpassing;
+
+    /* Where a client that has connected to us is in its authentication */
+    bool m_gotCredentialsByte;
+    bool m_authenticated;
+    bool m_negotiatedFD;
+    /* True if we have asked the client for the DATA of its AUTH */
+    bool m_waitingForData;
+    int m_clientCommands;
+    /* The part of the current line that the client has sent so far */
+    std::string m_partialLine;
 };
 
-static const std::regex OK_REGEX( "OK ([a-z0-9]*)" );
-static const std::regex DATA_REGEX( "DATA ([a-z0-9]*)" );
-static const std::regex ERROR_REGEX( "ERROR(.*)" );
-static const std::regex AGREE_UNIX_FD_REGEX( "AGREE_UNIX_FD" );
-static const std::regex REJECTED_REGEX( "REJECTED (.*)" );
 static const char* LOGGER_NAME = "DBus.priv.SASL";
 
+/* The maximum number of commands a client may send before it has to BEGIN */
+#define SERVER_MAX_COMMANDS 16
+/* The maximum length of a line that either side may send */
+#define MAX_LINE_LENGTH 1024
+
+namespace DBus {
+namespace priv {
+
+/**
+ * The commands of the SASL protocol, from either side
+ */
+enum class SASLCommand {
+    Auth,
+    Cancel,
+    Begin,
+    Data,
+    Error,
+    NegotiateUnixFD,
+    Rejected,
+    OK,
+    AgreeUnixFD,
+    Unknown
+};
+
+/**
+ * What we are still waiting on the server to tell us
+ */
+enum class SASLClientState {
+    WaitingForOK,
+    WaitingForAgreeUnixFD,
+    Authenticated,
+    Failed
+};
+
+} /* namespace priv */
+} /* namespace DBus */
+
+using DBus::priv::SASLCommand;
+using DBus::priv::SASLClientState;
+
 static int hexchar2int( char c ) {
     if( c >= '0' && c <= '9' ) {
         return c - 48;
     }
 
     if( c >= 'a' && c <= 'f' ) {
-        return c - 97;
+        return c - 'a' + 10;
+    }
+
+    if( c >= 'A' && c <= 'F' ) {
+        return c - 'A' + 10;
     }
 
     return 0;
 }
 
+static bool is_hex_string( const std::string& str ) {
+    for( const char& c : str ) {
+        if( !isxdigit( static_cast<unsigned char>( c ) ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Split a line into its command and the argument(everything after the
+ * first space).
+ */
+static SASLCommand parse_command( const std::string& line, std::string* argument ) {
+    size_t space = line.find( ' ' );
+    std::string command = line.substr( 0, space );
+
+    if( space == std::string::npos ) {
+        argument->clear();
+    } else {
+        *argument = line.substr( space + 1 );
+    }
+
+    if( command == "AUTH" ) { return SASLCommand::Auth; }
+    if( command == "CANCEL" ) { return SASLCommand::Cancel; }
+    if( command == "BEGIN" ) { return SASLCommand::Begin; }
+    if( command == "DATA" ) { return SASLCommand::Data; }
+    if( command == "ERROR" ) { return SASLCommand::Error; }
+    if( command == "NEGOTIATE_UNIX_FD" ) { return SASLCommand::NegotiateUnixFD; }
+    if( command == "REJECTED" ) { return SASLCommand::Rejected; }
+    if( command == "OK" ) { return SASLCommand::OK; }
+    if( command == "AGREE_UNIX_FD" ) { return SASLCommand::AgreeUnixFD; }
+
+    return SASLCommand::Unknown;
+}
+
 SASL::SASL( int fd, bool negotiateFDPassing ) :
     m_priv( std::make_unique<priv_data>( fd, negotiateFDPassing ) ) {
 
@@ -66,97 +160,384 @@ SASL::SASL( int fd, bool negotiateFDPassing ) :
 
 SASL::~SASL() {}
 
-std::tuple<bool, bool, std::vector<uint8_t>> SASL::authenticate() {
-    bool success = false;
+std::tuple<bool, bool, std::vector<uint8_t>> SASL::authenticate( const std::vector<uint8_t>& pipelinedData ) {
     bool negotiatedFD = false;
     std::vector<uint8_t> serverGUID;
     __uid_t uid = getuid();
-    std::string line;
-    std::smatch regex_match;
-
-    write_data_with_newline( "AUTH EXTERNAL " + encode_as_hex( uid ) );
-
-    line = read_data();
-    if( line.length() == 0 ){
-        goto out;
-    }
-
-    if( std::regex_search( line, regex_match, OK_REGEX ) ) {
-        serverGUID = hex_to_vector( regex_match[ 1 ] );
-    } else if( std::regex_search( line, regex_match, ERROR_REGEX ) ) {
-        SIMPLELOGGER_DEBUG( "DBus.priv.SASL", "Unable to authenticate: "
-            + regex_match[ 1 ].str() );
-        goto out;
-    } else if( std::regex_search( line, regex_match, REJECTED_REGEX ) ) {
-        SIMPLELOGGER_DEBUG( "DBus.priv.SASL", "Rejected authentication, available modes: "
-            + regex_match[ 1 ].str() );
-        goto out;
-    } else {
-        // Unknown command, return an error to the server
-        write_data_with_newline( "ERROR Unrecognized response" );
-        goto out;
-    }
+    std::string commands;
+    SASLClientState state = SASLClientState::WaitingForOK;
+
+    commands = "AUTH EXTERNAL " + encode_as_hex( uid ) + "\r\n";
 
     if( m_priv->m_negotiateFDpassing ) {
-        write_data_with_newline( "NEGOTIATE_UNIX_FD" );
-        line = read_data();
+        commands += "NEGOTIATE_UNIX_FD\r\n";
+    }
+
+    commands += "BEGIN\r\n";
+    commands.append( pipelinedData.begin(), pipelinedData.end() );
+
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Sending AUTH EXTERNAL"
+        << ( m_priv->m_negotiateFDpassing ? ", NEGOTIATE_UNIX_FD" : "" )
+        << ", BEGIN and " << pipelinedData.size() << " bytes of data" );
 
-        if( line.length() == 0 ){
-            goto out;
+    if( !write_data( commands.data(), commands.size() ) ) {
+        return std::make_tuple( false, false, serverGUID );
+    }
+
+    while( state == SASLClientState::WaitingForOK ||
+        state == SASLClientState::WaitingForAgreeUnixFD ) {
+        std::string argument;
+        std::string line = read_line( -1 );
+
+        if( line.empty() ) {
+            state = SASLClientState::Failed;
+            break;
         }
 
-        if( std::regex_search( line, regex_match, AGREE_UNIX_FD_REGEX ) ) {
-            negotiatedFD = true;
+        SASLCommand command = parse_command( line, &argument );
+
+        if( state == SASLClientState::WaitingForOK ) {
+            if( command == SASLCommand::OK && is_hex_string( argument ) ) {
+                serverGUID = hex_to_vector( argument );
+                state = m_priv->m_negotiateFDpassing ?
+                    SASLClientState::WaitingForAgreeUnixFD :
+                    SASLClientState::Authenticated;
+            } else if( command == SASLCommand::Rejected ) {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Rejected authentication, available modes: " + argument );
+                state = SASLClientState::Failed;
+            } else if( command == SASLCommand::Error ) {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to authenticate: " + argument );
+                state = SASLClientState::Failed;
+            } else {
+                // We have already sent BEGIN, so there's no way to recover from this
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unexpected response while authenticating: " + line );
+                state = SASLClientState::Failed;
+            }
+        } else {
+            if( command == SASLCommand::AgreeUnixFD ) {
+                negotiatedFD = true;
+                state = SASLClientState::Authenticated;
+            } else if( command == SASLCommand::Error ) {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to negotiate FD passing: " + argument );
+                state = SASLClientState::Authenticated;
+            } else {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unexpected response to NEGOTIATE_UNIX_FD: " + line );
+                state = SASLClientState::Failed;
+            }
         }
+    }
 
-        if( std::regex_search( line, regex_match, ERROR_REGEX ) ) {
-            SIMPLELOGGER_DEBUG( "DBus.priv.SASL", "Unable to negotiate FD passing: "
-                + regex_match[ 1 ].str() );
+    return std::make_tuple( state == SASLClientState::Authenticated, negotiatedFD, serverGUID );
+}
+
+DBus::priv::SASLServerStatus SASL::continue_client_authentication( const std::string& serverGUID ) {
+    if( !m_priv->m_gotCredentialsByte ) {
+        char nul_byte;
+        ssize_t ret = ::recv( m_priv->m_fd, &nul_byte, 1, 0 );
+
+        if( ret < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+            return SASLServerStatus::InProgress;
         }
+
+        if( ret != 1 || nul_byte != 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Invalid credentials byte from client" );
+            return SASLServerStatus::Failed;
+        }
+
+        m_priv->m_gotCredentialsByte = true;
     }
 
-    write_data_with_newline( "BEGIN" );
+    while( true ) {
+        std::string line;
+        bool failed = false;
 
-    success = true;
+        if( !read_available_line( &line, &failed ) ) {
+            return failed ? SASLServerStatus::Failed : SASLServerStatus::InProgress;
+        }
 
-out:
+        SASLServerStatus status = handle_client_line( line, serverGUID );
 
-    return std::make_tuple( success, negotiatedFD, serverGUID );
+        if( status != SASLServerStatus::InProgress ) {
+            return status;
+        }
+    }
 }
 
-int SASL::write_data_with_newline( std::string data ) {
-    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Sending command: " + data );
-    data += "\r\n";
-    return ::write( m_priv->m_fd, data.c_str(), data.length() );
+bool SASL::client_negotiated_fd_passing() const {
+    return m_priv->m_negotiatedFD;
 }
 
-std::string SASL::read_data() {
+DBus::priv::SASLServerStatus SASL::handle_client_line( const std::string& line, const std::string& serverGUID ) {
+    std::string argument;
+    SASLCommand command = parse_command( line, &argument );
+
+    if( m_priv->m_waitingForData ) {
+        // The client is answering the DATA that we sent for its AUTH
+        m_priv->m_waitingForData = false;
+
+        if( command == SASLCommand::Data && is_hex_string( argument ) &&
+            check_client_uid( argument ) ) {
+            write_data_with_newline( "OK " + serverGUID );
+            m_priv->m_authenticated = true;
+        } else {
+            write_data_with_newline( "REJECTED EXTERNAL" );
+        }
+
+        return SASLServerStatus::InProgress;
+    }
+
+    if( ++m_priv->m_clientCommands > SERVER_MAX_COMMANDS ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client did not authenticate" );
+        return SASLServerStatus::Failed;
+    }
+
+    switch( command ) {
+    case SASLCommand::Auth: {
+        size_t space = argument.find( ' ' );
+        std::string mechanism = argument.substr( 0, space );
+        std::string hexUID;
+
+        if( space != std::string::npos ) {
+            hexUID = argument.substr( space + 1 );
+        }
+
+        if( m_priv->m_authenticated || mechanism != "EXTERNAL" || !is_hex_string( hexUID ) ) {
+            write_data_with_newline( "REJECTED EXTERNAL" );
+            break;
+        }
+
+        if( hexUID.empty() ) {
+            // No initial response, so ask for it
+            write_data_with_newline( "DATA" );
+            m_priv->m_waitingForData = true;
+            break;
+        }
+
+        if( check_client_uid( hexUID ) ) {
+            write_data_with_newline( "OK " + serverGUID );
+            m_priv->m_authenticated = true;
+        } else {
+            write_data_with_newline( "REJECTED EXTERNAL" );
+        }
+
+        break;
+    }
+
+    case SASLCommand::NegotiateUnixFD:
+        if( m_priv->m_authenticated ) {
+            write_data_with_newline( "AGREE_UNIX_FD" );
+            m_priv->m_negotiatedFD = true;
+        } else {
+            write_data_with_newline( "ERROR Not authenticated" );
+        }
+
+        break;
+
+    case SASLCommand::Begin:
+        if( !m_priv->m_authenticated ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client did not authenticate" );
+            return SASLServerStatus::Failed;
+        }
+
+        return SASLServerStatus::Authenticated;
+
+    case SASLCommand::Cancel:
+    case SASLCommand::Error:
+        m_priv->m_authenticated = false;
+        write_data_with_newline( "REJECTED EXTERNAL" );
+        break;
+
+    default:
+        write_data_with_newline( "ERROR Unknown command" );
+        break;
+    }
+
+    return SASLServerStatus::InProgress;
+}
+
+bool SASL::check_client_uid( const std::string& hexUID ) {
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t credentials_len = sizeof( struct ucred );
+
+    if( getsockopt( m_priv->m_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_len ) < 0 ) {
+        std::string errmsg = strerror( errno );
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to get client credentials: " + errmsg );
+        return false;
+    }
+
+    // The client may tell us who it claims to be, but it must match what the kernel says
+    if( !hexUID.empty() ) {
+        std::vector<uint8_t> uidChars = hex_to_vector( hexUID );
+        std::string uidString( uidChars.begin(), uidChars.end() );
+        std::ostringstream actualUID;
+
+        actualUID << credentials.uid;
+
+        if( uidString != actualUID.str() ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client claimed uid " + uidString
+                + " but is " + actualUID.str() );
+            return false;
+        }
+    }
+
+    if( credentials.uid != getuid() ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Rejecting client running as a different user" );
+        return false;
+    }
+
+    return true;
+#else
+    SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to get client credentials on this platform" );
+    return false;
+#endif
+}
+
+std::string SASL::read_line( int timeoutMs ) {
     std::string line_read;
     char dataBuffer[ 512 ];
-    ssize_t bytesRead;
 
-    pollfd pollfd;
-    pollfd.fd = m_priv->m_fd;
-    pollfd.events = POLLIN;
+    /*
+     * Only take one line off of the socket: the other side may send a
+     * message right after its last line, and that belongs to the transport.
+     */
+    while( line_read.size() < MAX_LINE_LENGTH ) {
+        pollfd pollfd;
+        pollfd.fd = m_priv->m_fd;
+        pollfd.events = POLLIN;
+
+        if( poll( &pollfd, 1, timeoutMs ) <= 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Timed out waiting for other side" );
+            return std::string();
+        }
 
-    if( poll( &pollfd, 1, -1 ) < 0 ) {
-        std::string errmsg = strerror( errno );
-        SIMPLELOGGER_ERROR( "DBus.priv.SASL", "Unable to poll for response from daemon: " + errmsg );
-        return line_read;
+        ssize_t bytesPeeked = ::recv( m_priv->m_fd, dataBuffer, sizeof( dataBuffer ), MSG_PEEK );
+
+        if( bytesPeeked < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+            continue;
+        }
+
+        if( bytesPeeked <= 0 ) {
+            return std::string();
+        }
+
+        char* newline = static_cast<char*>( memchr( dataBuffer, '\n', bytesPeeked ) );
+        size_t toRead = newline ? ( newline - dataBuffer ) + 1 : bytesPeeked;
+
+        if( ::read( m_priv->m_fd, dataBuffer, toRead ) != static_cast<ssize_t>( toRead ) ) {
+            return std::string();
+        }
+
+        line_read.append( dataBuffer, toRead );
+
+        if( newline ) {
+            if( line_read.size() < 2 || line_read[ line_read.size() - 2 ] != '\r' ) {
+                return std::string();
+            }
+
+            line_read.resize( line_read.size() - 2 );
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Received command: " + line_read );
+            return line_read;
+        }
     }
 
-    // TODO Note that we are making an assumption here that we don't
-    // have a short read.  This may need to be fixed in the future.
-    bytesRead = ::read( m_priv->m_fd, &dataBuffer, 512 );
-    if( bytesRead < 0 ){
-        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to read SASL data!" );
-        return std::string();
+    return std::string();
+}
+
+bool SASL::read_available_line( std::string* line, bool* failed ) {
+    char dataBuffer[ 512 ];
+
+    /*
+     * Take what the client has sent up to the end of the current line,
+     * without waiting for more.  Anything after BEGIN belongs to the transport.
+     */
+    while( true ) {
+        ssize_t bytesPeeked = ::recv( m_priv->m_fd, dataBuffer, sizeof( dataBuffer ), MSG_PEEK );
+
+        if( bytesPeeked < 0 && errno == EINTR ) {
+            continue;
+        }
+
+        if( bytesPeeked < 0 && errno == EAGAIN ) {
+            return false;
+        }
+
+        if( bytesPeeked <= 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client went away while authenticating" );
+            *failed = true;
+            return false;
+        }
+
+        char* newline = static_cast<char*>( memchr( dataBuffer, '\n', bytesPeeked ) );
+        size_t toRead = newline ? ( newline - dataBuffer ) + 1 : bytesPeeked;
+        std::string& partial = m_priv->m_partialLine;
+
+        if( ::read( m_priv->m_fd, dataBuffer, toRead ) != static_cast<ssize_t>( toRead ) ) {
+            *failed = true;
+            return false;
+        }
+
+        partial.append( dataBuffer, toRead );
+
+        if( partial.size() > MAX_LINE_LENGTH ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Line from client is too long" );
+            *failed = true;
+            return false;
+        }
+
+        if( newline ) {
+            if( partial.size() < 2 || partial[ partial.size() - 2 ] != '\r' ) {
+                *failed = true;
+                return false;
+            }
+
+            line->assign( partial, 0, partial.size() - 2 );
+            partial.clear();
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Received command: " + *line );
+            return true;
+        }
     }
-    line_read = std::string( dataBuffer, bytesRead );
+}
 
-    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Received response: " + line_read );
+int SASL::write_data_with_newline( std::string data ) {
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Sending command: " + data );
+    data += "\r\n";
+    return ::write( m_priv->m_fd, data.c_str(), data.length() );
+}
+
+bool SASL::write_data( const char* data, size_t length ) {
+    size_t written = 0;
+
+    // The socket is non-blocking, and we may be sending a whole message
+    while( written < length ) {
+        ssize_t ret = ::write( m_priv->m_fd, data + written, length - written );
+
+        if( ret < 0 && errno == EINTR ) {
+            continue;
+        }
+
+        if( ret < 0 && errno == EAGAIN ) {
+            pollfd pollfd;
+            pollfd.fd = m_priv->m_fd;
+            pollfd.events = POLLOUT;
+
+            if( poll( &pollfd, 1, -1 ) < 0 && errno != EINTR ) {
+                break;
+            }
+
+            continue;
+        }
+
+        if( ret < 0 ) {
+            std::string errmsg = strerror( errno );
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to write SASL data: " + errmsg );
+            return false;
+        }
+
+        written += ret;
+    }
 
-    return line_read;
+    return written == length;
 }
 
 std::string SASL::encode_as_hex( int num ) {
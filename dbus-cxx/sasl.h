@@ -30,6 +30,15 @@
 namespace DBus {
 namespace priv {
 
+/**
+ * Where the authentication of a client that has connected to us is at
+ */
+enum class SASLServerStatus {
+    InProgress,
+    Authenticated,
+    Failed
+};
+
 /**
  * Implements the authentication routines for connection to the bus
  */
@@ -49,16 +58,53 @@ public:
     /**
      * Perform the authentication with the server.
      *
+     * Only the EXTERNAL mechanism is used, so we don't have to wait for the
+     * server between commands: AUTH, NEGOTIATE_UNIX_FD and BEGIN are all sent
+     * in a single write, followed by pipelinedData.  pipelinedData is normally
+     * the first message on the connection, which the server will read once it
+     * has processed the BEGIN.
+     *
+     * Only the server's replies to our commands are read from the socket; any
+     * data the server sends after that is left for the transport.
+     *
+     * @param pipelinedData Data to send directly after the BEGIN
      * @return A tuple containing the following:
      * - bool Success of authentication
      * - bool If this supports FD passing
      * - vector The GUID of the server
      */
-    std::tuple<bool, bool, std::vector<uint8_t>> authenticate();
+    std::tuple<bool, bool, std::vector<uint8_t>> authenticate(
+        const std::vector<uint8_t>& pipelinedData = std::vector<uint8_t>() );
+
+    /**
+     * Continue the server side of the authentication with a client that has
+     * connected to us, handling whatever the client has sent so far.  This
+     * never waits for the client: call it again once the FD is readable, for
+     * as long as it returns SASLServerStatus::InProgress.  Only the EXTERNAL
+     * mechanism is supported, and the client must be running as the same
+     * user that we are.
+     *
+     * @param serverGUID The GUID of our server, as a hex string
+     * @return Where the authentication is at
+     */
+    SASLServerStatus continue_client_authentication( const std::string& serverGUID );
+
+    /**
+     * True if the client that we have authenticated negotiated FD passing.
+     */
+    bool client_negotiated_fd_passing() const;
 
 private:
     int write_data_with_newline( std::string data );
-    std::string read_data();
+    bool write_data( const char* data, size_t length );
+    std::string read_line( int timeoutMs );
+    /**
+     * Read the rest of the current line from the client, if it has all been
+     * sent.  Sets failed if the client has gone away or sent a bad line.
+     */
+    bool read_available_line( std::string* line, bool* failed );
+    SASLServerStatus handle_client_line( const std::string& line, const std::string& serverGUID );
+    bool check_client_uid( const std::string& hexUID );
     std::string encode_as_hex( int num );
     std::vector<uint8_t> hex_to_vector( std::string hexData );
 
@@ -19,10 +19,14 @@
 #include "sendmsgtransport.h"
 
 #include "dbus-cxx-private.h"
+#include "receivebuffer.h"
 #include "utility.h"
 #include "validator.h"
 
 #include <message.h>
+#include <algorithm>
+#include <deque>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -31,20 +35,22 @@
 #include <sys/types.h>
 
 using DBus::priv::SendmsgTransport;
+using DBus::priv::ReceiveBuffer;
 
 static const char* LOGGER_NAME = "DBus.priv.SendmsgTransport";
 
-#define RECEIVE_BUFFER_SIZE 1024
 #define SEND_BUFFER_SIZE    2048
 #define CONTROL_BUFFER_SIZE 512
-
+/* Maximum number of messages that are coalesced into one call to sendmsg() */
+#define MAX_BATCH_MESSAGES  64
+/* Send buffers that have grown larger than this are released after use */
+#define SEND_BUFFER_SHRINK_SIZE ( 64 * 1024 )
 #ifdef _WIN32
 class SendmsgTransport::priv_data {
 public:
     priv_data( int fd ) :
         m_fd( fd ),
         m_ok( false ),
-        rx_capacity( RECEIVE_BUFFER_SIZE ),
         rx_control_capacity( CONTROL_BUFFER_SIZE ),
         lpWSARecvMsg( NULL ) {
         ::memset( &rx_msg, 0, sizeof( WSAMSG ) );
@@ -53,7 +59,6 @@ public:
     }
 
     ~priv_data() {
-        free( rx_msg.lpBuffers[0].buf );
         free( rx_msg.Control.buf );
         free( tx_msg.Control.buf );
     }
@@ -61,10 +66,11 @@ public:
     int m_fd;
     bool m_ok;
     std::vector<uint8_t> m_sendBuffer;
+    ReceiveBuffer m_receiveBuffer;
+    std::deque<int> m_receivedFds;
 
     WSAMSG rx_msg;
     WSABUF rx_buf;
-    int rx_capacity;
     int rx_control_capacity;
 
     WSAMSG tx_msg;
@@ -75,12 +81,14 @@ public:
     void init() {
         // Setup the RX data msghdr
         rx_msg.lpBuffers = &rx_buf;
-        rx_msg.lpBuffers[0].buf = ( PCHAR ) ::malloc( rx_capacity );
-        rx_msg.lpBuffers[0].len = rx_capacity;
         rx_msg.dwBufferCount = 1;
         rx_msg.Control.buf = ( PCHAR ) ::malloc( rx_control_capacity );
         rx_msg.Control.len = rx_control_capacity;
 
+        if( !m_receiveBuffer.set_capacity( RECEIVE_BUFFER_SIZE ) ) {
+            m_ok = false;
+        }
+
         // Setup the TX data msghdr
         tx_msg.lpBuffers = &tx_buf;
         tx_msg.dwBufferCount = 1;
@@ -94,26 +102,21 @@ public:
         }
     }
 
-    uint8_t* rx_byte_buf_data() {
-        return reinterpret_cast<uint8_t*>( rx_msg.lpBuffers[0].buf );
-    }
-
-    ssize_t rx_size() {
-        return rx_msg.lpBuffers[0].len;
-    }
-
     ssize_t rx_control_size() {
         return rx_msg.Control.len;
     }
 
-    void set_rx_capacity( ssize_t capacity ) {
-        free( rx_msg.lpBuffers[0].buf );
-        rx_msg.lpBuffers[0].buf = ( PCHAR ) ::malloc( capacity );
-        rx_capacity = capacity;
+    void take_received_fds() {
+        // Sending/receiving file descriptors is not supported on Windows
     }
 
-    int peek( ssize_t size ) {
-        return receive( size, 0, 0, MSG_PEEK );
+    void close_received_fds() {
+        m_receivedFds.clear();
+    }
+
+    void close_front_fds( size_t count ) {
+        count = std::min( count, m_receivedFds.size() );
+        m_receivedFds.erase( m_receivedFds.begin(), m_receivedFds.begin() + count );
     }
 
     int send() {
@@ -131,10 +134,11 @@ public:
         return result;
     }
 
-    int receive( ssize_t size, ssize_t control_size, ssize_t name_size, DWORD flags ) {
-        rx_msg.lpBuffers[0].len = size;
-        rx_msg.namelen = name_size;
-        rx_msg.Control.len = control_size;
+    int receive( uint8_t* buffer, ssize_t size, DWORD flags ) {
+        rx_buf.buf = ( PCHAR )buffer;
+        rx_buf.len = size;
+        rx_msg.namelen = 0;
+        rx_msg.Control.len = rx_control_capacity;
 
         rx_msg.dwFlags = flags;
         int result = lpWSARecvMsg( m_fd, &rx_msg, NULL, NULL, NULL );
@@ -147,88 +151,314 @@ public:
     }
 };
 #else /* POSIX */
+/**
+ * Data that has been accepted for writing, but that the socket has not
+ * taken yet.
+ */
+struct PendingWrite {
+    std::vector<uint8_t> data;
+    size_t offset;
+    /* The message whose FDs must be sent with the first byte of data, if any */
+    std::shared_ptr<const DBus::Message> fdMessage;
+};
+
 class SendmsgTransport::priv_data {
 public:
     priv_data( int fd ) :
         m_fd( fd ),
         m_ok( false ),
-        rx_capacity( RECEIVE_BUFFER_SIZE ),
         rx_control_capacity( CONTROL_BUFFER_SIZE ),
         tx_control_data( nullptr ),
-        tx_control_capacity( CONTROL_BUFFER_SIZE )
+        tx_control_capacity( CONTROL_BUFFER_SIZE ),
+        m_pendingSize( 0 )
         {
         ::memset( &rx_msg, 0, sizeof( struct msghdr ) );
         ::memset( &tx_msg, 0, sizeof( struct msghdr ) );
-        m_sendBuffer.reserve( SEND_BUFFER_SIZE );
     }
 
     ~priv_data() {
-        free( rx_msg.msg_iov[0].iov_base );
         free( rx_msg.msg_control );
         free( tx_control_data );
+        close_received_fds();
     }
 
     int m_fd;
     bool m_ok;
-    std::vector<uint8_t> m_sendBuffer;
+    /*
+     * One buffer per message in a batch that the header of the message is
+     * serialized into, reused between batches.  The body of the message is
+     * sent straight from the message.
+     */
+    std::vector<std::vector<uint8_t>> m_sendBuffers;
+    ReceiveBuffer m_receiveBuffer;
+    /* FDs that we have received, but have not given to a message yet */
+    std::deque<int> m_receivedFds;
 
     struct msghdr rx_msg;
     struct iovec rx_buf;
-    int rx_capacity;
     int rx_control_capacity;
 
     struct msghdr tx_msg;
-    struct iovec tx_buf;
+    /* Header and body of each message in a batch */
+    struct iovec tx_iov[ MAX_BATCH_MESSAGES * 2 ];
     void* tx_control_data;
     int tx_control_capacity;
 
+    /* Data that the socket would not take without blocking, oldest first */
+    std::deque<PendingWrite> m_pendingWrites;
+    size_t m_pendingSize;
+
     void init() {
         // Setup the RX data msghdr
         rx_msg.msg_iov = &rx_buf;
-        rx_msg.msg_iov[0].iov_base = ::malloc( rx_capacity );
-        rx_msg.msg_iov[0].iov_len = rx_capacity;
         rx_msg.msg_iovlen = 1;
         rx_msg.msg_control = ::malloc( rx_control_capacity );
 
+        if( !m_receiveBuffer.set_capacity( RECEIVE_BUFFER_SIZE ) ) {
+            m_ok = false;
+        }
+
         // Setup the TX data msghdr
-        tx_msg.msg_iov = &tx_buf;
-        tx_msg.msg_iovlen = 1;
         tx_control_data = ::malloc( tx_control_capacity );
+        m_sendBuffers.resize( 1 );
+        m_sendBuffers[ 0 ].reserve( SEND_BUFFER_SIZE );
     }
 
-    uint8_t* rx_byte_buf_data() {
-        return static_cast<uint8_t*>( rx_msg.msg_iov[0].iov_base );
+    ssize_t rx_control_size() {
+        return rx_msg.msg_controllen;
     }
 
-    ssize_t rx_size() {
-        return rx_msg.msg_iov[0].iov_len;
+    /**
+     * Add any FDs from the last receive() to our queue of received FDs.
+     */
+    void take_received_fds() {
+        struct cmsghdr* cmsg;
+        ssize_t num_fds;
+
+        if( rx_msg.msg_flags & MSG_CTRUNC ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Control data truncated, file descriptors have been lost" );
+        }
+
+        for( cmsg = CMSG_FIRSTHDR( &rx_msg );
+            cmsg != nullptr;
+            cmsg = CMSG_NXTHDR( &rx_msg, cmsg ) ) {
+            if( cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS ) {
+                /* This is our FD array */
+                num_fds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Have " << num_fds << " fds to extract from CMSGHDR" );
+                int* fd_array = reinterpret_cast<int*>( CMSG_DATA( cmsg ) );
+
+                for( ssize_t current = 0; current < num_fds; current++ ) {
+                    m_receivedFds.push_back( *fd_array );
+                    fd_array++;
+                }
+            }
+        }
     }
 
-    ssize_t rx_control_size() {
-        return rx_msg.msg_controllen;
+    void close_received_fds() {
+        for( int fd : m_receivedFds ) {
+            close( fd );
+        }
+
+        m_receivedFds.clear();
     }
 
-    void set_rx_capacity( ssize_t capacity ) {
-        free( rx_msg.msg_iov[0].iov_base );
-        rx_msg.msg_iov[0].iov_base = ::malloc( capacity );
-        rx_capacity = capacity;
+    /**
+     * Close the given number of FDs from the front of the queue, which
+     * belong to a message that we are throwing away.
+     */
+    void close_front_fds( size_t count ) {
+        count = std::min( count, m_receivedFds.size() );
+
+        for( size_t x = 0; x < count; x++ ) {
+            close( m_receivedFds.front() );
+            m_receivedFds.pop_front();
+        }
     }
 
-    int peek( ssize_t size ) {
-        return receive( size, 0, 0, MSG_PEEK );
+    /**
+     * Set the ancillary data of the next send() to pass the given FDs.
+     *
+     * @return false if we were unable to allocate enough space for the FDs
+     */
+    bool set_send_fds( const std::vector<int>& fds ) {
+        int fd_space_needed = CMSG_SPACE( sizeof( int ) * fds.size() );
+        struct cmsghdr* cmsg;
+
+        tx_msg.msg_control = nullptr;
+        tx_msg.msg_controllen = 0;
+
+        if( fds.empty() ) {
+            return true;
+        }
+
+        if( tx_control_capacity < fd_space_needed ) {
+            free( tx_control_data );
+            tx_control_data = ::malloc( fd_space_needed );
+            tx_control_capacity = fd_space_needed;
+
+            if( tx_control_data == nullptr ) {
+                tx_control_capacity = 0;
+                return false;
+            }
+        }
+
+        ::memset( tx_control_data, 0, fd_space_needed );
+        tx_msg.msg_control = tx_control_data;
+        tx_msg.msg_controllen = fd_space_needed;
+        cmsg = CMSG_FIRSTHDR( &tx_msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * fds.size() );
+
+        int* data = ( int* )CMSG_DATA( cmsg );
+
+        for( int fd : fds ) {
+            *data = fd;
+            data++;
+        }
+
+        return true;
     }
 
-    int send() {
-        tx_buf.iov_base = m_sendBuffer.data();
-        tx_buf.iov_len = m_sendBuffer.size();
+    /**
+     * Send the given data with sendmsg().  If the socket only takes part of
+     * the data, the rest is sent with more calls to sendmsg() until everything
+     * has been sent or the socket would block.  Any FDs from set_send_fds()
+     * only go along with the first byte.
+     *
+     * @return The number of bytes sent, or -1 on error(with errno set)
+     */
+    ssize_t send( struct iovec* iov, size_t iovlen ) {
+        ssize_t total = 0;
+
+        while( iovlen > 0 ) {
+            tx_msg.msg_iov = iov;
+            tx_msg.msg_iovlen = iovlen;
+
+            ssize_t ret = sendmsg( m_fd, &tx_msg, 0 );
+
+            if( ret < 0 ) {
+                if( errno == EINTR ) {
+                    continue;
+                }
+
+                if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                    break;
+                }
+
+                return ret;
+            }
+
+            total += ret;
+
+            // The FDs have been sent along with the first byte
+            tx_msg.msg_control = nullptr;
+            tx_msg.msg_controllen = 0;
+
+            size_t sent = ret;
+
+            while( iovlen > 0 && sent >= iov->iov_len ) {
+                sent -= iov->iov_len;
+                iov++;
+                iovlen--;
+            }
+
+            if( iovlen > 0 ) {
+                iov->iov_base = static_cast<uint8_t*>( iov->iov_base ) + sent;
+                iov->iov_len -= sent;
+            }
+        }
+
+        return total;
+    }
+
+    /**
+     * Queue up the data of the given messages that has not been sent yet,
+     * skipping the first already_sent bytes.  The headers of the messages
+     * must be in our send buffers.
+     *
+     * @param fd_message If not null, the message whose FDs must be sent along
+     * with the first byte of the queued data.
+     */
+    void queue_pending( const OutgoingMessage* messages, size_t num_messages,
+        size_t already_sent, std::shared_ptr<const DBus::Message> fd_message ) {
+        PendingWrite pending;
+        pending.offset = 0;
+        pending.fdMessage = fd_message;
+
+        for( size_t x = 0; x < num_messages; x++ ) {
+            const std::vector<uint8_t>& header = m_sendBuffers[ x ];
+
+            // Messages that failed to serialize have no header and are not sent
+            if( header.empty() ) {
+                continue;
+            }
+
+            const DBus::Message* msg = messages[ x ].msg.get();
+            const uint8_t* partData[] = { header.data(), msg->body_data() };
+            size_t partSize[] = { header.size(), msg->body_size() };
+
+            for( int part = 0; part < 2; part++ ) {
+                if( already_sent >= partSize[ part ] ) {
+                    already_sent -= partSize[ part ];
+                    continue;
+                }
+
+                pending.data.insert( pending.data.end(), partData[ part ] + already_sent, partData[ part ] + partSize[ part ] );
+                already_sent = 0;
+            }
+        }
+
+        if( pending.data.empty() ) {
+            return;
+        }
+
+        m_pendingSize += pending.data.size();
+        m_pendingWrites.push_back( std::move( pending ) );
+    }
 
-        return sendmsg( m_fd, &tx_msg, 0 );
+    /**
+     * Mark the given number of bytes of our pending data as written.
+     */
+    void consume_pending( size_t written ) {
+        m_pendingSize -= written;
+
+        while( written > 0 ) {
+            PendingWrite& front = m_pendingWrites.front();
+            size_t remaining = front.data.size() - front.offset;
+
+            if( written < remaining ) {
+                front.offset += written;
+                front.fdMessage.reset();
+                return;
+            }
+
+            written -= remaining;
+            m_pendingWrites.pop_front();
+        }
     }
 
-    int receive( ssize_t size, ssize_t control_size, ssize_t name_size, int flags ) {
-        rx_msg.msg_iov[0].iov_len = size;
-        rx_msg.msg_controllen = control_size;
-        rx_msg.msg_namelen = name_size;
+    /**
+     * Release the memory of any send buffers that have grown very large,
+     * so that one large message does not pin that memory forever.
+     */
+    void trim_send_buffers( size_t num_buffers ) {
+        for( size_t x = 0; x < num_buffers; x++ ) {
+            if( m_sendBuffers[ x ].capacity() > SEND_BUFFER_SHRINK_SIZE ) {
+                std::vector<uint8_t>().swap( m_sendBuffers[ x ] );
+                m_sendBuffers[ x ].reserve( SEND_BUFFER_SIZE );
+            }
+        }
+    }
+
+    int receive( uint8_t* buffer, ssize_t size, int flags ) {
+        rx_buf.iov_base = buffer;
+        rx_buf.iov_len = size;
+        rx_msg.msg_controllen = rx_control_capacity;
+        rx_msg.msg_namelen = 0;
 
         return recvmsg( m_fd, &rx_msg, flags );
     }
@@ -290,50 +520,6 @@ ssize_t SendmsgTransport::writeMessage( std::shared_ptr<const DBus::Message> mes
     debug_str << "Going to send the following bytes: " << std::endl;
     DBus::hexdump( &m_priv->m_sendBuffer, &debug_str );
     SIMPLELOGGER_TRACE( LOGGER_NAME, debug_str.str() );
-#else /* POSIX */
-    const std::vector<int> filedescriptors = message->filedescriptors();
-    struct cmsghdr* cmsg;
-    int fd_space_needed = CMSG_SPACE( sizeof( int ) * filedescriptors.size() );
-    std::ostringstream debug_str;
-    ssize_t ret;
-
-    m_priv->m_sendBuffer.clear();
-
-    if( !message->serialize_to_vector( &m_priv->m_sendBuffer, serial ) ) {
-        return 0;
-    }
-
-    debug_str << "Going to send the following bytes: " << std::endl;
-    DBus::hexdump( &m_priv->m_sendBuffer, &debug_str );
-    SIMPLELOGGER_TRACE( LOGGER_NAME, debug_str.str() );
-
-    m_priv->tx_msg.msg_control = nullptr;
-    m_priv->tx_msg.msg_controllen = 0;
-
-    if( m_priv->tx_control_capacity < fd_space_needed ) {
-        free( m_priv->tx_control_data );
-        m_priv->tx_control_data = ::malloc( fd_space_needed );
-        m_priv->tx_control_capacity = fd_space_needed;
-    }
-
-    /* Fill in our FD array(ancillary data) */
-    if( filedescriptors.size() > 0 ) {
-        m_priv->tx_msg.msg_control = m_priv->tx_control_data;
-        m_priv->tx_msg.msg_controllen = fd_space_needed;
-        cmsg = CMSG_FIRSTHDR( &m_priv->tx_msg );
-        cmsg->cmsg_level = SOL_SOCKET;
-        cmsg->cmsg_type = SCM_RIGHTS;
-        cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * filedescriptors.size() );
-
-        int* data = ( int* )CMSG_DATA( cmsg );
-
-        for( int fd : filedescriptors ) {
-            *data = fd;
-            data++;
-        }
-    }
-
-#endif /* WIN32 */
 
     /* Now we finally send the data! */
     ret = m_priv->send();
@@ -350,110 +536,241 @@ ssize_t SendmsgTransport::writeMessage( std::shared_ptr<const DBus::Message> mes
     }
 
     return ret;
+#else /* POSIX */
+    OutgoingMessage outgoing;
+    outgoing.msg = message;
+    outgoing.serial = serial;
+
+    return writeBatch( &outgoing, 1 );
+#endif /* WIN32 */
 }
 
-std::shared_ptr<DBus::Message> SendmsgTransport::readMessage() {
-    uint32_t header_array_len;
-    ssize_t body_len;
-    ssize_t total_len;
-    ssize_t ret;
-    uint8_t* header_raw = m_priv->rx_byte_buf_data();
-    std::vector<int> fds;
-#ifndef _WIN32
-    ssize_t num_fds;
-    struct cmsghdr* cmsg;
-#endif
+ssize_t SendmsgTransport::writeMessages( const std::vector<OutgoingMessage>& messages ) {
+#ifdef _WIN32
+    return Transport::writeMessages( messages );
+#else /* POSIX */
+    size_t position = 0;
+    ssize_t total = 0;
+
+    while( position < messages.size() ) {
+        /*
+         * FDs must be sent along with the first byte of the message that they
+         * belong to, so a message with FDs always starts a new batch.  Messages
+         * without FDs may follow it in the same batch.
+         */
+        size_t batch_size = 1;
+
+        while( position + batch_size < messages.size() &&
+            batch_size < MAX_BATCH_MESSAGES &&
+            messages[ position + batch_size ].msg->filedescriptors().empty() ) {
+            batch_size++;
+        }
 
-    /* Do a peek of the data to determine if our arrays are large enough or not */
-    ret = m_priv->peek( 16 );
+        ssize_t ret = writeBatch( messages.data() + position, batch_size );
 
-    if( ret < 0 ) {
-        return std::shared_ptr<DBus::Message>();
+        if( ret < 0 ) {
+            return ret;
+        }
+
+        total += ret;
+        position += batch_size;
     }
 
-    if( header_raw[0] == 'l' ) {
-        /* Little-endian */
-        body_len = header_raw[ 7 ] << 24 |
-            header_raw[ 6 ] << 16 |
-            header_raw[ 5 ] << 8 |
-            header_raw[ 4 ] << 0;
-
-        header_array_len = header_raw[ 15 ] << 24 |
-            header_raw[ 14 ] << 16 |
-            header_raw[ 13 ] << 8 |
-            header_raw[ 12 ] << 0;
-    } else if( header_raw[0] == 'B' ) {
-        /* Big-endian */
-        body_len = header_raw[ 4 ] << 24 |
-            header_raw[ 5 ] << 16 |
-            header_raw[ 6 ] << 8 |
-            header_raw[ 7 ] << 0;
-
-        header_array_len = header_raw[ 12 ] << 24 |
-            header_raw[ 13 ] << 16 |
-            header_raw[ 14 ] << 8 |
-            header_raw[ 15 ] << 0;
-    } else {
-        m_priv->m_ok = false;
-        return std::shared_ptr<DBus::Message>();
+    return total;
+#endif /* WIN32 */
+}
+
+#ifndef _WIN32
+ssize_t SendmsgTransport::writeBatch( const OutgoingMessage* messages, size_t num_messages ) {
+    size_t batch_size = 0;
+    size_t iovlen = 0;
+    ssize_t sent = 0;
+    bool queued_behind = !m_priv->m_pendingWrites.empty();
+    std::shared_ptr<const DBus::Message> first_message;
+
+    if( m_priv->m_sendBuffers.size() < num_messages ) {
+        m_priv->m_sendBuffers.resize( num_messages );
     }
 
-    if( (body_len + header_array_len + 12 + 4) >
-            DBus::Validator::maximum_message_size() ){
-        // Invalid message: it can't be that big!
-        // purge our reading buffer and reset to a known state.
-        purgeData();
-        return std::shared_ptr<DBus::Message>();
+    for( size_t x = 0; x < num_messages; x++ ) {
+        std::vector<uint8_t>* buffer = &m_priv->m_sendBuffers[ x ];
+
+        buffer->clear();
+
+        if( !messages[ x ].msg->serialize_header_to_vector( buffer, messages[ x ].serial ) ) {
+            // Skip this message, it can't be sent
+            buffer->clear();
+            continue;
+        }
+
+        if( !first_message ) {
+            first_message = messages[ x ].msg;
+        }
+
+        const uint8_t* body = messages[ x ].msg->body_data();
+        uint32_t bodySize = messages[ x ].msg->body_size();
+
+        if( dbuscxx_log_function ) {
+            // Dumping the body costs as much as copying it, so only do it if it goes somewhere
+            std::ostringstream debug_str;
+            debug_str << "Going to send the following bytes: " << std::endl;
+            DBus::hexdump( buffer, &debug_str );
+            DBus::hexdump( body, bodySize, &debug_str );
+            SIMPLELOGGER_TRACE( LOGGER_NAME, debug_str.str() );
+        }
+
+        /* The header and the body go out together without copying the body */
+        m_priv->tx_iov[ iovlen ].iov_base = buffer->data();
+        m_priv->tx_iov[ iovlen ].iov_len = buffer->size();
+        iovlen++;
+        batch_size += buffer->size();
+
+        if( bodySize != 0 ) {
+            m_priv->tx_iov[ iovlen ].iov_base = const_cast<uint8_t*>( body );
+            m_priv->tx_iov[ iovlen ].iov_len = bodySize;
+            iovlen++;
+            batch_size += bodySize;
+        }
     }
 
-    if( 0 != header_array_len % 8 ) {
-        header_array_len += 8 - ( header_array_len % 8 );
+    if( batch_size == 0 ) {
+        return 0;
     }
 
-    total_len = 12 + ( 4 + header_array_len ) + body_len;
+    /*
+     * If there is still data waiting to go out, this data has to wait behind it.
+     * Otherwise, send as much as the socket will take right now.
+     */
+    if( !queued_behind ) {
+        /* FDs go with the message whose bytes start the batch */
+        if( !m_priv->set_send_fds( first_message->filedescriptors() ) ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to allocate space for file descriptors" );
+            m_priv->m_ok = false;
+            return -1;
+        }
+
+        sent = m_priv->send( m_priv->tx_iov, iovlen );
+
+        if( sent < 0 ) {
+            int my_errno = errno;
+
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't send message: " << strerror( my_errno ) );
+            m_priv->m_ok = false;
+            return sent;
+        }
 
-    /* Check to see if our receive buffer capacity is big enough - expand if not */
-    if( m_priv->rx_capacity < total_len ) {
-        m_priv->set_rx_capacity( total_len );
-        header_raw = m_priv->rx_byte_buf_data();
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Sent " << sent << " of " << batch_size << " bytes for " << num_messages << " messages" );
     }
 
-    /* Do the real reading of the data */
-    ret = m_priv->receive( total_len, m_priv->rx_control_capacity, 0, 0 );
+    if( static_cast<size_t>( sent ) < batch_size ) {
+        std::shared_ptr<const DBus::Message> fd_message;
 
-    if( ret <= 0 ) {
-        m_priv->m_ok = false;
-        return std::shared_ptr<DBus::Message>();
+        if( sent == 0 && !first_message->filedescriptors().empty() ) {
+            fd_message = first_message;
+        }
+
+        m_priv->queue_pending( messages, num_messages, sent, fd_message );
+
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Socket is full, " << m_priv->m_pendingSize << " bytes waiting to be written" );
+
+        if( queued_behind && write_pending() < 0 ) {
+            return -1;
+        }
     }
 
-    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Have " << m_priv->rx_control_size() << " bytes of control after real reading" );
+    m_priv->trim_send_buffers( num_messages );
 
-#ifndef _WIN32
+    return batch_size;
+}
+#endif
 
-    /* Need to figure out how many FDs we have to create our array */
-    for( cmsg = CMSG_FIRSTHDR( &m_priv->rx_msg );
-        cmsg != nullptr;
-        cmsg = CMSG_NXTHDR( &m_priv->rx_msg, cmsg ) ) {
-        if( cmsg->cmsg_level == SOL_SOCKET &&
-            cmsg->cmsg_type == SCM_RIGHTS ) {
-            /* This is our FD array */
-            num_fds = CMSG_LEN( cmsg->cmsg_len ) / sizeof( int );
-            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Have " << num_fds << " fds to extract from CMSGHDR" );
-            int* fd_array = reinterpret_cast<int*>( CMSG_DATA( cmsg ) );
-
-            for( ssize_t current = 0; current < num_fds; current++ ) {
-                fds.push_back( *fd_array );
-                fd_array++;
+ssize_t SendmsgTransport::write_pending() {
+#ifdef _WIN32
+    return 0;
+#else /* POSIX */
+    static const std::vector<int> no_fds;
+    ssize_t total = 0;
+
+    while( !m_priv->m_pendingWrites.empty() ) {
+        size_t iovlen = 0;
+        size_t expected = 0;
+        std::shared_ptr<const DBus::Message> fd_message = m_priv->m_pendingWrites.front().fdMessage;
+
+        for( PendingWrite& pending : m_priv->m_pendingWrites ) {
+            // FDs must be sent along with the first byte of their data
+            if( iovlen == MAX_BATCH_MESSAGES ||
+                ( iovlen > 0 && pending.fdMessage ) ) {
+                break;
             }
+
+            m_priv->tx_iov[ iovlen ].iov_base = pending.data.data() + pending.offset;
+            m_priv->tx_iov[ iovlen ].iov_len = pending.data.size() - pending.offset;
+            expected += m_priv->tx_iov[ iovlen ].iov_len;
+            iovlen++;
+        }
+
+        if( !m_priv->set_send_fds( fd_message ? fd_message->filedescriptors() : no_fds ) ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to allocate space for file descriptors" );
+            m_priv->m_ok = false;
+            return -1;
+        }
+
+        ssize_t ret = m_priv->send( m_priv->tx_iov, iovlen );
+
+        if( ret < 0 ) {
+            int my_errno = errno;
+
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't send message: " << strerror( my_errno ) );
+            m_priv->m_ok = false;
+            return ret;
+        }
+
+        m_priv->consume_pending( ret );
+        total += ret;
+
+        if( static_cast<size_t>( ret ) < expected ) {
+            // The socket is full again
+            break;
         }
     }
 
-#endif
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Wrote " << total << " pending bytes, " << m_priv->m_pendingSize << " bytes still pending" );
 
-    std::shared_ptr<DBus::Message> retmsg =
-        DBus::Message::create_from_data( header_raw, m_priv->rx_size(), fds );
+    return total;
+#endif /* WIN32 */
+}
 
-    return retmsg;
+size_t SendmsgTransport::pending_write_size() const {
+#ifdef _WIN32
+    return 0;
+#else /* POSIX */
+    return m_priv->m_pendingSize;
+#endif /* WIN32 */
+}
+
+std::shared_ptr<DBus::Message> SendmsgTransport::readMessage() {
+    std::shared_ptr<DBus::Message> retmsg = extractMessage();
+
+    if( retmsg || !m_priv->m_ok ) {
+        return retmsg;
+    }
+
+    /*
+     * We don't have a full message buffered, so read as much as we can
+     * from the socket and try again.
+     */
+    if( fillReceiveBuffer() <= 0 ) {
+        return std::shared_ptr<DBus::Message>();
+    }
+
+    return extractMessage();
+}
+
+bool SendmsgTransport::has_buffered_message() const {
+    ssize_t message_size = m_priv->m_receiveBuffer.front_message_size();
+
+    return message_size > 0 &&
+        static_cast<size_t>( message_size ) <= m_priv->m_receiveBuffer.size();
 }
 
 bool SendmsgTransport::is_valid() const {
@@ -464,19 +781,95 @@ int SendmsgTransport::fd() const {
     return m_priv->m_fd;
 }
 
-void SendmsgTransport::purgeData(){
-//    If a message is
-//    too long to fit in the supplied buffers, and MSG_PEEK is not set in
-//    the flags argument, the excess bytes shall be discarded....
-    // https://man7.org/linux/man-pages/man3/recvmsg.3p.html
-    struct msghdr hdr;
-    struct iovec iov;
+std::shared_ptr<DBus::Message> SendmsgTransport::extractMessage() {
+    ssize_t total_len = m_priv->m_receiveBuffer.front_message_size();
+    std::shared_ptr<DBus::Message> retmsg;
+
+    if( total_len < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Invalid endianess in message header" );
+        m_priv->m_ok = false;
+        return retmsg;
+    }
+
+    if( static_cast<uint64_t>( total_len ) > DBus::Validator::maximum_message_size() ) {
+        // Invalid message: it can't be that big!
+        // We can't find the start of the next message, so give up on the stream.
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Message is too large: " << total_len << " bytes" );
+        m_priv->m_receiveBuffer.clear();
+        m_priv->close_received_fds();
+        m_priv->m_ok = false;
+        return retmsg;
+    }
+
+    if( total_len == 0 ||
+        m_priv->m_receiveBuffer.size() < static_cast<size_t>( total_len ) ) {
+        return retmsg;
+    }
+
+    /*
+     * Any FDs that belong to this message have been received at the same time as
+     * the first byte of the message, so they will be at the front of our FD queue.
+     * The message takes as many of them as its header says that it has.
+     */
+    std::vector<int> fds( m_priv->m_receivedFds.begin(), m_priv->m_receivedFds.end() );
+
+    retmsg = DBus::Message::create_from_data( m_priv->m_receiveBuffer.message_data( total_len ), total_len, std::move( fds ) );
+
+    if( retmsg ) {
+        size_t fds_used = retmsg->filedescriptors().size();
+
+        m_priv->m_receivedFds.erase( m_priv->m_receivedFds.begin(),
+            m_priv->m_receivedFds.begin() + fds_used );
+    } else {
+        // The message is thrown away, so the FDs that came with it must be too
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Unable to parse received message; dropping it" );
+        m_priv->close_front_fds( m_priv->m_receiveBuffer.front_message_unix_fds() );
+    }
+
+    m_priv->m_receiveBuffer.consume( total_len );
+
+    return retmsg;
+}
+
+ssize_t SendmsgTransport::fillReceiveBuffer() {
+    ssize_t front_size = m_priv->m_receiveBuffer.front_message_size();
+    ssize_t ret;
+
+    if( !m_priv->m_receiveBuffer.prepare_read( front_size > 0 ? front_size : 0 ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to allocate receive buffer of " << front_size << " bytes" );
+        m_priv->m_ok = false;
+        return -1;
+    }
+
+    ret = m_priv->receive( m_priv->m_receiveBuffer.free_space(),
+            m_priv->m_receiveBuffer.free_size(),
+            0 );
 
-    ::memset( &hdr, 0, sizeof( hdr ) );
-    ::memset( &iov, 0, sizeof( iov ) );
+    if( ret < 0 ) {
+        int my_errno = errno;
+
+        if( my_errno != EAGAIN && my_errno != EWOULDBLOCK && my_errno != EINTR ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't read from socket: " << strerror( my_errno ) );
+            m_priv->m_ok = false;
+        }
 
-    hdr.msg_iov = &iov;
-    hdr.msg_iovlen = 1;
+        errno = my_errno;
+        return ret;
+    }
 
-    m_priv->receive( 0, m_priv->rx_control_capacity, 0, 0 );
+    if( ret == 0 ) {
+        // End of the stream
+        SIMPLELOGGER_TRACE( LOGGER_NAME, "End of stream: closing transport" );
+        m_priv->m_ok = false;
+        return ret;
+    }
+
+    m_priv->m_receiveBuffer.produce( ret );
+
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Read " << ret << " bytes, have " << m_priv->rx_control_size() << " bytes of control" );
+
+    m_priv->take_received_fds();
+
+    return ret;
 }
+
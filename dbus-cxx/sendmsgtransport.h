@@ -56,8 +56,34 @@ public:
 
     ssize_t writeMessage( std::shared_ptr<const Message> message, uint32_t serial );
 
+    /**
+     * Write out several messages at once.  As many messages as possible are
+     * serialized and written with one call to sendmsg().  Since any FDs must be
+     * sent with the first byte of the message that they belong to, a message
+     * that contains FDs always starts a new call to sendmsg().
+     */
+    ssize_t writeMessages( const std::vector<OutgoingMessage>& messages );
+
+    /**
+     * Write out data that the socket would not take without blocking.
+     * Data that can't be written right away is kept in order, along with
+     * any FDs that have to go with it, until the socket is writable again.
+     */
+    ssize_t write_pending();
+
+    size_t pending_write_size() const;
+
+    /**
+     * Read a message from the stream.  All of the data that the socket has
+     * available is read in with one call to recvmsg(); any complete messages
+     * after the first are kept in our buffer and returned by subsequent calls.
+     *
+     * @return
+     */
     std::shared_ptr<Message> readMessage();
 
+    bool has_buffered_message() const;
+
     /**
      * Check if this transport is OK
      * @return
@@ -67,7 +93,28 @@ public:
     int fd() const;
 
 private:
-    void purgeData();
+#ifndef _WIN32
+    /**
+     * Serialize and write out the given messages with one call to sendmsg().
+     * Only the first message may contain FDs.
+     *
+     * @return The number of bytes written, or -1 on error
+     */
+    ssize_t writeBatch( const OutgoingMessage* messages, size_t num_messages );
+#endif
+
+    /**
+     * Create a message from the front of our receive buffer, if we have
+     * received the entire message.
+     */
+    std::shared_ptr<Message> extractMessage();
+
+    /**
+     * Read as much data as is available into our receive buffer.
+     *
+     * @return The number of bytes read, or <= 0 if no data was read.
+     */
+    ssize_t fillReceiveBuffer();
 
 private:
     class priv_data;
@@ -0,0 +1,290 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "server.h"
+
+#include "connection.h"
+#include "dbus-cxx-private.h"
+#include "dispatcher.h"
+#include "sasl.h"
+#include "transport.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+using DBus::Server;
+
+static const char* LOGGER_NAME = "DBus.Server";
+
+/* How long a client has to authenticate before we give up on it */
+#define CLIENT_AUTH_TIMEOUT_MS 10000
+
+/**
+ * A client that has connected to us, but has not authenticated yet.
+ */
+struct PendingClient {
+    int fd;
+    std::shared_ptr<DBus::priv::SASL> sasl;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+class Server::priv_data {
+public:
+    priv_data( std::shared_ptr<Dispatcher> dispatcher ) :
+        m_dispatcher( dispatcher ),
+        m_listenFd( -1 ),
+        m_running( false ) {
+        m_wakeupFd[ 0 ] = -1;
+        m_wakeupFd[ 1 ] = -1;
+    }
+
+    std::shared_ptr<Dispatcher> m_dispatcher;
+    std::string m_address;
+    std::string m_guid;
+    /* If we are listening on a path in the filesystem, the path to remove */
+    std::string m_socketPath;
+    int m_listenFd;
+    /* socketpair for telling the thread to stop */
+    int m_wakeupFd[ 2 ];
+    volatile bool m_running;
+    std::thread m_listenThread;
+    /* Only used from the listen thread */
+    std::vector<PendingClient> m_pendingClients;
+    sigc::signal<void(std::shared_ptr<Connection>)> m_newConnection;
+};
+
+static std::string create_guid() {
+    std::random_device random;
+    std::ostringstream guid;
+
+    guid << std::hex << std::setfill( '0' );
+
+    for( int x = 0; x < 4; x++ ) {
+        guid << std::setw( 8 ) << static_cast<uint32_t>( random() );
+    }
+
+    return guid.str();
+}
+
+Server::Server( std::shared_ptr<Dispatcher> dispatcher, std::string address ) :
+    m_priv( std::make_unique<priv_data>( dispatcher ) ) {
+    m_priv->m_guid = create_guid();
+    m_priv->m_listenFd = priv::Transport::open_listening_socket( address, &m_priv->m_socketPath );
+
+    if( m_priv->m_listenFd < 0 ) {
+        return;
+    }
+
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, m_priv->m_wakeupFd ) < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "error creating socket pair" );
+        return;
+    }
+
+    m_priv->m_address = address + ",guid=" + m_priv->m_guid;
+    m_priv->m_running = true;
+    m_priv->m_listenThread = std::thread( &Server::listen_thread_main, this );
+}
+
+std::shared_ptr<Server> Server::create( std::shared_ptr<Dispatcher> dispatcher, std::string address ) {
+    if( !dispatcher ) {
+        return std::shared_ptr<Server>();
+    }
+
+    std::shared_ptr<Server> server( new Server( dispatcher, address ) );
+
+    if( !server->m_priv->m_running ) {
+        return std::shared_ptr<Server>();
+    }
+
+    return server;
+}
+
+Server::~Server() {
+    m_priv->m_running = false;
+
+    if( m_priv->m_wakeupFd[ 0 ] >= 0 ) {
+        char to_write = '0';
+
+        if( write( m_priv->m_wakeupFd[ 0 ], &to_write, sizeof( char ) ) < 0 ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't write to socketpair?!" );
+        }
+    }
+
+    if( m_priv->m_listenThread.joinable() ) {
+        m_priv->m_listenThread.join();
+    }
+
+    for( const PendingClient& client : m_priv->m_pendingClients ) {
+        close( client.fd );
+    }
+
+    if( m_priv->m_listenFd >= 0 ) {
+        close( m_priv->m_listenFd );
+    }
+
+    if( !m_priv->m_socketPath.empty() ) {
+        unlink( m_priv->m_socketPath.c_str() );
+    }
+
+    for( int fd : m_priv->m_wakeupFd ) {
+        if( fd >= 0 ) {
+            close( fd );
+        }
+    }
+}
+
+std::string Server::address() const {
+    return m_priv->m_address;
+}
+
+std::string Server::guid() const {
+    return m_priv->m_guid;
+}
+
+sigc::signal<void(std::shared_ptr<DBus::Connection>)>& Server::signal_new_connection() {
+    return m_priv->m_newConnection;
+}
+
+void Server::listen_thread_main() {
+    std::vector<int> fds;
+
+    while( m_priv->m_running ) {
+        fds.clear();
+        fds.push_back( m_priv->m_wakeupFd[ 1 ] );
+        fds.push_back( m_priv->m_listenFd );
+
+        for( const PendingClient& client : m_priv->m_pendingClients ) {
+            fds.push_back( client.fd );
+        }
+
+        std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> fdResponse =
+            DBus::priv::wait_for_fd_activity( fds, authentication_timeout_ms() );
+        std::vector<int> fdsToRead = std::get<2>( fdResponse );
+
+        if( !m_priv->m_running ) {
+            break;
+        }
+
+        authenticate_clients( fdsToRead );
+
+        if( std::find( fdsToRead.begin(), fdsToRead.end(), m_priv->m_listenFd ) != fdsToRead.end() ) {
+            accept_connection();
+        }
+    }
+}
+
+int Server::authentication_timeout_ms() const {
+    if( m_priv->m_pendingClients.empty() ) {
+        return -1;
+    }
+
+    std::chrono::steady_clock::time_point deadline = m_priv->m_pendingClients.front().deadline;
+
+    for( const PendingClient& client : m_priv->m_pendingClients ) {
+        deadline = std::min( deadline, client.deadline );
+    }
+
+    std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+
+    if( remaining.count() <= 0 ) {
+        return 0;
+    }
+
+    // Round up so that we do not wake up just before the client runs out of time
+    return std::chrono::ceil<std::chrono::milliseconds>( remaining ).count();
+}
+
+void Server::authenticate_clients( const std::vector<int>& readableFds ) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    for( std::vector<PendingClient>::iterator it = m_priv->m_pendingClients.begin();
+        it != m_priv->m_pendingClients.end(); ) {
+        priv::SASLServerStatus status = priv::SASLServerStatus::InProgress;
+
+        if( std::find( readableFds.begin(), readableFds.end(), it->fd ) != readableFds.end() ) {
+            status = it->sasl->continue_client_authentication( m_priv->m_guid );
+        }
+
+        if( status == priv::SASLServerStatus::InProgress && now >= it->deadline ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client took too long to authenticate" );
+            status = priv::SASLServerStatus::Failed;
+        }
+
+        if( status == priv::SASLServerStatus::InProgress ) {
+            it++;
+            continue;
+        }
+
+        int fd = it->fd;
+        it = m_priv->m_pendingClients.erase( it );
+
+        if( status == priv::SASLServerStatus::Authenticated ) {
+            add_client( fd );
+        } else {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Client did not authenticate" );
+            close( fd );
+        }
+    }
+}
+
+void Server::accept_connection() {
+    int fd = accept4( m_priv->m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+    if( fd < 0 ) {
+        std::string errmsg = strerror( errno );
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to accept connection: " + errmsg );
+        return;
+    }
+
+    PendingClient client;
+    client.fd = fd;
+    client.sasl = std::make_shared<priv::SASL>( fd, true );
+    client.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( CLIENT_AUTH_TIMEOUT_MS );
+
+    // The client is authenticated as its data comes in, see authenticate_clients()
+    m_priv->m_pendingClients.push_back( client );
+}
+
+void Server::add_client( int fd ) {
+    std::shared_ptr<priv::Transport> transport = priv::Transport::create_for_socket( fd );
+
+    if( !transport || !transport->is_valid() ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to create transport for client" );
+        return;
+    }
+
+    std::shared_ptr<Connection> conn( new Connection( transport ) );
+
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "New client connected" );
+
+    m_priv->m_newConnection.emit( conn );
+
+    if( !m_priv->m_dispatcher->add_connection( conn ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to add client connection to dispatcher" );
+    }
+}
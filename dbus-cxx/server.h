@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUSCXX_SERVER_H
+#define DBUSCXX_SERVER_H
+
+#include <dbus-cxx/dbus-cxx-config.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sigc++/sigc++.h>
+
+namespace DBus {
+
+class Connection;
+class Dispatcher;
+
+/**
+ * A Server listens for peer-to-peer connections from other applications,
+ * so that they can talk to us directly instead of through a bus daemon.
+ * Clients connect to the server with Connection::create_peer().
+ *
+ * The server side of the authentication is done for each new client; only
+ * clients running as the same user as this application are accepted.  Each
+ * accepted client gets its own Connection, which is added to the Dispatcher
+ * that the Server was created with.  These connections have no bus name,
+ * but objects may be registered on them and object proxies created on them
+ * just like on a bus connection.
+ *
+ * The server accepts and authenticates clients on its own thread.  Clients
+ * are authenticated as their data comes in, so a client that stalls while
+ * authenticating does not hold up any other client.
+ *
+ * @ingroup core
+ */
+class Server {
+private:
+    Server( std::shared_ptr<Dispatcher> dispatcher, std::string address );
+
+public:
+    /**
+     * Create a new server, listening on the given address.  Only unix
+     * transports are supported (e.g. unix:path=/tmp/dbus-test or
+     * unix:abstract=dbus-test).
+     *
+     * @param dispatcher The dispatcher to add accepted connections to
+     * @param address The address to listen on
+     * @return An invalid shared_ptr if we are unable to listen on the address
+     */
+    static std::shared_ptr<Server> create( std::shared_ptr<Dispatcher> dispatcher, std::string address );
+
+    ~Server();
+
+    /**
+     * The address that clients can connect to, including the GUID of this server.
+     */
+    std::string address() const;
+
+    /** The GUID of this server, as a hex string */
+    std::string guid() const;
+
+    /**
+     * This signal is emitted from the server's thread whenever a new client
+     * has connected and authenticated.  It is emitted before the connection
+     * is added to the dispatcher, so objects that are registered on the
+     * connection in a slot attached to this signal are available as soon as
+     * the client sends its first message.
+     *
+     * To keep the client, the connection only needs to be held onto by the
+     * dispatcher; it is removed from the dispatcher once the client goes away.
+     */
+    sigc::signal<void(std::shared_ptr<Connection>)>& signal_new_connection();
+
+private:
+    void listen_thread_main();
+
+    /**
+     * Accept the next client that is waiting to connect, and start
+     * authenticating it.
+     */
+    void accept_connection();
+
+    /**
+     * Continue authenticating the clients that have sent us data, and give
+     * up on the ones that have taken too long.
+     *
+     * @param readableFds The FDs that have data to read
+     */
+    void authenticate_clients( const std::vector<int>& readableFds );
+
+    /**
+     * Create the connection for a client that has authenticated.
+     */
+    void add_client( int fd );
+
+    /**
+     * How long we can wait before the next client runs out of time to
+     * authenticate, or -1 if no clients are authenticating.
+     */
+    int authentication_timeout_ms() const;
+
+private:
+    class priv_data;
+
+    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+};
+
+} /* namespace DBus */
+
+#endif /* DBUSCXX_SERVER_H */
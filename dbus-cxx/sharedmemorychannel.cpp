@@ -0,0 +1,466 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "sharedmemorychannel.h"
+
+#include "dbus-cxx-private.h"
+#include "filedescriptor.h"
+#include "variant.h"
+
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if DBUS_CXX_HAS_MEMFD
+#include <sys/eventfd.h>
+#endif
+
+using DBus::SharedMemoryChannel;
+
+static const char* LOGGER_NAME = "DBus.SharedMemoryChannel";
+
+static const uint32_t CHANNEL_MAGIC = 0x44425243; /* "DBRC" */
+static const uint32_t MINIMUM_CAPACITY = 4096;
+static const uint32_t MAXIMUM_CAPACITY = 1u << 30;
+/* Record length that tells the consumer to continue at the start of the ring */
+static const uint32_t WRAP_MARKER = UINT32_MAX;
+
+namespace {
+
+/*
+ * The start of the shared memory.  The ring data follows directly after this.
+ * The producer and consumer fields are on their own cache lines so that the
+ * two sides do not fight over them.
+ */
+struct RingHeader {
+    uint32_t magic;
+    uint32_t capacity;
+    /* Total number of bytes ever written, only updated by the producer */
+    alignas( 64 ) std::atomic<uint64_t> head;
+    /* Total number of bytes ever read, only updated by the consumer */
+    alignas( 64 ) std::atomic<uint64_t> tail;
+    /* Set by the consumer before it sleeps on the eventfd */
+    alignas( 64 ) std::atomic<uint32_t> consumerWaiting;
+};
+
+static_assert( std::atomic<uint64_t>::is_always_lock_free,
+    "the ring indexes must be lock-free to be shared between processes" );
+
+}
+
+class SharedMemoryChannel::priv_data {
+public:
+    priv_data() :
+        m_producer( false ),
+        m_memfd( -1 ),
+        m_eventfd( -1 ),
+        m_mapped( nullptr ),
+        m_mappedSize( 0 ),
+        m_header( nullptr ),
+        m_data( nullptr ),
+        m_capacity( 0 ),
+        m_position( 0 ) {}
+
+    bool m_producer;
+    int m_memfd;
+    int m_eventfd;
+    void* m_mapped;
+    size_t m_mappedSize;
+    RingHeader* m_header;
+    uint8_t* m_data;
+    uint32_t m_capacity;
+    /*
+     * Our own copy of head(producer) or tail(consumer).  The other side can
+     * write to the shared header, so we never read our own index back from it.
+     */
+    uint64_t m_position;
+};
+
+static uint64_t align_record( uint64_t size ) {
+    return ( size + 7 ) & ~static_cast<uint64_t>( 7 );
+}
+
+SharedMemoryChannel::SharedMemoryChannel() :
+    m_priv( std::make_unique<priv_data>() ) {
+}
+
+SharedMemoryChannel::~SharedMemoryChannel() {
+    if( m_priv->m_mapped ) {
+        munmap( m_priv->m_mapped, m_priv->m_mappedSize );
+    }
+
+    if( m_priv->m_memfd >= 0 ) {
+        close( m_priv->m_memfd );
+    }
+
+    if( m_priv->m_eventfd >= 0 ) {
+        close( m_priv->m_eventfd );
+    }
+}
+
+std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::create( uint32_t capacity ) {
+#if DBUS_CXX_HAS_MEMFD
+    uint32_t real_capacity = MINIMUM_CAPACITY;
+
+    if( capacity > MAXIMUM_CAPACITY ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Capacity of " << capacity << " is too large" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    while( real_capacity < capacity ) {
+        real_capacity <<= 1;
+    }
+
+    std::shared_ptr<SharedMemoryChannel> channel( new SharedMemoryChannel() );
+    channel->m_priv->m_producer = true;
+    channel->m_priv->m_memfd = memfd_create( "dbus-cxx-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    channel->m_priv->m_eventfd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+    if( channel->m_priv->m_memfd < 0 || channel->m_priv->m_eventfd < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to create channel: " << strerror( errno ) );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    if( ftruncate( channel->m_priv->m_memfd, sizeof( RingHeader ) + real_capacity ) < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to size channel: " << strerror( errno ) );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    // The consumer refuses memory that could be shrunk underneath it
+    if( fcntl( channel->m_priv->m_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to seal channel: " << strerror( errno ) );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    if( !channel->map_memory( channel->m_priv->m_memfd, real_capacity ) ) {
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    // A new memfd is zero-filled, so only the fixed values need to be set
+    channel->m_priv->m_header->capacity = real_capacity;
+    channel->m_priv->m_header->magic = CHANNEL_MAGIC;
+
+    return channel;
+#else
+    SIMPLELOGGER_ERROR( LOGGER_NAME, "Shared memory channels are not supported on this platform" );
+    return std::shared_ptr<SharedMemoryChannel>();
+#endif
+}
+
+std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::open( std::shared_ptr<FileDescriptor> memory,
+    std::shared_ptr<FileDescriptor> event ) {
+#if DBUS_CXX_HAS_MEMFD
+    if( !memory || !event || !*memory || !*event ) {
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    std::shared_ptr<SharedMemoryChannel> channel( new SharedMemoryChannel() );
+    channel->m_priv->m_memfd = fcntl( memory->descriptor(), F_DUPFD_CLOEXEC, 3 );
+    channel->m_priv->m_eventfd = fcntl( event->descriptor(), F_DUPFD_CLOEXEC, 3 );
+
+    if( channel->m_priv->m_memfd < 0 || channel->m_priv->m_eventfd < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to duplicate channel descriptors: " << strerror( errno ) );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    int seals = fcntl( channel->m_priv->m_memfd, F_GET_SEALS );
+
+    if( seals < 0 || !( seals & F_SEAL_SHRINK ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel memory is not sealed against shrinking" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    struct stat memory_stat;
+
+    if( fstat( channel->m_priv->m_memfd, &memory_stat ) < 0 ||
+        memory_stat.st_size < static_cast<off_t>( sizeof( RingHeader ) + MINIMUM_CAPACITY ) ||
+        memory_stat.st_size > static_cast<off_t>( sizeof( RingHeader ) + MAXIMUM_CAPACITY ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel memory has an invalid size" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    uint32_t capacity = memory_stat.st_size - sizeof( RingHeader );
+
+    if( ( capacity & ( capacity - 1 ) ) != 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel memory has an invalid size" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    if( !channel->map_memory( channel->m_priv->m_memfd, capacity ) ) {
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    if( channel->m_priv->m_header->magic != CHANNEL_MAGIC ||
+        channel->m_priv->m_header->capacity != capacity ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel memory does not contain a channel" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    uint64_t head = channel->m_priv->m_header->head.load( std::memory_order_acquire );
+    uint64_t tail = channel->m_priv->m_header->tail.load( std::memory_order_acquire );
+
+    // Every record starts on an aligned offset, and there can't be more than a full ring
+    if( tail != align_record( tail ) || head < tail || head - tail > capacity ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel indexes are corrupt" );
+        return std::shared_ptr<SharedMemoryChannel>();
+    }
+
+    channel->m_priv->m_position = tail;
+
+    return channel;
+#else
+    SIMPLELOGGER_ERROR( LOGGER_NAME, "Shared memory channels are not supported on this platform" );
+    return std::shared_ptr<SharedMemoryChannel>();
+#endif
+}
+
+bool SharedMemoryChannel::map_memory( int memfd, uint32_t capacity ) {
+    size_t size = sizeof( RingHeader ) + capacity;
+    void* mapped = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0 );
+
+    if( mapped == MAP_FAILED ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to map channel: " << strerror( errno ) );
+        return false;
+    }
+
+    m_priv->m_mapped = mapped;
+    m_priv->m_mappedSize = size;
+    m_priv->m_header = static_cast<RingHeader*>( mapped );
+    m_priv->m_data = static_cast<uint8_t*>( mapped ) + sizeof( RingHeader );
+    m_priv->m_capacity = capacity;
+
+    return true;
+}
+
+bool SharedMemoryChannel::is_producer() const {
+    return m_priv->m_producer;
+}
+
+uint32_t SharedMemoryChannel::capacity() const {
+    return m_priv->m_capacity;
+}
+
+std::shared_ptr<DBus::FileDescriptor> SharedMemoryChannel::memory_fd() const {
+    return FileDescriptor::create( m_priv->m_memfd );
+}
+
+std::shared_ptr<DBus::FileDescriptor> SharedMemoryChannel::event_fd() const {
+    return FileDescriptor::create( m_priv->m_eventfd );
+}
+
+bool SharedMemoryChannel::write_record( const std::vector<uint8_t>& data ) {
+    if( !m_priv->m_producer ) { return false; }
+
+    if( data.size() > m_priv->m_capacity / 2 - sizeof( uint32_t ) ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Record of " << data.size() << " bytes is too large for channel" );
+        return false;
+    }
+
+    uint32_t record_size = align_record( sizeof( uint32_t ) + data.size() );
+    uint64_t head = m_priv->m_position;
+    uint64_t tail = m_priv->m_header->tail.load( std::memory_order_acquire );
+    uint32_t offset = head & ( m_priv->m_capacity - 1 );
+    uint32_t contiguous = m_priv->m_capacity - offset;
+    uint32_t needed = record_size;
+
+    // Records are never split, so skip the end of the ring if we don't fit
+    if( record_size > contiguous ) {
+        needed += contiguous;
+    }
+
+    if( head - tail + needed > m_priv->m_capacity ) {
+        return false;
+    }
+
+    if( record_size > contiguous ) {
+        std::memcpy( m_priv->m_data + offset, &WRAP_MARKER, sizeof( uint32_t ) );
+        head += contiguous;
+        offset = 0;
+    }
+
+    uint32_t length = data.size();
+    std::memcpy( m_priv->m_data + offset, &length, sizeof( uint32_t ) );
+    std::memcpy( m_priv->m_data + offset + sizeof( uint32_t ), data.data(), data.size() );
+    head += record_size;
+
+    m_priv->m_position = head;
+    m_priv->m_header->head.store( head, std::memory_order_release );
+
+    return true;
+}
+
+bool SharedMemoryChannel::read_record( std::vector<uint8_t>* data ) {
+    if( m_priv->m_producer || !data ) { return false; }
+
+    uint64_t head = m_priv->m_header->head.load( std::memory_order_acquire );
+    uint64_t tail = m_priv->m_position;
+    uint32_t offset = tail & ( m_priv->m_capacity - 1 );
+    uint32_t length;
+
+    if( head == tail ) { return false; }
+
+    // The producer may not be trustworthy, so check everything before we copy
+    if( head - tail > m_priv->m_capacity || offset != align_record( offset ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel indexes are corrupt" );
+        return false;
+    }
+
+    std::memcpy( &length, m_priv->m_data + offset, sizeof( uint32_t ) );
+
+    if( length == WRAP_MARKER ) {
+        tail += m_priv->m_capacity - offset;
+        offset = 0;
+
+        if( head - tail < sizeof( uint32_t ) || head - tail > m_priv->m_capacity ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel indexes are corrupt" );
+            return false;
+        }
+
+        std::memcpy( &length, m_priv->m_data, sizeof( uint32_t ) );
+    }
+
+    // A record never runs past the end of the ring; the producer wraps instead
+    if( length > m_priv->m_capacity / 2 - sizeof( uint32_t ) ||
+        align_record( sizeof( uint32_t ) + length ) > head - tail ||
+        offset + align_record( sizeof( uint32_t ) + length ) > m_priv->m_capacity ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Channel record is corrupt" );
+        return false;
+    }
+
+    const uint8_t* start = m_priv->m_data + offset + sizeof( uint32_t );
+    data->assign( start, start + length );
+    tail += align_record( sizeof( uint32_t ) + length );
+
+    m_priv->m_position = tail;
+    m_priv->m_header->tail.store( tail, std::memory_order_release );
+
+    return true;
+}
+
+void SharedMemoryChannel::flush() {
+    if( !m_priv->m_producer ) { return; }
+
+    // Pairs with the fence in wait(): either the consumer sees our new head,
+    // or we see that it is waiting.
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if( m_priv->m_header->consumerWaiting.exchange( 0 ) ) {
+        uint64_t value = 1;
+
+        if( ::write( m_priv->m_eventfd, &value, sizeof( value ) ) < 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to wake up consumer: " << strerror( errno ) );
+        }
+    }
+}
+
+bool SharedMemoryChannel::has_record() const {
+    uint64_t head = m_priv->m_header->head.load( std::memory_order_acquire );
+
+    if( m_priv->m_producer ) {
+        return head != m_priv->m_header->tail.load( std::memory_order_acquire );
+    }
+
+    return head != m_priv->m_position;
+}
+
+bool SharedMemoryChannel::wait( int timeout_milliseconds ) {
+    if( m_priv->m_producer ) { return false; }
+
+    if( has_record() ) { return true; }
+
+    m_priv->m_header->consumerWaiting.store( 1 );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if( !has_record() ) {
+        struct pollfd fds;
+        uint64_t value;
+
+        fds.fd = m_priv->m_eventfd;
+        fds.events = POLLIN;
+        fds.revents = 0;
+
+        if( poll( &fds, 1, timeout_milliseconds ) > 0 ) {
+            if( ::read( m_priv->m_eventfd, &value, sizeof( value ) ) < 0 ) {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to read eventfd: " << strerror( errno ) );
+            }
+        }
+    }
+
+    m_priv->m_header->consumerWaiting.store( 0 );
+
+    return has_record();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, bool& value ) {
+    value = demarshal.demarshal_boolean();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, uint8_t& value ) {
+    value = demarshal.demarshal_uint8_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, int16_t& value ) {
+    value = demarshal.demarshal_int16_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, uint16_t& value ) {
+    value = demarshal.demarshal_uint16_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, int32_t& value ) {
+    value = demarshal.demarshal_int32_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, uint32_t& value ) {
+    value = demarshal.demarshal_uint32_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, int64_t& value ) {
+    value = demarshal.demarshal_int64_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, uint64_t& value ) {
+    value = demarshal.demarshal_uint64_t();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, double& value ) {
+    value = demarshal.demarshal_double();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, std::string& value ) {
+    value = demarshal.demarshal_string();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, Path& value ) {
+    value = demarshal.demarshal_path();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, Signature& value ) {
+    value = demarshal.demarshal_signature();
+}
+
+void SharedMemoryChannel::demarshal_value( Demarshaling& demarshal, Variant& value ) {
+    value = demarshal.demarshal_variant();
+}
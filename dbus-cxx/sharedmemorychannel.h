@@ -0,0 +1,198 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUSCXX_SHAREDMEMORYCHANNEL_H
+#define DBUSCXX_SHAREDMEMORYCHANNEL_H
+
+#include <dbus-cxx/dbus-cxx-config.h>
+#include <dbus-cxx/marshaling.h>
+#include <dbus-cxx/demarshaling.h>
+#include <dbus-cxx/enums.h>
+#include <dbus-cxx/path.h>
+#include <dbus-cxx/signature.h>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace DBus {
+
+class FileDescriptor;
+class Variant;
+
+/**
+ * A SharedMemoryChannel is a single-producer/single-consumer ring of records
+ * in shared memory, for streams of data that are too frequent to send as
+ * individual messages.
+ *
+ * The producer creates the channel and hands its two file descriptors(the
+ * memfd that holds the ring and an eventfd used for wakeups) to the consumer,
+ * normally as the return value of a method call:
+ *
+ * @code
+ * std::tuple<std::shared_ptr<DBus::FileDescriptor>,std::shared_ptr<DBus::FileDescriptor>> open_channel(){
+ *     channel = DBus::SharedMemoryChannel::create();
+ *     return std::make_tuple( channel->memory_fd(), channel->event_fd() );
+ * }
+ * @endcode
+ *
+ * The consumer then calls open() with the descriptors it received.  From that
+ * point on the two sides exchange records without going through the bus.
+ *
+ * Each record is a sequence of values marshaled with the same rules as a
+ * message body, so anything that Marshaling can handle can be written.  The
+ * reader must know the types of the values, as no signature is sent.
+ *
+ * Records become visible to the consumer as soon as they are written, but
+ * the consumer is only woken up by flush().  The producer may thus write a
+ * batch of records and pay for a single wakeup, which is only sent at all
+ * if the consumer is actually waiting.
+ *
+ * @ingroup core
+ */
+class SharedMemoryChannel {
+private:
+    SharedMemoryChannel();
+
+public:
+    /**
+     * Create a new channel as the producer.
+     *
+     * @param capacity The size of the ring in bytes.  This is rounded up to a
+     * power of two; the largest record that can be written is half of this.
+     * @return An invalid shared_ptr if the channel could not be created
+     */
+    static std::shared_ptr<SharedMemoryChannel> create( uint32_t capacity = 64 * 1024 );
+
+    /**
+     * Open a channel that was created by a producer as the consumer.
+     *
+     * The descriptors are duplicated, so the caller still owns the ones passed in.
+     *
+     * @param memory The memfd that holds the ring
+     * @param event The eventfd used for wakeups
+     * @return An invalid shared_ptr if the descriptors do not refer to a valid channel
+     */
+    static std::shared_ptr<SharedMemoryChannel> open( std::shared_ptr<FileDescriptor> memory,
+        std::shared_ptr<FileDescriptor> event );
+
+    ~SharedMemoryChannel();
+
+    /** True if we created this channel, false if we opened it */
+    bool is_producer() const;
+
+    /** The size of the ring in bytes */
+    uint32_t capacity() const;
+
+    /** The file descriptor of the shared memory, to send to the consumer */
+    std::shared_ptr<FileDescriptor> memory_fd() const;
+
+    /**
+     * The eventfd used for wakeups.  The consumer may poll this for
+     * readability instead of calling wait().
+     */
+    std::shared_ptr<FileDescriptor> event_fd() const;
+
+    /**
+     * Write one record of already marshaled data.
+     *
+     * @return false if this is not the producer, the record is too large, or
+     * there is currently not enough space in the ring.
+     */
+    bool write_record( const std::vector<uint8_t>& data );
+
+    /**
+     * Read the next record, if there is one.
+     *
+     * @return false if this is not the consumer or there is no record available
+     */
+    bool read_record( std::vector<uint8_t>* data );
+
+    /**
+     * Marshal the given values into one record and write it.
+     *
+     * @return false if the record could not be written, see write_record()
+     */
+    template <typename... T>
+    bool write( const T& ...values ) {
+        std::vector<uint8_t> record;
+        Marshaling marshal( &record, HOST_ENDIANESS );
+        ( marshal.marshal( values ), ... );
+        return write_record( record );
+    }
+
+    /**
+     * Read the next record and demarshal it into the given values, which
+     * must be the same types that the record was written with.
+     *
+     * @return false if there is no record available
+     */
+    template <typename... T>
+    bool read( T& ...values ) {
+        std::vector<uint8_t> record;
+
+        if( !read_record( &record ) ) { return false; }
+
+        Demarshaling demarshal( record.data(), record.size(), HOST_ENDIANESS );
+        ( demarshal_value( demarshal, values ), ... );
+        return true;
+    }
+
+    /**
+     * Wake up the consumer if it is waiting.  Call this after writing a
+     * batch of records.
+     */
+    void flush();
+
+    /** True if there is at least one record waiting to be read */
+    bool has_record() const;
+
+    /**
+     * Wait until there is a record to read.
+     *
+     * @param timeout_milliseconds How long to wait, or -1 to wait forever
+     * @return true if there is a record to read
+     */
+    bool wait( int timeout_milliseconds = -1 );
+
+private:
+    static void demarshal_value( Demarshaling& demarshal, bool& value );
+    static void demarshal_value( Demarshaling& demarshal, uint8_t& value );
+    static void demarshal_value( Demarshaling& demarshal, int16_t& value );
+    static void demarshal_value( Demarshaling& demarshal, uint16_t& value );
+    static void demarshal_value( Demarshaling& demarshal, int32_t& value );
+    static void demarshal_value( Demarshaling& demarshal, uint32_t& value );
+    static void demarshal_value( Demarshaling& demarshal, int64_t& value );
+    static void demarshal_value( Demarshaling& demarshal, uint64_t& value );
+    static void demarshal_value( Demarshaling& demarshal, double& value );
+    static void demarshal_value( Demarshaling& demarshal, std::string& value );
+    static void demarshal_value( Demarshaling& demarshal, Path& value );
+    static void demarshal_value( Demarshaling& demarshal, Signature& value );
+    static void demarshal_value( Demarshaling& demarshal, Variant& value );
+
+    bool map_memory( int memfd, uint32_t capacity );
+
+private:
+    class priv_data;
+
+    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+};
+
+} /* namespace DBus */
+
+#endif /* DBUSCXX_SHAREDMEMORYCHANNEL_H */
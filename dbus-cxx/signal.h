@@ -112,7 +112,9 @@ protected:
 
         if( !destination().empty() ) { __msg->set_destination( destination() ); }
 
-        ( *__msg << ... << args );
+        MessageAppendIterator iter = __msg->append();
+        iter.reserve_for( args... );
+        ( void )( iter << ... << args );
         bool result = this->handle_dbus_outgoing( __msg );
         DBUSCXX_DEBUG_STDSTR( "DBus.Signal", "signal::internal_callback: result=" << result );
     }
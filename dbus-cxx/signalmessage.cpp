@@ -40,30 +40,40 @@ SignalMessage::SignalMessage( const std::string& path, const std::string& interf
 }
 
 std::shared_ptr<SignalMessage> SignalMessage::create( ) {
-    return std::shared_ptr<SignalMessage>( new SignalMessage() );
+    Message* msg = take_from_pool( MessageType::SIGNAL );
+
+    if( !msg ) {
+        msg = new SignalMessage();
+    }
+
+    return std::static_pointer_cast<SignalMessage>( manage_pooled( msg ) );
 }
 
 std::shared_ptr<SignalMessage> SignalMessage::create( const std::string& name ) {
-    return std::shared_ptr<SignalMessage>( new SignalMessage( name ) );
+    std::shared_ptr<SignalMessage> msg = create();
+
+    msg->set_member( name );
+
+    return msg;
 }
 
 std::shared_ptr<SignalMessage> SignalMessage::create( const std::string& path, const std::string& interface_name, const std::string& name ) {
-    return std::shared_ptr<SignalMessage>( new SignalMessage( path, interface_name, name ) );
+    std::shared_ptr<SignalMessage> msg = create();
+
+    msg->set_path( path );
+    msg->set_interface( interface_name );
+    msg->set_member( name );
+
+    return msg;
 }
 
 bool SignalMessage::set_path( const std::string& p ) {
-    set_header_field( MessageHeaderFields::Path, Variant( Path( p ) ) );
+    set_header_string( MessageHeaderFields::Path, p );
     return true;
 }
 
-Path SignalMessage::path() const {
-    DBus::Variant memberName = header_field( MessageHeaderFields::Path );
-
-    if( memberName.type() == DataType::OBJECT_PATH ) {
-        return memberName.to_path();
-    }
-
-    return std::string( "" );
+const Path& SignalMessage::path() const {
+    return header_path();
 }
 
 //  bool SignalMessage::has_path( const std::string& p ) const
@@ -84,33 +94,21 @@ std::vector<std::string> SignalMessage::path_decomposed() const {
 bool SignalMessage::set_interface( const std::string& i ) {
     if( !Validator::validate_interface_name( i ) ) { return false; }
 
-    set_header_field( MessageHeaderFields::Interface, Variant( i ) );
+    set_header_string( MessageHeaderFields::Interface, i );
     return true;
 }
 
-std::string SignalMessage::interface_name() const {
-    DBus::Variant memberName = header_field( MessageHeaderFields::Interface );
-
-    if( memberName.type() == DataType::STRING ) {
-        return memberName.to_string();
-    }
-
-    return std::string( "" );
+const std::string& SignalMessage::interface_name() const {
+    return header_string( MessageHeaderFields::Interface );
 }
 
 bool SignalMessage::set_member( const std::string& m ) {
-    set_header_field( MessageHeaderFields::Member, Variant( m ) );
+    set_header_string( MessageHeaderFields::Member, m );
     return true;
 }
 
-std::string SignalMessage::member() const {
-    DBus::Variant memberName = header_field( MessageHeaderFields::Member );
-
-    if( memberName.type() == DataType::STRING ) {
-        return memberName.to_string();
-    }
-
-    return std::string( "" );
+const std::string& SignalMessage::member() const {
+    return header_string( MessageHeaderFields::Member );
 }
 
 
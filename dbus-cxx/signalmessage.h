@@ -57,7 +57,7 @@ public:
 
     bool set_path( const std::string& p );
 
-    Path path() const;
+    const Path& path() const;
 
     //      bool has_path( const std::string& p ) const;
 
@@ -65,13 +65,13 @@ public:
 
     bool set_interface( const std::string& i );
 
-    std::string interface_name() const;
+    const std::string& interface_name() const;
 
     //bool has_interface( const std::string& i ) const;
 
     bool set_member( const std::string& m );
 
-    std::string member() const;
+    const std::string& member() const;
 
     //bool has_member( const std::string& m ) const;
 
@@ -17,54 +17,358 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include "signature.h"
-#include <stack>
 #include "dbus-cxx-private.h"
 
 #include "types.h"
 
+#include <atomic>
+#include <mutex>
+
 static const char* LOGGER_NAME = "DBus.Signature";
 
-namespace DBus {
+/* Limits from the D-Bus specification */
+#define MAX_SIGNATURE_LENGTH 255
+#define MAX_ARRAY_NESTING 32
+#define MAX_STRUCT_NESTING 32
 
-const Signature::size_type npos = std::string::npos;
+/* Size of the signature intern table */
+#define INTERN_BUCKETS 1024
+#define INTERN_MAX_ENTRIES 4096
 
-class Signature::priv_data {
+namespace {
+
+/**
+ * Parses a signature into the flat node array of a SignatureData, checking
+ * that it is valid as it goes.
+ */
+class SignatureParser {
 public:
-    priv_data() :
-        m_valid( false )
-    {}
+    SignatureParser( DBus::priv::SignatureData* data ) :
+        m_sig( data->m_signature ),
+        m_nodes( data->m_nodes ) {}
+
+    bool parse() {
+        size_t pos = 0;
+        size_t previous = 0;
+
+        if( m_sig.size() > MAX_SIGNATURE_LENGTH ) {
+            return false;
+        }
+
+        m_nodes.resize( m_sig.size() );
+
+        while( pos < m_sig.size() ) {
+            size_t end = parse_single( pos, 0, 0 );
+
+            if( end == 0 ) {
+                return false;
+            }
+
+            if( pos != 0 ) {
+                m_nodes[ previous ].m_next = pos;
+            }
+
+            previous = pos;
+            pos = end;
+        }
+
+        return true;
+    }
+
+private:
+    /**
+     * Parse the complete type that starts at pos.
+     *
+     * @return The position just after it, or 0 if it is not valid.
+     */
+    size_t parse_single( size_t pos, int arrayDepth, int structDepth ) {
+        if( pos >= m_sig.size() ) {
+            return 0;
+        }
+
+        DBus::priv::SignatureNode& node = m_nodes[ pos ];
+        char code = m_sig[ pos ];
+        size_t end = pos + 1;
+
+        node.m_next = 0;
+        node.m_fixedSize = 0;
+
+        switch( code ) {
+        case 'y':
+        case 'b':
+        case 'n':
+        case 'q':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 't':
+        case 'd':
+        case 'h':
+            // These are exactly as big as their alignment
+            node.m_fixedSize = DBus::TypeInfo( DBus::char_to_dbus_type( code ) ).alignment();
+            break;
+
+        case 's':
+        case 'o':
+        case 'g':
+        case 'v':
+            break;
+
+        case 'a':
+            if( arrayDepth + 1 > MAX_ARRAY_NESTING ) {
+                return 0;
+            }
+
+            if( end < m_sig.size() && m_sig[ end ] == '{' ) {
+                end = parse_dict_entry( end, arrayDepth + 1, structDepth );
+            } else {
+                end = parse_single( end, arrayDepth + 1, structDepth );
+            }
+
+            break;
+
+        case '(':
+            end = parse_struct( pos, arrayDepth, structDepth );
+            break;
+
+        default:
+            // Closing characters, dict entries outside of an array, and codes
+            // that are not allowed in signatures
+            return 0;
+        }
+
+        if( end == 0 ) {
+            return 0;
+        }
+
+        DBus::DataType type = DBus::char_to_dbus_type( code );
+
+        node.m_dataType = static_cast<uint8_t>( type );
+        node.m_end = end;
+        node.m_alignment = DBus::TypeInfo( type ).alignment();
+
+        return end;
+    }
+
+    /* Parse the members of a struct or dict entry, up to and including the closing character */
+    size_t parse_members( size_t pos, char closing, int arrayDepth, int structDepth ) {
+        size_t member = pos + 1;
+        size_t previous = 0;
+        size_t offset = 0;
+        bool fixed = true;
 
-    std::string m_signature;
-    std::shared_ptr<priv::SignatureNode> m_startingNode;
-    bool m_valid;
+        if( structDepth + 1 > MAX_STRUCT_NESTING ) {
+            return 0;
+        }
+
+        while( member < m_sig.size() && m_sig[ member ] != closing ) {
+            size_t end = parse_single( member, arrayDepth, structDepth + 1 );
+
+            if( end == 0 ) {
+                return 0;
+            }
+
+            if( previous != 0 ) {
+                m_nodes[ previous ].m_next = member;
+            }
+
+            // Structs start on an 8-byte boundary, so the padding inside
+            // of them is always the same
+            const DBus::priv::SignatureNode& memberNode = m_nodes[ member ];
+            fixed = fixed && memberNode.m_fixedSize != 0;
+            offset = ( ( offset + memberNode.m_alignment - 1 ) & ~( memberNode.m_alignment - 1 ) ) + memberNode.m_fixedSize;
+
+            previous = member;
+            member = end;
+        }
+
+        // Empty containers are not allowed
+        if( member >= m_sig.size() || previous == 0 ) {
+            return 0;
+        }
+
+        m_nodes[ member ].m_dataType = static_cast<uint8_t>( DBus::DataType::INVALID );
+        m_nodes[ member ].m_end = member + 1;
+        m_nodes[ member ].m_next = 0;
+        m_nodes[ pos ].m_fixedSize = fixed ? offset : 0;
+
+        return member + 1;
+    }
+
+    size_t parse_struct( size_t pos, int arrayDepth, int structDepth ) {
+        return parse_members( pos, ')', arrayDepth, structDepth );
+    }
+
+    size_t parse_dict_entry( size_t pos, int arrayDepth, int structDepth ) {
+        size_t end = parse_members( pos, '}', arrayDepth, structDepth );
+
+        if( end == 0 ) {
+            return 0;
+        }
+
+        // The key must be a basic type, and there must be exactly one value
+        DBus::TypeInfo keyInfo( DBus::char_to_dbus_type( m_sig[ pos + 1 ] ) );
+        size_t value = m_nodes[ pos + 1 ].m_next;
+
+        if( !keyInfo.is_basic() || value == 0 || m_nodes[ value ].m_next != 0 ) {
+            return 0;
+        }
+
+        DBus::priv::SignatureNode& node = m_nodes[ pos ];
+        node.m_dataType = static_cast<uint8_t>( DBus::DataType::DICT_ENTRY );
+        node.m_end = end;
+        node.m_next = 0;
+        node.m_alignment = 8;
+
+        return end;
+    }
+
+private:
+    const std::string& m_sig;
+    std::vector<DBus::priv::SignatureNode>& m_nodes;
 };
 
-Signature::Signature() :
-    m_priv( std::make_shared<priv_data>() ) {
+/**
+ * The process-wide table of parsed signatures.  Entries are only ever added,
+ * and are never freed, so a reader can walk a bucket without taking a lock;
+ * the Signatures that point at them do not own them.  Only the first
+ * INTERN_MAX_ENTRIES valid signatures are kept, so that a peer sending us
+ * random signatures cannot grow the table without bound.
+ */
+class SignatureTable {
+public:
+    struct Entry {
+        size_t m_hash;
+        DBus::priv::SignatureData m_data;
+        Entry* m_next;
+    };
+
+    /**
+     * Find the entry for the signature, adding it if it is valid and there
+     * is room.  Returns nullptr if the signature was not added.
+     */
+    const Entry* intern( std::string_view signature ) {
+        size_t hash = hash_of( signature );
+        std::atomic<Entry*>& bucket = m_buckets[ hash % INTERN_BUCKETS ];
+        const Entry* found = find( bucket.load( std::memory_order_acquire ), hash, signature );
+
+        if( found ) {
+            m_hits.fetch_add( 1, std::memory_order_relaxed );
+            return found;
+        }
+
+        m_misses.fetch_add( 1, std::memory_order_relaxed );
+
+        if( m_entries.load( std::memory_order_relaxed ) >= INTERN_MAX_ENTRIES ||
+            signature.size() > MAX_SIGNATURE_LENGTH ) {
+            return nullptr;
+        }
+
+        std::unique_ptr<Entry> entry( new Entry() );
+        entry->m_hash = hash;
+        entry->m_data.m_signature = std::string( signature );
+        entry->m_data.m_valid = SignatureParser( &entry->m_data ).parse();
+
+        if( !entry->m_data.m_valid ) {
+            return nullptr;
+        }
+
+        std::scoped_lock lock( m_mutex );
+
+        // Somebody else may have added it while we were parsing
+        found = find( bucket.load( std::memory_order_relaxed ), hash, signature );
+
+        if( found ) {
+            return found;
+        }
+
+        if( m_entries.load( std::memory_order_relaxed ) >= INTERN_MAX_ENTRIES ) {
+            return nullptr;
+        }
+
+        entry->m_next = bucket.load( std::memory_order_relaxed );
+        bucket.store( entry.get(), std::memory_order_release );
+        m_entries.fetch_add( 1, std::memory_order_relaxed );
+
+        return entry.release();
+    }
+
+    DBus::SignatureCacheStatistics statistics() const {
+        DBus::SignatureCacheStatistics stats;
+
+        stats.hits = m_hits.load( std::memory_order_relaxed );
+        stats.misses = m_misses.load( std::memory_order_relaxed );
+        stats.entries = m_entries.load( std::memory_order_relaxed );
+
+        return stats;
+    }
+
+private:
+    static const Entry* find( const Entry* entry, size_t hash, std::string_view signature ) {
+        for( ; entry != nullptr; entry = entry->m_next ) {
+            if( entry->m_hash == hash && entry->m_data.m_signature == signature ) {
+                return entry;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /* FNV-1a; signatures are short */
+    static size_t hash_of( std::string_view signature ) {
+        uint32_t hash = 2166136261u;
+
+        for( char c : signature ) {
+            hash ^= static_cast<uint8_t>( c );
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+private:
+    std::atomic<Entry*> m_buckets[ INTERN_BUCKETS ] = {};
+    std::atomic<uint64_t> m_hits{ 0 };
+    std::atomic<uint64_t> m_misses{ 0 };
+    std::atomic<uint32_t> m_entries{ 0 };
+    std::mutex m_mutex;
+};
+
+SignatureTable& signature_table() {
+    // Never destroyed, as Signatures in other static objects may outlive it
+    static SignatureTable* table = new SignatureTable();
+
+    return *table;
+}
+
+} /* anonymous namespace */
+
+namespace DBus {
+
+const Signature::size_type npos = std::string::npos;
+
+Signature::Signature() {
+    // Not a valid signature; all of these can share the same data
+    static const std::shared_ptr<const priv::SignatureData> empty =
+        std::make_shared<priv::SignatureData>();
+
+    m_priv = empty;
 }
 
-Signature::Signature( const std::string& s, size_type pos, size_type n ):
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_signature = std::string( s, pos, n );
-    initialize();
+Signature::Signature( const std::string& s, size_type pos, size_type n ) {
+    initialize( std::string_view( s ).substr( pos, n ) );
 }
 
-Signature::Signature( const char* s ) :
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_signature = std::string( s );
-    initialize();
+Signature::Signature( const char* s ) {
+    initialize( s );
 }
 
-Signature::Signature( const char* s, size_type n ):
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_signature = std::string( s, n );
-    initialize();
+Signature::Signature( const char* s, size_type n ) {
+    initialize( std::string_view( s, n ) );
 }
 
-Signature::Signature( size_type n, char c ):
-    m_priv( std::make_shared<priv_data>() ) {
-    m_priv->m_signature = std::string( n, c );
-    initialize();
+Signature::Signature( size_type n, char c ) {
+    initialize( std::string( n, c ) );
 }
 
 Signature::~Signature() {
@@ -79,33 +383,33 @@ const std::string& Signature::str() const {
 }
 
 Signature& Signature::operator =( const std::string& s ) {
-    m_priv->m_signature = s;
+    initialize( s );
     return *this;
 }
 
 Signature& Signature::operator =( const char* s ) {
-    m_priv->m_signature = s;
+    initialize( s );
     return *this;
 }
 
 Signature::iterator Signature::begin() {
-    if( !m_priv->m_valid ) { return SignatureIterator(); }
+    if( !m_priv->m_valid || m_priv->m_nodes.empty() ) { return SignatureIterator(); }
 
-    return SignatureIterator( m_priv->m_startingNode );
+    return SignatureIterator( m_priv, 0 );
 }
 
 Signature::const_iterator Signature::begin() const {
-    if( !m_priv->m_valid ) { return SignatureIterator(); }
+    if( !m_priv->m_valid || m_priv->m_nodes.empty() ) { return SignatureIterator(); }
 
-    return SignatureIterator( m_priv->m_startingNode );
+    return SignatureIterator( m_priv, 0 );
 }
 
 Signature::iterator Signature::end() {
-    return SignatureIterator( nullptr );
+    return SignatureIterator();
 }
 
 Signature::const_iterator Signature::end() const {
-    return SignatureIterator( nullptr );
+    return SignatureIterator();
 }
 
 bool Signature::is_valid() const {
@@ -114,201 +418,54 @@ bool Signature::is_valid() const {
 
 bool Signature::is_singleton() const {
     return m_priv->m_valid &&
-        m_priv->m_startingNode != nullptr &&
-        m_priv->m_startingNode->m_dataType != DataType::INVALID  &&
-        m_priv->m_startingNode->m_next == nullptr &&
-        m_priv->m_startingNode->m_sub == nullptr;
+        !m_priv->m_nodes.empty() &&
+        m_priv->m_nodes[ 0 ].m_end == m_priv->m_nodes.size();
 }
 
-std::shared_ptr<priv::SignatureNode> Signature::create_signature_tree( std::string::const_iterator* it,
-    std::stack<ContainerType>* container_stack,
-    bool* ok ) {
-    DataType tmpDataType;
-    std::shared_ptr<priv::SignatureNode> first = nullptr;
-    std::shared_ptr<priv::SignatureNode> current = nullptr;
-    bool ending_container;
-
-    if( container_stack->size() > 64 ) {
-        *ok = false;
-        return nullptr;
-    }
-
-    if( *it == m_priv->m_signature.cend() ) {
-        return nullptr;
+void Signature::print_tree( std::ostream* stream ) const {
+    if( !m_priv->m_valid || m_priv->m_nodes.empty() ) {
+        return;
     }
 
-    do {
-        tmpDataType = char_to_dbus_type( **it );
-        ending_container = is_ending_container( **it );
-
-        if( tmpDataType == DataType::INVALID ) {
-            *ok = false;
-            return nullptr;
-        }
-
-        if( ending_container ) {
-            if( container_stack->size() == 0 ) {
-                *ok = false;
-                return nullptr;
-            }
-
-            ContainerType currentTop = container_stack->top();
-
-            if( currentTop == ContainerType::STRUCT &&
-                tmpDataType == DataType::STRUCT ) {
-                return first;
-            } else if( currentTop == ContainerType::DICT_ENTRY &&
-                tmpDataType == DataType::DICT_ENTRY ) {
-                return first;
-            } else {
-                *ok = false;
-                return nullptr;
-            }
-        }
+    size_t current = 0;
 
+    while( true ) {
+        *stream << static_cast<DataType>( m_priv->m_nodes[ current ].m_dataType );
+        current = m_priv->m_nodes[ current ].m_next;
 
-        std::shared_ptr<priv::SignatureNode> newnode = std::make_shared<priv::SignatureNode>( tmpDataType );
-
-        if( current != nullptr ) {
-            current->m_next = newnode;
-            current = newnode;
-        }
-
-        if( first == nullptr ) {
-            first = newnode;
-            current = newnode;
-        }
-
-        TypeInfo ti( tmpDataType );
-
-        if( !container_stack->empty() &&
-            container_stack->top() == ContainerType::ARRAY &&
-            ti.is_basic() ) {
-            // We just added this basic element to the array
-            ( *it )++;
+        if( current == 0 ) {
+            *stream << " (null) ";
             break;
         }
 
-        if( ti.is_container() &&
-            tmpDataType != DataType::VARIANT ) {
-            ContainerType toPush = char_to_container_type( **it );
-            container_stack->push( toPush );
-            ( *it )++;
-            current->m_sub = create_signature_tree( it, container_stack, ok );
-
-            if( container_stack->top() != toPush ) {
-                // Unbalanced
-                *ok = false;
-                return nullptr;
-            }
-
-            // If we're the ending character of a container,
-            // advance the iterator so we go to the next character
-            ending_container = is_ending_container( **it );
-
-            if( ending_container &&
-                toPush == ContainerType::STRUCT ) {
-                container_stack->pop();
-
-                if( !container_stack->empty() ) {
-                    ( *it )++;
-                    return first;
-                }
-
-            } else if( ending_container &&
-                toPush == ContainerType::DICT_ENTRY ) {
-                container_stack->pop();
-                ( *it )++;
-                return first;
-            } else if( toPush == ContainerType::ARRAY &&
-                current->m_sub != nullptr ) {
-                // Note: need to be special about popping and advancing iterator
-                // Assume we have 'aaid' as our signature.  When popping the array
-                // off of our stack, we only need to advance the iterator once.
-                // So basically, don't advance the iterator unless we're all the way
-                // at the begining of the array.
-                // This also means that we will either continue or break, depending on
-                // if we are at the end of the signature or not, so we know if we need
-                // to go on at all.
-                bool isArrayEnd = true;
-
-                container_stack->pop();
-
-                if( !container_stack->empty() &&
-                    container_stack->top() == ContainerType::ARRAY ) {
-                    isArrayEnd = false;
-                }
-
-                if( isArrayEnd && *it != m_priv->m_signature.cend() ) {
-                    //(*it)++;
-                    continue;
-                }
-
-                break;
-            } else {
-                *ok = false;
-                return nullptr;
-            }
-        }
-
-        if( *it != m_priv->m_signature.cend() ) { ( *it )++; }
-    } while( *it != m_priv->m_signature.cend() );
-
-    return first;
-}
-
-
-void Signature::print_tree( std::ostream* stream ) const {
-    std::shared_ptr<priv::SignatureNode> current = m_priv->m_startingNode;
-
-    while( current != nullptr ) {
-        *stream << current->m_dataType;
-        current = current->m_next;
-
-        if( current == nullptr ) {
-            *stream << " (null) ";
-        } else {
-            *stream << " --> ";
-        }
+        *stream << " --> ";
     }
 }
 
-void Signature::print_node( std::ostream* stream, priv::SignatureNode* node, int spaces ) const {
-    if( node == nullptr ) {
-        return;
-    }
-
-    //if( node->)
-    for( int x = 0; x < spaces; x++ ) {
-        *stream << " ";
-    }
-
-    *stream << node->m_dataType;
+SignatureCacheStatistics Signature::cache_statistics() {
+    return signature_table().statistics();
 }
 
-void Signature::initialize() {
-    m_priv->m_valid = true;
-    std::stack<ContainerType> containerStack;
-    std::string::const_iterator it = m_priv->m_signature.begin();
-    m_priv->m_startingNode = create_signature_tree( &it, &containerStack, &m_priv->m_valid );
+void Signature::initialize( std::string_view signature ) {
+    const SignatureTable::Entry* entry = signature_table().intern( signature );
 
-    if( !containerStack.empty() ||
-        it != m_priv->m_signature.end() ) {
-        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Either stack not empty or signature not used up completely" );
-        m_priv->m_valid = false;
+    if( entry ) {
+        // The entry lives forever, so this does not need to own it and
+        // copying it does not touch a reference count
+        m_priv = std::shared_ptr<const priv::SignatureData>( std::shared_ptr<void>(), &entry->m_data );
+        return;
     }
 
-    std::ostringstream logmsg;
-    logmsg << "Signature \'" << m_priv->m_signature << "\' is ";
+    std::shared_ptr<priv::SignatureData> data = std::make_shared<priv::SignatureData>();
 
-    if( m_priv->m_valid ) {
-        logmsg << "valid";
-    } else {
-        logmsg << "invalid";
+    data->m_signature = std::string( signature );
+    data->m_valid = SignatureParser( data.get() ).parse();
+
+    if( !data->m_valid ) {
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Signature '" << data->m_signature << "' is invalid" );
     }
 
-    SIMPLELOGGER_TRACE( LOGGER_NAME, logmsg.str() );
+    m_priv = data;
 }
 
 }
-
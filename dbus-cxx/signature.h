@@ -24,7 +24,11 @@
 #include <map>
 #include <memory>
 #include <ostream>
+#include <stddef.h>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 #include <stack>
 #include "enums.h"
@@ -57,24 +61,56 @@ namespace DBus {
 
 namespace priv {
 /**
- * Represents a single entry in our graph of the signature
+ * One type code of a parsed signature.
  */
 class SignatureNode {
 public:
-    SignatureNode( DataType d ) :
-        m_dataType( d ),
-        m_next( nullptr ),
-        m_sub( nullptr ) {}
-
-    DataType m_dataType;
-    std::shared_ptr<priv::SignatureNode> m_next;
-    std::shared_ptr<priv::SignatureNode> m_sub;
+    /* The DataType, stored in a byte */
+    uint8_t m_dataType;
+    /* Index just past the end of the complete type that starts here */
+    uint8_t m_end;
+    /* Index of the next type in the same container, or 0 if there is none */
+    uint8_t m_next;
+    uint8_t m_alignment;
+    /* The marshaled size if it never changes, otherwise 0 */
+    uint16_t m_fixedSize;
+};
+
+/**
+ * A parsed signature.  The nodes run parallel to the signature string, so
+ * the node of the type code at position x is at index x, and the first type
+ * inside of a container is always the one right after it.  Closing ')' and
+ * '}' also get a node, which is never visited.
+ *
+ * This is shared between copies of a Signature and its iterators, and is
+ * never changed once it has been parsed.
+ */
+class SignatureData {
+public:
+    SignatureData() :
+        m_valid( false ) {}
+
+    std::string m_signature;
+    std::vector<SignatureNode> m_nodes;
+    bool m_valid;
 };
 }
 
 class FileDescriptor;
 class Variant;
 
+/**
+ * Counters for the process-wide table of parsed signatures.
+ */
+struct SignatureCacheStatistics {
+    /** Signatures that were already in the table */
+    uint64_t hits;
+    /** Signatures that had to be parsed */
+    uint64_t misses;
+    /** Signatures in the table */
+    uint32_t entries;
+};
+
 /**
  * Represents a DBus signature.  DBus signatures indicate what type of
  * data the message contains/the method parameters.
@@ -138,19 +174,136 @@ public:
      */
     void print_tree( std::ostream* stream ) const;
 
+    /**
+     * Valid signatures are parsed once and then kept in a table for the life
+     * of the process, so that constructing a Signature that has been seen
+     * before is a lookup, and copying it is a pointer copy.  Returns the hit
+     * and miss counts of that table.
+     */
+    static SignatureCacheStatistics cache_statistics();
+
 private:
-    void initialize();
+    void initialize( std::string_view signature );
+
+private:
+    std::shared_ptr<const priv::SignatureData> m_priv;
+};
+
+/**
+ * A signature that is known at compile time.  It is stored inline, along
+ * with a nul terminator, so it needs no allocation and can be used in
+ * constant expressions.
+ *
+ * Signatures of compound types are built by adding these together.
+ */
+template <size_t N>
+class StaticSignature {
+public:
+    constexpr StaticSignature() :
+        m_data{} {}
+
+    constexpr StaticSignature( const char ( &s )[N + 1] ) :
+        m_data{} {
+        for( size_t x = 0; x < N; x++ ) {
+            m_data[ x ] = s[ x ];
+        }
+    }
+
+    constexpr size_t size() const { return N; }
+
+    constexpr const char* c_str() const { return m_data; }
+
+    constexpr std::string_view view() const { return std::string_view( m_data, N ); }
+
+    std::string str() const { return std::string( m_data, N ); }
+
+    template <size_t M>
+    constexpr StaticSignature<N + M> operator+( const StaticSignature<M>& other ) const {
+        StaticSignature<N + M> sum;
+
+        for( size_t x = 0; x < N; x++ ) {
+            sum.m_data[ x ] = m_data[ x ];
+        }
 
-    std::shared_ptr<priv::SignatureNode> create_signature_tree( std::string::const_iterator* it,
-        std::stack<ContainerType>* container_stack,
-        bool* ok );
+        for( size_t x = 0; x < M; x++ ) {
+            sum.m_data[ N + x ] = other.m_data[ x ];
+        }
 
-    void print_node( std::ostream* stream, priv::SignatureNode* node, int spaces ) const;
+        return sum;
+    }
 
 private:
-    class priv_data;
+    template <size_t M>
+    friend class StaticSignature;
+
+    char m_data[ N + 1 ];
+};
+
+template <size_t N>
+StaticSignature( const char ( & )[N] ) -> StaticSignature<N - 1>;
 
-    std::shared_ptr<priv_data> m_priv;
+/**
+ * The signature of a C++ type, known at compile time.  Specializations
+ * have a static constexpr member named value, which is a StaticSignature.
+ *
+ * This is specialized for all of the types that dbus-cxx supports, and for
+ * vectors, maps and tuples of them.  To give a custom type a signature that
+ * is known at compile time, specialize it as well:
+ * \code
+ * namespace DBus {
+ * template <> struct signature_traits<MyStruct> {
+ *     static constexpr auto value = StaticSignature( "(is)" );
+ * };
+ * }
+ * \endcode
+ *
+ * Types that have no specialization fall back to their signature()
+ * overload, which is called at runtime.
+ */
+template <typename T, typename Enable = void>
+struct signature_traits {};
+
+/** True if signature_traits has been specialized for T */
+template <typename T, typename = void>
+struct has_signature_traits : std::false_type {};
+
+template <typename T>
+struct has_signature_traits<T, std::void_t<decltype( signature_traits<T>::value )>> : std::true_type {};
+
+template <> struct signature_traits<uint8_t>     { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_BYTE_AS_STRING ); };
+template <> struct signature_traits<bool>        { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_BOOLEAN_AS_STRING ); };
+template <> struct signature_traits<int16_t>     { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_INT16_AS_STRING ); };
+template <> struct signature_traits<uint16_t>    { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_UINT16_AS_STRING ); };
+template <> struct signature_traits<int32_t>     { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_INT32_AS_STRING ); };
+template <> struct signature_traits<uint32_t>    { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_UINT32_AS_STRING ); };
+template <> struct signature_traits<int64_t>     { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_INT64_AS_STRING ); };
+template <> struct signature_traits<uint64_t>    { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_UINT64_AS_STRING ); };
+template <> struct signature_traits<double>      { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_DOUBLE_AS_STRING ); };
+template <> struct signature_traits<std::string> { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_STRING_AS_STRING ); };
+template <> struct signature_traits<const char*> { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_STRING_AS_STRING ); };
+template <> struct signature_traits<Signature>   { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_SIGNATURE_AS_STRING ); };
+template <> struct signature_traits<Path>        { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_OBJECT_PATH_AS_STRING ); };
+template <> struct signature_traits<Variant>     { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_VARIANT_AS_STRING ); };
+template <> struct signature_traits<std::shared_ptr<FileDescriptor>> { static constexpr auto value = StaticSignature( DBUSCXX_TYPE_UNIX_FD_AS_STRING ); };
+
+template <typename T>
+struct signature_traits<std::vector<T>, std::enable_if_t<has_signature_traits<T>::value>> {
+    static constexpr auto value = StaticSignature( DBUSCXX_TYPE_ARRAY_AS_STRING ) + signature_traits<T>::value;
+};
+
+template <typename Key, typename Data>
+struct signature_traits<std::map<Key, Data>,
+    std::enable_if_t<has_signature_traits<Key>::value && has_signature_traits<Data>::value>> {
+    static constexpr auto value = StaticSignature( DBUSCXX_TYPE_ARRAY_AS_STRING DBUSCXX_DICT_ENTRY_BEGIN_CHAR_AS_STRING ) +
+        signature_traits<Key>::value +
+        signature_traits<Data>::value +
+        StaticSignature( DBUSCXX_DICT_ENTRY_END_CHAR_AS_STRING );
+};
+
+template <typename... T>
+struct signature_traits<std::tuple<T...>, std::enable_if_t<( has_signature_traits<T>::value && ... )>> {
+    static constexpr auto value = ( StaticSignature( DBUSCXX_STRUCT_BEGIN_CHAR_AS_STRING ) + ... + signature_traits<T>::value ) +
+        StaticSignature( DBUSCXX_STRUCT_END_CHAR_AS_STRING );
 };
 
 template <typename... T>
@@ -171,29 +324,57 @@ inline std::string signature( Path )        { return DBUSCXX_TYPE_OBJECT_PATH_AS
 inline std::string signature( const DBus::Variant& )     { return DBUSCXX_TYPE_VARIANT_AS_STRING; }
 inline std::string signature( const std::shared_ptr<FileDescriptor> )  { return DBUSCXX_TYPE_UNIX_FD_AS_STRING; }
 
-template <typename T> inline std::string signature( const std::vector<T>& ) { T t; return DBUSCXX_TYPE_ARRAY_AS_STRING + signature( t ); }
+template <typename T> inline std::string signature( const std::vector<T>& );
+
+template <typename Key, typename Data> inline std::string signature( const std::map<Key, Data>& );
+
+namespace priv {
+
+/*
+ * The signature of T.  This is a std::string_view of the compile-time
+ * signature when T has one.  Otherwise, T is default-constructed and its
+ * signature() overload is called, which returns a std::string.
+ */
+template <typename T>
+inline auto signature_of() {
+    if constexpr( has_signature_traits<T>::value ) {
+        return signature_traits<T>::value.view();
+    } else {
+        T t;
+        return signature( t );
+    }
+}
+
+} /* namespace priv */
+
+template <typename T> inline std::string signature( const std::vector<T>& ) {
+    if constexpr( has_signature_traits<std::vector<T>>::value ) {
+        return signature_traits<std::vector<T>>::value.str();
+    } else {
+        return DBUSCXX_TYPE_ARRAY_AS_STRING + std::string( priv::signature_of<T>() );
+    }
+}
 
 template <typename Key, typename Data> inline std::string signature( const std::map<Key, Data>& ) {
-    Key k; Data d;
-    std::string sig;
-    sig = DBUSCXX_TYPE_ARRAY_AS_STRING;
-    sig += DBUSCXX_DICT_ENTRY_BEGIN_CHAR_AS_STRING +
-        signature( k ) + signature( d ) +
-        DBUSCXX_DICT_ENTRY_END_CHAR_AS_STRING;
-    return sig;
+    if constexpr( has_signature_traits<std::map<Key, Data>>::value ) {
+        return signature_traits<std::map<Key, Data>>::value.str();
+    } else {
+        std::string sig;
+        sig = DBUSCXX_TYPE_ARRAY_AS_STRING;
+        sig += DBUSCXX_DICT_ENTRY_BEGIN_CHAR_AS_STRING;
+        sig += priv::signature_of<Key>();
+        sig += priv::signature_of<Data>();
+        sig += DBUSCXX_DICT_ENTRY_END_CHAR_AS_STRING;
+        return sig;
+    }
 }
 
 //Note: we need to have two different signature() methods for dictionaries; this is because
 //when introspecting, we need to use the normal signature() so that it comes up properly.
 //However, when we are sending out data, that signature would give us an extra array signature,
 //which is not good.  Hence, this method is only used when we need to send out a dict
-template <typename Key, typename Data> inline std::string signature_dict_data( const std::map<Key, Data>& ) {
-    Key k; Data d;
-    std::string sig;
-    sig = DBUSCXX_DICT_ENTRY_BEGIN_CHAR_AS_STRING +
-        signature( k ) + signature( d ) +
-        DBUSCXX_DICT_ENTRY_END_CHAR_AS_STRING;
-    return sig;
+template <typename Key, typename Data> inline std::string signature_dict_data( const std::map<Key, Data>& dictionary ) {
+    return signature( dictionary ).substr( 1 );
 }
 
 namespace priv {
@@ -214,8 +395,13 @@ template<typename arg1, typename... argn>
 class dbus_signature<arg1, argn...> : public dbus_signature<argn...> {
 public:
     std::string dbus_sig() const {
-        arg1 arg;
-        return signature( arg ) + dbus_signature<argn...>::dbus_sig();
+        if constexpr( has_signature_traits<std::tuple<arg1, argn...>>::value ) {
+            // The signature of the tuple, without the parentheses
+            constexpr std::string_view sig = signature_traits<std::tuple<arg1, argn...>>::value.view();
+            return std::string( sig.substr( 1, sig.size() - 2 ) );
+        } else {
+            return std::string( signature_of<arg1>() ) + dbus_signature<argn...>::dbus_sig();
+        }
     }
 };
 
@@ -223,11 +409,15 @@ public:
 
 template<typename... T_arg>
 inline std::string signature( const std::tuple<T_arg...>& ) {
-    priv::dbus_signature<T_arg...> sig;
-
-    return DBUSCXX_STRUCT_BEGIN_CHAR_AS_STRING +
-        sig.dbus_sig() +
-        DBUSCXX_STRUCT_END_CHAR_AS_STRING;
+    if constexpr( has_signature_traits<std::tuple<T_arg...>>::value ) {
+        return signature_traits<std::tuple<T_arg...>>::value.str();
+    } else {
+        priv::dbus_signature<T_arg...> sig;
+
+        return DBUSCXX_STRUCT_BEGIN_CHAR_AS_STRING +
+            sig.dbus_sig() +
+            DBUSCXX_STRUCT_END_CHAR_AS_STRING;
+    }
 }
 
 
@@ -17,52 +17,35 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include "signatureiterator.h"
-#include <cstring>
-#include <algorithm>
-#include <iterator>
+#include "signature.h"
 #include "enums.h"
 #include "types.h"
 
 namespace DBus {
 
-class SignatureIterator::priv_data {
-public:
-    priv_data() :
-        m_valid( false )
-    {}
-
-    priv_data( std::shared_ptr<priv::SignatureNode> startnode ) :
-        m_valid( startnode != nullptr ),
-        m_current( startnode ),
-        m_first( startnode )
-    {}
-
-    bool m_valid;
-    std::shared_ptr<priv::SignatureNode> m_current;
-    std::shared_ptr<priv::SignatureNode> m_first;
-};
-
-SignatureIterator::SignatureIterator():
-    m_priv( std::make_unique<priv_data>() ) {
+SignatureIterator::SignatureIterator() :
+    m_first( 0 ),
+    m_current( 0 ),
+    m_valid( false ) {
 }
 
-SignatureIterator::SignatureIterator( const SignatureIterator& other ) :
-    m_priv( std::make_unique<priv_data>() ) {
-    *m_priv = *other.m_priv;
-}
+SignatureIterator::SignatureIterator( const SignatureIterator& other ) = default;
 
-SignatureIterator::SignatureIterator( std::shared_ptr<priv::SignatureNode> startnode ) :
-    m_priv( std::make_unique<priv_data>( startnode ) ) {
+SignatureIterator::SignatureIterator( std::shared_ptr<const priv::SignatureData> data, uint8_t first ) :
+    m_data( std::move( data ) ),
+    m_first( first ),
+    m_current( first ),
+    m_valid( true ) {
 }
 
 SignatureIterator::~SignatureIterator() {}
 
 void SignatureIterator::invalidate() {
-    m_priv->m_valid = false;
+    m_valid = false;
 }
 
 bool SignatureIterator::is_valid() const {
-    return ( m_priv->m_valid && this->type() != DataType::INVALID );
+    return ( m_valid && this->type() != DataType::INVALID );
 }
 
 SignatureIterator::operator bool() const {
@@ -72,13 +55,14 @@ SignatureIterator::operator bool() const {
 bool SignatureIterator::next() {
     if( !this->is_valid() ) { return false; }
 
-    if( m_priv->m_current->m_next == nullptr ) {
-        m_priv->m_current = nullptr;
-        m_priv->m_valid = false;
+    uint8_t next = m_data->m_nodes[ m_current ].m_next;
+
+    if( next == 0 ) {
+        m_valid = false;
         return false;
     }
 
-    m_priv->m_current = m_priv->m_current->m_next;
+    m_current = next;
 
     return true;
 }
@@ -96,20 +80,24 @@ SignatureIterator SignatureIterator::operator ++( int ) {
 }
 
 bool SignatureIterator::operator==( const SignatureIterator& other ) {
-    return m_priv->m_current == other.m_priv->m_current;
+    if( !m_valid || !other.m_valid ) {
+        return m_valid == other.m_valid;
+    }
+
+    return m_data == other.m_data && m_current == other.m_current;
 }
 
 DataType SignatureIterator::type() const {
-    if( !m_priv->m_valid ) { return DataType::INVALID; }
+    if( !m_valid ) { return DataType::INVALID; }
 
-    return m_priv->m_current->m_dataType;
+    return static_cast<DataType>( m_data->m_nodes[ m_current ].m_dataType );
 }
 
 DataType SignatureIterator::element_type() const {
     if( this->type() != DataType::ARRAY ) { return DataType::INVALID; }
 
-    SignatureIterator subit( m_priv->m_current->m_sub );
-    return subit.type();
+    // The element always comes right after the 'a'
+    return static_cast<DataType>( m_data->m_nodes[ m_current + 1 ].m_dataType );
 }
 
 bool SignatureIterator::is_basic() const {
@@ -135,93 +123,59 @@ bool SignatureIterator::is_dict() const {
     return this->is_array() && this->element_type() == DataType::DICT_ENTRY;
 }
 
-SignatureIterator SignatureIterator::recurse() {
-    std::string substr;
+int SignatureIterator::alignment() const {
+    if( !m_valid ) { return 0; }
 
-    if( !this->is_container() ) { return SignatureIterator(); }
-
-    SignatureIterator subiter = SignatureIterator( m_priv->m_current->m_sub );
-
-    return subiter;
+    return m_data->m_nodes[ m_current ].m_alignment;
 }
 
-std::string SignatureIterator::signature() const {
-    std::shared_ptr<priv::SignatureNode> tmpCurrent;
-    std::string signature;
-
-    if( m_priv->m_first == nullptr ) {
-        return "";
-    }
-
-    TypeInfo ti( m_priv->m_first->m_dataType );
-    char dbusChar = ti.to_dbus_char();
+int SignatureIterator::fixed_size() const {
+    if( !m_valid ) { return 0; }
 
-    if( dbusChar ) {
-        signature += dbusChar;
-    }
-
-    signature += iterate_over_subsig( m_priv->m_first->m_sub );
-
-    for( tmpCurrent = m_priv->m_first->m_next;
-        tmpCurrent != nullptr;
-        tmpCurrent = tmpCurrent->m_next ) {
-        TypeInfo ti( tmpCurrent->m_dataType );
-        dbusChar = ti.to_dbus_char();
+    return m_data->m_nodes[ m_current ].m_fixedSize;
+}
 
-        if( dbusChar ) {
-            signature += dbusChar;
-        }
+SignatureIterator SignatureIterator::recurse() {
+    DataType t = this->type();
 
-        signature += iterate_over_subsig( tmpCurrent->m_sub );
+    // Variants have their signature in the data, not here
+    if( t != DataType::ARRAY &&
+        t != DataType::STRUCT &&
+        t != DataType::DICT_ENTRY ) {
+        return SignatureIterator();
     }
 
-    return signature;
+    // The first type inside of a container always comes right after it
+    return SignatureIterator( m_data, m_current + 1 );
 }
 
-std::string SignatureIterator::iterate_over_subsig( std::shared_ptr<priv::SignatureNode> start ) const {
-    std::string retval;
-
-    if( start == nullptr ) {
+std::string SignatureIterator::signature() const {
+    if( !m_data || m_data->m_nodes.empty() ) {
         return "";
     }
 
-    if( start->m_dataType == DataType::DICT_ENTRY ) {
-        retval += "{";
-    }
+    // Everything from the first type at this level up to the end of the last one
+    uint8_t last = m_first;
 
-    for( std::shared_ptr<priv::SignatureNode> current = start;
-        current != nullptr;
-        current = current->m_next ) {
-        TypeInfo ti( current->m_dataType );
-        char dbusChar = ti.to_dbus_char();
-
-        if( dbusChar ) {
-            retval += dbusChar;
-        }
-
-        retval += iterate_over_subsig( current->m_sub );
-    }
-
-    if( start->m_dataType == DataType::DICT_ENTRY ) {
-        retval += "}";
+    while( m_data->m_nodes[ last ].m_next != 0 ) {
+        last = m_data->m_nodes[ last ].m_next;
     }
 
-    return retval;
+    return m_data->m_signature.substr( m_first, m_data->m_nodes[ last ].m_end - m_first );
 }
 
-SignatureIterator& SignatureIterator::operator=( const SignatureIterator& other ) {
-    if( this != &other ) {
-        m_priv->m_valid = other.m_priv->m_valid;
-        m_priv->m_current = other.m_priv->m_current;
-        m_priv->m_first = other.m_priv->m_first;
+std::string SignatureIterator::type_signature() const {
+    if( !m_valid ) {
+        return "";
     }
 
-    return *this;
+    return m_data->m_signature.substr( m_current, m_data->m_nodes[ m_current ].m_end - m_current );
 }
 
+SignatureIterator& SignatureIterator::operator=( const SignatureIterator& other ) = default;
+
 bool SignatureIterator::has_next() const {
-    return m_priv->m_current->m_next != nullptr;
+    return m_valid && m_data->m_nodes[ m_current ].m_next != 0;
 }
 
 }
-
@@ -18,6 +18,7 @@
  ***************************************************************************/
 #include <dbus-cxx/enums.h>
 #include <dbus-cxx/dbus-cxx-config.h>
+#include <stdint.h>
 #include <string>
 #include <memory>
 
@@ -26,8 +27,10 @@
 
 namespace DBus {
 
+class Signature;
+
 namespace priv {
-class SignatureNode;
+class SignatureData;
 }
 
 /**
@@ -37,6 +40,9 @@ class SignatureNode;
  * Note that you must have a valid signature before you can create a SignatureIterator.
  * Don't create this class directly; it can only be created from the Signature class.
  *
+ * The iterator is only a position in the parsed signature, so it is cheap to
+ * copy, and moving it around does not allocate.
+ *
  * @ingroup core
  *
  * @author Rick L Vinyard Jr <rvinyard@cs.nmsu.edu>
@@ -48,8 +54,6 @@ public:
 
     SignatureIterator( const SignatureIterator& other );
 
-    SignatureIterator( std::shared_ptr<priv::SignatureNode> startnode );
-
     ~SignatureIterator();
 
     /** Invalidates the iterator */
@@ -108,6 +112,17 @@ public:
     /** True if the iterator points to a dictionary */
     bool is_dict() const;
 
+    /** The alignment of the type that the iterator points to, or 0 if it is not valid */
+    int alignment() const;
+
+    /**
+     * The number of bytes that the type that the iterator points to always
+     * takes up once it is marshaled.  This is 0 for types whose size
+     * depends on their data, such as strings and arrays; structs and dict
+     * entries of fixed-size types have a fixed size too.
+     */
+    int fixed_size() const;
+
     /**
      * If the iterator points to a container recurses into the container returning a sub-iterator.
      *
@@ -118,14 +133,23 @@ public:
     /** Returns the current signature of the iterator */
     std::string signature() const;
 
+    /**
+     * Returns the signature of only the type that the iterator points to,
+     * such as "a{sv}" for a dictionary.
+     */
+    std::string type_signature() const;
+
 private:
+    SignatureIterator( std::shared_ptr<const priv::SignatureData> data, uint8_t first );
 
-    std::string iterate_over_subsig( std::shared_ptr<priv::SignatureNode> start ) const;
+    friend class Signature;
 
 private:
-    class priv_data;
-
-    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+    std::shared_ptr<const priv::SignatureData> m_data;
+    /* Index of the first type at this level, and of the current type */
+    uint8_t m_first;
+    uint8_t m_current;
+    bool m_valid;
 };
 
 }
@@ -261,6 +261,11 @@ std::shared_ptr<DBus::Message> SimpleTransport::readMessage() {
     return retmsg;
 }
 
+bool SimpleTransport::has_buffered_message() const {
+    // We only ever read up to the end of the current message
+    return false;
+}
+
 bool SimpleTransport::is_valid() const {
     return m_priv->m_ok;
 }
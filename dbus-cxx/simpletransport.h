@@ -56,6 +56,8 @@ public:
 
     std::shared_ptr<Message> readMessage();
 
+    bool has_buffered_message() const;
+
     /**
      * Check if this transport is OK
      * @return
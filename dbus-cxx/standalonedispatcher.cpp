@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
 #include <deque>
 #include <utility>
 #include <string.h>
@@ -47,6 +48,8 @@ public:
 
     }
 
+    /* Connections may be added from any thread, e.g. by a DBus::Server */
+    std::mutex m_connectionsLock;
     std::vector<std::shared_ptr<Connection>> m_connections;
     volatile bool m_running;
     std::thread m_dispatch_thread;
@@ -105,7 +108,10 @@ bool StandaloneDispatcher::add_connection( std::shared_ptr<Connection> connectio
 
     connection->set_dispatching_thread( m_priv->m_dispatch_thread.get_id() );
     connection->signal_needs_dispatch().connect( sigc::mem_fun( *this, &StandaloneDispatcher::wakeup_thread ) );
-    m_priv->m_connections.push_back( connection );
+    {
+        std::unique_lock<std::mutex> lock( m_priv->m_connectionsLock );
+        m_priv->m_connections.push_back( connection );
+    }
     wakeup_thread();
 
     return true;
@@ -141,28 +147,44 @@ bool StandaloneDispatcher::is_running() {
 
 void StandaloneDispatcher::dispatch_thread_main() {
     std::vector<int> fds;
+    std::vector<int> write_fds;
 
-    for( std::shared_ptr<Connection> conn : m_priv->m_connections ) {
+    for( std::shared_ptr<Connection> conn : connections() ) {
         conn->set_dispatching_thread( std::this_thread::get_id() );
     }
 
     while( m_priv->m_running ) {
+        int timeout_ms = -1;
+
         fds.clear();
+        write_fds.clear();
         fds.push_back( m_priv->process_fd[ 1 ] );
 
-        for( std::shared_ptr<Connection> conn : m_priv->m_connections ) {
+        for( std::shared_ptr<Connection> conn : connections() ) {
             if( !conn->is_registered() ) {
                 conn->bus_register();
             }
 
-            fds.push_back( conn->unix_fd() );
+            fds.push_back( conn->dispatch_fd() );
+
+            // Wait for the bus to take the rest of our data
+            if( conn->has_messages_to_send() ) {
+                write_fds.push_back( conn->dispatch_fd() );
+            }
+
+            // Come back in time to write out any corked messages
+            int flush_timeout = conn->flush_timeout_milliseconds();
+
+            if( flush_timeout >= 0 && ( timeout_ms < 0 || flush_timeout < timeout_ms ) ) {
+                timeout_ms = flush_timeout;
+            }
         }
 
         std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> fdResponse =
-            DBus::priv::wait_for_fd_activity( fds, -1 );
+            DBus::priv::wait_for_fd_activity( fds, write_fds, timeout_ms );
         std::vector<int> fdsToRead = std::get<2>( fdResponse );
 
-        if( fdsToRead[ 0 ] == m_priv->process_fd[ 1 ] ) {
+        if( !fdsToRead.empty() && fdsToRead[ 0 ] == m_priv->process_fd[ 1 ] ) {
             char discard;
             if( read( m_priv->process_fd[ 1 ], &discard, sizeof( char ) ) < 0 ){
                 SIMPLELOGGER_DEBUG( LOGGER_NAME, "Failure reading from dispatch thread process_fd: "
@@ -183,7 +205,7 @@ void StandaloneDispatcher::dispatch_connections() {
 
     SIMPLELOGGER_DEBUG( LOGGER_NAME, "Dispatching connections" );
 
-    for( std::shared_ptr<Connection> conn : m_priv->m_connections ) {
+    for( std::shared_ptr<Connection> conn : connections() ) {
         for( uint32_t x = 0; x < loop_limit; x++ ) {
             DispatchStatus stat = conn->dispatch();
 
@@ -200,6 +222,20 @@ void StandaloneDispatcher::dispatch_connections() {
     SIMPLELOGGER_DEBUG( LOGGER_NAME, "done dispatching" );
 }
 
+std::vector<std::shared_ptr<DBus::Connection>> StandaloneDispatcher::connections() {
+    std::unique_lock<std::mutex> lock( m_priv->m_connectionsLock );
+
+    // A connection whose other end has gone away will never become valid again
+    m_priv->m_connections.erase(
+        std::remove_if( m_priv->m_connections.begin(), m_priv->m_connections.end(),
+            []( const std::shared_ptr<Connection>& conn ) {
+                return !conn->is_valid();
+            } ),
+        m_priv->m_connections.end() );
+
+    return m_priv->m_connections;
+}
+
 void StandaloneDispatcher::wakeup_thread() {
     char to_write = '0';
 
@@ -20,6 +20,8 @@
 #define DBUSCXX_STANDALONE_DISPATCHER
 
 #include "dispatcher.h"
+#include <memory>
+#include <vector>
 
 namespace DBus {
 
@@ -69,6 +71,11 @@ private:
      */
     void dispatch_connections();
 
+    /**
+     * Get all of our connections that are still valid
+     */
+    std::vector<std::shared_ptr<Connection>> connections();
+
 private:
     class priv_data;
 
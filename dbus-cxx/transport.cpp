@@ -22,6 +22,9 @@
 #include "simpletransport.h"
 #include "sendmsgtransport.h"
 #include "sasl.h"
+#if DBUS_CXX_HAS_IO_URING
+#include "uringtransport.h"
+#endif
 
 #include <cstring>
 #include <fcntl.h>
@@ -181,9 +184,86 @@ static int open_unix_socket( std::string socketAddress, bool is_abstract ) {
     return fd;
 }
 
+static int open_listening_unix_socket( std::string socketAddress, bool is_abstract ) {
+    struct sockaddr_un addr;
+    int fd;
+    socklen_t data_len = 0;
+
+    if( socketAddress.size() >= sizeof( addr.sun_path ) ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Socket address is too long: " + socketAddress );
+        return -1;
+    }
+
+    memset( &addr, 0, sizeof( struct sockaddr_un ) );
+    fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if( fd < 0 ) {
+        std::string errmsg = strerror( errno );
+        SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to create socket: " + errmsg );
+        return fd;
+    }
+
+    addr.sun_family = AF_UNIX;
+
+    if( is_abstract ) {
+        memcpy( &addr.sun_path[ 1 ], socketAddress.c_str(), socketAddress.size() );
+        data_len = offsetof( struct sockaddr_un, sun_path ) + socketAddress.size() + 1;
+    } else {
+        memcpy( addr.sun_path, socketAddress.c_str(), socketAddress.size() );
+        data_len = sizeof( addr );
+    }
+
+    if( ::bind( fd, ( struct sockaddr* )&addr, data_len ) < 0 ||
+        ::listen( fd, SOMAXCONN ) < 0 ) {
+        int my_errno = errno;
+        std::string errmsg = strerror( errno );
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to listen on " + socketAddress + ": " + errmsg );
+        close( fd );
+        errno = my_errno;
+        return -1;
+    }
+
+    SIMPLELOGGER_DEBUG( LOGGER_NAME, "Listening for connections on " + socketAddress );
+
+    return fd;
+}
+
 Transport::~Transport() {}
 
-std::shared_ptr<Transport> Transport::open_transport( std::string address ) {
+ssize_t Transport::writeMessages( const std::vector<OutgoingMessage>& messages ) {
+    ssize_t total = 0;
+
+    for( const OutgoingMessage& outgoing : messages ) {
+        ssize_t ret = writeMessage( outgoing.msg, outgoing.serial );
+
+        if( ret < 0 ) {
+            return ret;
+        }
+
+        total += ret;
+    }
+
+    return total;
+}
+
+ssize_t Transport::write_pending() {
+    return 0;
+}
+
+size_t Transport::pending_write_size() const {
+    return 0;
+}
+
+bool Transport::needs_writable() const {
+    return pending_write_size() > 0;
+}
+
+int Transport::socket_fd() const {
+    return fd();
+}
+
+std::shared_ptr<Transport> Transport::open_transport( std::string address,
+    const std::vector<uint8_t>& pipelinedData ) {
     std::vector<ParsedTransport> transports = parseTransports( address );
     std::shared_ptr<Transport> retTransport;
     bool negotiateFD = false;
@@ -231,7 +311,7 @@ std::shared_ptr<Transport> Transport::open_transport( std::string address ) {
     if( retTransport ) {
         priv::SASL saslAuth( retTransport->fd(), negotiateFD );
         std::tuple<bool, bool, std::vector<uint8_t>> resp =
-                saslAuth.authenticate();
+                saslAuth.authenticate( pipelinedData );
 
         retTransport->m_serverAddress = std::get<2>( resp );
 
@@ -241,5 +321,72 @@ std::shared_ptr<Transport> Transport::open_transport( std::string address ) {
         }
     }
 
+#if DBUS_CXX_HAS_IO_URING
+    if( retTransport ) {
+        /*
+         * Now that we are authenticated, hand the socket over to io_uring
+         * if the kernel supports it.  If not, we just keep on using sendmsg.
+         */
+        int uringFd = dup( retTransport->fd() );
+        std::shared_ptr<Transport> uringTransport;
+
+        if( uringFd >= 0 ) {
+            uringTransport = priv::UringTransport::create( uringFd );
+
+            if( !uringTransport ) {
+                close( uringFd );
+            }
+        }
+
+        if( uringTransport ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Using io_uring transport" );
+            uringTransport->m_serverAddress = retTransport->m_serverAddress;
+            retTransport = uringTransport;
+        }
+    }
+#endif
+
     return retTransport;
 }
+
+std::shared_ptr<Transport> Transport::create_for_socket( int fd ) {
+#if DBUS_CXX_HAS_IO_URING
+    std::shared_ptr<Transport> uringTransport = priv::UringTransport::create( fd );
+
+    if( uringTransport ) {
+        return uringTransport;
+    }
+#endif
+
+    return SendmsgTransport::create( fd, false );
+}
+
+int Transport::open_listening_socket( std::string address, std::string* socketPath ) {
+    std::vector<ParsedTransport> transports = parseTransports( address );
+
+    for( ParsedTransport param : transports ) {
+        if( param.m_transportName != "unix" ) {
+            continue;
+        }
+
+        std::string path = param.m_config[ "path" ];
+        std::string abstractPath = param.m_config[ "abstract" ];
+        int fd = -1;
+
+        if( !path.empty() ) {
+            fd = open_listening_unix_socket( path, false );
+
+            if( fd >= 0 && socketPath ) {
+                *socketPath = path;
+            }
+        } else if( !abstractPath.empty() ) {
+            fd = open_listening_unix_socket( abstractPath, true );
+        }
+
+        if( fd >= 0 ) {
+            return fd;
+        }
+    }
+
+    return -1;
+}
@@ -30,6 +30,15 @@ class Message;
 
 namespace priv {
 
+/**
+ * A message that is waiting to be written to a transport, along with
+ * the serial that it is to be sent with.
+ */
+struct OutgoingMessage {
+    std::shared_ptr<const Message> msg;
+    uint32_t serial;
+};
+
 class Transport {
 public:
     virtual ~Transport();
@@ -43,6 +52,43 @@ public:
      */
     virtual ssize_t writeMessage( std::shared_ptr<const Message> message, uint32_t serial ) = 0;
 
+    /**
+     * Writes several messages to the transport stream, in order.  Transports
+     * that are able to should coalesce the messages into as few writes as
+     * possible.  The default implementation calls writeMessage() for each
+     * message.
+     *
+     * @param messages The messages to write
+     * @return The total number of bytes written on success, an error code otherwise.
+     */
+    virtual ssize_t writeMessages( const std::vector<OutgoingMessage>& messages );
+
+    /**
+     * Write out as much data as possible that is waiting to be written
+     * because the stream was not able to take it without blocking.
+     *
+     * @return The number of bytes written(may be 0) on success, an error code otherwise.
+     */
+    virtual ssize_t write_pending();
+
+    /**
+     * Returns the number of bytes that have been accepted by writeMessage()
+     * or writeMessages() but have not been written to the stream yet.  When
+     * this is not 0, write_pending() should be called once fd() is writable.
+     *
+     * @return
+     */
+    virtual size_t pending_write_size() const;
+
+    /**
+     * Returns true if this transport has data that it can only write out once
+     * fd() becomes writable.  Transports that write asynchronously report the
+     * completion of their writes by fd() becoming readable instead.
+     *
+     * @return
+     */
+    virtual bool needs_writable() const;
+
     /**
      * Read a message from the transport stream.  If there is no message
      * to be read, or there is not enough data to read a message yet,
@@ -52,6 +98,16 @@ public:
      */
     virtual std::shared_ptr<Message> readMessage() = 0;
 
+    /**
+     * Check to see if this transport has already read a complete message
+     * from the stream that has not been returned from readMessage() yet.
+     * If this is true, readMessage() should be called again without waiting
+     * for the file descriptor to become readable.
+     *
+     * @return
+     */
+    virtual bool has_buffered_message() const = 0;
+
     /**
      * Check to see if this transport is valid.
      * @return
@@ -65,14 +121,47 @@ public:
      */
     virtual int fd() const = 0;
 
+    /**
+     * Returns the socket that this transport reads from and writes to.  This
+     * is the same as fd(), unless the transport waits on a different FD for
+     * its reads and writes to complete.
+     *
+     * @return
+     */
+    virtual int socket_fd() const;
+
     /**
      * Open and return a transport based off of the given address.
      *
      * @param address The address to connect to, in DBus transport format
      * (e.g. unix:path=/tmp/dbus-test)
+     * @param pipelinedData Data to send as soon as the authentication commands
+     * have been sent, without waiting for the server to reply to them.  This is
+     * generally the serialized Hello message.
      * @return An opened file descriptor, or -1 on error(with errno set)
      */
-    static std::shared_ptr<Transport> open_transport( std::string address );
+    static std::shared_ptr<Transport> open_transport( std::string address,
+        const std::vector<uint8_t>& pipelinedData = std::vector<uint8_t>() );
+
+    /**
+     * Create a transport for a socket that has already been connected and
+     * authenticated, such as one that a server has accepted.
+     *
+     * @param fd The socket; the returned transport takes ownership of it
+     * @return
+     */
+    static std::shared_ptr<Transport> create_for_socket( int fd );
+
+    /**
+     * Open a socket that listens for connections on the given address.
+     *
+     * @param address The address to listen on, in DBus transport format
+     * (e.g. unix:path=/tmp/dbus-test or unix:abstract=dbus-test)
+     * @param socketPath If the socket was created in the filesystem, set
+     * to its path so that it can be removed later
+     * @return The listening file descriptor, or -1 on error
+     */
+    static int open_listening_socket( std::string address, std::string* socketPath );
 
 protected:
     std::vector<uint8_t> m_serverAddress;
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 #ifndef DBUSCXX_TYPES_H
@@ -170,6 +171,23 @@ inline DataType type( const float& )               { return DataType::DOUBLE; }
 template <typename T>
 inline DataType type( const std::vector<T>& ) { return DataType::ARRAY; }
 
+/**
+ * True if T is a fixed D-Bus type that is laid out the same in memory as it
+ * is on the wire, so that an array of them may be copied as one block.
+ *
+ * bool is not one of these, as a D-Bus BOOLEAN is 4 bytes long.
+ */
+template <typename T>
+struct is_fixed_array_type : std::integral_constant<bool,
+    std::is_same<T, uint8_t>::value ||
+    std::is_same<T, int16_t>::value ||
+    std::is_same<T, uint16_t>::value ||
+    std::is_same<T, int32_t>::value ||
+    std::is_same<T, uint32_t>::value ||
+    std::is_same<T, int64_t>::value ||
+    std::is_same<T, uint64_t>::value ||
+    std::is_same<T, double>::value> {};
+
 template <typename ...T>
 inline DataType type( const std::tuple<T...>& ) { return DataType::STRUCT; }
 
@@ -0,0 +1,891 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include "uringtransport.h"
+
+#include "dbus-cxx-private.h"
+#include "receivebuffer.h"
+#include "utility.h"
+#include "validator.h"
+
+#include <message.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+using DBus::priv::UringTransport;
+using DBus::priv::ReceiveBuffer;
+
+static const char* LOGGER_NAME = "DBus.priv.UringTransport";
+
+/* Number of entries in the submission queue */
+#define URING_QUEUE_ENTRIES 32
+/* Number of buffers that the kernel receives into; must be a power of 2 */
+#define URING_BUFFER_COUNT  16
+/* Size of each receive buffer, including the recvmsg header and control data */
+#define URING_BUFFER_SIZE   16384
+#define URING_BUFFER_GROUP  0
+#define CONTROL_BUFFER_SIZE 512
+/* Maximum number of messages that are written with one sendmsg */
+#define MAX_BATCH_MESSAGES  64
+/* Header buffers that have grown larger than this are not reused */
+#define HEADER_BUFFER_REUSE_SIZE 4096
+
+/* The user_data of our submissions, so we know what has completed */
+#define RECEIVE_TAG 1
+#define SEND_TAG    2
+#define CANCEL_TAG  3
+
+static int uring_setup( unsigned entries, struct io_uring_params* params ) {
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int uring_enter( int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags ) {
+    return syscall( __NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0 );
+}
+
+static int uring_register( int ring_fd, unsigned opcode, void* arg, unsigned nr_args ) {
+    return syscall( __NR_io_uring_register, ring_fd, opcode, arg, nr_args );
+}
+
+/**
+ * A message that has been handed to us to write.  The header is serialized
+ * into our own buffer, the body is sent straight from the message.
+ */
+struct UringSend {
+    std::vector<uint8_t> header;
+    std::shared_ptr<const DBus::Message> msg;
+    /* The number of bytes of this message that have been written */
+    size_t sent;
+
+    size_t size() const {
+        return header.size() + msg->body_size();
+    }
+};
+
+class UringTransport::priv_data {
+public:
+    priv_data( int fd ) :
+        m_fd( fd ),
+        m_ringFd( -1 ),
+        m_ok( false ),
+        m_sqRing( MAP_FAILED ),
+        m_sqRingSize( 0 ),
+        m_cqRing( MAP_FAILED ),
+        m_cqRingSize( 0 ),
+        m_sqes( MAP_FAILED ),
+        m_sqesSize( 0 ),
+        m_sqeTail( 0 ),
+        m_unsubmitted( 0 ),
+        m_bufferRing( MAP_FAILED ),
+        m_buffers( MAP_FAILED ),
+        m_receiving( false ),
+        m_pendingSize( 0 ),
+        m_sending( false ) {
+        ::memset( &m_params, 0, sizeof( struct io_uring_params ) );
+        ::memset( &rx_msg, 0, sizeof( struct msghdr ) );
+        ::memset( &tx_msg, 0, sizeof( struct msghdr ) );
+    }
+
+    ~priv_data() {
+        // The kernel must be done with our buffers and messages before we free them
+        drain();
+
+        if( m_ringFd >= 0 ) {
+            close( m_ringFd );
+        }
+
+        if( m_sqes != MAP_FAILED ) { munmap( m_sqes, m_sqesSize ); }
+
+        if( m_cqRing != MAP_FAILED && m_cqRing != m_sqRing ) { munmap( m_cqRing, m_cqRingSize ); }
+
+        if( m_sqRing != MAP_FAILED ) { munmap( m_sqRing, m_sqRingSize ); }
+
+        if( m_bufferRing != MAP_FAILED ) { munmap( m_bufferRing, URING_BUFFER_COUNT * sizeof( struct io_uring_buf ) ); }
+
+        if( m_buffers != MAP_FAILED ) { munmap( m_buffers, URING_BUFFER_COUNT * URING_BUFFER_SIZE ); }
+
+        if( m_fd >= 0 ) {
+            close( m_fd );
+        }
+
+        close_received_fds();
+    }
+
+    int m_fd;
+    int m_ringFd;
+    bool m_ok;
+    mutable std::mutex m_lock;
+    struct io_uring_params m_params;
+
+    /* The memory that is shared with the kernel */
+    void* m_sqRing;
+    size_t m_sqRingSize;
+    void* m_cqRing;
+    size_t m_cqRingSize;
+    void* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* Our next submission queue entry, and how many have not been submitted */
+    unsigned m_sqeTail;
+    unsigned m_unsubmitted;
+
+    /* The buffers that are registered with the kernel to receive into */
+    void* m_bufferRing;
+    void* m_buffers;
+
+    ReceiveBuffer m_receiveBuffer;
+    /* FDs that we have received, but have not given to a message yet */
+    std::deque<int> m_receivedFds;
+    struct msghdr rx_msg;
+    /* True if our multishot receive is still active */
+    bool m_receiving;
+
+    std::deque<UringSend> m_sends;
+    std::vector<std::vector<uint8_t>> m_freeHeaders;
+    size_t m_pendingSize;
+    /* True if we have a sendmsg in flight */
+    bool m_sending;
+    struct msghdr tx_msg;
+    struct iovec tx_iov[ MAX_BATCH_MESSAGES * 2 ];
+    std::vector<uint8_t> tx_control;
+
+    struct io_uring_buf_ring* buffer_ring() {
+        return static_cast<struct io_uring_buf_ring*>( m_bufferRing );
+    }
+
+    uint8_t* buffer( uint16_t bid ) {
+        return static_cast<uint8_t*>( m_buffers ) + ( bid * URING_BUFFER_SIZE );
+    }
+
+    /**
+     * Set up the io_uring instance, register our receive buffers with it
+     * and start receiving.
+     *
+     * @return false if io_uring can't be used
+     */
+    bool init() {
+        m_ringFd = uring_setup( URING_QUEUE_ENTRIES, &m_params );
+
+        if( m_ringFd < 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to set up io_uring: " << strerror( errno ) );
+            return false;
+        }
+
+        m_sqRingSize = m_params.sq_off.array + m_params.sq_entries * sizeof( unsigned );
+        m_cqRingSize = m_params.cq_off.cqes + m_params.cq_entries * sizeof( struct io_uring_cqe );
+        m_sqesSize = m_params.sq_entries * sizeof( struct io_uring_sqe );
+
+        if( m_params.features & IORING_FEAT_SINGLE_MMAP ) {
+            m_sqRingSize = m_cqRingSize = std::max( m_sqRingSize, m_cqRingSize );
+        }
+
+        m_sqRing = mmap( nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING );
+
+        if( m_sqRing == MAP_FAILED ) {
+            return false;
+        }
+
+        if( m_params.features & IORING_FEAT_SINGLE_MMAP ) {
+            m_cqRing = m_sqRing;
+        } else {
+            m_cqRing = mmap( nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING );
+        }
+
+        m_sqes = mmap( nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES );
+
+        if( m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED ) {
+            return false;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>( m_sqRing );
+        uint8_t* cq = static_cast<uint8_t*>( m_cqRing );
+        sq_head = reinterpret_cast<unsigned*>( sq + m_params.sq_off.head );
+        sq_tail = reinterpret_cast<unsigned*>( sq + m_params.sq_off.tail );
+        sq_mask = reinterpret_cast<unsigned*>( sq + m_params.sq_off.ring_mask );
+        sq_array = reinterpret_cast<unsigned*>( sq + m_params.sq_off.array );
+        cq_head = reinterpret_cast<unsigned*>( cq + m_params.cq_off.head );
+        cq_tail = reinterpret_cast<unsigned*>( cq + m_params.cq_off.tail );
+        cq_mask = reinterpret_cast<unsigned*>( cq + m_params.cq_off.ring_mask );
+        cqes = reinterpret_cast<struct io_uring_cqe*>( cq + m_params.cq_off.cqes );
+        m_sqeTail = *sq_tail;
+
+        if( !register_buffers() ) {
+            return false;
+        }
+
+        rx_msg.msg_namelen = 0;
+        rx_msg.msg_controllen = CONTROL_BUFFER_SIZE;
+
+        m_ok = true;
+
+        if( !arm_receive() || submit() < 0 ) {
+            m_ok = false;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool register_buffers() {
+        struct io_uring_buf_reg reg;
+
+        m_bufferRing = mmap( nullptr, URING_BUFFER_COUNT * sizeof( struct io_uring_buf ),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        m_buffers = mmap( nullptr, URING_BUFFER_COUNT * URING_BUFFER_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+        if( m_bufferRing == MAP_FAILED || m_buffers == MAP_FAILED ) {
+            return false;
+        }
+
+        ::memset( &reg, 0, sizeof( struct io_uring_buf_reg ) );
+        reg.ring_addr = reinterpret_cast<uintptr_t>( m_bufferRing );
+        reg.ring_entries = URING_BUFFER_COUNT;
+        reg.bgid = URING_BUFFER_GROUP;
+
+        if( uring_register( m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Unable to register receive buffers: " << strerror( errno ) );
+            return false;
+        }
+
+        for( uint16_t bid = 0; bid < URING_BUFFER_COUNT; bid++ ) {
+            recycle_buffer( bid );
+        }
+
+        return true;
+    }
+
+    /**
+     * Give the buffer back to the kernel to receive into.
+     */
+    void recycle_buffer( uint16_t bid ) {
+        struct io_uring_buf_ring* ring = buffer_ring();
+        uint16_t tail = ring->tail;
+        // Not ring->bufs: in C++ the empty struct in front of the flexible array moves it
+        struct io_uring_buf* buf = static_cast<struct io_uring_buf*>( m_bufferRing ) +
+            ( tail & ( URING_BUFFER_COUNT - 1 ) );
+
+        buf->addr = reinterpret_cast<uintptr_t>( buffer( bid ) );
+        buf->len = URING_BUFFER_SIZE;
+        buf->bid = bid;
+
+        __atomic_store_n( &ring->tail, static_cast<uint16_t>( tail + 1 ), __ATOMIC_RELEASE );
+    }
+
+    /**
+     * Get the next submission queue entry, or nullptr if the queue is full.
+     */
+    struct io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n( sq_head, __ATOMIC_ACQUIRE );
+
+        if( m_sqeTail - head >= m_params.sq_entries ) {
+            if( submit() < 0 ) {
+                return nullptr;
+            }
+
+            head = __atomic_load_n( sq_head, __ATOMIC_ACQUIRE );
+
+            if( m_sqeTail - head >= m_params.sq_entries ) {
+                return nullptr;
+            }
+        }
+
+        unsigned index = m_sqeTail & *sq_mask;
+        struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>( m_sqes ) + index;
+
+        ::memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+        sq_array[ index ] = index;
+        m_sqeTail++;
+        m_unsubmitted++;
+
+        return sqe;
+    }
+
+    /**
+     * Tell the kernel about all of our new submission queue entries.
+     *
+     * @return The number of entries submitted, or -1 on error
+     */
+    int submit() {
+        int ret;
+
+        __atomic_store_n( sq_tail, m_sqeTail, __ATOMIC_RELEASE );
+
+        if( m_unsubmitted == 0 ) {
+            return 0;
+        }
+
+        do {
+            ret = uring_enter( m_ringFd, m_unsubmitted, 0, 0 );
+        } while( ret < 0 && errno == EINTR );
+
+        if( ret < 0 ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to submit to io_uring: " << strerror( errno ) );
+            m_ok = false;
+            return ret;
+        }
+
+        m_unsubmitted -= ret;
+
+        return ret;
+    }
+
+    /**
+     * Handle all of the completions that the kernel has posted.
+     */
+    void reap_completions() {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE );
+
+        while( head != tail ) {
+            const struct io_uring_cqe* cqe = &cqes[ head & *cq_mask ];
+
+            if( cqe->user_data == RECEIVE_TAG ) {
+                handle_receive( cqe );
+            } else if( cqe->user_data == SEND_TAG ) {
+                handle_send( cqe );
+            }
+
+            head++;
+        }
+
+        __atomic_store_n( cq_head, head, __ATOMIC_RELEASE );
+    }
+
+    /**
+     * Cancel our receive and send, and wait for the kernel to post their
+     * final completions so that it no longer uses our buffers.
+     */
+    void drain() {
+        if( m_ringFd < 0 || m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED ) {
+            return;
+        }
+
+        const uint64_t tags[] = { RECEIVE_TAG, SEND_TAG };
+
+        for( uint64_t tag : tags ) {
+            struct io_uring_sqe* sqe = get_sqe();
+
+            if( !sqe ) {
+                break;
+            }
+
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag;
+            sqe->user_data = CANCEL_TAG;
+        }
+
+        if( submit() < 0 ) {
+            // Nothing that we have armed may be running, but the kernel still tears it down on close
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to cancel io_uring requests" );
+            return;
+        }
+
+        reap_completions();
+
+        while( m_receiving || m_sending ) {
+            if( uring_enter( m_ringFd, 0, 1, IORING_ENTER_GETEVENTS ) < 0 && errno != EINTR ) {
+                SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to wait for io_uring requests: " << strerror( errno ) );
+                return;
+            }
+
+            reap_completions();
+        }
+    }
+
+    /**
+     * Start a multishot receive, which keeps on receiving into our buffers
+     * until it runs out of buffers or the stream is closed.
+     */
+    bool arm_receive() {
+        struct io_uring_sqe* sqe = get_sqe();
+
+        if( !sqe ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "No room in the submission queue to receive" );
+            return false;
+        }
+
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = m_fd;
+        sqe->addr = reinterpret_cast<uintptr_t>( &rx_msg );
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = RECEIVE_TAG;
+        m_receiving = true;
+
+        return true;
+    }
+
+    /**
+     * Send as much of our queued data as we can with one sendmsg.  Only
+     * one sendmsg is in flight at a time, so that our data stays in order.
+     */
+    bool arm_send() {
+        size_t iovlen = 0;
+        size_t num_messages = 0;
+
+        if( m_sending || m_sends.empty() || !m_ok ) {
+            return true;
+        }
+
+        for( const UringSend& send : m_sends ) {
+            // FDs must be sent along with the first byte of their message
+            if( num_messages == MAX_BATCH_MESSAGES ||
+                ( num_messages > 0 && !send.msg->filedescriptors().empty() ) ) {
+                break;
+            }
+
+            const uint8_t* body = send.msg->body_data();
+            size_t bodySize = send.msg->body_size();
+            size_t skip = send.sent;
+
+            if( skip < send.header.size() ) {
+                tx_iov[ iovlen ].iov_base = const_cast<uint8_t*>( send.header.data() ) + skip;
+                tx_iov[ iovlen ].iov_len = send.header.size() - skip;
+                iovlen++;
+                skip = 0;
+            } else {
+                skip -= send.header.size();
+            }
+
+            if( skip < bodySize ) {
+                tx_iov[ iovlen ].iov_base = const_cast<uint8_t*>( body ) + skip;
+                tx_iov[ iovlen ].iov_len = bodySize - skip;
+                iovlen++;
+            }
+
+            num_messages++;
+        }
+
+        tx_msg.msg_iov = tx_iov;
+        tx_msg.msg_iovlen = iovlen;
+        tx_msg.msg_control = nullptr;
+        tx_msg.msg_controllen = 0;
+
+        const UringSend& first = m_sends.front();
+
+        if( first.sent == 0 && !first.msg->filedescriptors().empty() ) {
+            const std::vector<int>& fds = first.msg->filedescriptors();
+            struct cmsghdr* cmsg;
+
+            tx_control.assign( CMSG_SPACE( sizeof( int ) * fds.size() ), 0 );
+            tx_msg.msg_control = tx_control.data();
+            tx_msg.msg_controllen = tx_control.size();
+            cmsg = CMSG_FIRSTHDR( &tx_msg );
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * fds.size() );
+            ::memcpy( CMSG_DATA( cmsg ), fds.data(), sizeof( int ) * fds.size() );
+        }
+
+        struct io_uring_sqe* sqe = get_sqe();
+
+        if( !sqe ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "No room in the submission queue to send" );
+            return false;
+        }
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = m_fd;
+        sqe->addr = reinterpret_cast<uintptr_t>( &tx_msg );
+        sqe->len = 1;
+        sqe->user_data = SEND_TAG;
+        m_sending = true;
+
+        SIMPLELOGGER_TRACE( LOGGER_NAME, "Sending " << num_messages << " messages" );
+
+        return true;
+    }
+
+    /**
+     * Queue up the message to be written.
+     *
+     * @return The size of the message, 0 if it could not be serialized.
+     */
+    size_t queue_message( std::shared_ptr<const DBus::Message> message, uint32_t serial ) {
+        UringSend send;
+
+        if( !m_freeHeaders.empty() ) {
+            send.header.swap( m_freeHeaders.back() );
+            m_freeHeaders.pop_back();
+        }
+
+        send.msg = message;
+        send.sent = 0;
+
+        if( !message->serialize_header_to_vector( &send.header, serial ) ) {
+            return 0;
+        }
+
+        if( dbuscxx_log_function ) {
+            // Dumping the body costs as much as copying it, so only do it if it goes somewhere
+            std::ostringstream debug_str;
+            debug_str << "Going to send the following bytes: " << std::endl;
+            DBus::hexdump( &send.header, &debug_str );
+            DBus::hexdump( message->body_data(), message->body_size(), &debug_str );
+            SIMPLELOGGER_TRACE( LOGGER_NAME, debug_str.str() );
+        }
+
+        size_t size = send.size();
+        m_pendingSize += size;
+        m_sends.push_back( std::move( send ) );
+
+        return size;
+    }
+
+    void handle_receive( const struct io_uring_cqe* cqe ) {
+        if( !( cqe->flags & IORING_CQE_F_MORE ) ) {
+            // The multishot receive has stopped; we will start it again
+            m_receiving = false;
+        }
+
+        if( cqe->res < 0 ) {
+            if( -cqe->res == ENOBUFS ) {
+                SIMPLELOGGER_DEBUG( LOGGER_NAME, "Out of receive buffers" );
+                return;
+            }
+
+            if( -cqe->res == ECANCELED ) {
+                return;
+            }
+
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't read from socket: " << strerror( -cqe->res ) );
+            m_ok = false;
+            return;
+        }
+
+        if( !( cqe->flags & IORING_CQE_F_BUFFER ) ) {
+            // End of the stream
+            SIMPLELOGGER_TRACE( LOGGER_NAME, "End of stream: closing transport" );
+            m_ok = false;
+            return;
+        }
+
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t* buf = buffer( bid );
+        struct io_uring_recvmsg_out* out = reinterpret_cast<struct io_uring_recvmsg_out*>( buf );
+        uint8_t* control = buf + sizeof( struct io_uring_recvmsg_out ) + rx_msg.msg_namelen;
+        uint8_t* payload = control + rx_msg.msg_controllen;
+        ssize_t payload_len = cqe->res - ( payload - buf );
+
+        take_received_fds( out, control );
+
+        if( payload_len <= 0 ) {
+            SIMPLELOGGER_TRACE( LOGGER_NAME, "End of stream: closing transport" );
+            m_ok = false;
+        } else if( !m_receiveBuffer.append( payload, payload_len ) ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Unable to allocate receive buffer" );
+            m_ok = false;
+        } else {
+            SIMPLELOGGER_DEBUG( LOGGER_NAME, "Read " << payload_len << " bytes, have " << out->controllen << " bytes of control" );
+        }
+
+        recycle_buffer( bid );
+    }
+
+    void take_received_fds( const struct io_uring_recvmsg_out* out, uint8_t* control ) {
+        struct msghdr control_msg;
+        struct cmsghdr* cmsg;
+
+        if( out->flags & MSG_CTRUNC ) {
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Control data truncated, file descriptors have been lost" );
+        }
+
+        ::memset( &control_msg, 0, sizeof( struct msghdr ) );
+        control_msg.msg_control = control;
+        control_msg.msg_controllen = out->controllen;
+
+        for( cmsg = CMSG_FIRSTHDR( &control_msg );
+            cmsg != nullptr;
+            cmsg = CMSG_NXTHDR( &control_msg, cmsg ) ) {
+            if( cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS ) {
+                ssize_t num_fds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+                int* fd_array = reinterpret_cast<int*>( CMSG_DATA( cmsg ) );
+
+                for( ssize_t current = 0; current < num_fds; current++ ) {
+                    m_receivedFds.push_back( fd_array[ current ] );
+                }
+            }
+        }
+    }
+
+    void handle_send( const struct io_uring_cqe* cqe ) {
+        m_sending = false;
+
+        if( cqe->res < 0 ) {
+            if( -cqe->res == EINTR || -cqe->res == EAGAIN || -cqe->res == ECANCELED ) {
+                return;
+            }
+
+            SIMPLELOGGER_ERROR( LOGGER_NAME, "Can't send message: " << strerror( -cqe->res ) );
+            m_ok = false;
+            return;
+        }
+
+        size_t written = cqe->res;
+        m_pendingSize -= written;
+
+        while( written > 0 && !m_sends.empty() ) {
+            UringSend& front = m_sends.front();
+            size_t remaining = front.size() - front.sent;
+
+            if( written < remaining ) {
+                front.sent += written;
+                return;
+            }
+
+            written -= remaining;
+
+            if( front.header.capacity() <= HEADER_BUFFER_REUSE_SIZE &&
+                m_freeHeaders.size() < MAX_BATCH_MESSAGES ) {
+                front.header.clear();
+                m_freeHeaders.push_back( std::move( front.header ) );
+            }
+
+            m_sends.pop_front();
+        }
+    }
+
+    void close_received_fds() {
+        for( int fd : m_receivedFds ) {
+            close( fd );
+        }
+
+        m_receivedFds.clear();
+    }
+
+    /**
+     * Close the given number of FDs from the front of the queue, which
+     * belong to a message that we are throwing away.
+     */
+    void close_front_fds( size_t count ) {
+        count = std::min( count, m_receivedFds.size() );
+
+        for( size_t x = 0; x < count; x++ ) {
+            close( m_receivedFds.front() );
+            m_receivedFds.pop_front();
+        }
+    }
+};
+
+UringTransport::UringTransport( int fd ) :
+    m_priv( std::make_unique<priv_data>( fd ) ) {
+}
+
+UringTransport::~UringTransport() {
+}
+
+std::shared_ptr<UringTransport> UringTransport::create( int fd ) {
+    std::shared_ptr<UringTransport> transport( new UringTransport( fd ) );
+
+    if( !transport->m_priv->init() ) {
+        // Leave the FD open so that another transport can use it
+        transport->m_priv->m_fd = -1;
+        return std::shared_ptr<UringTransport>();
+    }
+
+    return transport;
+}
+
+ssize_t UringTransport::writeMessage( std::shared_ptr<const DBus::Message> message, uint32_t serial ) {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+
+    if( !m_priv->m_ok ) {
+        return -1;
+    }
+
+    size_t size = m_priv->queue_message( message, serial );
+
+    if( !m_priv->arm_send() || m_priv->submit() < 0 ) {
+        m_priv->m_ok = false;
+        return -1;
+    }
+
+    return size;
+}
+
+ssize_t UringTransport::writeMessages( const std::vector<OutgoingMessage>& messages ) {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+    ssize_t total = 0;
+
+    if( !m_priv->m_ok ) {
+        return -1;
+    }
+
+    for( const OutgoingMessage& outgoing : messages ) {
+        total += m_priv->queue_message( outgoing.msg, outgoing.serial );
+    }
+
+    /* Everything that we have goes out with one submission */
+    if( !m_priv->arm_send() || m_priv->submit() < 0 ) {
+        m_priv->m_ok = false;
+        return -1;
+    }
+
+    return total;
+}
+
+ssize_t UringTransport::write_pending() {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+    size_t pending_before = m_priv->m_pendingSize;
+
+    processCompletions();
+
+    if( !m_priv->m_ok ) {
+        return -1;
+    }
+
+    return pending_before - m_priv->m_pendingSize;
+}
+
+size_t UringTransport::pending_write_size() const {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+
+    return m_priv->m_pendingSize;
+}
+
+bool UringTransport::needs_writable() const {
+    // Our writes complete asynchronously, and the ring FD becomes readable when they do
+    return false;
+}
+
+std::shared_ptr<DBus::Message> UringTransport::readMessage() {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+    std::shared_ptr<DBus::Message> retmsg = extractMessage();
+
+    if( retmsg || !m_priv->m_ok ) {
+        return retmsg;
+    }
+
+    processCompletions();
+
+    return extractMessage();
+}
+
+bool UringTransport::has_buffered_message() const {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+    ssize_t message_size = m_priv->m_receiveBuffer.front_message_size();
+
+    return message_size > 0 &&
+        static_cast<size_t>( message_size ) <= m_priv->m_receiveBuffer.size();
+}
+
+bool UringTransport::is_valid() const {
+    std::unique_lock<std::mutex> lock( m_priv->m_lock );
+
+    return m_priv->m_ok;
+}
+
+int UringTransport::fd() const {
+    return m_priv->m_ringFd;
+}
+
+int UringTransport::socket_fd() const {
+    return m_priv->m_fd;
+}
+
+void UringTransport::processCompletions() {
+    m_priv->reap_completions();
+
+    if( !m_priv->m_ok ) {
+        return;
+    }
+
+    if( !m_priv->m_receiving && !m_priv->arm_receive() ) {
+        m_priv->m_ok = false;
+        return;
+    }
+
+    if( !m_priv->arm_send() || m_priv->submit() < 0 ) {
+        m_priv->m_ok = false;
+    }
+}
+
+std::shared_ptr<DBus::Message> UringTransport::extractMessage() {
+    ssize_t total_len = m_priv->m_receiveBuffer.front_message_size();
+    std::shared_ptr<DBus::Message> retmsg;
+
+    if( total_len < 0 ) {
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Invalid endianess in message header" );
+        m_priv->m_ok = false;
+        return retmsg;
+    }
+
+    if( static_cast<uint64_t>( total_len ) > DBus::Validator::maximum_message_size() ) {
+        // Invalid message: it can't be that big!
+        // We can't find the start of the next message, so give up on the stream.
+        SIMPLELOGGER_ERROR( LOGGER_NAME, "Message is too large: " << total_len << " bytes" );
+        m_priv->m_receiveBuffer.clear();
+        m_priv->close_received_fds();
+        m_priv->m_ok = false;
+        return retmsg;
+    }
+
+    if( total_len == 0 ||
+        m_priv->m_receiveBuffer.size() < static_cast<size_t>( total_len ) ) {
+        return retmsg;
+    }
+
+    /*
+     * Any FDs that belong to this message have been received at the same time as
+     * the first byte of the message, so they will be at the front of our FD queue.
+     */
+    std::vector<int> fds( m_priv->m_receivedFds.begin(), m_priv->m_receivedFds.end() );
+
+    retmsg = DBus::Message::create_from_data( m_priv->m_receiveBuffer.message_data( total_len ), total_len, std::move( fds ) );
+
+    if( retmsg ) {
+        size_t fds_used = retmsg->filedescriptors().size();
+
+        m_priv->m_receivedFds.erase( m_priv->m_receivedFds.begin(),
+            m_priv->m_receivedFds.begin() + fds_used );
+    } else {
+        // The message is thrown away, so the FDs that came with it must be too
+        SIMPLELOGGER_WARN( LOGGER_NAME, "Unable to parse received message; dropping it" );
+        m_priv->close_front_fds( m_priv->m_receiveBuffer.front_message_unix_fds() );
+    }
+
+    m_priv->m_receiveBuffer.consume( total_len );
+
+    return retmsg;
+}
@@ -0,0 +1,112 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef DBUS_CXX_URINGTRANSPORT_H
+#define DBUS_CXX_URINGTRANSPORT_H
+
+#include <dbus-cxx/dbus-cxx-config.h>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "transport.h"
+
+namespace DBus {
+
+class Message;
+
+namespace priv {
+
+/**
+ * The UringTransport handles reading and writing over a Unix FD using
+ * io_uring.  A single multishot recvmsg keeps receiving data(and FDs) into
+ * buffers that are registered with the kernel, and sends are submitted in
+ * batches, so that a busy connection needs very few system calls.
+ *
+ * The FD that this transport returns from fd() is the FD of the io_uring
+ * instance, which becomes readable when data has been received or when
+ * a write has completed.  socket_fd() returns the socket itself.
+ */
+class UringTransport : public Transport {
+private:
+    UringTransport( int fd );
+
+public:
+    ~UringTransport();
+
+    /**
+     * Create a UringTransport on an already-open and authenticated socket.
+     * If io_uring is not supported by the running kernel, returns an
+     * invalid shared_ptr and the FD is left open for the caller to use.
+     *
+     * @param fd The already-open file descriptor
+     * @return
+     */
+    static std::shared_ptr<UringTransport> create( int fd );
+
+    ssize_t writeMessage( std::shared_ptr<const Message> message, uint32_t serial );
+
+    /**
+     * Queue up the messages and submit them to the kernel with one
+     * submission.  Messages are written out in order; any FDs are sent
+     * along with the first byte of the message that they belong to.
+     */
+    ssize_t writeMessages( const std::vector<OutgoingMessage>& messages );
+
+    /**
+     * Handle any writes that have completed, and submit the next write
+     * if there is more data to write.
+     */
+    ssize_t write_pending();
+
+    size_t pending_write_size() const;
+
+    bool needs_writable() const;
+
+    std::shared_ptr<Message> readMessage();
+
+    bool has_buffered_message() const;
+
+    bool is_valid() const;
+
+    int fd() const;
+
+    int socket_fd() const;
+
+private:
+    /**
+     * Handle all of the completions that the kernel has posted.
+     */
+    void processCompletions();
+
+    /**
+     * Create a message from the front of our receive buffer, if we have
+     * received the entire message.
+     */
+    std::shared_ptr<Message> extractMessage();
+
+private:
+    class priv_data;
+
+    DBUS_CXX_PROPAGATE_CONST( std::unique_ptr<priv_data> ) m_priv;
+};
+
+} /* namespace priv */
+
+} /* namespace DBus */
+
+#endif /* DBUS_CXX_URINGTRANSPORT_H */
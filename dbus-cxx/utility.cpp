@@ -17,6 +17,7 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include "utility.h"
+#include <algorithm>
 #include <stdio.h>
 #include <iostream>
 #include <mutex>
@@ -104,13 +105,17 @@ void hexdump( const uint8_t* vec, uint32_t len, std::ostream* stream ) {
 }
 
 std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> priv::wait_for_fd_activity( std::vector<int> fds, int timeout_ms ) {
+    return wait_for_fd_activity( fds, std::vector<int>(), timeout_ms );
+}
+
+std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> priv::wait_for_fd_activity( std::vector<int> fds, std::vector<int> write_fds, int timeout_ms ) {
     std::vector<pollfd> toListen;
     bool timeout;
     int poll_ret;
     std::chrono::milliseconds ms_waited;
     std::vector<int> fdsToRead;
 
-    toListen.reserve( fds.size() );
+    toListen.reserve( fds.size() + write_fds.size() );
 
     for( int fd : fds ) {
         struct pollfd pollfd;
@@ -120,6 +125,22 @@ std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> priv::wait_fo
         toListen.push_back( pollfd );
     }
 
+    for( int fd : write_fds ) {
+        std::vector<pollfd>::iterator it = std::find_if( toListen.begin(), toListen.end(),
+            [fd]( const struct pollfd& entry ) { return entry.fd == fd; } );
+
+        if( it != toListen.end() ) {
+            it->events |= POLLOUT;
+            continue;
+        }
+
+        struct pollfd pollfd;
+        pollfd.fd = fd;
+        pollfd.events = POLLOUT;
+        pollfd.revents = 0;
+        toListen.push_back( pollfd );
+    }
+
     std::chrono::time_point start = std::chrono::high_resolution_clock::now();
 
     do {
@@ -132,7 +153,7 @@ std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> priv::wait_fo
                 );
 
             for( pollfd pollentry : toListen ) {
-                if( pollentry.revents & POLLIN ) {
+                if( pollentry.revents & ( POLLIN | POLLOUT | POLLERR | POLLHUP ) ) {
                     fdsToRead.push_back( pollentry.fd );
                 }
             }
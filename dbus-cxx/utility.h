@@ -86,6 +86,7 @@
     \
     namespace DBus {                                                                                    \
     inline std::string signature( CppType ) { DBusType d; return signature( d ); }          \
+    template <> struct signature_traits<CppType> : signature_traits<DBusType> {};                     \
     }
 
 
@@ -286,6 +287,22 @@ struct dbus_function_traits<std::function<T_ret( Args... )>> {
  */
 std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> wait_for_fd_activity( std::vector<int> fds, int timeout_ms );
 
+/**
+ * Wait for activity on any of the given FDs.  The FDs in fds are checked
+ * for being readable, and the FDs in write_fds are checked for being writable.
+ * If the system call is interrupted, it will be restarted automatically.
+ *
+ * @param fds The FDs to monitor for reading
+ * @param write_fds The FDs to monitor for writing
+ * @param timeout The timeout, in milliseconds to wait.  -1 means infite.
+ * @return Tuple containing:
+ * - bool true if we timedout, false otherwise
+ * - int # of FDs with activity
+ * - vector of FDs with activity, in the order that they were given
+ * - milliseconds # of MS we waited
+ */
+std::tuple<bool, int, std::vector<int>, std::chrono::milliseconds> wait_for_fd_activity( std::vector<int> fds, std::vector<int> write_fds, int timeout_ms );
+
 } /* namespace priv */
 
 } /* namespace DBus */
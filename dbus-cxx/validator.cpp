@@ -17,9 +17,12 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include "validator.h"
+#include <atomic>
 
 using DBus::Validator;
 
+static std::atomic<uint32_t> maximum_memfd_size( Validator::maximum_message_size() );
+
 static bool is_allowable_character( char c ) {
     if( c >= 'A' && c <= 'Z' ) {
         return true;
@@ -138,3 +141,11 @@ bool Validator::message_is_small_enough( const std::vector<uint8_t>* data ) {
     return data->size() < maximum_message_size();
 }
 
+void Validator::set_maximum_memfd_array_size( uint32_t size ) {
+    maximum_memfd_size = size;
+}
+
+uint32_t Validator::maximum_memfd_array_size() {
+    return maximum_memfd_size;
+}
+
@@ -108,6 +108,18 @@ public:
 
     static constexpr uint32_t maximum_message_size() { return ( 0x01 << 27 ); };
 
+    /**
+     * Set the largest byte array that may be sent or received out-of-band in
+     * a memfd(see MessageAppendIterator::set_memfd_threshold).  Both sides
+     * check against this limit: a larger array is appended inline instead,
+     * and a larger memfd that is received is rejected.
+     *
+     * @param size The maximum size in bytes; defaults to maximum_message_size()
+     */
+    static void set_maximum_memfd_array_size( uint32_t size );
+
+    static uint32_t maximum_memfd_array_size();
+
 };
 
 } /* namespace DBus */
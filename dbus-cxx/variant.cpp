@@ -33,14 +33,15 @@ namespace DBus { class FileDescriptor; }
 using DBus::Variant;
 
 Variant::Variant():
-    m_currentType( DataType::INVALID )
+    m_currentType( DataType::INVALID ),
+    m_dataAlignment( 1 )
 {}
 
 Variant::Variant( uint8_t byte ) :
     m_currentType( DataType::BYTE ),
     m_signature( DBus::signature( byte ) ),
     m_dataAlignment( 1 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( byte );
 }
 
@@ -48,7 +49,7 @@ Variant::Variant( bool b ) :
     m_currentType( DataType::BOOLEAN ),
     m_signature( DBus::signature( b ) ),
     m_dataAlignment( 4 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( b );
 }
 
@@ -56,7 +57,7 @@ Variant::Variant( int16_t i ) :
     m_currentType( DataType::INT16 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 2 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -64,7 +65,7 @@ Variant::Variant( uint16_t i ):
     m_currentType( DataType::UINT16 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 2 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -72,7 +73,7 @@ Variant::Variant( int32_t i ) :
     m_currentType( DataType::INT32 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 4 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -80,7 +81,7 @@ Variant::Variant( uint32_t i ) :
     m_currentType( DataType::UINT32 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 4 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -88,7 +89,7 @@ Variant::Variant( int64_t i ) :
     m_currentType( DataType::INT64 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 8 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -96,7 +97,7 @@ Variant::Variant( uint64_t i ) :
     m_currentType( DataType::UINT64 ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 8 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -104,7 +105,7 @@ Variant::Variant( double i ) :
     m_currentType( DataType::DOUBLE ),
     m_signature( DBus::signature( i ) ),
     m_dataAlignment( 8 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( i );
 }
 
@@ -115,7 +116,7 @@ Variant::Variant( std::string str ) :
     m_currentType( DataType::STRING ),
     m_signature( DBus::signature( str ) ),
     m_dataAlignment( 4 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( str );
 }
 
@@ -123,7 +124,7 @@ Variant::Variant( DBus::Signature sig ) :
     m_currentType( DataType::SIGNATURE ),
     m_signature( DBus::signature( sig ) ),
     m_dataAlignment( 1 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( sig );
 }
 
@@ -131,7 +132,7 @@ Variant::Variant( DBus::Path path )  :
     m_currentType( DataType::OBJECT_PATH ),
     m_signature( DBus::signature( path ) ),
     m_dataAlignment( 4 ) {
-    Marshaling marshal( &m_marshaled, Endianess::Big );
+    Marshaling marshal( &m_marshaled, HOST_ENDIANESS );
     marshal.marshal( path );
 }
 
@@ -163,7 +164,7 @@ DBus::Variant Variant::createFromMessage( MessageIterator iter ) {
     Variant v;
     DBus::DataType dt = iter.signature_iterator().type();
     TypeInfo ti( dt );
-    Marshaling marshal( &v.m_marshaled, Endianess::Big );
+    Marshaling marshal( &v.m_marshaled, HOST_ENDIANESS );
 
     v.m_signature = DBus::Signature( iter.signature() );
     v.m_currentType = dt;
@@ -243,7 +244,7 @@ void Variant::recurseArray( MessageIterator iter, Marshaling* marshal ) {
     DataType dt = iter.signature_iterator().type();
     TypeInfo ti( dt );
     std::vector<uint8_t> workingData;
-    Marshaling workingMarshal( &workingData, Endianess::Big );
+    Marshaling workingMarshal( &workingData, HOST_ENDIANESS );
 
     while( iter.is_valid() ) {
         switch( dt ) {
@@ -384,6 +385,10 @@ void Variant::recurseDictEntry( MessageIterator iter, Marshaling* marshal ) {
         case DataType::DICT_ENTRY:
             recurseDictEntry( iter.recurse(), marshal );
             break;
+
+        case DataType::STRUCT:
+            recurseStruct( iter.recurse(), marshal );
+            break;
         }
 
         sigit++;
@@ -456,6 +461,10 @@ void Variant::recurseStruct( MessageIterator iter, Marshaling* marshal ) {
         case DataType::DICT_ENTRY:
             recurseDictEntry( iter.recurse(), marshal );
             break;
+
+        case DataType::STRUCT:
+            recurseStruct( iter.recurse(), marshal );
+            break;
         }
 
         sigit++;
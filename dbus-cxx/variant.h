@@ -70,7 +70,7 @@ public:
     template<typename T>
     Variant( const std::vector<T>& vec ) :
         m_currentType( DataType::ARRAY ),
-        m_signature( DBus::signature( vec ) ),
+        m_signature( std::string( priv::signature_of<std::vector<T>>() ) ),
         m_dataAlignment( 4 ) {
         priv::VariantAppendIterator it( this );
 
@@ -80,7 +80,7 @@ public:
     template<typename Key, typename Value>
     Variant( const std::map<Key, Value>& map ) :
         m_currentType( DataType::ARRAY ),
-        m_signature( DBus::signature( map ) ),
+        m_signature( std::string( priv::signature_of<std::map<Key, Value>>() ) ),
         m_dataAlignment( 4 ) {
         priv::VariantAppendIterator it( this );
 
@@ -90,7 +90,7 @@ public:
     template<typename ...T>
     Variant( const std::tuple<T...>& tup ) :
         m_currentType( DataType::STRUCT ),
-        m_signature( DBus::signature( tup ) ),
+        m_signature( std::string( priv::signature_of<std::tuple<T...>>() ) ),
         m_dataAlignment( 8 ) {
         priv::VariantAppendIterator it( this );
         it << tup;
@@ -44,13 +44,13 @@ public:
 
 VariantAppendIterator::VariantAppendIterator( Variant* variant ):
     m_priv( std::make_shared<priv_data>( variant ) ) {
-    m_priv->m_marshaling = Marshaling( &variant->m_marshaled, Endianess::Big );
+    m_priv->m_marshaling = Marshaling( &variant->m_marshaled, HOST_ENDIANESS );
 }
 
 VariantAppendIterator::VariantAppendIterator( Variant* variant, ContainerType t ) :
     m_priv( std::make_shared<priv_data>( variant ) ) {
     m_priv->m_currentContainer = t;
-    m_priv->m_marshaling = Marshaling( &m_priv->m_workingBuffer, Endianess::Big );
+    m_priv->m_marshaling = Marshaling( &m_priv->m_workingBuffer, HOST_ENDIANESS );
 }
 
 VariantAppendIterator::~VariantAppendIterator() {
@@ -147,17 +147,13 @@ VariantAppendIterator& VariantAppendIterator::operator<<( const Variant& v ){
     return *this;
 }
 
-bool VariantAppendIterator::open_container( ContainerType t, const std::string& sig ) {
-    std::string signature;
+bool VariantAppendIterator::open_container( ContainerType t, std::string_view sig ) {
     int32_t array_align = 0;
 
     if( m_priv->m_subiter ) { this->close_container(); }
 
-    if( t == ContainerType::ARRAY ) {
-        Signature tmpSig( sig );
-        SignatureIterator tmpSigIter = tmpSig.begin();
-        TypeInfo ti( tmpSigIter.type() );
-        array_align = ti.alignment();
+    if( t == ContainerType::ARRAY && !sig.empty() ) {
+        array_align = TypeInfo( char_to_dbus_type( sig[ 0 ] ) ).alignment();
     }
 
     m_priv->m_subiter = new VariantAppendIterator( m_priv->m_variant, t );
@@ -60,7 +60,7 @@ public:
 
     template <typename T>
     VariantAppendIterator& operator<<( const std::vector<T>& v ) {
-        open_container( ContainerType::ARRAY, DBus::signature( v ) );
+        open_container( ContainerType::ARRAY, priv::signature_of<std::vector<T>>() );
         VariantAppendIterator* sub = sub_iterator();
 
         for( T t : v ) {
@@ -74,12 +74,12 @@ public:
 
     template <typename Key, typename Data>
     VariantAppendIterator& operator<<( const std::map<Key, Data>& dictionary ) {
-        std::string sig = signature_dict_data( dictionary );
+        auto sig = priv::signature_of<std::map<Key, Data>>();
         typename std::map<Key, Data>::const_iterator it;
-        this->open_container( ContainerType::ARRAY, sig );
+        this->open_container( ContainerType::ARRAY, std::string_view( sig ).substr( 1 ) );
 
         for( it = dictionary.begin(); it != dictionary.end(); it++ ) {
-            sub_iterator()->open_container( ContainerType::DICT_ENTRY, std::string() );
+            sub_iterator()->open_container( ContainerType::DICT_ENTRY, std::string_view() );
             *( sub_iterator()->sub_iterator() ) << it->first;
             *( sub_iterator()->sub_iterator() ) << it->second;
             sub_iterator()->close_container();
@@ -93,8 +93,8 @@ public:
     template <typename... T>
     VariantAppendIterator& operator<<( const std::tuple<T...>& tup ) {
         bool success;
-        std::string signature = DBus::signature( tup );
-        success = this->open_container( ContainerType::STRUCT, signature.c_str() );
+        auto signature = priv::signature_of<std::tuple<T...>>();
+        success = this->open_container( ContainerType::STRUCT, signature );
         VariantAppendIterator* subiter = sub_iterator();
         std::apply( [subiter]( auto&& ...arg ) mutable {
             ( *subiter << ... << arg );
@@ -106,7 +106,7 @@ public:
     }
 
 private:
-    bool open_container( ContainerType t, const std::string& contained_signature );
+    bool open_container( ContainerType t, std::string_view contained_signature );
 
     bool close_container( );
 
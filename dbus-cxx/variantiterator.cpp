@@ -52,7 +52,7 @@ VariantIterator::VariantIterator() {
 VariantIterator::VariantIterator( const Variant* variant ) {
     m_priv = std::make_shared<priv_data>();
     m_priv->m_variant = variant;
-    m_priv->m_demarshal = std::make_shared<Demarshaling>( variant->m_marshaled.data(), variant->m_marshaled.size(), Endianess::Big );
+    m_priv->m_demarshal = std::make_shared<Demarshaling>( variant->m_marshaled.data(), variant->m_marshaled.size(), HOST_ENDIANESS );
     m_priv->m_signatureIterator = variant->signature().begin();
 }
 
@@ -66,8 +66,11 @@ VariantIterator::VariantIterator( DataType d,
     m_priv->m_signatureIterator = sig;
 
     if( d == DataType::ARRAY ) {
+        // The length does not include the padding before the first element
+        uint32_t arrayLength = m_priv->m_demarshal->demarshal_uint32_t();
+        m_priv->m_demarshal->align( TypeInfo( sig.type() ).alignment() );
         m_priv->m_subiterInfo.m_subiterDataType = d;
-        m_priv->m_subiterInfo.m_arrayLastPosition = m_priv->m_demarshal->current_offset() + m_priv->m_demarshal->demarshal_uint32_t();
+        m_priv->m_subiterInfo.m_arrayLastPosition = m_priv->m_demarshal->current_offset() + arrayLength;
     } else if( d == DataType::VARIANT ) {
         Signature demarshaled_sig = demarshal->demarshal_signature();
         m_priv->m_subiterInfo.m_variantSignature = demarshaled_sig;
@@ -88,7 +91,7 @@ bool VariantIterator::is_valid() const {
 
     if( m_priv->m_subiterInfo.m_subiterDataType == DataType::ARRAY ) {
         // We are in a subiter here, figure out if we're at the end of the array yet
-        if( m_priv->m_demarshal->current_offset() > m_priv-> m_subiterInfo.m_arrayLastPosition ) {
+        if( m_priv->m_demarshal->current_offset() >= m_priv->m_subiterInfo.m_arrayLastPosition ) {
             return false;
         }
 
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/*
+ * Measures how long it takes to append a large array of a fixed type to a
+ * message and to extract it again, both in our byte order and in the other
+ * byte order.
+ *
+ * Usage: benchmark-arrays [iterations] [elements]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_us( Clock::time_point start, Clock::time_point end ) {
+    return std::chrono::duration<double, std::micro>( end - start ).count();
+}
+
+static DBus::Endianess other_endianess() {
+    if( DBus::HOST_ENDIANESS == DBus::Endianess::Little ) {
+        return DBus::Endianess::Big;
+    }
+
+    return DBus::Endianess::Little;
+}
+
+template <typename T>
+static bool run( const std::string& name, int iterations, int elements, DBus::Endianess endian ) {
+    std::vector<T> values;
+    std::vector<double> appendTimes;
+    std::vector<double> extractTimes;
+
+    for( int x = 0; x < elements; x++ ) {
+        values.push_back( static_cast<T>( x ) );
+    }
+
+    // The first iteration is only to warm up the allocator
+    for( int x = -1; x < iterations; x++ ) {
+        std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/dbuscxx/benchmark", "method" );
+        std::vector<T> extracted;
+
+        msg->set_endianess( endian );
+
+        Clock::time_point start = Clock::now();
+        DBus::MessageAppendIterator appendIter( msg );
+        appendIter << values;
+        Clock::time_point appended = Clock::now();
+        DBus::MessageIterator iter( msg );
+        iter >> extracted;
+        Clock::time_point done = Clock::now();
+
+        if( extracted != values ) {
+            std::cerr << name << ": extracted values do not match" << std::endl;
+            return false;
+        }
+
+        if( x >= 0 ) {
+            appendTimes.push_back( elapsed_us( start, appended ) );
+            extractTimes.push_back( elapsed_us( appended, done ) );
+        }
+    }
+
+    std::sort( appendTimes.begin(), appendTimes.end() );
+    std::sort( extractTimes.begin(), extractTimes.end() );
+
+    std::cout << name
+              << ( endian == DBus::HOST_ENDIANESS ? " host order " : " other order" )
+              << " append median " << appendTimes[ appendTimes.size() / 2 ] << "us"
+              << " extract median " << extractTimes[ extractTimes.size() / 2 ] << "us"
+              << std::endl;
+
+    return true;
+}
+
+int main( int argc, char** argv ) {
+    int iterations = 20;
+    int elements = 1000000;
+
+    if( argc > 1 ) {
+        iterations = std::atoi( argv[ 1 ] );
+    }
+
+    if( argc > 2 ) {
+        elements = std::atoi( argv[ 2 ] );
+    }
+
+    if( iterations <= 0 || elements <= 0 ) {
+        std::cerr << "Iterations and elements must be positive numbers" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Fixed-size arrays, " << elements << " elements, "
+              << iterations << " iterations" << std::endl;
+
+    for( DBus::Endianess endian : { DBus::HOST_ENDIANESS, other_endianess() } ) {
+        if( !run<uint8_t>( "ay", iterations, elements, endian ) ||
+            !run<int32_t>( "ai", iterations, elements, endian ) ||
+            !run<double>( "ad", iterations, elements, endian ) ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Measures how many CallMessages can be built per second: creating the
+ * message, appending a typical set of arguments, and serializing it the way
+ * that it is written out to the bus.
+ *
+ * Usage: benchmark-callmessage [messages]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+int main( int argc, char** argv ) {
+    int messages = 200000;
+    std::map<std::string, DBus::Variant> properties;
+    std::vector<double> samples;
+    std::vector<uint8_t> serialized;
+    size_t totalSize = 0;
+
+    if( argc > 1 ) {
+        messages = std::atoi( argv[ 1 ] );
+    }
+
+    if( messages <= 0 ) {
+        std::cerr << "Messages must be a positive number" << std::endl;
+        return 1;
+    }
+
+    properties[ "Name" ] = DBus::Variant( std::string( "benchmark" ) );
+    properties[ "Enabled" ] = DBus::Variant( true );
+    properties[ "Count" ] = DBus::Variant( static_cast<uint32_t>( 42 ) );
+    properties[ "Ratio" ] = DBus::Variant( 0.5 );
+    properties[ "Path" ] = DBus::Variant( DBus::Path( "/dbuscxx/benchmark/object" ) );
+
+    for( int x = 0; x < 16; x++ ) {
+        samples.push_back( x * 1.5 );
+    }
+
+    Clock::time_point start = Clock::now();
+
+    for( int x = 0; x < messages; x++ ) {
+        std::shared_ptr<DBus::CallMessage> msg =
+            DBus::CallMessage::create( "/dbuscxx/benchmark", "dbuscxx.Benchmark", "Update" );
+        msg->set_destination( "dbuscxx.benchmark" );
+
+        // The same as a MethodProxy call does
+        DBus::MessageAppendIterator iter = msg->append();
+        iter.reserve_for( static_cast<int32_t>( x ), std::string( "an argument" ), properties, samples );
+        iter << static_cast<int32_t>( x );
+        iter << std::string( "an argument" );
+        iter << properties;
+        iter << samples;
+
+        serialized.clear();
+        msg->serialize_to_vector( &serialized, x + 1 );
+        totalSize += serialized.size();
+    }
+
+    Clock::time_point end = Clock::now();
+    double seconds = std::chrono::duration<double>( end - start ).count();
+
+    std::cout << "CallMessage construction, " << messages << " messages of "
+              << totalSize / messages << " bytes" << std::endl;
+    std::cout << "total " << seconds * 1000 << "ms, "
+              << static_cast<uint64_t>( messages / seconds ) << " messages/s, "
+              << seconds * 1000000000 / messages << "ns/message" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+ * Measures the heap allocations and the time of a method call round trip,
+ * without the bus: the call is built and serialized, parsed the way that
+ * the other end receives it, and answered with a reply that goes back the
+ * same way.  It is run without the message pool, and then with it.
+ *
+ * Usage: benchmark-messagepool [round trips]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t allocations = 0;
+
+void* operator new( size_t size ) {
+    allocations++;
+
+    void* ptr = std::malloc( size ? size : 1 );
+
+    if( !ptr ) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void operator delete( void* ptr ) noexcept {
+    std::free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept {
+    std::free( ptr );
+}
+
+static std::shared_ptr<DBus::Message> receive( const std::vector<uint8_t>& data ) {
+    // This stands in for the receive buffer
+    std::shared_ptr<uint8_t> received( static_cast<uint8_t*>( std::malloc( data.size() ) ), std::free );
+    std::memcpy( received.get(), data.data(), data.size() );
+
+    return DBus::Message::create_from_data( received, data.size() );
+}
+
+static bool round_trip( uint32_t serial, std::vector<uint8_t>* buffer ) {
+    std::shared_ptr<DBus::CallMessage> call =
+        DBus::CallMessage::create( "dbuscxx.benchmark", "/dbuscxx/benchmark", "dbuscxx.Benchmark", "Add" );
+    int32_t first = 0;
+    int32_t second = 0;
+    int32_t sum = 0;
+
+    call << static_cast<int32_t>( serial ) << static_cast<int32_t>( 5 );
+    buffer->clear();
+    call->serialize_to_vector( buffer, serial );
+
+    std::shared_ptr<DBus::CallMessage> received = std::static_pointer_cast<DBus::CallMessage>( receive( *buffer ) );
+    received >> first >> second;
+
+    std::shared_ptr<DBus::ReturnMessage> reply = received->create_reply();
+    reply << first + second;
+    buffer->clear();
+    reply->serialize_to_vector( buffer, serial + 1 );
+
+    std::shared_ptr<DBus::Message> answer = receive( *buffer );
+    answer >> sum;
+
+    return sum == static_cast<int32_t>( serial ) + 5;
+}
+
+static bool run( const std::string& name, int roundTrips ) {
+    std::vector<uint8_t> buffer;
+
+    buffer.reserve( 1024 );
+
+    // Warm up, so that the pool is full if it is on
+    for( int x = 0; x < 16; x++ ) {
+        round_trip( x + 1, &buffer );
+    }
+
+    DBus::MessagePoolStatistics before = DBus::Message::pool_statistics();
+    uint64_t allocationsBefore = allocations;
+    Clock::time_point start = Clock::now();
+
+    for( int x = 0; x < roundTrips; x++ ) {
+        if( !round_trip( x + 1, &buffer ) ) {
+            std::cerr << "Wrong answer" << std::endl;
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+    DBus::MessagePoolStatistics after = DBus::Message::pool_statistics();
+
+    std::cout << name
+              << static_cast<double>( allocations - allocationsBefore ) / roundTrips << " allocations/round trip, "
+              << seconds * 1000000000 / roundTrips << "ns/round trip, "
+              << "messages allocated " << after.allocated - before.allocated
+              << " reused " << after.reused - before.reused << std::endl;
+
+    return true;
+}
+
+int main( int argc, char** argv ) {
+    int roundTrips = 100000;
+
+    if( argc > 1 ) {
+        roundTrips = std::atoi( argv[ 1 ] );
+    }
+
+    if( roundTrips <= 0 ) {
+        std::cerr << "Round trips must be a positive number" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Method call round trip, " << roundTrips << " round trips" << std::endl;
+
+    if( !run( "no pool: ", roundTrips ) ) {
+        return 1;
+    }
+
+    DBus::Message::set_pool_size( 8 );
+
+    if( !run( "pool:    ", roundTrips ) ) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+/*
+ * Measures how long it takes to turn received data into a message, both by
+ * copying the body out of the receive buffer and by reading it from where it
+ * was received, and how long it takes to forward it: copy it with a new
+ * destination and serialize the header of the copy.  Also measures how long it takes to receive a small signal
+ * and look only at what is needed to route it, which is all that happens to
+ * a signal that nothing is listening for.
+ *
+ * Usage: benchmark-receive [iterations] [body size]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_us( Clock::time_point start, Clock::time_point end ) {
+    return std::chrono::duration<double, std::micro>( end - start ).count();
+}
+
+static void print_result( const std::string& name, std::vector<double>& samples, size_t bytes ) {
+    std::sort( samples.begin(), samples.end() );
+
+    double median = samples[ samples.size() / 2 ];
+
+    std::cout << name
+              << " median " << median << "us, "
+              << bytes / median / 1000 << "GB/s" << std::endl;
+}
+
+int main( int argc, char** argv ) {
+    int iterations = 50;
+    int bodySize = 16 * 1024 * 1024;
+    std::vector<double> copyTimes;
+    std::vector<double> sharedTimes;
+    std::vector<double> forwardTimes;
+    std::vector<uint8_t> forwardHeader;
+
+    if( argc > 1 ) {
+        iterations = std::atoi( argv[ 1 ] );
+    }
+
+    if( argc > 2 ) {
+        bodySize = std::atoi( argv[ 2 ] );
+    }
+
+    if( iterations <= 0 || bodySize <= 0 ) {
+        std::cerr << "Iterations and body size must be positive numbers" << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/dbuscxx/benchmark", "method" );
+    std::vector<uint8_t> serialized;
+    msg << std::vector<uint8_t>( bodySize, 0x5A );
+    msg->serialize_to_vector( &serialized, 1 );
+
+    // This stands in for the receive buffer
+    std::shared_ptr<uint8_t> received( new uint8_t[ serialized.size() ], std::default_delete<uint8_t[]>() );
+    std::memcpy( received.get(), serialized.data(), serialized.size() );
+
+    // The first iteration is only to warm up the allocator
+    for( int x = -1; x < iterations; x++ ) {
+        Clock::time_point start = Clock::now();
+        std::shared_ptr<DBus::Message> copied =
+            DBus::Message::create_from_data( received.get(), serialized.size() );
+        Clock::time_point copyDone = Clock::now();
+        std::shared_ptr<DBus::Message> shared =
+            DBus::Message::create_from_data( received, serialized.size() );
+        Clock::time_point sharedDone = Clock::now();
+
+        if( !copied || !shared || !( *copied == *shared ) ) {
+            std::cerr << "Messages do not match" << std::endl;
+            return 1;
+        }
+
+        forwardHeader.clear();
+        Clock::time_point forwardStart = Clock::now();
+        std::shared_ptr<DBus::Message> forwarded = shared->copy();
+        forwarded->set_destination( "dbuscxx.forwarded" );
+        forwarded->serialize_header_to_vector( &forwardHeader, 2 );
+        Clock::time_point forwardDone = Clock::now();
+
+        if( forwarded->body_size() != shared->body_size() ) {
+            std::cerr << "Forwarded message does not match" << std::endl;
+            return 1;
+        }
+
+        if( x >= 0 ) {
+            copyTimes.push_back( elapsed_us( start, copyDone ) );
+            sharedTimes.push_back( elapsed_us( copyDone, sharedDone ) );
+            forwardTimes.push_back( elapsed_us( forwardStart, forwardDone ) );
+        }
+    }
+
+    std::cout << "Receiving a message, " << serialized.size() << " bytes, "
+              << iterations << " iterations" << std::endl;
+    print_result( "copy body  ", copyTimes, serialized.size() );
+    print_result( "shared body", sharedTimes, serialized.size() );
+    print_result( "forward    ", forwardTimes, serialized.size() );
+
+    std::shared_ptr<DBus::SignalMessage> signal =
+        DBus::SignalMessage::create( "/dbuscxx/benchmark", "dbuscxx.Benchmark", "Changed" );
+    std::vector<uint8_t> signalData;
+    signal->set_destination( "dbuscxx.listener" );
+    signal->set_header_field( DBus::MessageHeaderFields::Sender, DBus::Variant( std::string( ":1.42" ) ) );
+    signal << std::string( "property" ) << uint32_t( 42 );
+    signal->serialize_to_vector( &signalData, 1 );
+
+    std::shared_ptr<uint8_t> signalReceived( new uint8_t[ signalData.size() ], std::default_delete<uint8_t[]>() );
+    std::memcpy( signalReceived.get(), signalData.data(), signalData.size() );
+
+    const int signalsPerSample = 1000;
+    std::vector<double> signalTimes;
+    size_t matched = 0;
+
+    for( int x = -1; x < iterations; x++ ) {
+        Clock::time_point start = Clock::now();
+
+        for( int y = 0; y < signalsPerSample; y++ ) {
+            std::shared_ptr<DBus::SignalMessage> received = std::static_pointer_cast<DBus::SignalMessage>(
+                DBus::Message::create_from_data( signalReceived, signalData.size() ) );
+
+            if( received->interface_name() == "dbuscxx.Other" && received->member() == "Changed" ) {
+                matched++;
+            }
+        }
+
+        if( x >= 0 ) {
+            signalTimes.push_back( elapsed_us( start, Clock::now() ) * 1000 / signalsPerSample );
+        }
+    }
+
+    if( matched != 0 ) {
+        std::cerr << "Signal should not have matched" << std::endl;
+        return 1;
+    }
+
+    std::sort( signalTimes.begin(), signalTimes.end() );
+    std::cout << "unmatched signal, " << signalData.size() << " bytes, median "
+              << signalTimes[ signalTimes.size() / 2 ] << "ns" << std::endl;
+
+    return 0;
+}
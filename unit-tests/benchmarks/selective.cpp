@@ -0,0 +1,137 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Measures how long it takes to read one value out of a large message: the
+ * last argument, and one key out of a dictionary of properties.  Each is
+ * read both by extracting everything before it and by looking it up with
+ * Message::arg() and Message::find().
+ *
+ * Usage: benchmark-selective [iterations] [strings]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static void print_result( const std::string& name, double seconds, int iterations ) {
+    std::cout << name << ": " << seconds * 1000000 / iterations << "us" << std::endl;
+}
+
+int main( int argc, char** argv ) {
+    int iterations = 1000;
+    int strings = 10000;
+    std::map<std::string, DBus::Variant> properties;
+    std::vector<std::string> names;
+    int64_t sum = 0;
+
+    if( argc > 1 ) {
+        iterations = std::atoi( argv[ 1 ] );
+    }
+
+    if( argc > 2 ) {
+        strings = std::atoi( argv[ 2 ] );
+    }
+
+    if( iterations <= 0 || strings <= 0 ) {
+        std::cerr << "Iterations and strings must be positive numbers" << std::endl;
+        return 1;
+    }
+
+    for( int x = 0; x < strings; x++ ) {
+        names.push_back( "dbuscxx.benchmark.Name" + std::to_string( x ) );
+    }
+
+    for( int x = 0; x < 100; x++ ) {
+        properties[ "Property" + std::to_string( x ) ] = DBus::Variant( static_cast<int32_t>( x ) );
+    }
+
+    std::shared_ptr<DBus::CallMessage> original =
+        DBus::CallMessage::create( "/dbuscxx/benchmark", "dbuscxx.Benchmark", "Update" );
+    original << names << properties << static_cast<int32_t>( 1 );
+
+    std::vector<uint8_t> serialized;
+    original->serialize_to_vector( &serialized, 1 );
+
+    std::cout << "Message of " << serialized.size() << " bytes, "
+              << iterations << " iterations" << std::endl;
+
+    // Each message is new, so that looking values up pays for building the index
+    std::vector<std::shared_ptr<DBus::Message>> messages;
+
+    for( int x = 0; x < iterations * 3; x++ ) {
+        messages.push_back( DBus::Message::create_from_data( serialized.data(), serialized.size() ) );
+    }
+
+    Clock::time_point start = Clock::now();
+
+    for( int x = 0; x < iterations; x++ ) {
+        std::vector<std::string> extractedNames;
+        std::map<std::string, DBus::Variant> extractedProperties;
+        int32_t last;
+        DBus::MessageIterator iter = messages[ x ]->begin();
+        iter >> extractedNames >> extractedProperties >> last;
+        sum += last;
+    }
+
+    print_result( "last argument, extracting everything", std::chrono::duration<double>( Clock::now() - start ).count(), iterations );
+
+    start = Clock::now();
+
+    for( int x = 0; x < iterations; x++ ) {
+        int32_t last;
+        messages[ iterations + x ]->arg( 2 ) >> last;
+        sum += last;
+    }
+
+    print_result( "last argument, arg()", std::chrono::duration<double>( Clock::now() - start ).count(), iterations );
+
+    start = Clock::now();
+
+    for( int x = 0; x < iterations; x++ ) {
+        std::vector<std::string> extractedNames;
+        std::map<std::string, DBus::Variant> extractedProperties;
+        DBus::MessageIterator iter = messages[ x ]->begin();
+        iter >> extractedNames >> extractedProperties;
+        sum += extractedProperties[ "Property50" ].to_int32();
+    }
+
+    print_result( "dictionary key, extracting everything", std::chrono::duration<double>( Clock::now() - start ).count(), iterations );
+
+    start = Clock::now();
+
+    for( int x = 0; x < iterations; x++ ) {
+        DBus::Variant value = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( messages[ iterations * 2 + x ]->find( "a{sv}", "Property50" ) );
+        sum += value.to_int32();
+    }
+
+    print_result( "dictionary key, find()", std::chrono::duration<double>( Clock::now() - start ).count(), iterations );
+
+    if( sum != static_cast<int64_t>( iterations ) * 102 ) {
+        std::cerr << "Read the wrong values" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
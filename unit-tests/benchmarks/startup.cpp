@@ -0,0 +1,105 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/*
+ * Measures how long it takes to get a usable connection to the session bus:
+ * connecting and authenticating, registering with the bus, and then the
+ * first call to the bus daemon.  This is what a short-lived tool pays
+ * every time that it starts.
+ *
+ * Usage: benchmark-startup [iterations]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static void print_stats( const std::string& name, std::vector<double>& samples ) {
+    double total = 0;
+
+    std::sort( samples.begin(), samples.end() );
+
+    for( double sample : samples ) {
+        total += sample;
+    }
+
+    std::cout << name
+              << " min " << samples.front() << "us"
+              << " median " << samples[ samples.size() / 2 ] << "us"
+              << " mean " << total / samples.size() << "us"
+              << " max " << samples.back() << "us" << std::endl;
+}
+
+static double elapsed_us( Clock::time_point start, Clock::time_point end ) {
+    return std::chrono::duration<double, std::micro>( end - start ).count();
+}
+
+int main( int argc, char** argv ) {
+    int iterations = 200;
+    std::vector<double> connectTimes;
+    std::vector<double> registerTimes;
+    std::vector<double> firstCallTimes;
+    std::vector<double> totalTimes;
+
+    if( argc > 1 ) {
+        iterations = std::atoi( argv[ 1 ] );
+    }
+
+    if( iterations <= 0 ) {
+        std::cerr << "Iterations must be a positive number" << std::endl;
+        return 1;
+    }
+
+    for( int x = 0; x < iterations; x++ ) {
+        Clock::time_point start = Clock::now();
+        std::shared_ptr<DBus::Connection> conn = DBus::Connection::create( DBus::BusType::SESSION );
+        Clock::time_point connected = Clock::now();
+
+        if( !conn->is_valid() || !conn->bus_register() ) {
+            std::cerr << "Unable to connect to the session bus" << std::endl;
+            return 1;
+        }
+
+        Clock::time_point registered = Clock::now();
+
+        if( conn->unique_name().empty() || !conn->name_has_owner( conn->unique_name() ) ) {
+            std::cerr << "Connection is not registered" << std::endl;
+            return 1;
+        }
+
+        Clock::time_point called = Clock::now();
+
+        connectTimes.push_back( elapsed_us( start, connected ) );
+        registerTimes.push_back( elapsed_us( connected, registered ) );
+        firstCallTimes.push_back( elapsed_us( registered, called ) );
+        totalTimes.push_back( elapsed_us( start, called ) );
+    }
+
+    std::cout << "Session bus startup, " << iterations << " iterations" << std::endl;
+    print_stats( "connect+auth ", connectTimes );
+    print_stats( "bus_register ", registerTimes );
+    print_stats( "first call   ", firstCallTimes );
+    print_stats( "total        ", totalTimes );
+
+    return 0;
+}
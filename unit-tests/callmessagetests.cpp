@@ -18,7 +18,9 @@
  ***************************************************************************/
 
 #include <dbus-cxx.h>
+#include <atomic>
 #include <cstring>
+#include <thread>
 
 #include "test_macros.h"
 
@@ -175,6 +177,407 @@ bool call_message_insertion_extraction_operator_multiple( ) {
     return true;
 }
 
+bool call_message_insertion_extraction_operator_signature() {
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    std::vector<uint8_t> data;
+    int32_t i32 = 0;
+    std::string str;
+
+    msg << int32_t( 5 ) << std::string( "five" );
+    TEST_EQUALS_RET_FAIL( msg->signature().str(), "is" );
+
+    // Appending after the signature has been read carries on from it
+    msg << std::vector<double>( 2, 1.0 ) << DBus::Path( "/five" );
+    TEST_EQUALS_RET_FAIL( msg->signature().str(), "isado" );
+
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 1 ) );
+
+    std::shared_ptr<DBus::Message> parsed = DBus::Message::create_from_data( data.data(), data.size() );
+
+    TEST_ASSERT_RET_FAIL( parsed );
+    TEST_EQUALS_RET_FAIL( parsed->signature().str(), "isado" );
+
+    parsed >> i32 >> str;
+    TEST_EQUALS_RET_FAIL( i32, 5 );
+    TEST_EQUALS_RET_FAIL( str, "five" );
+
+    return true;
+}
+
+bool call_message_insertion_extraction_operator_headers() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> data;
+
+    msg << int32_t( 5 );
+
+    // A field only holds values of its own type
+    msg->set_header_field( DBus::MessageHeaderFields::Member, DBus::Variant( uint32_t( 5 ) ) );
+    TEST_EQUALS_RET_FAIL( msg->member(), "Method" );
+
+    msg->set_header_field( DBus::MessageHeaderFields::Sender, DBus::Variant( std::string( ":1.5" ) ) );
+    TEST_EQUALS_RET_FAIL( msg->sender(), ":1.5" );
+    msg->set_header_field( DBus::MessageHeaderFields::Sender, DBus::Variant() );
+    TEST_EQUALS_RET_FAIL( msg->sender(), "" );
+    TEST_EQUALS_RET_FAIL( msg->header_field( DBus::MessageHeaderFields::Sender ).type(), DBus::DataType::INVALID );
+
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+
+    std::shared_ptr<DBus::Message> parsed = DBus::Message::create_from_data( data.data(), data.size() );
+    std::shared_ptr<DBus::CallMessage> call = std::dynamic_pointer_cast<DBus::CallMessage>( parsed );
+
+    TEST_ASSERT_RET_FAIL( call );
+    TEST_EQUALS_RET_FAIL( call->serial(), 7 );
+    TEST_EQUALS_RET_FAIL( call->destination(), "dbuscxx.test" );
+    TEST_EQUALS_RET_FAIL( call->path(), "/dbuscxx/test" );
+    TEST_EQUALS_RET_FAIL( call->interface_name(), "dbuscxx.Interface" );
+    TEST_EQUALS_RET_FAIL( call->member(), "Method" );
+    TEST_EQUALS_RET_FAIL( call->sender(), "" );
+    TEST_EQUALS_RET_FAIL( call->signature().str(), "i" );
+    TEST_EQUALS_RET_FAIL( call->header_field( DBus::MessageHeaderFields::Path ).to_path(), "/dbuscxx/test" );
+
+    std::shared_ptr<DBus::ReturnMessage> reply = call->create_reply();
+    TEST_EQUALS_RET_FAIL( reply->reply_serial(), 7 );
+    TEST_EQUALS_RET_FAIL( reply->header_field( DBus::MessageHeaderFields::Reply_Serial ).to_uint32(), 7 );
+
+    return true;
+}
+
+static std::shared_ptr<uint8_t> shared_copy( const std::vector<uint8_t>& data ) {
+    std::shared_ptr<uint8_t> storage( new uint8_t[ data.size() ], std::default_delete<uint8_t[]>() );
+
+    memcpy( storage.get(), data.data(), data.size() );
+
+    return storage;
+}
+
+bool call_message_insertion_extraction_operator_received_headers() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> data;
+    int32_t i32 = 0;
+
+    msg << int32_t( 5 ) << std::string( "five" );
+    msg->set_header_field( DBus::MessageHeaderFields::Sender, DBus::Variant( std::string( ":1.5" ) ) );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+
+    // The fields that are not needed for routing are decoded when they are asked for
+    std::shared_ptr<DBus::CallMessage> call = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( shared_copy( data ), data.size() ) );
+
+    TEST_ASSERT_RET_FAIL( call );
+    TEST_EQUALS_RET_FAIL( call->path(), "/dbuscxx/test" );
+    TEST_EQUALS_RET_FAIL( call->interface_name(), "dbuscxx.Interface" );
+    TEST_EQUALS_RET_FAIL( call->member(), "Method" );
+    TEST_EQUALS_RET_FAIL( call->sender(), ":1.5" );
+    TEST_EQUALS_RET_FAIL( call->destination(), "dbuscxx.test" );
+    TEST_EQUALS_RET_FAIL( call->header_field( DBus::MessageHeaderFields::Signature ).to_signature().str(), "is" );
+    call >> i32;
+    TEST_EQUALS_RET_FAIL( i32, 5 );
+
+    // Replacing a field before it has been decoded
+    call = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( shared_copy( data ), data.size() ) );
+    TEST_ASSERT_RET_FAIL( call->set_destination( "dbuscxx.other" ) );
+    TEST_EQUALS_RET_FAIL( call->destination(), "dbuscxx.other" );
+
+    // Everything is decoded when the message is compared or sent on
+    call = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( shared_copy( data ), data.size() ) );
+    std::shared_ptr<DBus::Message> copied = DBus::Message::create_from_data( data.data(), data.size() );
+    std::vector<uint8_t> reserialized;
+
+    TEST_ASSERT_RET_FAIL( *copied == *call );
+    TEST_ASSERT_RET_FAIL( call->serialize_to_vector( &reserialized, 7 ) );
+    TEST_ASSERT_RET_FAIL( reserialized == data );
+
+    return true;
+}
+
+bool call_message_insertion_extraction_operator_received_headers_threads() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> data;
+    std::atomic<int> failures( 0 );
+
+    msg << int32_t( 5 ) << std::string( "five" );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+
+    // A received message is handed to several threads at once, each of
+    // which may be the first to decode a field
+    for( int round = 0; round < 200; round++ ) {
+        std::shared_ptr<const DBus::Message> received =
+            DBus::Message::create_from_data( shared_copy( data ), data.size() );
+        std::vector<std::thread> threads;
+        std::atomic<bool> start( false );
+
+        for( int x = 0; x < 4; x++ ) {
+            threads.push_back( std::thread( [received, &failures, &start]() {
+                std::string five;
+
+                while( !start ) {
+                    std::this_thread::yield();
+                }
+
+                received->arg( 1 ) >> five;
+
+                if( received->signature().str() != "is" ||
+                    received->destination() != "dbuscxx.test" ||
+                    received->serialized_body().size() != received->body_size() ||
+                    five != "five" ) {
+                    failures++;
+                }
+            } ) );
+        }
+
+        start = true;
+
+        for( std::thread& thr : threads ) {
+            thr.join();
+        }
+    }
+
+    TEST_EQUALS_RET_FAIL( failures.load(), 0 );
+
+    return true;
+}
+
+bool call_message_insertion_extraction_operator_bad_headers() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> bad;
+
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+
+    // The header field array is longer than the message
+    bad = data;
+    bad[ 12 ] = 0xFF;
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( bad.data(), bad.size() ) );
+
+    // The last field runs past the end of the header field array
+    bad = data;
+    bad[ 12 ] -= 4;
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( shared_copy( bad ), bad.size() ) );
+
+    // Too short to hold the fixed header
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( data.data(), 12 ) );
+
+    return true;
+}
+
+/*
+ * Add a header field with the given code and variant to a serialized message
+ * that has no body.  The value must already be marshaled, with any padding
+ * that it needs after the signature.
+ */
+static std::vector<uint8_t> add_header_field( std::vector<uint8_t> data, uint8_t code,
+    const std::string& signature, const std::vector<uint8_t>& value ) {
+    uint32_t fieldsLength;
+
+    // Without a body, the message ends where the padded header fields do
+    data.push_back( code );
+    data.push_back( signature.size() );
+    data.insert( data.end(), signature.begin(), signature.end() );
+    data.push_back( 0 );
+    data.insert( data.end(), value.begin(), value.end() );
+
+    fieldsLength = data.size() - 16;
+    memcpy( data.data() + 12, &fieldsLength, sizeof( uint32_t ) );
+
+    while( data.size() % 8 != 0 ) {
+        data.push_back( 0 );
+    }
+
+    return data;
+}
+
+static std::vector<uint8_t> uint32_bytes( uint32_t value ) {
+    std::vector<uint8_t> bytes( sizeof( uint32_t ) );
+
+    memcpy( bytes.data(), &value, sizeof( uint32_t ) );
+
+    return bytes;
+}
+
+bool call_message_insertion_extraction_operator_unknown_headers() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> clean;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> bad;
+    std::vector<uint8_t> value;
+    std::vector<uint8_t> text;
+
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &clean, 7 ) );
+
+    // An array of strings: padding, the array length, then "abc"
+    value = { 0, 0, 0 };
+    text = uint32_bytes( 8 );
+    value.insert( value.end(), text.begin(), text.end() );
+    text = uint32_bytes( 3 );
+    value.insert( value.end(), text.begin(), text.end() );
+    value.insert( value.end(), { 'a', 'b', 'c', 0 } );
+    data = add_header_field( clean, 200, "as", value );
+
+    // A variant holding a uint32
+    value = { 1, 'u', 0, 0 };
+    text = uint32_bytes( 5 );
+    value.insert( value.end(), text.begin(), text.end() );
+    data = add_header_field( data, 201, "v", value );
+
+    // A struct holding a byte and a string
+    value = { 0, 9, 0, 0, 0 };
+    text = uint32_bytes( 1 );
+    value.insert( value.end(), text.begin(), text.end() );
+    value.insert( value.end(), { 'x', 0 } );
+    data = add_header_field( data, 202, "(ys)", value );
+
+    std::shared_ptr<DBus::CallMessage> call = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( data.data(), data.size() ) );
+    TEST_ASSERT_RET_FAIL( call );
+    TEST_EQUALS_RET_FAIL( call->serial(), 7 );
+    TEST_EQUALS_RET_FAIL( call->destination(), "dbuscxx.test" );
+    TEST_EQUALS_RET_FAIL( call->member(), "Method" );
+
+    call = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( shared_copy( data ), data.size() ) );
+    TEST_ASSERT_RET_FAIL( call );
+    TEST_EQUALS_RET_FAIL( call->destination(), "dbuscxx.test" );
+
+    // The signature of an unknown field must still be a single complete type
+    bad = add_header_field( clean, 200, "a(", { 0, 0, 0, 0 } );
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( bad.data(), bad.size() ) );
+    bad = add_header_field( clean, 200, "uu", uint32_bytes( 1 ) );
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( bad.data(), bad.size() ) );
+
+    // The value of an unknown field must not run past the header fields
+    value = { 0, 0, 0 };
+    text = uint32_bytes( 0xFFFFFFF0 );
+    value.insert( value.end(), text.begin(), text.end() );
+    bad = add_header_field( clean, 200, "as", value );
+    TEST_ASSERT_RET_FAIL( !DBus::Message::create_from_data( bad.data(), bad.size() ) );
+
+    return true;
+}
+
+bool call_message_insertion_extraction_operator_pool() {
+    std::vector<uint8_t> data;
+    DBus::CallMessage* first;
+
+    DBus::Message::set_pool_size( 2 );
+
+    {
+        std::shared_ptr<DBus::CallMessage> msg =
+            DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+        msg->set_header_field( DBus::MessageHeaderFields::Sender, DBus::Variant( std::string( ":1.5" ) ) );
+        msg << int32_t( 5 ) << std::string( "five" );
+        TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+        first = msg.get();
+    }
+
+    DBus::MessagePoolStatistics stats = DBus::Message::pool_statistics();
+    TEST_EQUALS_RET_FAIL( stats.recycled, 1 );
+    TEST_EQUALS_RET_FAIL( stats.pooled, 1 );
+
+    // A message from the pool is as good as new
+    std::shared_ptr<DBus::CallMessage> reused = DBus::CallMessage::create();
+    std::shared_ptr<DBus::CallMessage> fresh = DBus::CallMessage::create();
+
+    TEST_ASSERT_RET_FAIL( reused.get() == first );
+    TEST_EQUALS_RET_FAIL( DBus::Message::pool_statistics().reused, 1 );
+    TEST_ASSERT_RET_FAIL( *reused == *fresh );
+    TEST_ASSERT_RET_FAIL( reused->is_valid() );
+    TEST_EQUALS_RET_FAIL( reused->serial(), 0 );
+    TEST_EQUALS_RET_FAIL( reused->path(), "" );
+    TEST_EQUALS_RET_FAIL( reused->sender(), "" );
+    TEST_EQUALS_RET_FAIL( reused->signature().str(), "" );
+    TEST_EQUALS_RET_FAIL( reused->begin().arg_type(), DBus::DataType::INVALID );
+
+    // Messages of the other types come from their own pools
+    std::shared_ptr<DBus::ReturnMessage> reply = DBus::ReturnMessage::create();
+    TEST_ASSERT_RET_FAIL( static_cast<DBus::Message*>( reply.get() ) != first );
+    reply.reset();
+
+    // Received messages are pooled as well
+    reused.reset();
+    std::shared_ptr<DBus::Message> parsed = DBus::Message::create_from_data( data.data(), data.size() );
+    TEST_ASSERT_RET_FAIL( parsed.get() == first );
+    TEST_EQUALS_RET_FAIL( std::static_pointer_cast<DBus::CallMessage>( parsed )->member(), "Method" );
+    TEST_EQUALS_RET_FAIL( parsed->sender(), ":1.5" );
+    TEST_EQUALS_RET_FAIL( parsed->signature().str(), "is" );
+
+    // The pool does not grow past its size
+    {
+        std::vector<std::shared_ptr<DBus::CallMessage>> messages;
+
+        for( int x = 0; x < 4; x++ ) {
+            messages.push_back( DBus::CallMessage::create() );
+        }
+    }
+
+    TEST_EQUALS_RET_FAIL( DBus::Message::pool_statistics().pooled, 3 );
+
+    return true;
+}
+
+bool call_message_insertion_extraction_operator_copy() {
+    std::shared_ptr<DBus::CallMessage> msg =
+        DBus::CallMessage::create( "dbuscxx.test", "/dbuscxx/test", "dbuscxx.Interface", "Method" );
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> forwarded;
+    int32_t i32 = 0;
+    std::string str;
+
+    msg << int32_t( 5 ) << std::string( "five" );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 7 ) );
+
+    std::shared_ptr<DBus::Message> received = DBus::Message::create_from_data( shared_copy( data ), data.size() );
+    std::shared_ptr<DBus::CallMessage> copy = std::dynamic_pointer_cast<DBus::CallMessage>( received->copy() );
+
+    // The copy reads the body from where the original was received
+    TEST_ASSERT_RET_FAIL( copy );
+    TEST_ASSERT_RET_FAIL( copy->body_data() == received->body_data() );
+    TEST_EQUALS_RET_FAIL( copy->body_size(), received->body_size() );
+    TEST_EQUALS_RET_FAIL( copy->serial(), 7 );
+    TEST_EQUALS_RET_FAIL( copy->signature().str(), "is" );
+
+    // Only the header changes when the routing fields are rewritten
+    TEST_ASSERT_RET_FAIL( copy->set_destination( "dbuscxx.other" ) );
+    copy->set_path( "/dbuscxx/other" );
+    TEST_ASSERT_RET_FAIL( copy->serialize_header_to_vector( &forwarded, 9 ) );
+    forwarded.insert( forwarded.end(), copy->body_data(), copy->body_data() + copy->body_size() );
+    TEST_EQUALS_RET_FAIL( received->destination(), "dbuscxx.test" );
+
+    std::shared_ptr<DBus::CallMessage> relayed = std::dynamic_pointer_cast<DBus::CallMessage>(
+        DBus::Message::create_from_data( forwarded.data(), forwarded.size() ) );
+    TEST_ASSERT_RET_FAIL( relayed );
+    TEST_EQUALS_RET_FAIL( relayed->serial(), 9 );
+    TEST_EQUALS_RET_FAIL( relayed->destination(), "dbuscxx.other" );
+    TEST_EQUALS_RET_FAIL( relayed->path(), "/dbuscxx/other" );
+    TEST_EQUALS_RET_FAIL( relayed->member(), "Method" );
+    relayed >> i32 >> str;
+    TEST_EQUALS_RET_FAIL( i32, 5 );
+    TEST_EQUALS_RET_FAIL( str, "five" );
+
+    // Changing the body of one of them does not change the other
+    DBus::Endianess foreign = DBus::HOST_ENDIANESS == DBus::Endianess::Little ?
+        DBus::Endianess::Big : DBus::Endianess::Little;
+    TEST_ASSERT_RET_FAIL( copy->set_endianess( foreign ) );
+    TEST_ASSERT_RET_FAIL( copy->body_data() != received->body_data() );
+    i32 = 0;
+    received >> i32;
+    TEST_EQUALS_RET_FAIL( i32, 5 );
+
+    copy = std::dynamic_pointer_cast<DBus::CallMessage>( received->copy() );
+    copy << int32_t( 6 );
+    TEST_EQUALS_RET_FAIL( copy->signature().str(), "isi" );
+    TEST_EQUALS_RET_FAIL( received->signature().str(), "is" );
+    TEST_ASSERT_RET_FAIL( copy->body_size() > received->body_size() );
+
+    return true;
+}
+
 #define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
             ret = call_message_insertion_extraction_operator_##name();\
         } \
@@ -201,6 +604,14 @@ int main( int argc, char** argv ) {
     ADD_TEST( string );
     ADD_TEST( array_double );
     ADD_TEST( multiple );
+    ADD_TEST( signature );
+    ADD_TEST( headers );
+    ADD_TEST( received_headers );
+    ADD_TEST( received_headers_threads );
+    ADD_TEST( bad_headers );
+    ADD_TEST( unknown_headers );
+    ADD_TEST( pool );
+    ADD_TEST( copy );
 
     return !ret;
 }
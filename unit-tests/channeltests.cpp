@@ -0,0 +1,296 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <iostream>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstring>
+
+#include "test_macros.h"
+
+static std::shared_ptr<DBus::SharedMemoryChannel> open_consumer( std::shared_ptr<DBus::SharedMemoryChannel> producer ) {
+    return DBus::SharedMemoryChannel::open( producer->memory_fd(), producer->event_fd() );
+}
+
+static bool event_fd_readable( std::shared_ptr<DBus::SharedMemoryChannel> channel ) {
+    struct pollfd fds;
+
+    fds.fd = channel->event_fd()->descriptor();
+    fds.events = POLLIN;
+    fds.revents = 0;
+
+    return poll( &fds, 1, 0 ) > 0;
+}
+
+/*
+ * Map the producer's memory ourselves so that we can act as a hostile
+ * producer.  This mirrors the layout of the private ring header: the
+ * indexes each sit on their own cache line and the data follows the header.
+ */
+static const size_t HEAD_OFFSET = 64;
+static const size_t TAIL_OFFSET = 128;
+static const size_t DATA_OFFSET = 256;
+
+static uint8_t* map_channel( std::shared_ptr<DBus::SharedMemoryChannel> producer ) {
+    void* mapped = mmap( nullptr, DATA_OFFSET + producer->capacity(), PROT_READ | PROT_WRITE,
+            MAP_SHARED, producer->memory_fd()->descriptor(), 0 );
+
+    if( mapped == MAP_FAILED ) { return nullptr; }
+
+    return static_cast<uint8_t*>( mapped );
+}
+
+static void set_indexes( uint8_t* mapped, uint64_t head, uint64_t tail ) {
+    std::memcpy( mapped + HEAD_OFFSET, &head, sizeof( head ) );
+    std::memcpy( mapped + TAIL_OFFSET, &tail, sizeof( tail ) );
+}
+
+bool channel_typed_records() {
+    std::shared_ptr<DBus::SharedMemoryChannel> producer = DBus::SharedMemoryChannel::create();
+    TEST_ASSERT_RET_FAIL( producer );
+    std::shared_ptr<DBus::SharedMemoryChannel> consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+
+    TEST_ASSERT_RET_FAIL( producer->is_producer() );
+    TEST_ASSERT_RET_FAIL( !consumer->is_producer() );
+    TEST_EQUALS_RET_FAIL( consumer->capacity(), producer->capacity() );
+
+    TEST_ASSERT_RET_FAIL( producer->write( static_cast<uint8_t>( 5 ), 1234.5, std::string( "sample" ), static_cast<int64_t>( -77 ) ) );
+    TEST_ASSERT_RET_FAIL( producer->write( static_cast<uint32_t>( 99 ) ) );
+    TEST_ASSERT_RET_FAIL( consumer->has_record() );
+
+    uint8_t byte_val;
+    double double_val;
+    std::string string_val;
+    int64_t long_val;
+    uint32_t int_val;
+
+    TEST_ASSERT_RET_FAIL( consumer->read( byte_val, double_val, string_val, long_val ) );
+    TEST_EQUALS_RET_FAIL( byte_val, 5 );
+    TEST_EQUALS_RET_FAIL( double_val, 1234.5 );
+    TEST_EQUALS_RET_FAIL( string_val, "sample" );
+    TEST_EQUALS_RET_FAIL( long_val, -77 );
+
+    TEST_ASSERT_RET_FAIL( consumer->read( int_val ) );
+    TEST_EQUALS_RET_FAIL( int_val, 99 );
+
+    TEST_ASSERT_RET_FAIL( !consumer->read( int_val ) );
+    TEST_ASSERT_RET_FAIL( !consumer->has_record() );
+
+    // Only the producer writes, only the consumer reads
+    TEST_ASSERT_RET_FAIL( !consumer->write( int_val ) );
+    TEST_ASSERT_RET_FAIL( !producer->read( int_val ) );
+
+    return true;
+}
+
+bool channel_wraparound() {
+    std::shared_ptr<DBus::SharedMemoryChannel> producer = DBus::SharedMemoryChannel::create( 4096 );
+    TEST_ASSERT_RET_FAIL( producer );
+    std::shared_ptr<DBus::SharedMemoryChannel> consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+
+    // Record sizes that don't divide the ring evenly, so some of them have to skip the end
+    for( uint32_t x = 0; x < 5000; x++ ) {
+        std::vector<uint8_t> record( x % 300, static_cast<uint8_t>( x ) );
+        std::vector<uint8_t> received;
+
+        TEST_ASSERT_RET_FAIL( producer->write_record( record ) );
+        TEST_ASSERT_RET_FAIL( consumer->read_record( &received ) );
+        TEST_ASSERT_RET_FAIL( record == received );
+    }
+
+    return true;
+}
+
+bool channel_full() {
+    std::shared_ptr<DBus::SharedMemoryChannel> producer = DBus::SharedMemoryChannel::create( 4096 );
+    TEST_ASSERT_RET_FAIL( producer );
+    std::shared_ptr<DBus::SharedMemoryChannel> consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+
+    uint32_t written = 0;
+    uint32_t value;
+
+    while( producer->write( written ) ) {
+        written++;
+    }
+
+    // Each record is a length and a value
+    TEST_EQUALS_RET_FAIL( written, 4096 / 8 );
+
+    TEST_ASSERT_RET_FAIL( consumer->read( value ) );
+    TEST_EQUALS_RET_FAIL( value, 0 );
+    TEST_ASSERT_RET_FAIL( producer->write( written ) );
+
+    for( uint32_t x = 1; x <= written; x++ ) {
+        TEST_ASSERT_RET_FAIL( consumer->read( value ) );
+        TEST_EQUALS_RET_FAIL( value, x );
+    }
+
+    // Too big to ever fit
+    TEST_ASSERT_RET_FAIL( !producer->write_record( std::vector<uint8_t>( 4096, 0 ) ) );
+
+    return true;
+}
+
+bool channel_batched_wakeup() {
+    std::shared_ptr<DBus::SharedMemoryChannel> producer = DBus::SharedMemoryChannel::create();
+    TEST_ASSERT_RET_FAIL( producer );
+    std::shared_ptr<DBus::SharedMemoryChannel> consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+
+    // Nobody is waiting, so a flush doesn't need to wake anyone up
+    TEST_ASSERT_RET_FAIL( producer->write( static_cast<int32_t>( 1 ) ) );
+    producer->flush();
+    TEST_ASSERT_RET_FAIL( !event_fd_readable( consumer ) );
+    TEST_ASSERT_RET_FAIL( consumer->wait( 0 ) );
+
+    int32_t value;
+    TEST_ASSERT_RET_FAIL( consumer->read( value ) );
+    TEST_ASSERT_RET_FAIL( !consumer->wait( 10 ) );
+
+    int32_t total = 0;
+    int32_t received = 0;
+    std::thread consumer_thread( [&]() {
+        while( received < 1000 && consumer->wait( 5000 ) ) {
+            int32_t next;
+
+            while( consumer->read( next ) ) {
+                total += next;
+                received++;
+            }
+        }
+    } );
+
+    for( int32_t batch = 0; batch < 10; batch++ ) {
+        for( int32_t x = 0; x < 100; x++ ) {
+            while( !producer->write( x ) ) {
+                producer->flush();
+                std::this_thread::yield();
+            }
+        }
+
+        producer->flush();
+    }
+
+    consumer_thread.join();
+
+    TEST_EQUALS_RET_FAIL( received, 1000 );
+    TEST_EQUALS_RET_FAIL( total, 10 * 4950 );
+
+    return true;
+}
+
+bool channel_open_invalid() {
+    int pipes[2];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipes ) == 0 );
+    TEST_ASSERT_RET_FAIL( !DBus::SharedMemoryChannel::open( DBus::FileDescriptor::create( pipes[0] ),
+            DBus::FileDescriptor::create( pipes[1] ) ) );
+
+    // Memory that is not sealed could be shrunk while we have it mapped
+    int memfd = memfd_create( "channel-test", MFD_CLOEXEC );
+    TEST_ASSERT_RET_FAIL( memfd >= 0 );
+    TEST_ASSERT_RET_FAIL( ftruncate( memfd, 1024 * 1024 ) == 0 );
+    TEST_ASSERT_RET_FAIL( !DBus::SharedMemoryChannel::open( DBus::FileDescriptor::create( memfd ),
+            DBus::FileDescriptor::create( pipes[0] ) ) );
+
+    close( pipes[0] );
+    close( pipes[1] );
+    close( memfd );
+
+    return true;
+}
+
+bool channel_corrupt_records() {
+    std::shared_ptr<DBus::SharedMemoryChannel> producer = DBus::SharedMemoryChannel::create( 4096 );
+    TEST_ASSERT_RET_FAIL( producer );
+    uint8_t* mapped = map_channel( producer );
+    TEST_ASSERT_RET_FAIL( mapped );
+    uint32_t capacity = producer->capacity();
+    std::vector<uint8_t> record;
+
+    // A tail that is not on a record boundary
+    set_indexes( mapped, 20, 4 );
+    TEST_ASSERT_RET_FAIL( !open_consumer( producer ) );
+
+    // More data than the ring can hold
+    set_indexes( mapped, capacity + 8, 0 );
+    TEST_ASSERT_RET_FAIL( !open_consumer( producer ) );
+
+    // A tail ahead of the head
+    set_indexes( mapped, 0, 8 );
+    TEST_ASSERT_RET_FAIL( !open_consumer( producer ) );
+
+    // A record that runs past the end of the ring instead of wrapping
+    uint32_t length = capacity / 2 - sizeof( uint32_t );
+    set_indexes( mapped, capacity - 8 + capacity / 2, capacity - 8 );
+    std::memcpy( mapped + DATA_OFFSET + capacity - 8, &length, sizeof( length ) );
+    std::shared_ptr<DBus::SharedMemoryChannel> consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+    TEST_ASSERT_RET_FAIL( !consumer->read_record( &record ) );
+
+    // A record that claims more data than has been written
+    length = 64;
+    set_indexes( mapped, 16, 0 );
+    std::memcpy( mapped + DATA_OFFSET, &length, sizeof( length ) );
+    consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+    TEST_ASSERT_RET_FAIL( !consumer->read_record( &record ) );
+
+    // The same record is fine once the head covers it
+    set_indexes( mapped, 72, 0 );
+    consumer = open_consumer( producer );
+    TEST_ASSERT_RET_FAIL( consumer );
+    TEST_ASSERT_RET_FAIL( consumer->read_record( &record ) );
+    TEST_EQUALS_RET_FAIL( record.size(), 64 );
+
+    munmap( mapped, DATA_OFFSET + capacity );
+
+    return true;
+}
+
+#define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
+            ret = channel_##name();\
+        } \
+    } while( 0 )
+
+int main( int argc, char** argv ) {
+    if( argc < 1 ) {
+        return 1;
+    }
+
+    std::string test_name = argv[1];
+    bool ret = false;
+
+    DBus::set_logging_function( DBus::log_std_err );
+    DBus::set_log_level( SL_DEBUG );
+
+    ADD_TEST( typed_records );
+    ADD_TEST( wraparound );
+    ADD_TEST( full );
+    ADD_TEST( batched_wakeup );
+    ADD_TEST( open_invalid );
+    ADD_TEST( corrupt_records );
+
+    return !ret;
+}
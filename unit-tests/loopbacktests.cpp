@@ -0,0 +1,197 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+#include "test_macros.h"
+
+static std::shared_ptr<DBus::Dispatcher> dispatch;
+static std::shared_ptr<DBus::Connection> client_conn;
+static std::shared_ptr<DBus::Connection> service_conn;
+static std::shared_ptr<DBus::Object> service_object;
+static std::string signal_value;
+
+static int add( int first, int second ) {
+    return first + second;
+}
+
+static std::string echo( std::string value ) {
+    return value;
+}
+
+static void write_to_fd( std::shared_ptr<DBus::FileDescriptor> fd ) {
+    const char* data = "loopback";
+
+    if( write( fd->descriptor(), data, strlen( data ) ) < 0 ) {
+        std::cerr << "Unable to write to fd" << std::endl;
+    }
+
+    close( fd->descriptor() );
+}
+
+static void signal_handler( std::string value ) {
+    signal_value = value;
+}
+
+static std::shared_ptr<DBus::ObjectProxy> client_proxy() {
+    // There is only one other end, so no destination is needed
+    return client_conn->create_object_proxy( "/dbuscxx/loopback" );
+}
+
+bool loopback_pair() {
+    TEST_ASSERT_RET_FAIL( client_conn && client_conn->is_valid() );
+    TEST_ASSERT_RET_FAIL( service_conn && service_conn->is_valid() );
+    TEST_ASSERT_RET_FAIL( client_conn->is_peer() );
+    TEST_ASSERT_RET_FAIL( client_conn->is_registered() );
+    TEST_ASSERT_RET_FAIL( client_conn->unique_name().empty() );
+
+    return true;
+}
+
+bool loopback_method_call() {
+    std::shared_ptr<DBus::ObjectProxy> proxy = client_proxy();
+    std::shared_ptr<DBus::MethodProxy<int( int, int )>> add_proxy =
+        proxy->create_method<int( int, int )>( "dbuscxx.test", "add" );
+    std::shared_ptr<DBus::MethodProxy<std::string( std::string )>> echo_proxy =
+        proxy->create_method<std::string( std::string )>( "dbuscxx.test", "echo" );
+
+    for( int x = 0; x < 100; x++ ) {
+        TEST_EQUALS_RET_FAIL( ( *add_proxy )( x, 7 ), x + 7 );
+    }
+
+    TEST_EQUALS_RET_FAIL( ( *echo_proxy )( "no bytes were harmed" ), "no bytes were harmed" );
+
+    return true;
+}
+
+bool loopback_unknown_method() {
+    std::shared_ptr<DBus::ObjectProxy> proxy = client_proxy();
+    std::shared_ptr<DBus::MethodProxy<int( int, int )>> missing_proxy =
+        proxy->create_method<int( int, int )>( "dbuscxx.test", "subtract" );
+    bool threw = false;
+
+    try {
+        ( *missing_proxy )( 1, 2 );
+    } catch( DBus::Error& ) {
+        threw = true;
+    }
+
+    TEST_ASSERT_RET_FAIL( threw );
+
+    return true;
+}
+
+bool loopback_signal() {
+    std::shared_ptr<DBus::ObjectProxy> proxy = client_proxy();
+    std::shared_ptr<DBus::SignalProxy<void(std::string)>> signal_proxy =
+        proxy->create_signal<void(std::string)>( "dbuscxx.test", "changed" );
+    std::shared_ptr<DBus::Signal<void(std::string)>> signal =
+        service_object->create_signal<void(std::string)>( "dbuscxx.test", "changed" );
+
+    signal_proxy->connect( sigc::ptr_fun( signal_handler ) );
+    signal->emit( "loopback signal" );
+
+    for( int x = 0; x < 500 && signal_value.empty(); x++ ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+
+    TEST_EQUALS_RET_FAIL( signal_value, "loopback signal" );
+
+    return true;
+}
+
+bool loopback_filedescriptor() {
+    std::shared_ptr<DBus::ObjectProxy> proxy = client_proxy();
+    std::shared_ptr<DBus::MethodProxy<void( std::shared_ptr<DBus::FileDescriptor> )>> fd_proxy =
+        proxy->create_method<void( std::shared_ptr<DBus::FileDescriptor> )>( "dbuscxx.test", "write_to_fd" );
+    int pipes[ 2 ];
+    char buffer[ 16 ];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipes ) == 0 );
+
+    ( *fd_proxy )( DBus::FileDescriptor::create( pipes[ 1 ] ) );
+    close( pipes[ 1 ] );
+
+    memset( buffer, 0, sizeof( buffer ) );
+    TEST_EQUALS_RET_FAIL( read( pipes[ 0 ], buffer, sizeof( buffer ) - 1 ), 8 );
+    TEST_EQUALS_RET_FAIL( std::string( buffer ), "loopback" );
+    close( pipes[ 0 ] );
+
+    return true;
+}
+
+bool loopback_disconnect() {
+    std::pair<std::shared_ptr<DBus::Connection>, std::shared_ptr<DBus::Connection>> pair =
+        DBus::Connection::create_loopback_pair();
+
+    TEST_ASSERT_RET_FAIL( pair.first->is_valid() );
+    TEST_ASSERT_RET_FAIL( pair.second->is_valid() );
+
+    pair.second.reset();
+
+    TEST_ASSERT_RET_FAIL( !pair.first->is_valid() );
+
+    return true;
+}
+
+#define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
+            ret = loopback_##name();\
+        } \
+    } while( 0 )
+
+int main( int argc, char** argv ) {
+    if( argc < 1 ) {
+        return 1;
+    }
+
+    std::string test_name = argv[1];
+    bool ret = false;
+
+    DBus::set_logging_function( DBus::log_std_err );
+    DBus::set_log_level( SL_INFO );
+
+    std::tie( client_conn, service_conn ) = DBus::Connection::create_loopback_pair();
+
+    if( !client_conn || !service_conn ) {
+        std::cerr << "Unable to create loopback pair" << std::endl;
+        return 1;
+    }
+
+    service_object = service_conn->create_object( "/dbuscxx/loopback" );
+    service_object->create_method<int( int, int )>( "dbuscxx.test", "add", sigc::ptr_fun( add ) );
+    service_object->create_method<std::string( std::string )>( "dbuscxx.test", "echo", sigc::ptr_fun( echo ) );
+    service_object->create_method<void( std::shared_ptr<DBus::FileDescriptor> )>( "dbuscxx.test", "write_to_fd", sigc::ptr_fun( write_to_fd ) );
+
+    dispatch = DBus::StandaloneDispatcher::create();
+    dispatch->add_connection( client_conn );
+    dispatch->add_connection( service_conn );
+
+    ADD_TEST( pair );
+    ADD_TEST( method_call );
+    ADD_TEST( unknown_method );
+    ADD_TEST( signal );
+    ADD_TEST( filedescriptor );
+    ADD_TEST( disconnect );
+
+    return !ret;
+}
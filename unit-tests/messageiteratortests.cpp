@@ -16,13 +16,40 @@
  *   You should have received a copy of the GNU General Public License     *
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
+#include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <dbus-cxx.h>
+#include <dbus-cxx/validator.h>
 #include <iostream>
+#include <new>
 
 #include "test_macros.h"
 
+static uint64_t allocations = 0;
+
+void* operator new( size_t size ) {
+    allocations++;
+
+    void* ptr = std::malloc( size ? size : 1 );
+
+    if( !ptr ) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void operator delete( void* ptr ) noexcept {
+    std::free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept {
+    std::free( ptr );
+}
+
 template <typename T>
 bool test_numeric_call_message_append_extract_iterator( T v ) {
     T v2 = 0;
@@ -816,6 +843,825 @@ bool call_message_iterator_insertion_extraction_operator_struct() {
     return true;
 }
 
+#if DBUS_CXX_HAS_MEMFD
+bool call_message_append_extract_iterator_memfd_array() {
+    std::vector<uint8_t> v1;
+    std::vector<uint8_t> v2;
+
+    for( int x = 0; x < 100000; x++ ) {
+        v1.push_back( x * 7 );
+    }
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1.set_memfd_threshold( 4096 );
+    iter1 << v1;
+
+    TEST_EQUALS_RET_FAIL( msg->signature(), "h" );
+    TEST_EQUALS_RET_FAIL( msg->filedescriptors().size(), 1 );
+    TEST_ASSERT_RET_FAIL( msg->serialized_body().size() < 100 );
+
+    DBus::MessageIterator iter2( msg );
+    iter2 >> v2;
+
+    TEST_ASSERT_RET_FAIL( v1 == v2 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_memfd_threshold() {
+    std::vector<uint8_t> small( 100, 0x55 );
+    std::vector<std::vector<uint8_t>> nested;
+    nested.push_back( std::vector<uint8_t>( 8192, 0xAA ) );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1.set_memfd_threshold( 4096 );
+    iter1 << small;
+    iter1 << nested;
+
+    // Too small, and not a top-level argument
+    TEST_EQUALS_RET_FAIL( msg->signature(), "ayaay" );
+    TEST_EQUALS_RET_FAIL( msg->filedescriptors().size(), 0 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_memfd_unsealed() {
+    std::vector<uint8_t> v;
+    int pipes[2];
+    bool threw = false;
+
+    if( pipe( pipes ) < 0 ) {
+        return false;
+    }
+
+    std::shared_ptr<DBus::FileDescriptor> fd = DBus::FileDescriptor::create( pipes[0] );
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << fd;
+
+    DBus::MessageIterator iter2( msg );
+
+    try {
+        iter2 >> v;
+    } catch( DBus::ErrorInvalidTypecast& ) {
+        threw = true;
+    }
+
+    close( pipes[1] );
+
+    TEST_ASSERT_RET_FAIL( threw );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_memfd_too_large() {
+    std::vector<uint8_t> v;
+    bool threw = false;
+
+    // A sealed memfd that is larger than the limit; the file is sparse
+    int memfd = memfd_create( "memfd-too-large", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    TEST_ASSERT_RET_FAIL( memfd >= 0 );
+    TEST_ASSERT_RET_FAIL( ftruncate( memfd, static_cast<off_t>( DBus::Validator::maximum_memfd_array_size() ) + 1 ) == 0 );
+    TEST_ASSERT_RET_FAIL( fcntl( memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL ) == 0 );
+
+    std::shared_ptr<DBus::FileDescriptor> fd = DBus::FileDescriptor::create( memfd );
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << fd;
+    close( memfd );
+
+    DBus::MessageIterator iter2( msg );
+
+    try {
+        iter2 >> v;
+    } catch( DBus::ErrorInvalidTypecast& ) {
+        threw = true;
+    }
+
+    TEST_ASSERT_RET_FAIL( threw );
+    TEST_ASSERT_RET_FAIL( v.empty() );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_memfd_limit() {
+    std::vector<uint8_t> v1( 8192, 0x5A );
+    std::vector<uint8_t> v2;
+    uint32_t old_limit = DBus::Validator::maximum_memfd_array_size();
+
+    DBus::Validator::set_maximum_memfd_array_size( 4096 );
+
+    // Over the limit, so the sender falls back to an inline array
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1.set_memfd_threshold( 1024 );
+    iter1 << v1;
+
+    TEST_EQUALS_RET_FAIL( msg->signature(), "ay" );
+    TEST_EQUALS_RET_FAIL( msg->filedescriptors().size(), 0 );
+
+    DBus::MessageIterator iter2( msg );
+    iter2 >> v2;
+    TEST_ASSERT_RET_FAIL( v1 == v2 );
+
+    // The receiver rejects the same array in a memfd that was made with a larger limit
+    DBus::Validator::set_maximum_memfd_array_size( old_limit );
+    msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter3( msg );
+    iter3.set_memfd_threshold( 1024 );
+    iter3 << v1;
+    TEST_EQUALS_RET_FAIL( msg->signature(), "h" );
+
+    DBus::Validator::set_maximum_memfd_array_size( 4096 );
+    DBus::MessageIterator iter4( msg );
+    bool threw = false;
+    v2.clear();
+
+    try {
+        iter4 >> v2;
+    } catch( DBus::ErrorInvalidTypecast& ) {
+        threw = true;
+    }
+
+    DBus::Validator::set_maximum_memfd_array_size( old_limit );
+
+    TEST_ASSERT_RET_FAIL( threw );
+    TEST_ASSERT_RET_FAIL( v2.empty() );
+
+    return true;
+}
+#endif
+
+static DBus::Endianess foreign_endianess() {
+    if( DBus::HOST_ENDIANESS == DBus::Endianess::Little ) {
+        return DBus::Endianess::Big;
+    }
+
+    return DBus::Endianess::Little;
+}
+
+bool call_message_append_extract_iterator_byte_order_round_trip() {
+    std::map<std::string, DBus::Variant> props;
+    std::tuple<int32_t, int64_t, double> values = { -5, 0x0102030405060708, 1.5 };
+    std::vector<std::string> strings = { "first", "second" };
+    std::vector<uint8_t> serialized;
+
+    props[ "count" ] = DBus::Variant( static_cast<uint16_t>( 0x1234 ) );
+    props[ "list" ] = DBus::Variant( std::vector<int32_t>{ 1, 2, 3 } );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << props;
+    iter1 << values;
+    iter1 << strings;
+
+    TEST_ASSERT_RET_FAIL( msg->endianess() == DBus::HOST_ENDIANESS );
+    std::vector<uint8_t> hostBody = msg->serialized_body();
+
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( foreign_endianess() ) );
+    TEST_ASSERT_RET_FAIL( msg->serialized_body() != hostBody );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &serialized, 5 ) );
+
+    // Parse it as if it came from the other side, then convert it back
+    std::shared_ptr<DBus::Message> received =
+        DBus::Message::create_from_data( serialized.data(), serialized.size() );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( received->endianess() == foreign_endianess() );
+    TEST_ASSERT_RET_FAIL( received->set_endianess( DBus::HOST_ENDIANESS ) );
+    TEST_ASSERT_RET_FAIL( received->serialized_body() == hostBody );
+
+    std::map<std::string, DBus::Variant> extractedProps;
+    std::tuple<int32_t, int64_t, double> extractedValues;
+    std::vector<std::string> extractedStrings;
+    DBus::MessageIterator iter2( received );
+    iter2 >> extractedProps;
+    iter2 >> extractedValues;
+    iter2 >> extractedStrings;
+
+    TEST_EQUALS_RET_FAIL( extractedProps[ "count" ].to_uint16(), 0x1234 );
+    TEST_ASSERT_RET_FAIL( extractedProps[ "list" ].to_vector<int32_t>() == std::vector<int32_t>( { 1, 2, 3 } ) );
+    TEST_ASSERT_RET_FAIL( extractedValues == values );
+    TEST_ASSERT_RET_FAIL( extractedStrings == strings );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_byte_order_foreign() {
+    std::tuple<uint16_t, uint32_t, std::string> values = { 0xABCD, 0x01020304, "foreign" };
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( foreign_endianess() ) );
+
+    // Appending to a message that is already in the other byte order
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << values;
+    iter1 << DBus::Variant( static_cast<int64_t>( -0x0102030405060708 ) );
+
+    std::tuple<uint16_t, uint32_t, std::string> extracted;
+    DBus::Variant extractedVariant;
+    DBus::MessageIterator iter2( msg );
+    iter2 >> extracted;
+    extractedVariant = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( iter2 );
+
+    TEST_ASSERT_RET_FAIL( extracted == values );
+    TEST_EQUALS_RET_FAIL( extractedVariant.to_int64(), -0x0102030405060708 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_byte_order_header() {
+    std::vector<uint8_t> serialized;
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &serialized, 1 ) );
+    TEST_EQUALS_RET_FAIL( serialized[ 0 ], ( DBus::HOST_ENDIANESS == DBus::Endianess::Little ? 'l' : 'B' ) );
+
+    serialized.clear();
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( foreign_endianess() ) );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &serialized, 1 ) );
+    TEST_EQUALS_RET_FAIL( serialized[ 0 ], ( DBus::HOST_ENDIANESS == DBus::Endianess::Little ? 'B' : 'l' ) );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_byte_order_empty_struct() {
+    std::vector<uint8_t> serialized;
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( foreign_endianess() ) );
+
+    msg << std::vector<uint8_t>( { 1, 2, 3, 4 } ) << static_cast<uint32_t>( 5 );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &serialized, 1 ) );
+
+    // Turn the signature into "a()", whose elements would take up no bytes
+    std::string text( serialized.begin(), serialized.end() );
+    size_t sigPos = text.find( std::string( "ayu\0", 4 ) );
+    TEST_ASSERT_RET_FAIL( sigPos != std::string::npos );
+    memcpy( serialized.data() + sigPos, "a()", 3 );
+
+    std::shared_ptr<DBus::Message> received = DBus::Message::create_from_data( serialized.data(), serialized.size() );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( !received->set_endianess( DBus::HOST_ENDIANESS ) );
+
+    return true;
+}
+
+template <typename T>
+bool test_fixed_array( DBus::Endianess endian ) {
+    std::vector<T> v1;
+    std::vector<T> v2;
+    std::vector<T> empty;
+    std::vector<T> emptyExtracted;
+    uint8_t before = 0;
+    uint32_t after = 0;
+
+    for( int64_t x = 0; x < 1001; x++ ) {
+        v1.push_back( static_cast<T>( x * 0x01030507 ) );
+    }
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( endian ) );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << static_cast<uint8_t>( 1 );
+    iter1 << v1;
+    iter1 << empty;
+    iter1 << static_cast<uint32_t>( 0xAABBCCDD );
+
+    DBus::MessageIterator iter2( msg );
+    iter2 >> before;
+    iter2 >> v2;
+    iter2 >> emptyExtracted;
+    iter2 >> after;
+
+    TEST_EQUALS_RET_FAIL( before, 1 );
+    TEST_ASSERT_RET_FAIL( v1 == v2 );
+    TEST_ASSERT_RET_FAIL( emptyExtracted.empty() );
+    TEST_EQUALS_RET_FAIL( after, 0xAABBCCDD );
+
+    return true;
+}
+
+template <typename T>
+bool test_fixed_array_both_endians() {
+    return test_fixed_array<T>( DBus::Endianess::Little ) &&
+        test_fixed_array<T>( DBus::Endianess::Big );
+}
+
+bool call_message_append_extract_iterator_fixed_array_byte() {
+    return test_fixed_array_both_endians<uint8_t>();
+}
+
+bool call_message_append_extract_iterator_fixed_array_int16() {
+    return test_fixed_array_both_endians<int16_t>() &&
+        test_fixed_array_both_endians<uint16_t>();
+}
+
+bool call_message_append_extract_iterator_fixed_array_int32() {
+    return test_fixed_array_both_endians<int32_t>() &&
+        test_fixed_array_both_endians<uint32_t>();
+}
+
+bool call_message_append_extract_iterator_fixed_array_int64() {
+    return test_fixed_array_both_endians<int64_t>() &&
+        test_fixed_array_both_endians<uint64_t>();
+}
+
+bool call_message_append_extract_iterator_fixed_array_double() {
+    return test_fixed_array_both_endians<double>();
+}
+
+bool call_message_append_extract_iterator_fixed_array_nested() {
+    std::vector<std::vector<int32_t>> v1 = { { 1 }, {}, { 2, 3 } };
+    std::vector<std::vector<int32_t>> v2;
+    std::vector<double> d1 = { 1.5, -2.25 };
+    std::vector<double> d2;
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << d1;
+    iter1 << v1;
+
+    TEST_EQUALS_RET_FAIL( msg->signature(), "adaai" );
+
+    DBus::MessageIterator iter2( msg );
+    iter2 >> d2;
+    iter2 >> v2;
+
+    TEST_ASSERT_RET_FAIL( d1 == d2 );
+    TEST_ASSERT_RET_FAIL( v1 == v2 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_variant_nested_struct() {
+    typedef std::tuple<int32_t, std::tuple<uint8_t, double>, std::string> nested_type;
+    nested_type good = nested_type( 5, std::make_tuple( 7, 2.5 ), "nested" );
+    DBus::Variant var1( good );
+    DBus::Variant var2;
+
+    TEST_EQUALS_RET_FAIL( var1.signature().str(), "(i(yd)s)" );
+    TEST_ASSERT_RET_FAIL( ( var1.to_tuple<int32_t, std::tuple<uint8_t, double>, std::string>() == good ) );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << var1;
+
+    DBus::MessageIterator iter2( msg );
+    var2 = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( iter2 );
+
+    TEST_EQUALS_RET_FAIL( var2.signature().str(), "(i(yd)s)" );
+    TEST_ASSERT_RET_FAIL( ( var2.to_tuple<int32_t, std::tuple<uint8_t, double>, std::string>() == good ) );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_nested_alignment() {
+    std::vector<std::vector<int64_t>> arrays = { { 1 }, {}, { 2, 3 } };
+    std::vector<std::tuple<int32_t, double>> structs = { { 1, 1.5 }, { 2, 2.5 } };
+    std::map<std::string, std::map<std::string, DBus::Variant>> dicts;
+    std::vector<std::vector<int64_t>> extractedArrays;
+    std::vector<std::tuple<int32_t, double>> extractedStructs;
+    std::map<std::string, std::map<std::string, DBus::Variant>> extractedDicts;
+
+    dicts[ "first" ][ "value" ] = DBus::Variant( static_cast<int64_t>( -7 ) );
+    dicts[ "first" ][ "name" ] = DBus::Variant( std::string( "first" ) );
+    dicts[ "second" ][ "value" ] = DBus::Variant( 2.5 );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    // The byte puts everything after it at an odd offset
+    iter1 << static_cast<uint8_t>( 1 );
+    iter1 << arrays;
+    iter1 << static_cast<uint8_t>( 2 );
+    iter1 << structs;
+    iter1 << static_cast<uint8_t>( 3 );
+    iter1 << dicts;
+
+    TEST_EQUALS_RET_FAIL( msg->signature(), "yaaxya(id)ya{sa{sv}}" );
+
+    // Going through a foreign byte order checks every length and padding
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( DBus::HOST_ENDIANESS == DBus::Endianess::Little ?
+            DBus::Endianess::Big : DBus::Endianess::Little ) );
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( DBus::HOST_ENDIANESS ) );
+
+    uint8_t byte;
+    DBus::MessageIterator iter2( msg );
+    iter2 >> byte;
+    iter2 >> extractedArrays;
+    iter2 >> byte;
+    iter2 >> extractedStructs;
+    iter2 >> byte;
+    iter2 >> extractedDicts;
+
+    TEST_EQUALS_RET_FAIL( byte, 3 );
+    TEST_ASSERT_RET_FAIL( extractedArrays == arrays );
+    TEST_ASSERT_RET_FAIL( extractedStructs == structs );
+    TEST_EQUALS_RET_FAIL( extractedDicts[ "first" ][ "value" ].to_int64(), -7 );
+    TEST_EQUALS_RET_FAIL( extractedDicts[ "first" ][ "name" ].to_string(), "first" );
+    TEST_EQUALS_RET_FAIL( extractedDicts[ "second" ][ "value" ].to_double(), 2.5 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_skip() {
+    std::vector<std::vector<int64_t>> arrays = { { 1 }, {}, { 2, 3 } };
+    std::vector<std::tuple<int32_t, double>> structs = { { 1, 1.5 }, { 2, 2.5 } };
+    std::map<std::string, DBus::Variant> dict;
+    std::vector<std::string> strings = { "one", "two", "three" };
+    std::string extracted;
+
+    dict[ "name" ] = DBus::Variant( std::string( "value" ) );
+    dict[ "nested" ] = DBus::Variant( std::make_tuple( static_cast<uint8_t>( 3 ), 2.5 ) );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << static_cast<uint8_t>( 1 );
+    iter1 << arrays;
+    iter1 << std::string( "skipped" );
+    iter1 << structs;
+    iter1 << DBus::Signature( "a{sv}" );
+    iter1 << dict;
+    iter1 << DBus::Variant( strings );
+    iter1 << strings;
+    iter1 << std::string( "last" );
+
+    TEST_EQUALS_RET_FAIL( msg->signature(), "yaaxsa(id)ga{sv}vass" );
+
+    DBus::MessageIterator iter2( msg );
+
+    for( int i = 0; i < 7; i++ ) {
+        TEST_ASSERT_RET_FAIL( iter2.skip() );
+    }
+
+    // Skip elements inside of an array; the parent still moves past all of it
+    DBus::MessageIterator subiter = iter2.recurse();
+    TEST_ASSERT_RET_FAIL( subiter.skip() );
+    subiter >> extracted;
+    TEST_EQUALS_RET_FAIL( extracted, "two" );
+    subiter.skip();
+    TEST_ASSERT_RET_FAIL( !subiter.is_valid() );
+
+    TEST_ASSERT_RET_FAIL( iter2.next() );
+    iter2 >> extracted;
+    TEST_EQUALS_RET_FAIL( extracted, "last" );
+    TEST_ASSERT_RET_FAIL( !iter2.is_valid() );
+    TEST_ASSERT_RET_FAIL( !iter2.skip() );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_arg_index() {
+    std::vector<std::string> strings = { "one", "two", "three" };
+    std::map<std::string, DBus::Variant> dict;
+    int32_t extractedInt;
+    std::string extractedString;
+    double extractedDouble;
+    std::vector<std::string> extractedStrings;
+
+    dict[ "name" ] = DBus::Variant( std::string( "value" ) );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << static_cast<uint8_t>( 1 );
+    iter1 << strings;
+    iter1 << dict;
+    iter1 << static_cast<int32_t>( 42 );
+    iter1 << std::string( "fifth" );
+
+    msg->arg( 4 ) >> extractedString;
+    TEST_EQUALS_RET_FAIL( extractedString, "fifth" );
+    msg->arg( 3 ) >> extractedInt;
+    TEST_EQUALS_RET_FAIL( extractedInt, 42 );
+    msg->arg( 1 ) >> extractedStrings;
+    TEST_ASSERT_RET_FAIL( extractedStrings == strings );
+    TEST_ASSERT_RET_FAIL( !msg->arg( 5 ).is_valid() );
+
+    // The iterator carries on to the arguments after it
+    DBus::MessageIterator iter2 = msg->arg( 3 );
+    iter2 >> extractedInt;
+    iter2 >> extractedString;
+    TEST_EQUALS_RET_FAIL( extractedString, "fifth" );
+
+    // Appending more arguments after looking one up finds the new ones too
+    iter1 << 2.5;
+    msg->arg( 5 ) >> extractedDouble;
+    TEST_EQUALS_RET_FAIL( extractedDouble, 2.5 );
+
+    // A received message in a foreign byte order is indexed in place
+    std::vector<uint8_t> data;
+    TEST_ASSERT_RET_FAIL( msg->set_endianess( DBus::HOST_ENDIANESS == DBus::Endianess::Little ?
+            DBus::Endianess::Big : DBus::Endianess::Little ) );
+    TEST_ASSERT_RET_FAIL( msg->serialize_to_vector( &data, 1 ) );
+    std::shared_ptr<DBus::Message> received = DBus::Message::create_from_data( data.data(), data.size() );
+    TEST_ASSERT_RET_FAIL( received );
+
+    received->arg( 4 ) >> extractedString;
+    TEST_EQUALS_RET_FAIL( extractedString, "fifth" );
+    received->arg( 3 ) >> extractedInt;
+    TEST_EQUALS_RET_FAIL( extractedInt, 42 );
+    received->arg( 5 ) >> extractedDouble;
+    TEST_EQUALS_RET_FAIL( extractedDouble, 2.5 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_find() {
+    std::map<std::string, DBus::Variant> first;
+    std::map<std::string, DBus::Variant> second;
+    std::map<std::string, std::string> strings;
+    std::vector<int32_t> ints;
+    std::string extractedString;
+
+    first[ "a" ] = DBus::Variant( static_cast<int32_t>( 1 ) );
+    first[ "b" ] = DBus::Variant( std::vector<std::string>{ "x", "y" } );
+    first[ "c" ] = DBus::Variant( std::string( "first" ) );
+    second[ "d" ] = DBus::Variant( std::string( "second" ) );
+    strings[ "e" ] = "string";
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << strings;
+    iter1 << first;
+    iter1 << static_cast<uint8_t>( 1 );
+    iter1 << second;
+
+    DBus::Variant found = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( msg->find( "a{sv}", "c" ) );
+    TEST_EQUALS_RET_FAIL( found.to_string(), "first" );
+
+    found = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( msg->find( "a{sv}", "a" ) );
+    TEST_EQUALS_RET_FAIL( found.to_int32(), 1 );
+
+    // Keys in the later dictionaries are found as well
+    found = DBUSCXX_MESSAGEITERATOR_OPERATOR_VARIANT( msg->find( "a{sv}", "d" ) );
+    TEST_EQUALS_RET_FAIL( found.to_string(), "second" );
+
+    msg->find( "a{ss}", "e" ) >> extractedString;
+    TEST_EQUALS_RET_FAIL( extractedString, "string" );
+
+    TEST_ASSERT_RET_FAIL( !msg->find( "a{sv}", "e" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !msg->find( "a{sv}", "missing" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !msg->find( "a{ss}", "a" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !msg->find( "y", "a" ).is_valid() );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_recurse_lifetime() {
+    std::vector<std::string> strings = { "one", "two", "three" };
+    std::vector<std::string> extracted;
+    std::string extractedString;
+    int32_t extractedInt = 0;
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    msg << strings << static_cast<int32_t>( 42 );
+
+    // The sub-iterator of a temporary does not need the temporary
+    DBus::MessageIterator fromTemporary = msg->begin().recurse();
+
+    while( fromTemporary.is_valid() ) {
+        fromTemporary >> extractedString;
+        extracted.push_back( extractedString );
+    }
+
+    TEST_ASSERT_RET_FAIL( extracted == strings );
+
+    // Assigning an iterator its own sub-iterator
+    DBus::MessageIterator iter = msg->begin();
+    iter = iter.recurse();
+    iter >> extractedString;
+    TEST_EQUALS_RET_FAIL( extractedString, "one" );
+    iter = iter.recurse();
+    TEST_ASSERT_RET_FAIL( !iter.is_valid() );
+
+    // Moving past a container that was only partly read
+    DBus::MessageIterator parent = msg->begin();
+    DBus::MessageIterator child = parent.recurse();
+    child >> extractedString;
+    TEST_ASSERT_RET_FAIL( parent.next() );
+    parent >> extractedInt;
+    TEST_EQUALS_RET_FAIL( extractedInt, 42 );
+
+    return true;
+}
+
+/*
+ * Serialize the message and receive it again, after overwriting the 32-bit
+ * value at the given offset in the body
+ */
+static std::shared_ptr<DBus::Message> patched_body( std::shared_ptr<DBus::Message> msg,
+    uint32_t bodyOffset, uint32_t value ) {
+    std::vector<uint8_t> serialized;
+    uint32_t fieldsLength;
+
+    if( !msg->serialize_to_vector( &serialized, 1 ) ) {
+        return std::shared_ptr<DBus::Message>();
+    }
+
+    // The body starts after the header fields, on an 8-byte boundary
+    memcpy( &fieldsLength, serialized.data() + 12, sizeof( uint32_t ) );
+    uint32_t bodyStart = ( 16 + fieldsLength + 7 ) & ~7;
+    memcpy( serialized.data() + bodyStart + bodyOffset, &value, sizeof( uint32_t ) );
+
+    return DBus::Message::create_from_data( serialized.data(), serialized.size() );
+}
+
+/*
+ * A received message with the body "sa{ss}u", with the 32-bit value at the
+ * given offset in the body overwritten
+ */
+static std::shared_ptr<DBus::Message> malformed_body( uint32_t bodyOffset, uint32_t value ) {
+    std::map<std::string, std::string> dict;
+
+    dict[ "key" ] = "value";
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    msg << std::string( "abc" ) << dict << static_cast<uint32_t>( 5 );
+
+    return patched_body( msg, bodyOffset, value );
+}
+
+bool call_message_append_extract_iterator_malformed_body() {
+    std::string extracted;
+    uint32_t extractedInt = 0;
+
+    // Untouched, so that we know the offsets are right
+    std::shared_ptr<DBus::Message> good = malformed_body( 0, 3 );
+    TEST_ASSERT_RET_FAIL( good );
+    good->find( "a{ss}", "key" ) >> extracted;
+    TEST_EQUALS_RET_FAIL( extracted, "value" );
+    good->arg( 2 ) >> extractedInt;
+    TEST_EQUALS_RET_FAIL( extractedInt, 5 );
+
+    // The length of the first string runs past the end of the body
+    std::shared_ptr<DBus::Message> longString = malformed_body( 0, 0xFFFFFFFF );
+    TEST_ASSERT_RET_FAIL( longString );
+    TEST_ASSERT_RET_FAIL( !longString->arg( 1 ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !longString->find( "a{ss}", "key" ).is_valid() );
+    DBus::MessageIterator iter = longString->begin();
+    TEST_ASSERT_RET_FAIL( !iter.skip() );
+    TEST_ASSERT_RET_FAIL( !iter.is_valid() );
+
+    // The length of the dictionary runs past the end of the body
+    std::shared_ptr<DBus::Message> longDict = malformed_body( 8, 0xFFFFFFF0 );
+    TEST_ASSERT_RET_FAIL( longDict );
+    TEST_ASSERT_RET_FAIL( !longDict->find( "a{ss}", "key" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !longDict->arg( 2 ).is_valid() );
+
+    // The length of a key in the dictionary runs past the end of the body
+    std::shared_ptr<DBus::Message> longKey = malformed_body( 16, 0xFFFFFFFF );
+    TEST_ASSERT_RET_FAIL( longKey );
+    TEST_ASSERT_RET_FAIL( !longKey->find( "a{ss}", "key" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !longKey->find( "a{ss}", "other" ).is_valid() );
+
+    // The length of a value in the dictionary runs past the end of the body
+    std::shared_ptr<DBus::Message> longValue = malformed_body( 24, 0x7FFFFFFF );
+    TEST_ASSERT_RET_FAIL( longValue );
+    TEST_ASSERT_RET_FAIL( !longValue->find( "a{ss}", "other" ).is_valid() );
+
+    return true;
+}
+
+template <typename T>
+static bool fixed_array_throws( std::shared_ptr<DBus::Message> received ) {
+    std::vector<T> extracted;
+    DBus::MessageIterator iter = received->begin();
+
+    try {
+        iter >> extracted;
+    } catch( DBus::ErrorInvalidTypecast& ) {
+        return extracted.empty();
+    }
+
+    return false;
+}
+
+bool call_message_append_extract_iterator_malformed_fixed_array() {
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    msg << std::vector<int32_t>( { 1, 2, 3 } ) << static_cast<uint32_t>( 5 );
+
+    std::shared_ptr<DBus::Message> received = patched_body( msg, 0, 12 );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( !fixed_array_throws<int32_t>( received ) );
+
+    // Not a whole number of elements
+    received = patched_body( msg, 0, 6 );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( fixed_array_throws<int32_t>( received ) );
+
+    // Longer than the message
+    received = patched_body( msg, 0, 0xFFFFFFF0 );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( fixed_array_throws<int32_t>( received ) );
+
+    std::shared_ptr<DBus::CallMessage> doubles = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    doubles << std::vector<double>( { 1.5 } );
+    received = patched_body( doubles, 0, 16 );
+    TEST_ASSERT_RET_FAIL( received );
+    TEST_ASSERT_RET_FAIL( fixed_array_throws<double>( received ) );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_no_allocations() {
+    std::vector<std::string> strings = { "one", "two", "three" };
+    std::vector<std::tuple<int32_t, double>> structs = { { 1, 1.5 }, { 2, 2.5 } };
+    std::map<std::string, DBus::Variant> dict;
+    int32_t extractedInt = 0;
+    double extractedDouble = 0;
+    std::string extractedString;
+
+    dict[ "name" ] = DBus::Variant( static_cast<int32_t>( 7 ) );
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    msg << static_cast<int32_t>( 42 ) << strings << structs << dict;
+
+    // Looks the signature up and builds the argument index
+    msg->arg( 3 );
+    extractedString.reserve( 16 );
+
+    uint64_t allocationsBefore = allocations;
+
+    DBus::MessageIterator iter = msg->begin();
+    DBus::MessageIterator copy = iter;
+    copy >> extractedInt;
+    TEST_EQUALS_RET_FAIL( extractedInt, 42 );
+
+    // Reading the copy of a top-level iterator does not move the original
+    iter >> extractedInt;
+
+    DBus::MessageIterator stringIter = iter.recurse();
+
+    while( stringIter.is_valid() ) {
+        stringIter >> extractedString;
+    }
+
+    TEST_EQUALS_RET_FAIL( extractedString, "three" );
+    TEST_ASSERT_RET_FAIL( iter.next() );
+
+    DBus::MessageIterator structArray = iter.recurse();
+    DBus::MessageIterator structIter = structArray.recurse();
+    // A copy of a sub-iterator reads from its own position
+    DBus::MessageIterator structCopy = structIter;
+    structCopy >> extractedInt;
+    structIter.next();
+    structIter >> extractedDouble;
+    TEST_EQUALS_RET_FAIL( extractedInt, 1 );
+    TEST_EQUALS_RET_FAIL( extractedDouble, 1.5 );
+
+    DBus::MessageIterator dictArg = msg->arg( 3 );
+    DBus::MessageIterator dictIter = dictArg.recurse().recurse();
+    dictIter.skip();
+    TEST_ASSERT_RET_FAIL( dictIter.arg_type() == DBus::DataType::VARIANT );
+
+    TEST_EQUALS_RET_FAIL( allocations - allocationsBefore, 0 );
+
+    return true;
+}
+
+bool call_message_append_extract_iterator_array_subiterator_end() {
+    std::vector<uint8_t> bytes = { 1, 2, 3 };
+    std::vector<std::tuple<int32_t, int64_t>> structs = { std::make_tuple( 1, 2 ), std::make_tuple( 3, 4 ) };
+    std::vector<double> doubles = { 1.5, 2.5, 3.5 };
+    std::vector<std::tuple<int32_t, int64_t>> extractedStructs;
+    int32_t sentinel = 0;
+
+    std::shared_ptr<DBus::CallMessage> msg = DBus::CallMessage::create( "/org/freedesktop/DBus", "method" );
+    DBus::MessageAppendIterator iter1( msg );
+    iter1 << bytes;
+    iter1 << structs;
+    iter1 << DBus::Variant( doubles );
+    iter1 << static_cast<int32_t>( 99 );
+
+    // The array ends after its length, the padding and exactly that many bytes
+    DBus::MessageIterator iter2( msg );
+    DBus::MessageIterator byteIter = iter2.recurse();
+    int count = 0;
+
+    while( byteIter.is_valid() ) {
+        uint8_t byte;
+        byteIter >> byte;
+        count++;
+    }
+
+    TEST_EQUALS_RET_FAIL( count, 3 );
+
+    // Structs are aligned to 8, so there is padding after the length
+    TEST_ASSERT_RET_FAIL( iter2.next() );
+    iter2 >> extractedStructs;
+    TEST_ASSERT_RET_FAIL( extractedStructs == structs );
+
+    // The same goes for arrays read through a VariantIterator
+    DBus::Variant var;
+    iter2 >> var;
+    TEST_ASSERT_RET_FAIL( var.to_vector<double>() == doubles );
+
+    iter2 >> sentinel;
+    TEST_EQUALS_RET_FAIL( sentinel, 99 );
+
+    return true;
+}
+
 #define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
             ret = call_message_append_extract_iterator_##name();\
         } \
@@ -864,6 +1710,33 @@ int main( int argc, char** argv ) {
     ADD_TEST( map_string_string );
     ADD_TEST( map_string_string_many );
     ADD_TEST( correct_variant_signature );
+#if DBUS_CXX_HAS_MEMFD
+    ADD_TEST( memfd_array );
+    ADD_TEST( memfd_threshold );
+    ADD_TEST( memfd_unsealed );
+    ADD_TEST( memfd_too_large );
+    ADD_TEST( memfd_limit );
+#endif
+    ADD_TEST( array_subiterator_end );
+    ADD_TEST( byte_order_round_trip );
+    ADD_TEST( byte_order_foreign );
+    ADD_TEST( byte_order_header );
+    ADD_TEST( byte_order_empty_struct );
+    ADD_TEST( fixed_array_byte );
+    ADD_TEST( fixed_array_int16 );
+    ADD_TEST( fixed_array_int32 );
+    ADD_TEST( fixed_array_int64 );
+    ADD_TEST( fixed_array_double );
+    ADD_TEST( fixed_array_nested );
+    ADD_TEST( nested_alignment );
+    ADD_TEST( variant_nested_struct );
+    ADD_TEST( skip );
+    ADD_TEST( arg_index );
+    ADD_TEST( find );
+    ADD_TEST( no_allocations );
+    ADD_TEST( malformed_body );
+    ADD_TEST( malformed_fixed_array );
+    ADD_TEST( recurse_lifetime );
 
     ADD_TEST2( bool );
     ADD_TEST2( byte );
@@ -0,0 +1,357 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "test_macros.h"
+
+static std::shared_ptr<DBus::Dispatcher> dispatch;
+static std::shared_ptr<DBus::Server> server;
+static std::string abstract_name;
+
+static std::mutex server_conn_lock;
+static std::condition_variable server_conn_cv;
+static std::shared_ptr<DBus::Connection> server_conn;
+static std::shared_ptr<DBus::Signal<void(std::string)>> server_signal;
+static std::string signal_value;
+static std::shared_ptr<DBus::SharedMemoryChannel> producer_channel;
+
+static int add( int first, int second ) {
+    return first + second;
+}
+
+static uint32_t checksum( std::vector<uint8_t> data ) {
+    uint32_t sum = 0;
+
+    for( uint8_t byte : data ) {
+        sum = sum * 31 + byte;
+    }
+
+    return sum;
+}
+
+static std::tuple<std::shared_ptr<DBus::FileDescriptor>, std::shared_ptr<DBus::FileDescriptor>> open_channel() {
+    producer_channel = DBus::SharedMemoryChannel::create();
+
+    return std::make_tuple( producer_channel->memory_fd(), producer_channel->event_fd() );
+}
+
+static void signal_handler( std::string value ) {
+    signal_value = value;
+}
+
+static void new_connection( std::shared_ptr<DBus::Connection> conn ) {
+    std::shared_ptr<DBus::Object> object = conn->create_object( "/dbuscxx/test" );
+    object->create_method<int( int, int )>( "dbuscxx.test", "add", sigc::ptr_fun( add ) );
+    object->create_method<uint32_t( std::vector<uint8_t> )>( "dbuscxx.test", "checksum", sigc::ptr_fun( checksum ) );
+    object->create_method<std::tuple<std::shared_ptr<DBus::FileDescriptor>, std::shared_ptr<DBus::FileDescriptor>>()>(
+        "dbuscxx.test", "open_channel", sigc::ptr_fun( open_channel ) );
+    server_signal = object->create_signal<void(std::string)>( "dbuscxx.test", "changed" );
+
+    std::unique_lock<std::mutex> lock( server_conn_lock );
+    server_conn = conn;
+    server_conn_cv.notify_all();
+}
+
+static bool wait_for_server_connection() {
+    std::unique_lock<std::mutex> lock( server_conn_lock );
+
+    return server_conn_cv.wait_for( lock, std::chrono::seconds( 5 ),
+        [] { return server_conn.operator bool(); } );
+}
+
+static std::shared_ptr<DBus::Connection> connect_client() {
+    std::shared_ptr<DBus::Connection> client = DBus::Connection::create_peer( server->address() );
+
+    if( !dispatch->add_connection( client ) ) {
+        return std::shared_ptr<DBus::Connection>();
+    }
+
+    return client;
+}
+
+bool server_connect() {
+    std::shared_ptr<DBus::Connection> client = connect_client();
+    bool threw = false;
+
+    TEST_ASSERT_RET_FAIL( client );
+    TEST_ASSERT_RET_FAIL( wait_for_server_connection() );
+
+    TEST_ASSERT_RET_FAIL( client->is_peer() );
+    TEST_ASSERT_RET_FAIL( client->is_registered() );
+    TEST_ASSERT_RET_FAIL( client->unique_name().empty() );
+    TEST_ASSERT_RET_FAIL( server_conn->is_peer() );
+    TEST_ASSERT_RET_FAIL( server_conn->is_valid() );
+    TEST_EQUALS_RET_FAIL( server->guid().size(), 32 );
+
+    // There is no bus daemon to ask for a name
+    try {
+        client->request_name( "dbuscxx.test.server" );
+    } catch( DBus::ErrorNotSupported& ) {
+        threw = true;
+    }
+
+    TEST_ASSERT_RET_FAIL( threw );
+
+    return true;
+}
+
+bool server_method_call() {
+    std::shared_ptr<DBus::Connection> client = connect_client();
+    TEST_ASSERT_RET_FAIL( client );
+
+    // No destination: our peer is the only one that can answer
+    std::shared_ptr<DBus::ObjectProxy> proxy = client->create_object_proxy( "/dbuscxx/test" );
+    std::shared_ptr<DBus::MethodProxy<int( int, int )>> add_proxy =
+        proxy->create_method<int( int, int )>( "dbuscxx.test", "add" );
+
+    TEST_EQUALS_RET_FAIL( ( *add_proxy )( 5, 7 ), 12 );
+    TEST_EQUALS_RET_FAIL( ( *add_proxy )( -1, 1 ), 0 );
+
+    return true;
+}
+
+bool server_memfd_method_call() {
+    std::shared_ptr<DBus::Connection> client = connect_client();
+    TEST_ASSERT_RET_FAIL( client );
+
+    std::shared_ptr<DBus::ObjectProxy> proxy = client->create_object_proxy( "/dbuscxx/test" );
+    std::shared_ptr<DBus::MethodProxy<uint32_t( std::vector<uint8_t> )>> checksum_proxy =
+        proxy->create_method<uint32_t( std::vector<uint8_t> )>( "dbuscxx.test", "checksum" );
+    checksum_proxy->set_memfd_threshold( 64 * 1024 );
+
+    std::vector<uint8_t> data;
+
+    for( int x = 0; x < 4 * 1024 * 1024; x++ ) {
+        data.push_back( x % 251 );
+    }
+
+    TEST_EQUALS_RET_FAIL( ( *checksum_proxy )( data ), checksum( data ) );
+
+    return true;
+}
+
+bool server_channel() {
+    typedef std::tuple<std::shared_ptr<DBus::FileDescriptor>, std::shared_ptr<DBus::FileDescriptor>> ChannelFds;
+
+    std::shared_ptr<DBus::Connection> client = connect_client();
+    TEST_ASSERT_RET_FAIL( client );
+
+    std::shared_ptr<DBus::ObjectProxy> proxy = client->create_object_proxy( "/dbuscxx/test" );
+    std::shared_ptr<DBus::MethodProxy<ChannelFds()>> open_proxy =
+        proxy->create_method<ChannelFds()>( "dbuscxx.test", "open_channel" );
+
+    ChannelFds fds = ( *open_proxy )();
+    std::shared_ptr<DBus::SharedMemoryChannel> channel =
+        DBus::SharedMemoryChannel::open( std::get<0>( fds ), std::get<1>( fds ) );
+    close( std::get<0>( fds )->descriptor() );
+    close( std::get<1>( fds )->descriptor() );
+
+    TEST_ASSERT_RET_FAIL( channel );
+    TEST_ASSERT_RET_FAIL( producer_channel );
+
+    for( int32_t x = 0; x < 100; x++ ) {
+        TEST_ASSERT_RET_FAIL( producer_channel->write( x, std::string( "sample" ) ) );
+    }
+
+    producer_channel->flush();
+
+    int32_t value;
+    std::string name;
+
+    for( int32_t x = 0; x < 100; x++ ) {
+        TEST_ASSERT_RET_FAIL( channel->wait( 1000 ) );
+        TEST_ASSERT_RET_FAIL( channel->read( value, name ) );
+        TEST_EQUALS_RET_FAIL( value, x );
+        TEST_EQUALS_RET_FAIL( name, "sample" );
+    }
+
+    return true;
+}
+
+bool server_signal_rx() {
+    std::shared_ptr<DBus::Connection> client = connect_client();
+    TEST_ASSERT_RET_FAIL( client );
+
+    std::shared_ptr<DBus::ObjectProxy> proxy = client->create_object_proxy( "/dbuscxx/test" );
+    std::shared_ptr<DBus::SignalProxy<void(std::string)>> signal_proxy =
+        proxy->create_signal<void(std::string)>( "dbuscxx.test", "changed" );
+    signal_proxy->connect( sigc::ptr_fun( signal_handler ) );
+
+    TEST_ASSERT_RET_FAIL( wait_for_server_connection() );
+    server_signal->emit( "peer signal" );
+
+    for( int x = 0; x < 500 && signal_value.empty(); x++ ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+
+    TEST_EQUALS_RET_FAIL( signal_value, "peer signal" );
+
+    return true;
+}
+
+bool server_client_disconnect() {
+    std::shared_ptr<DBus::Connection> client = DBus::Connection::create_peer( server->address() );
+    TEST_ASSERT_RET_FAIL( client && client->is_valid() );
+    TEST_ASSERT_RET_FAIL( wait_for_server_connection() );
+
+    client.reset();
+
+    for( int x = 0; x < 500 && server_conn->is_valid(); x++ ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    }
+
+    TEST_ASSERT_RET_FAIL( !server_conn->is_valid() );
+
+    return true;
+}
+
+/*
+ * Connect to the server without authenticating, so that we can send it
+ * whatever we want.
+ */
+static int connect_raw() {
+    struct sockaddr_un addr;
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+    if( fd < 0 ) {
+        return -1;
+    }
+
+    memset( &addr, 0, sizeof( struct sockaddr_un ) );
+    addr.sun_family = AF_UNIX;
+    memcpy( &addr.sun_path[ 1 ], abstract_name.c_str(), abstract_name.size() );
+
+    if( connect( fd, ( struct sockaddr* )&addr,
+            offsetof( struct sockaddr_un, sun_path ) + abstract_name.size() + 1 ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+bool server_reject_mechanism() {
+    char response[ 128 ];
+    struct pollfd pfd;
+    int fd = connect_raw();
+    const char auth[] = "\0AUTH ANONYMOUS\r\n";
+
+    TEST_ASSERT_RET_FAIL( fd >= 0 );
+
+    TEST_ASSERT_RET_FAIL( write( fd, auth, sizeof( auth ) - 1 ) == sizeof( auth ) - 1 );
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    TEST_ASSERT_RET_FAIL( poll( &pfd, 1, 5000 ) == 1 );
+
+    ssize_t len = read( fd, response, sizeof( response ) );
+    TEST_ASSERT_RET_FAIL( len > 0 );
+    TEST_EQUALS_RET_FAIL( std::string( response, len ), "REJECTED EXTERNAL\r\n" );
+
+    close( fd );
+
+    return !server_conn;
+}
+
+bool server_stalled_client() {
+    int stalled = connect_raw();
+    const char partial_auth[] = "\0AUTH EXT";
+
+    TEST_ASSERT_RET_FAIL( stalled >= 0 );
+
+    // Start authenticating, and then stop in the middle of a line
+    TEST_ASSERT_RET_FAIL( write( stalled, partial_auth, sizeof( partial_auth ) - 1 ) == sizeof( partial_auth ) - 1 );
+
+    // Another client does not have to wait for the stalled one
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::shared_ptr<DBus::Connection> client = connect_client();
+
+    TEST_ASSERT_RET_FAIL( client && client->is_valid() );
+    TEST_ASSERT_RET_FAIL( wait_for_server_connection() );
+    TEST_ASSERT_RET_FAIL( std::chrono::steady_clock::now() - start < std::chrono::seconds( 2 ) );
+
+    close( stalled );
+
+    return true;
+}
+
+bool server_path_address() {
+    std::string path = "/tmp/dbuscxx-server-test-" + std::to_string( getpid() );
+    struct stat statbuf;
+
+    std::shared_ptr<DBus::Server> path_server = DBus::Server::create( dispatch, "unix:path=" + path );
+    TEST_ASSERT_RET_FAIL( path_server );
+    TEST_ASSERT_RET_FAIL( stat( path.c_str(), &statbuf ) == 0 );
+
+    std::shared_ptr<DBus::Connection> client = DBus::Connection::create_peer( path_server->address() );
+    TEST_ASSERT_RET_FAIL( client && client->is_valid() );
+
+    // The socket goes away along with the server
+    path_server.reset();
+    TEST_ASSERT_RET_FAIL( stat( path.c_str(), &statbuf ) != 0 );
+
+    return true;
+}
+
+#define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
+            ret = server_##name();\
+        } \
+    } while( 0 )
+
+int main( int argc, char** argv ) {
+    if( argc < 1 ) {
+        return 1;
+    }
+
+    std::string test_name = argv[1];
+    bool ret = false;
+
+    abstract_name = "dbuscxx-server-test-" + std::to_string( getpid() );
+    dispatch = DBus::StandaloneDispatcher::create();
+    server = DBus::Server::create( dispatch, "unix:abstract=" + abstract_name );
+
+    if( !server ) {
+        std::cerr << "Unable to create server" << std::endl;
+        return 1;
+    }
+
+    server->signal_new_connection().connect( sigc::ptr_fun( new_connection ) );
+
+    ADD_TEST( connect );
+    ADD_TEST( method_call );
+    ADD_TEST( memfd_method_call );
+    ADD_TEST( channel );
+    ADD_TEST( signal_rx );
+    ADD_TEST( client_disconnect );
+    ADD_TEST( reject_mechanism );
+    ADD_TEST( stalled_client );
+    ADD_TEST( path_address );
+
+    return !ret;
+}
@@ -17,6 +17,8 @@
  *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 #include <dbus-cxx.h>
+#include <atomic>
+#include <poll.h>
 #include <unistd.h>
 #include <iostream>
 
@@ -24,7 +26,7 @@
 
 static std::shared_ptr<DBus::Dispatcher> dispatch;
 static std::string signal_value;
-static int num_rx = 0;
+static std::atomic<int> num_rx( 0 );
 
 void sigHandle( std::string value ) {
     signal_value = value;
@@ -34,6 +36,15 @@ void voidSigHandle() {
     num_rx++;
 }
 
+/* Wait up to 5 seconds for the dispatcher to deliver the given number of signals */
+static int wait_for_rx( int expected ) {
+    for( int x = 0; x < 500 && num_rx < expected; x++ ) {
+        poll( nullptr, 0, 10 );
+    }
+
+    return num_rx;
+}
+
 bool signal_create() {
     std::shared_ptr<DBus::Connection> conn = dispatch->create_connection( DBus::BusType::SESSION );
 
@@ -203,6 +214,61 @@ bool signal_remove_handler() {
     return true;
 }
 
+bool signal_batch_txrx() {
+    std::shared_ptr<DBus::Connection> conn = dispatch->create_connection( DBus::BusType::SESSION );
+    std::vector<std::shared_ptr<const DBus::Message>> messages;
+
+    std::shared_ptr<DBus::SignalProxy<void()>> proxy = conn->create_free_signal_proxy<void()>(
+                DBus::MatchRuleBuilder::create()
+                .set_path( "/test/signal" )
+                .set_interface( "test.signal.type" )
+                .set_member( "ExampleMember" )
+                .as_signal_match(),
+                DBus::ThreadForCalling::DispatcherThread );
+
+    proxy->connect( sigc::ptr_fun( voidSigHandle ) );
+
+    for( int x = 0; x < 200; x++ ) {
+        messages.push_back( DBus::SignalMessage::create( "/test/signal", "test.signal.type", "ExampleMember" ) );
+    }
+
+    std::vector<uint32_t> serials = conn->send_batch( messages );
+
+    TEST_EQUALS_RET_FAIL( serials.size(), 200 );
+
+    for( size_t x = 1; x < serials.size(); x++ ) {
+        TEST_ASSERT_RET_FAIL( serials[ x ] == serials[ x - 1 ] + 1 );
+    }
+
+    TEST_EQUALS_RET_FAIL( wait_for_rx( 200 ), 200 );
+    return true;
+}
+
+bool signal_corked_txrx() {
+    std::shared_ptr<DBus::Connection> conn = dispatch->create_connection( DBus::BusType::SESSION );
+
+    std::shared_ptr<DBus::Signal<void()>> signal = conn->create_free_signal<void()>( "/test/signal", "test.signal.type", "ExampleMember" );
+    std::shared_ptr<DBus::SignalProxy<void()>> proxy = conn->create_free_signal_proxy<void()>(
+                DBus::MatchRuleBuilder::create()
+                .set_path( "/test/signal" )
+                .set_interface( "test.signal.type" )
+                .set_member( "ExampleMember" )
+                .as_signal_match(),
+                DBus::ThreadForCalling::DispatcherThread );
+
+    proxy->connect( sigc::ptr_fun( voidSigHandle ) );
+
+    conn->set_flush_latency_budget( std::chrono::microseconds( 500 ) );
+    TEST_ASSERT_RET_FAIL( conn->flush_latency_budget() == std::chrono::microseconds( 500 ) );
+
+    for( int x = 0; x < 100; x++ ) {
+        signal->emit();
+    }
+
+    TEST_EQUALS_RET_FAIL( wait_for_rx( 100 ), 100 );
+    return true;
+}
+
 #define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
             ret = signal_##name();\
         } \
@@ -229,6 +295,8 @@ int main( int argc, char** argv ) {
     ADD_TEST( member_match_only );
     ADD_TEST( multiple_handlers );
     ADD_TEST( remove_handler );
+    ADD_TEST( batch_txrx );
+    ADD_TEST( corked_txrx );
 
     return !ret;
 }
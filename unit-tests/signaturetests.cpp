@@ -19,9 +19,32 @@
 #include <dbus-cxx.h>
 #include <unistd.h>
 #include <iostream>
+#include <thread>
 
 #include "test_macros.h"
 
+struct static_custom {
+    int32_t first;
+    std::string second;
+};
+
+namespace DBus {
+template <> struct signature_traits<static_custom> {
+    static constexpr auto value = StaticSignature( "(is)" );
+};
+}
+
+namespace signaturetest {
+/* Only has a signature() overload, found through ADL */
+struct runtime_custom {};
+
+inline std::string signature( runtime_custom ) { return "(ss)"; }
+}
+
+static_assert( DBus::signature_traits<std::vector<double>>::value.view() == "ad" );
+static_assert( DBus::signature_traits<std::map<std::string, DBus::Variant>>::value.view() == "a{sv}" );
+static_assert( DBus::signature_traits<std::tuple<uint8_t, std::vector<DBus::Path>>>::value.view() == "(yao)" );
+
 bool signature_create() {
     DBus::Signature sig;
 
@@ -239,6 +262,51 @@ bool signature_single_bool() {
     return true;
 }
 
+bool signature_iterate_fixed_arrays() {
+    DBus::Signature sig( "adabai" );
+
+    DBus::SignatureIterator it = sig.begin();
+
+    TEST_EQUALS_RET_FAIL( it.type(), DBus::DataType::ARRAY );
+    TEST_EQUALS_RET_FAIL( it.element_type(), DBus::DataType::DOUBLE );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.type(), DBus::DataType::ARRAY );
+    TEST_EQUALS_RET_FAIL( it.element_type(), DBus::DataType::BOOLEAN );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.type(), DBus::DataType::ARRAY );
+    TEST_EQUALS_RET_FAIL( it.element_type(), DBus::DataType::INT32 );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.type(), DBus::DataType::INVALID );
+
+    return true;
+}
+
+bool signature_fixed_type_info() {
+    // BOOLEAN and DOUBLE are both basic and fixed; UNIX_FD is fixed too
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::BOOLEAN ).is_basic() );
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::BOOLEAN ).is_fixed() );
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::DOUBLE ).is_basic() );
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::DOUBLE ).is_fixed() );
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::UNIX_FD ).is_basic() );
+    TEST_ASSERT_RET_FAIL( DBus::TypeInfo( DBus::DataType::UNIX_FD ).is_fixed() );
+    TEST_ASSERT_RET_FAIL( !DBus::TypeInfo( DBus::DataType::STRING ).is_fixed() );
+
+    // So they can be dictionary keys
+    DBus::Signature sig( "a{bs}a{di}" );
+    TEST_ASSERT_RET_FAIL( sig.is_valid() );
+
+    DBus::SignatureIterator it = sig.begin();
+    DBus::SignatureIterator entry = it.recurse().recurse();
+    TEST_EQUALS_RET_FAIL( entry.type(), DBus::DataType::BOOLEAN );
+    TEST_ASSERT_RET_FAIL( entry.is_fixed() );
+    it.next();
+    entry = it.recurse().recurse();
+    TEST_EQUALS_RET_FAIL( entry.type(), DBus::DataType::DOUBLE );
+    TEST_ASSERT_RET_FAIL( entry.is_fixed() );
+
+    return true;
+}
+
 bool signature_create_from_struct_in_array() {
     std::vector<std::tuple<int32_t, uint64_t>> vector_type;
 
@@ -247,6 +315,172 @@ bool signature_create_from_struct_in_array() {
     return sig_output == "a(it)";
 }
 
+bool signature_invalid_signatures() {
+    const char* invalid[] = { "a", "(", ")", "()", "(i", "i)", "{sv}", "a{vs}", "a{s}", "a{sii}",
+                              "a{sv", "r", "e", "z", "aa", "(a)", "a(i}" };
+
+    for( const char* sig : invalid ) {
+        if( DBus::Signature( sig ).is_valid() ) {
+            std::cerr << "Signature " << sig << " should not be valid" << std::endl;
+            return false;
+        }
+    }
+
+    TEST_ASSERT_RET_FAIL( DBus::Signature( "" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( DBus::Signature( std::string( 255, 'i' ) ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !DBus::Signature( std::string( 256, 'i' ) ).is_valid() );
+    TEST_ASSERT_RET_FAIL( DBus::Signature( std::string( 32, 'a' ) + "i" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !DBus::Signature( std::string( 33, 'a' ) + "i" ).is_valid() );
+    TEST_ASSERT_RET_FAIL( !DBus::Signature( std::string( 33, '(' ) + "i" + std::string( 33, ')' ) ).is_valid() );
+
+    return true;
+}
+
+bool signature_fixed_size() {
+    DBus::Signature sig( "(yi)(ys)a{yd}h(y(yt))" );
+    DBus::SignatureIterator it = sig.begin();
+
+    TEST_EQUALS_RET_FAIL( it.fixed_size(), 8 );
+    TEST_EQUALS_RET_FAIL( it.alignment(), 8 );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.fixed_size(), 0 );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.fixed_size(), 0 );
+    TEST_EQUALS_RET_FAIL( it.alignment(), 4 );
+    TEST_EQUALS_RET_FAIL( it.recurse().fixed_size(), 16 );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.fixed_size(), 4 );
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.fixed_size(), 24 );
+
+    return true;
+}
+
+bool signature_iterator_signature() {
+    DBus::Signature sig( "a(ii)v(s(yd))" );
+    DBus::SignatureIterator it = sig.begin();
+
+    TEST_EQUALS_RET_FAIL( it.signature(), "a(ii)v(s(yd))" );
+    TEST_EQUALS_RET_FAIL( it.recurse().signature(), "(ii)" );
+    TEST_EQUALS_RET_FAIL( it.recurse().recurse().signature(), "ii" );
+    it.next();
+    it.next();
+    TEST_EQUALS_RET_FAIL( it.recurse().signature(), "s(yd)" );
+    TEST_ASSERT_RET_FAIL( !it.recurse().recurse().is_valid() );
+
+    return true;
+}
+
+bool signature_assign() {
+    DBus::Signature sig( "i" );
+    DBus::Signature copy = sig;
+
+    sig = "ad";
+
+    TEST_EQUALS_RET_FAIL( sig.begin().type(), DBus::DataType::ARRAY );
+    TEST_EQUALS_RET_FAIL( sig.begin().element_type(), DBus::DataType::DOUBLE );
+    TEST_EQUALS_RET_FAIL( copy.str(), "i" );
+    TEST_EQUALS_RET_FAIL( copy.begin().type(), DBus::DataType::INT32 );
+
+    sig = "(";
+    TEST_ASSERT_RET_FAIL( !sig.is_valid() );
+    TEST_ASSERT_RET_FAIL( !DBus::Signature().is_valid() );
+
+    return true;
+}
+
+bool signature_cache() {
+    DBus::SignatureCacheStatistics before = DBus::Signature::cache_statistics();
+    DBus::Signature first( "a{s(dbcxx)}" );
+
+    TEST_ASSERT_RET_FAIL( !first.is_valid() );
+
+    DBus::Signature second( "a{s(nqiu)}" );
+    DBus::SignatureCacheStatistics middle = DBus::Signature::cache_statistics();
+
+    // The invalid signature is not kept
+    TEST_EQUALS_RET_FAIL( middle.misses, before.misses + 2 );
+    TEST_EQUALS_RET_FAIL( middle.entries, before.entries + 1 );
+
+    DBus::Signature third( std::string( "a{s(nqiu)}" ) );
+    DBus::SignatureCacheStatistics after = DBus::Signature::cache_statistics();
+
+    TEST_EQUALS_RET_FAIL( after.hits, middle.hits + 1 );
+    TEST_EQUALS_RET_FAIL( after.entries, middle.entries );
+    TEST_EQUALS_RET_FAIL( &second.str(), &third.str() );
+
+    DBus::SignatureIterator entry = third.begin().recurse();
+    DBus::SignatureIterator value = entry.recurse();
+
+    TEST_ASSERT_RET_FAIL( value.next() );
+    TEST_EQUALS_RET_FAIL( value.type(), DBus::DataType::STRUCT );
+
+    return true;
+}
+
+bool signature_cache_threads() {
+    std::vector<std::thread> threads;
+    std::vector<const std::string*> found( 8 );
+    const char* signatures[] = { "a(oa{sv})", "a{sv}", "(ii)", "as" };
+
+    for( size_t x = 0; x < found.size(); x++ ) {
+        threads.push_back( std::thread( [x, &found, &signatures]() {
+            for( int y = 0; y < 1000; y++ ) {
+                DBus::Signature sig( signatures[ y % 4 ] );
+
+                if( y % 4 == 0 ) {
+                    // Interned signatures are never freed
+                    found[ x ] = &sig.str();
+                }
+            }
+        } ) );
+    }
+
+    for( std::thread& thr : threads ) {
+        thr.join();
+    }
+
+    for( const std::string* str : found ) {
+        TEST_EQUALS_RET_FAIL( str, found[ 0 ] );
+    }
+
+    TEST_EQUALS_RET_FAIL( *found[ 0 ], "a(oa{sv})" );
+
+    return true;
+}
+
+bool signature_static_signatures() {
+    typedef std::map<std::string, std::vector<std::tuple<int32_t, uint64_t>>> nested_type;
+
+    TEST_EQUALS_RET_FAIL( DBus::signature_traits<nested_type>::value.str(), "a{sa(it)}" );
+    TEST_EQUALS_RET_FAIL( std::string( DBus::signature_traits<nested_type>::value.c_str() ), "a{sa(it)}" );
+    TEST_EQUALS_RET_FAIL( DBus::signature( nested_type() ), "a{sa(it)}" );
+    TEST_EQUALS_RET_FAIL( DBus::signature_dict_data( nested_type() ), "{sa(it)}" );
+    TEST_EQUALS_RET_FAIL( ( DBus::priv::dbus_signature<int32_t, std::string, nested_type>().dbus_sig() ), "isa{sa(it)}" );
+    TEST_EQUALS_RET_FAIL( ( DBus::signature( std::tuple<bool, std::shared_ptr<DBus::FileDescriptor>>() ) ), "(bh)" );
+
+    return true;
+}
+
+bool signature_static_custom_type() {
+    TEST_EQUALS_RET_FAIL( DBus::signature( std::vector<static_custom>() ), "a(is)" );
+    TEST_EQUALS_RET_FAIL( ( DBus::signature( std::map<std::string, static_custom>() ) ), "a{s(is)}" );
+    TEST_ASSERT_RET_FAIL( DBus::has_signature_traits<std::vector<static_custom>>::value );
+
+    return true;
+}
+
+bool signature_runtime_custom_type() {
+    typedef std::vector<signaturetest::runtime_custom> custom_vector;
+
+    TEST_ASSERT_RET_FAIL( !DBus::has_signature_traits<custom_vector>::value );
+    TEST_EQUALS_RET_FAIL( DBus::signature( custom_vector() ), "a(ss)" );
+    TEST_EQUALS_RET_FAIL( ( DBus::signature( std::map<int32_t, signaturetest::runtime_custom>() ) ), "a{i(ss)}" );
+    TEST_EQUALS_RET_FAIL( ( DBus::priv::dbus_signature<int32_t, signaturetest::runtime_custom>().dbus_sig() ), "i(ss)" );
+
+    return true;
+}
+
 #define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
             ret = signature_##name();\
         } \
@@ -274,8 +508,19 @@ int main( int argc, char** argv ) {
 
     ADD_TEST( unbalanced_struct );
     ADD_TEST( single_bool );
+    ADD_TEST( iterate_fixed_arrays );
+    ADD_TEST( fixed_type_info );
 
     ADD_TEST( create_from_struct_in_array );
+    ADD_TEST( static_signatures );
+    ADD_TEST( invalid_signatures );
+    ADD_TEST( fixed_size );
+    ADD_TEST( iterator_signature );
+    ADD_TEST( assign );
+    ADD_TEST( cache );
+    ADD_TEST( cache_threads );
+    ADD_TEST( static_custom_type );
+    ADD_TEST( runtime_custom_type );
 
     return !ret;
 }
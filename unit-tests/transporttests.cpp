@@ -0,0 +1,622 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <dbus-cxx/sendmsgtransport.h>
+#include <dbus-cxx/receivebuffer.h>
+#include <dbus-cxx/validator.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test_macros.h"
+
+/* sockets[0] is read from, sockets[1] is written to */
+static int sockets[ 2 ];
+static std::shared_ptr<DBus::priv::SendmsgTransport> reader;
+static std::shared_ptr<DBus::priv::SendmsgTransport> writer;
+
+static std::shared_ptr<DBus::CallMessage> create_call( const std::string& member ) {
+    return DBus::CallMessage::create( "/org/freedesktop/DBus", "dbuscxx.test", member );
+}
+
+static std::vector<uint8_t> serialize( std::shared_ptr<DBus::Message> msg, uint32_t serial ) {
+    std::vector<uint8_t> data;
+
+    msg->serialize_to_vector( &data, serial );
+
+    return data;
+}
+
+static bool read_member( const std::string& member ) {
+    std::shared_ptr<DBus::Message> msg = reader->readMessage();
+
+    if( !msg || msg->type() != DBus::MessageType::CALL ) {
+        return false;
+    }
+
+    return std::static_pointer_cast<DBus::CallMessage>( msg )->member() == member;
+}
+
+bool transport_multiple_messages() {
+    std::vector<uint8_t> all_data;
+
+    for( int x = 0; x < 3; x++ ) {
+        std::vector<uint8_t> data = serialize( create_call( "method" + std::to_string( x ) ), x + 1 );
+        all_data.insert( all_data.end(), data.begin(), data.end() );
+    }
+
+    TEST_ASSERT_RET_FAIL( ::write( sockets[ 1 ], all_data.data(), all_data.size() ) == static_cast<ssize_t>( all_data.size() ) );
+
+    // All three messages come in on one read, the rest should be buffered
+    TEST_ASSERT_RET_FAIL( read_member( "method0" ) );
+    TEST_ASSERT_RET_FAIL( reader->has_buffered_message() );
+    TEST_ASSERT_RET_FAIL( read_member( "method1" ) );
+    TEST_ASSERT_RET_FAIL( read_member( "method2" ) );
+    TEST_ASSERT_RET_FAIL( !reader->has_buffered_message() );
+    TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+
+    return reader->is_valid();
+}
+
+bool transport_partial_message() {
+    std::vector<uint8_t> data = serialize( create_call( "partial" ), 1 );
+    size_t half = data.size() / 2;
+
+    TEST_ASSERT_RET_FAIL( ::write( sockets[ 1 ], data.data(), half ) == static_cast<ssize_t>( half ) );
+    TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+    TEST_ASSERT_RET_FAIL( !reader->has_buffered_message() );
+
+    TEST_ASSERT_RET_FAIL( ::write( sockets[ 1 ], data.data() + half, data.size() - half ) ==
+        static_cast<ssize_t>( data.size() - half ) );
+    TEST_ASSERT_RET_FAIL( read_member( "partial" ) );
+
+    return reader->is_valid();
+}
+
+bool transport_large_message() {
+    std::vector<int32_t> large( 64 * 1024 );
+    std::vector<int32_t> received;
+
+    for( size_t x = 0; x < large.size(); x++ ) {
+        large[ x ] = x;
+    }
+
+    std::shared_ptr<DBus::CallMessage> msg = create_call( "large" );
+    msg << large;
+
+    // The message is larger than the socket buffer, so write it from another thread
+    std::vector<uint8_t> data = serialize( msg, 1 );
+    std::vector<uint8_t> small_data = serialize( create_call( "small" ), 2 );
+    data.insert( data.end(), small_data.begin(), small_data.end() );
+    std::thread write_thread( [data]() {
+        size_t written = 0;
+
+        while( written < data.size() ) {
+            ssize_t ret = ::write( sockets[ 1 ], data.data() + written, data.size() - written );
+
+            if( ret > 0 ) {
+                written += ret;
+            } else {
+                // Wait for the reader to make room in the socket
+                struct pollfd pollfd = { sockets[ 1 ], POLLOUT, 0 };
+                poll( &pollfd, 1, 100 );
+            }
+        }
+    } );
+
+    std::shared_ptr<DBus::Message> incoming;
+
+    // The socket will not hand us the large message all at once
+    for( int x = 0; x < 5000 && !incoming; x++ ) {
+        incoming = reader->readMessage();
+
+        if( !incoming ) {
+            struct pollfd pollfd = { sockets[ 0 ], POLLIN, 0 };
+            poll( &pollfd, 1, 100 );
+        }
+    }
+
+    write_thread.join();
+
+    TEST_ASSERT_RET_FAIL( incoming );
+    incoming >> received;
+    TEST_ASSERT_RET_FAIL( received == large );
+
+    // Small messages must still work after the buffer has grown
+    std::shared_ptr<DBus::Message> small;
+
+    for( int x = 0; x < 5000 && !small; x++ ) {
+        small = reader->readMessage();
+    }
+
+    TEST_ASSERT_RET_FAIL( small );
+    TEST_ASSERT_RET_FAIL( std::static_pointer_cast<DBus::CallMessage>( small )->member() == "small" );
+
+    return reader->is_valid();
+}
+
+bool transport_filedescriptors() {
+    int pipe1[ 2 ];
+    int pipe2[ 2 ];
+    char buffer[ 8 ];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipe1 ) == 0 );
+    TEST_ASSERT_RET_FAIL( pipe( pipe2 ) == 0 );
+
+    std::shared_ptr<DBus::CallMessage> msg1 = create_call( "fd1" );
+    std::shared_ptr<DBus::CallMessage> msg2 = create_call( "no_fd" );
+    std::shared_ptr<DBus::CallMessage> msg3 = create_call( "fd2" );
+    msg1 << DBus::FileDescriptor::create( pipe1[ 1 ] );
+    msg3 << DBus::FileDescriptor::create( pipe2[ 1 ] );
+
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( msg1, 1 ) > 0 );
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( msg2, 2 ) > 0 );
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( msg3, 3 ) > 0 );
+
+    std::shared_ptr<DBus::Message> in1 = reader->readMessage();
+    std::shared_ptr<DBus::Message> in2 = reader->readMessage();
+    std::shared_ptr<DBus::Message> in3 = reader->readMessage();
+    TEST_ASSERT_RET_FAIL( in1 && in2 && in3 );
+    TEST_EQUALS_RET_FAIL( in1->filedescriptors().size(), 1 );
+    TEST_EQUALS_RET_FAIL( in2->filedescriptors().size(), 0 );
+    TEST_EQUALS_RET_FAIL( in3->filedescriptors().size(), 1 );
+
+    // Make sure that each FD went to the correct message
+    std::shared_ptr<DBus::FileDescriptor> fd1;
+    std::shared_ptr<DBus::FileDescriptor> fd2;
+    in1 >> fd1;
+    in3 >> fd2;
+
+    TEST_ASSERT_RET_FAIL( ::write( fd1->descriptor(), "1", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::write( fd2->descriptor(), "2", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::read( pipe1[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '1' );
+    TEST_ASSERT_RET_FAIL( ::read( pipe2[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '2' );
+
+    return reader->is_valid();
+}
+
+bool transport_batched_messages() {
+    int pipe1[ 2 ];
+    int pipe2[ 2 ];
+    char buffer[ 8 ];
+    std::vector<DBus::priv::OutgoingMessage> batch;
+    const char* members[] = { "fd1", "no_fd1", "no_fd2", "fd2", "no_fd3" };
+
+    TEST_ASSERT_RET_FAIL( pipe( pipe1 ) == 0 );
+    TEST_ASSERT_RET_FAIL( pipe( pipe2 ) == 0 );
+
+    for( uint32_t x = 0; x < 5; x++ ) {
+        DBus::priv::OutgoingMessage outgoing;
+        std::shared_ptr<DBus::CallMessage> msg = create_call( members[ x ] );
+        outgoing.msg = msg;
+        outgoing.serial = x + 1;
+        batch.push_back( outgoing );
+    }
+
+    std::const_pointer_cast<DBus::Message>( batch[ 0 ].msg ) << DBus::FileDescriptor::create( pipe1[ 1 ] );
+    std::const_pointer_cast<DBus::Message>( batch[ 3 ].msg ) << DBus::FileDescriptor::create( pipe2[ 1 ] );
+
+    TEST_ASSERT_RET_FAIL( writer->writeMessages( batch ) > 0 );
+
+    std::vector<std::shared_ptr<DBus::Message>> incoming;
+
+    for( int x = 0; x < 5; x++ ) {
+        std::shared_ptr<DBus::Message> msg = reader->readMessage();
+        TEST_ASSERT_RET_FAIL( msg && msg->type() == DBus::MessageType::CALL );
+        TEST_ASSERT_RET_FAIL( std::static_pointer_cast<DBus::CallMessage>( msg )->member() == members[ x ] );
+        TEST_EQUALS_RET_FAIL( msg->serial(), static_cast<uint32_t>( x + 1 ) );
+        incoming.push_back( msg );
+    }
+
+    TEST_EQUALS_RET_FAIL( incoming[ 0 ]->filedescriptors().size(), 1 );
+    TEST_EQUALS_RET_FAIL( incoming[ 1 ]->filedescriptors().size(), 0 );
+    TEST_EQUALS_RET_FAIL( incoming[ 2 ]->filedescriptors().size(), 0 );
+    TEST_EQUALS_RET_FAIL( incoming[ 3 ]->filedescriptors().size(), 1 );
+    TEST_EQUALS_RET_FAIL( incoming[ 4 ]->filedescriptors().size(), 0 );
+
+    // Make sure that each FD went to the correct message
+    std::shared_ptr<DBus::FileDescriptor> fd1;
+    std::shared_ptr<DBus::FileDescriptor> fd2;
+    incoming[ 0 ] >> fd1;
+    incoming[ 3 ] >> fd2;
+
+    TEST_ASSERT_RET_FAIL( ::write( fd1->descriptor(), "1", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::write( fd2->descriptor(), "2", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::read( pipe1[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '1' );
+    TEST_ASSERT_RET_FAIL( ::read( pipe2[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '2' );
+
+    return reader->is_valid() && writer->is_valid();
+}
+
+bool transport_write_backpressure() {
+    const int num_messages = 16;
+    std::vector<int32_t> values( 16 * 1024 );
+    int pipe1[ 2 ];
+    char buffer[ 8 ];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipe1 ) == 0 );
+
+    for( size_t x = 0; x < values.size(); x++ ) {
+        values[ x ] = x;
+    }
+
+    // Write much more data than the socket can hold without anybody reading it
+    for( int x = 0; x < num_messages; x++ ) {
+        std::shared_ptr<DBus::CallMessage> msg = create_call( "large" + std::to_string( x ) );
+        msg << values;
+
+        TEST_ASSERT_RET_FAIL( writer->writeMessage( msg, x + 1 ) > 0 );
+    }
+
+    TEST_ASSERT_RET_FAIL( writer->is_valid() );
+    TEST_ASSERT_RET_FAIL( writer->pending_write_size() > 0 );
+
+    // A message with an FD queued up behind the pending data
+    std::shared_ptr<DBus::CallMessage> fd_msg = create_call( "fd" );
+    fd_msg << DBus::FileDescriptor::create( pipe1[ 1 ] );
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( fd_msg, num_messages + 1 ) > 0 );
+
+    int num_read = 0;
+    std::shared_ptr<DBus::Message> last;
+
+    for( int loops = 0; loops < 100000 && num_read < num_messages + 1; loops++ ) {
+        std::shared_ptr<DBus::Message> msg = reader->readMessage();
+
+        TEST_ASSERT_RET_FAIL( reader->is_valid() && writer->is_valid() );
+
+        if( !msg ) {
+            TEST_ASSERT_RET_FAIL( writer->write_pending() >= 0 );
+            continue;
+        }
+
+        TEST_EQUALS_RET_FAIL( msg->serial(), static_cast<uint32_t>( num_read + 1 ) );
+
+        if( num_read < num_messages ) {
+            std::vector<int32_t> received;
+            msg >> received;
+            TEST_ASSERT_RET_FAIL( received == values );
+            TEST_EQUALS_RET_FAIL( msg->filedescriptors().size(), 0 );
+        }
+
+        last = msg;
+        num_read++;
+    }
+
+    TEST_EQUALS_RET_FAIL( num_read, num_messages + 1 );
+    TEST_EQUALS_RET_FAIL( writer->pending_write_size(), 0 );
+    TEST_EQUALS_RET_FAIL( last->filedescriptors().size(), 1 );
+
+    std::shared_ptr<DBus::FileDescriptor> fd;
+    last >> fd;
+    TEST_ASSERT_RET_FAIL( ::write( fd->descriptor(), "1", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::read( pipe1[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '1' );
+
+    return true;
+}
+
+bool transport_header_body() {
+    std::vector<uint8_t> header;
+    std::vector<int32_t> body_data( 1000, 0x55 );
+    std::shared_ptr<DBus::CallMessage> msg = create_call( "header_body" );
+    msg << body_data;
+
+    // The header and the body are sent separately, but must make up the complete message
+    std::vector<uint8_t> complete = serialize( msg, 7 );
+    TEST_ASSERT_RET_FAIL( msg->serialize_header_to_vector( &header, 7 ) );
+    TEST_EQUALS_RET_FAIL( header.size() % 8, 0 );
+
+    header.insert( header.end(), msg->serialized_body().begin(), msg->serialized_body().end() );
+    TEST_ASSERT_RET_FAIL( header == complete );
+
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( msg, 7 ) == static_cast<ssize_t>( complete.size() ) );
+
+    std::shared_ptr<DBus::Message> incoming = reader->readMessage();
+    std::vector<int32_t> received;
+    TEST_ASSERT_RET_FAIL( incoming );
+    incoming >> received;
+    TEST_EQUALS_RET_FAIL( incoming->serial(), 7 );
+    TEST_ASSERT_RET_FAIL( received == body_data );
+
+    return reader->is_valid();
+}
+
+bool transport_held_messages() {
+    std::vector<std::shared_ptr<DBus::Message>> held;
+
+    // Messages read their bodies from the receive buffer, so it must not
+    // reuse that space while they are still around
+    for( int round = 0; round < 4; round++ ) {
+        std::vector<uint8_t> all_data;
+
+        for( int x = 0; x < 3; x++ ) {
+            std::shared_ptr<DBus::CallMessage> msg = create_call( "held" );
+            msg << std::string( "round " + std::to_string( round ) + " message " + std::to_string( x ) );
+            std::vector<uint8_t> data = serialize( msg, round * 3 + x + 1 );
+            all_data.insert( all_data.end(), data.begin(), data.end() );
+        }
+
+        TEST_ASSERT_RET_FAIL( ::write( sockets[ 1 ], all_data.data(), all_data.size() ) == static_cast<ssize_t>( all_data.size() ) );
+
+        for( int x = 0; x < 3; x++ ) {
+            std::shared_ptr<DBus::Message> msg = reader->readMessage();
+            TEST_ASSERT_RET_FAIL( msg );
+            held.push_back( msg );
+        }
+    }
+
+    for( size_t x = 0; x < held.size(); x++ ) {
+        std::string value;
+
+        held[ x ] >> value;
+        TEST_EQUALS_RET_FAIL( value, "round " + std::to_string( x / 3 ) + " message " + std::to_string( x % 3 ) );
+    }
+
+    return reader->is_valid();
+}
+
+/* Send the data with the FD attached to it, as the peer would */
+static bool send_with_fd( const std::vector<uint8_t>& data, int fd ) {
+    struct msghdr msg;
+    struct iovec iov;
+    char control[ CMSG_SPACE( sizeof( int ) ) ];
+
+    memset( &msg, 0, sizeof( msg ) );
+    memset( control, 0, sizeof( control ) );
+    iov.iov_base = const_cast<uint8_t*>( data.data() );
+    iov.iov_len = data.size();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+    memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+
+    return sendmsg( sockets[ 1 ], &msg, 0 ) == static_cast<ssize_t>( data.size() );
+}
+
+bool transport_bad_message_fds() {
+    int pipe1[ 2 ];
+    int pipe2[ 2 ];
+    char buffer[ 8 ];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipe1 ) == 0 );
+    TEST_ASSERT_RET_FAIL( pipe( pipe2 ) == 0 );
+    TEST_ASSERT_RET_FAIL( fcntl( pipe1[ 0 ], F_SETFL, O_NONBLOCK ) == 0 );
+    TEST_ASSERT_RET_FAIL( fcntl( pipe2[ 0 ], F_SETFL, O_NONBLOCK ) == 0 );
+
+    // A message that claims one FD, but is of a type that does not exist
+    std::shared_ptr<DBus::CallMessage> bad = create_call( "bad" );
+    bad << DBus::FileDescriptor::create( pipe1[ 1 ] );
+    std::vector<uint8_t> data = serialize( bad, 1 );
+    data[ 1 ] = 0;
+    TEST_ASSERT_RET_FAIL( send_with_fd( data, pipe1[ 1 ] ) );
+    bad.reset();
+    close( pipe1[ 1 ] );
+
+    std::shared_ptr<DBus::CallMessage> good = create_call( "good" );
+    good << DBus::FileDescriptor::create( pipe2[ 1 ] );
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( good, 2 ) > 0 );
+
+    // The bad message is dropped, and the good one gets its own FD
+    TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+    std::shared_ptr<DBus::Message> incoming = reader->readMessage();
+    TEST_ASSERT_RET_FAIL( incoming );
+    TEST_EQUALS_RET_FAIL( incoming->serial(), 2 );
+    TEST_EQUALS_RET_FAIL( incoming->filedescriptors().size(), 1 );
+
+    std::shared_ptr<DBus::FileDescriptor> fd;
+    incoming >> fd;
+    TEST_ASSERT_RET_FAIL( ::write( fd->descriptor(), "2", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::read( pipe2[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '2' );
+
+    // Nothing is holding the FD of the bad message open any more
+    TEST_ASSERT_RET_FAIL( ::read( pipe1[ 0 ], buffer, 1 ) == 0 );
+
+    return reader->is_valid();
+}
+
+bool transport_oversized_message() {
+    int pipes[ 2 ];
+    char buffer[ 8 ];
+
+    TEST_ASSERT_RET_FAIL( pipe( pipes ) == 0 );
+    TEST_ASSERT_RET_FAIL( fcntl( pipes[ 0 ], F_SETFL, O_NONBLOCK ) == 0 );
+
+    // A message whose header claims a body larger than any message may be,
+    // followed by a valid message in the same write
+    std::vector<uint8_t> data = serialize( create_call( "oversized" ), 1 );
+    uint32_t body_len = DBus::Validator::maximum_message_size();
+    data[ 0 ] = 'l';
+    data[ 4 ] = body_len & 0xFF;
+    data[ 5 ] = ( body_len >> 8 ) & 0xFF;
+    data[ 6 ] = ( body_len >> 16 ) & 0xFF;
+    data[ 7 ] = ( body_len >> 24 ) & 0xFF;
+    std::vector<uint8_t> good = serialize( create_call( "good" ), 2 );
+    data.insert( data.end(), good.begin(), good.end() );
+    TEST_ASSERT_RET_FAIL( send_with_fd( data, pipes[ 1 ] ) );
+    close( pipes[ 1 ] );
+
+    // We can't tell where the next message starts, so the stream is dead
+    // rather than parsing the following bytes as something they are not
+    TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+    TEST_ASSERT_RET_FAIL( !reader->is_valid() );
+    TEST_ASSERT_RET_FAIL( !reader->has_buffered_message() );
+    TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+
+    // The FD that came with it has been closed
+    TEST_ASSERT_RET_FAIL( ::read( pipes[ 0 ], buffer, 1 ) == 0 );
+    close( pipes[ 0 ] );
+
+    return true;
+}
+
+bool transport_receive_buffer_shrink() {
+    DBus::priv::ReceiveBuffer buffer;
+    const size_t large_size = RECEIVE_BUFFER_SIZE * 8;
+
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( large_size ) );
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), large_size );
+
+    // Part of a message is left over in the enlarged buffer
+    memset( buffer.free_space(), 0x5A, 100 );
+    buffer.produce( 100 );
+
+    for( int x = 0; x < RECEIVE_BUFFER_SHRINK_READS - 1; x++ ) {
+        TEST_ASSERT_RET_FAIL( buffer.prepare_read( 0 ) );
+        TEST_EQUALS_RET_FAIL( buffer.capacity(), large_size );
+    }
+
+    // Another large message puts off the shrinking
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( large_size ) );
+
+    for( int x = 0; x < RECEIVE_BUFFER_SHRINK_READS - 1; x++ ) {
+        TEST_ASSERT_RET_FAIL( buffer.prepare_read( 0 ) );
+    }
+
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), large_size );
+
+    // Held on to by a message while the buffer shrinks
+    std::shared_ptr<uint8_t> held = buffer.shared_data();
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( 0 ) );
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), RECEIVE_BUFFER_SIZE );
+    TEST_EQUALS_RET_FAIL( buffer.size(), 100 );
+
+    for( size_t x = 0; x < 100; x++ ) {
+        TEST_EQUALS_RET_FAIL( buffer.data()[ x ], 0x5A );
+        TEST_EQUALS_RET_FAIL( held.get()[ x ], 0x5A );
+    }
+
+    return true;
+}
+
+bool transport_receive_buffer_shared_compact() {
+    DBus::priv::ReceiveBuffer buffer;
+    const size_t large_size = RECEIVE_BUFFER_SIZE * 128;
+
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( large_size ) );
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), large_size );
+
+    // A small message followed by part of the next one
+    memset( buffer.free_space(), 0x11, 64 );
+    memset( buffer.free_space() + 64, 0x22, 100 );
+    buffer.produce( 164 );
+
+    // The small message keeps the storage alive after it has been consumed
+    std::shared_ptr<uint8_t> held = buffer.shared_data();
+    buffer.consume( 64 );
+
+    // Moving the partial message must not allocate another large buffer
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( 0 ) );
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), RECEIVE_BUFFER_SIZE );
+    TEST_EQUALS_RET_FAIL( buffer.size(), 100 );
+
+    for( size_t x = 0; x < 100; x++ ) {
+        TEST_EQUALS_RET_FAIL( buffer.data()[ x ], 0x22 );
+    }
+
+    for( size_t x = 0; x < 64; x++ ) {
+        TEST_EQUALS_RET_FAIL( held.get()[ x ], 0x11 );
+    }
+
+    // Clearing a shared buffer does not allocate a large one either
+    held = buffer.shared_data();
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( large_size ) );
+    held = buffer.shared_data();
+    buffer.clear();
+    TEST_EQUALS_RET_FAIL( buffer.capacity(), RECEIVE_BUFFER_SIZE );
+    TEST_EQUALS_RET_FAIL( buffer.size(), 0 );
+
+    return true;
+}
+
+bool transport_receive_buffer_small_message_copy() {
+    DBus::priv::ReceiveBuffer buffer;
+    const size_t large_size = RECEIVE_BUFFER_SIZE * 128;
+
+    TEST_ASSERT_RET_FAIL( buffer.prepare_read( large_size ) );
+    memset( buffer.free_space(), 0x11, 64 );
+    memset( buffer.free_space() + 64, 0x22, large_size - 64 );
+    buffer.produce( large_size );
+
+    std::weak_ptr<uint8_t> slab = buffer.shared_data();
+
+    // The small message gets its own copy, the large one shares the buffer
+    std::shared_ptr<uint8_t> small = buffer.message_data( 64 );
+    buffer.consume( 64 );
+    std::shared_ptr<uint8_t> large = buffer.message_data( large_size - 64 );
+    buffer.consume( large_size - 64 );
+    TEST_ASSERT_RET_FAIL( large.get() == slab.lock().get() + 64 );
+
+    // Once the large message is gone, the small one doesn't keep the buffer alive
+    large.reset();
+    TEST_ASSERT_RET_FAIL( buffer.set_capacity( RECEIVE_BUFFER_SIZE ) );
+    TEST_ASSERT_RET_FAIL( slab.expired() );
+
+    for( size_t x = 0; x < 64; x++ ) {
+        TEST_EQUALS_RET_FAIL( small.get()[ x ], 0x11 );
+    }
+
+    return true;
+}
+
+#define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
+            ret = transport_##name();\
+        } \
+    } while( 0 )
+
+int main( int argc, char** argv ) {
+    if( argc < 1 ) {
+        return 1;
+    }
+
+    std::string test_name = argv[1];
+    bool ret = false;
+
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets ) < 0 ) {
+        std::cerr << "Can't create socketpair" << std::endl;
+        return 1;
+    }
+
+    reader = DBus::priv::SendmsgTransport::create( sockets[ 0 ], false );
+    writer = DBus::priv::SendmsgTransport::create( sockets[ 1 ], false );
+
+    ADD_TEST( multiple_messages );
+    ADD_TEST( partial_message );
+    ADD_TEST( large_message );
+    ADD_TEST( filedescriptors );
+    ADD_TEST( batched_messages );
+    ADD_TEST( write_backpressure );
+    ADD_TEST( header_body );
+    ADD_TEST( held_messages );
+    ADD_TEST( bad_message_fds );
+    ADD_TEST( oversized_message );
+    ADD_TEST( receive_buffer_shrink );
+    ADD_TEST( receive_buffer_shared_compact );
+    ADD_TEST( receive_buffer_small_message_copy );
+
+    return !ret;
+}
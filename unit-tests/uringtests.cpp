@@ -0,0 +1,281 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Robert Middleton                                *
+ *   robert.middleton@rm5248.com                                           *
+ *                                                                         *
+ *   This file is part of the dbus-cxx library.                            *
+ *                                                                         *
+ *   The dbus-cxx library is free software; you can redistribute it and/or *
+ *   modify it under the terms of the GNU General Public License           *
+ *   version 3 as published by the Free Software Foundation.               *
+ *                                                                         *
+ *   The dbus-cxx library is distributed in the hope that it will be       *
+ *   useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ *   of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU   *
+ *   General Public License for more details.                              *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this software. If not see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#include <dbus-cxx.h>
+#include <dbus-cxx/uringtransport.h>
+#include <iostream>
+#include <thread>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test_macros.h"
+
+/* sockets[0] is read from, sockets[1] is written to */
+static int sockets[ 2 ];
+static std::shared_ptr<DBus::priv::UringTransport> reader;
+static std::shared_ptr<DBus::priv::UringTransport> writer;
+
+static std::shared_ptr<DBus::CallMessage> create_call( const std::string& member ) {
+    return DBus::CallMessage::create( "/org/freedesktop/DBus", "dbuscxx.test", member );
+}
+
+/*
+ * Our reads and writes complete asynchronously, so wait for the reader
+ * to be able to give us a message.
+ */
+static std::shared_ptr<DBus::Message> wait_for_message() {
+    std::shared_ptr<DBus::Message> msg;
+
+    for( int x = 0; x < 5000 && !msg && reader->is_valid(); x++ ) {
+        struct pollfd pfd;
+
+        msg = reader->readMessage();
+
+        if( msg ) {
+            break;
+        }
+
+        writer->write_pending();
+
+        pfd.fd = reader->fd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll( &pfd, 1, 1 );
+    }
+
+    return msg;
+}
+
+static bool read_member( const std::string& member ) {
+    std::shared_ptr<DBus::Message> msg = wait_for_message();
+
+    if( !msg || msg->type() != DBus::MessageType::CALL ) {
+        return false;
+    }
+
+    return std::static_pointer_cast<DBus::CallMessage>( msg )->member() == member;
+}
+
+bool uring_multiple_messages() {
+    std::vector<DBus::priv::OutgoingMessage> batch;
+
+    for( uint32_t x = 0; x < 3; x++ ) {
+        DBus::priv::OutgoingMessage outgoing;
+        outgoing.msg = create_call( "method" + std::to_string( x ) );
+        outgoing.serial = x + 1;
+        batch.push_back( outgoing );
+    }
+
+    TEST_ASSERT_RET_FAIL( writer->writeMessages( batch ) > 0 );
+
+    TEST_ASSERT_RET_FAIL( read_member( "method0" ) );
+    TEST_ASSERT_RET_FAIL( read_member( "method1" ) );
+    TEST_ASSERT_RET_FAIL( read_member( "method2" ) );
+    TEST_ASSERT_RET_FAIL( !reader->has_buffered_message() );
+
+    return reader->is_valid() && writer->is_valid();
+}
+
+bool uring_large_message() {
+    const int num_messages = 8;
+    std::vector<int32_t> values( 64 * 1024 );
+
+    for( size_t x = 0; x < values.size(); x++ ) {
+        values[ x ] = x;
+    }
+
+    // Much more than the socket can hold; the kernel sends it as the reader reads
+    for( int x = 0; x < num_messages; x++ ) {
+        std::shared_ptr<DBus::CallMessage> msg = create_call( "large" + std::to_string( x ) );
+        msg << values;
+
+        TEST_ASSERT_RET_FAIL( writer->writeMessage( msg, x + 1 ) > 0 );
+    }
+
+    TEST_ASSERT_RET_FAIL( writer->pending_write_size() > 0 );
+
+    for( int x = 0; x < num_messages; x++ ) {
+        std::shared_ptr<DBus::Message> msg = wait_for_message();
+        std::vector<int32_t> received;
+
+        TEST_ASSERT_RET_FAIL( msg );
+        TEST_EQUALS_RET_FAIL( msg->serial(), static_cast<uint32_t>( x + 1 ) );
+        msg >> received;
+        TEST_ASSERT_RET_FAIL( received == values );
+    }
+
+    // Small messages must still work afterwards
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( create_call( "small" ), num_messages + 1 ) > 0 );
+    TEST_ASSERT_RET_FAIL( read_member( "small" ) );
+
+    writer->write_pending();
+    TEST_EQUALS_RET_FAIL( writer->pending_write_size(), 0 );
+
+    return reader->is_valid() && writer->is_valid();
+}
+
+bool uring_filedescriptors() {
+    int pipe1[ 2 ];
+    int pipe2[ 2 ];
+    char buffer[ 8 ];
+    std::vector<DBus::priv::OutgoingMessage> batch;
+    const char* members[] = { "fd1", "no_fd", "fd2" };
+
+    TEST_ASSERT_RET_FAIL( pipe( pipe1 ) == 0 );
+    TEST_ASSERT_RET_FAIL( pipe( pipe2 ) == 0 );
+
+    for( uint32_t x = 0; x < 3; x++ ) {
+        DBus::priv::OutgoingMessage outgoing;
+        outgoing.msg = create_call( members[ x ] );
+        outgoing.serial = x + 1;
+        batch.push_back( outgoing );
+    }
+
+    std::const_pointer_cast<DBus::Message>( batch[ 0 ].msg ) << DBus::FileDescriptor::create( pipe1[ 1 ] );
+    std::const_pointer_cast<DBus::Message>( batch[ 2 ].msg ) << DBus::FileDescriptor::create( pipe2[ 1 ] );
+
+    TEST_ASSERT_RET_FAIL( writer->writeMessages( batch ) > 0 );
+
+    std::shared_ptr<DBus::Message> in1 = wait_for_message();
+    std::shared_ptr<DBus::Message> in2 = wait_for_message();
+    std::shared_ptr<DBus::Message> in3 = wait_for_message();
+    TEST_ASSERT_RET_FAIL( in1 && in2 && in3 );
+    TEST_EQUALS_RET_FAIL( in1->filedescriptors().size(), 1 );
+    TEST_EQUALS_RET_FAIL( in2->filedescriptors().size(), 0 );
+    TEST_EQUALS_RET_FAIL( in3->filedescriptors().size(), 1 );
+
+    // Make sure that each FD went to the correct message
+    std::shared_ptr<DBus::FileDescriptor> fd1;
+    std::shared_ptr<DBus::FileDescriptor> fd2;
+    in1 >> fd1;
+    in3 >> fd2;
+
+    TEST_ASSERT_RET_FAIL( ::write( fd1->descriptor(), "1", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::write( fd2->descriptor(), "2", 1 ) == 1 );
+    TEST_ASSERT_RET_FAIL( ::read( pipe1[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '1' );
+    TEST_ASSERT_RET_FAIL( ::read( pipe2[ 0 ], buffer, 1 ) == 1 && buffer[ 0 ] == '2' );
+
+    return reader->is_valid() && writer->is_valid();
+}
+
+bool uring_end_of_stream() {
+    writer.reset();
+
+    for( int x = 0; x < 5000 && reader->is_valid(); x++ ) {
+        struct pollfd pfd;
+
+        TEST_ASSERT_RET_FAIL( !reader->readMessage() );
+
+        pfd.fd = reader->fd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll( &pfd, 1, 1 );
+    }
+
+    return !reader->is_valid();
+}
+
+bool uring_destroy_while_sending() {
+    std::vector<int32_t> values( 64 * 1024 );
+    std::shared_ptr<DBus::CallMessage> msg = create_call( "large" );
+    msg << values;
+
+    // The socket can't take all of this, so the kernel is still sending when we go away
+    TEST_ASSERT_RET_FAIL( writer->writeMessage( msg, 1 ) > 0 );
+    TEST_ASSERT_RET_FAIL( writer->pending_write_size() > 0 );
+
+    writer.reset();
+
+    // The writer has closed its end of the socket after cancelling its send
+    for( int x = 0; x < 5000 && reader->is_valid(); x++ ) {
+        struct pollfd pfd;
+
+        reader->readMessage();
+
+        pfd.fd = reader->fd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll( &pfd, 1, 1 );
+    }
+
+    return !reader->is_valid();
+}
+
+bool uring_bus_connection() {
+    const char* address = getenv( "DBUS_SESSION_BUS_ADDRESS" );
+
+    TEST_ASSERT_RET_FAIL( address );
+
+    // The transport to the bus uses io_uring
+    std::shared_ptr<DBus::priv::Transport> transport = DBus::priv::Transport::open_transport( address );
+    TEST_ASSERT_RET_FAIL( std::dynamic_pointer_cast<DBus::priv::UringTransport>( transport ) );
+
+    // and a connection works through the dispatcher with it
+    std::shared_ptr<DBus::Dispatcher> dispatch = DBus::StandaloneDispatcher::create();
+    std::shared_ptr<DBus::Connection> conn = dispatch->create_connection( DBus::BusType::SESSION );
+    TEST_ASSERT_RET_FAIL( conn && conn->is_registered() );
+    TEST_ASSERT_RET_FAIL( !conn->unique_name().empty() );
+    TEST_ASSERT_RET_FAIL( conn->request_name( "dbuscxx.test.uring" ) == DBus::RequestNameResponse::PrimaryOwner );
+
+    // unix_fd() is the socket, the dispatcher waits on the ring instead
+    int type;
+    socklen_t type_len = sizeof( type );
+    TEST_ASSERT_RET_FAIL( conn->unix_fd() != conn->dispatch_fd() );
+    TEST_ASSERT_RET_FAIL( getsockopt( conn->unix_fd(), SOL_SOCKET, SO_TYPE, &type, &type_len ) == 0 );
+    TEST_EQUALS_RET_FAIL( type, SOCK_STREAM );
+
+    return true;
+}
+
+#define ADD_TEST(name) do{ if( test_name == STRINGIFY(name) ){ \
+            ret = uring_##name();\
+        } \
+    } while( 0 )
+
+int main( int argc, char** argv ) {
+    if( argc < 1 ) {
+        return 1;
+    }
+
+    std::string test_name = argv[1];
+    bool ret = false;
+
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets ) < 0 ) {
+        std::cerr << "Can't create socketpair" << std::endl;
+        return 1;
+    }
+
+    reader = DBus::priv::UringTransport::create( sockets[ 0 ] );
+    writer = DBus::priv::UringTransport::create( sockets[ 1 ] );
+
+    if( !reader || !writer ) {
+        std::cerr << "io_uring is not supported by this kernel" << std::endl;
+        return 1;
+    }
+
+    ADD_TEST( multiple_messages );
+    ADD_TEST( large_message );
+    ADD_TEST( filedescriptors );
+    ADD_TEST( end_of_stream );
+    ADD_TEST( destroy_while_sending );
+    ADD_TEST( bus_connection );
+
+    return !ret;
+}